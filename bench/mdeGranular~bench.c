@@ -0,0 +1,788 @@
+/******************************************************************************
+ *
+ * File:             mdeGranular~bench.c
+ *
+ * Author:           Michael Edwards - m@michael-edwards.org -
+ *                   http://www.michael-edwards.org
+ *
+ * Date:             October 17th 2026
+ *
+ * $$ Last modified:  14:02:11 Sat Oct 17 2026 BST
+ *
+ * Purpose:          Headless benchmark of the mdeGranular~ engine: drives
+ *                   mdeGranularPerform (with input in live mode) over a
+ *                   sweep of voices, transpositions, grain
+ *                   length, ramp type, channels, live/static mode and block
+ *                   size, reporting ns per output sample and how many
+ *                   voices one core could run in real time at 48kHz.
+ *                   Many voices are also rendered with threads from the
+ *                   shared pool (see mdeGranularSetThreads()), and the
+ *                   default case with internal blocks longer than the host's
+ *                   (see mdeGranularSetInternalBlock()).
+ *                   Each case also reports how long the object took to
+ *                   set up (Init1 to Init3) and how much memory it holds
+ *                   once it's running, as counted by its arena.
+ *                   Results can be written as JSON and compared against a
+ *                   stored baseline, flagging any case that got slower.
+ *                   -T instead compares a five minute buffer~ read by 1000
+ *                   voices with and without huge pages (see
+ *                   mdeGranularSetHugePages()), counting dTLB misses with
+ *                   perf where the kernel allows it (Linux only).
+ *
+ *                   make bench
+ *                   build/mdegranular-bench -o baseline.json
+ *                   ... change things ...
+ *                   build/mdegranular-bench -c baseline.json
+ *
+ *                   The exit status is 1 when -c finds a regression.
+ *
+ * License:          Copyright (c) 2003 Michael Edwards
+ *
+ *                   This file is part of mdeGranular~
+ *
+ *                   mdeGranular~ is free software; you can redistribute it
+ *                   and/or modify it under the terms of the GNU General
+ *                   Public License as published by the Free Software
+ *                   Foundation; either version 2 of the License, or (at your
+ *                   option) any later version.
+ *
+ *                   mdeGranular~ is distributed in the hope that it will be
+ *                   useful, but WITHOUT ANY WARRANTY; without even the
+ *                   implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *                   PARTICULAR PURPOSE.  See the GNU General Public License
+ *                   for more details.
+ *
+ *                   You should have received a copy of the <a
+ *                   href="../../COPYING.TXT">GNU General Public License</a>
+ *                   along with mdeGranular~; if not, write to the Free
+ *                   Software Foundation, Inc., 59 Temple Place, Suite 330,
+ *                   Boston, MA 02111-1307 USA
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "mdeGranular~.h"
+
+/* all cases run at this rate; voices per core are given for it too */
+#define BENCH_SR 48000
+/* seconds of source sound in static mode, of live buffer in live mode */
+#define BENCH_SOURCE_SECS 10
+#define BENCH_LIVE_SECS 2
+#define BENCH_MAX_CHANNELS 8
+#define BENCH_MAX_BLOCK 4096
+#define BENCH_MAX_CASES 64
+#define BENCH_NAME_LEN 128
+/* -T: a long buffer~ read by many voices, so that the TLB can't cover it */
+#define BENCH_TLB_SECS 300
+#define BENCH_TLB_VOICES 1000
+
+/* one point in the sweep */
+typedef struct
+{
+  int voices;
+  int numTranspositions;
+  /* transpositions are spread evenly over +/- this many semitones */
+  mdefloat transpositionRange;
+  mdefloat grainLengthMS;
+  const char* rampType;
+  int channels;
+  int live;
+  int block;
+  /* 0 = no worker threads */
+  int threads;
+  /* 0 = render the host's blocks */
+  int internalBlock;
+  char name[BENCH_NAME_LEN];
+  /* results */
+  double nsPerSample;
+  double voicesPerCore;
+  double initUS;
+  double memoryKB;
+} benchCase;
+
+/* a result read back from a baseline file */
+typedef struct
+{
+  char name[BENCH_NAME_LEN];
+  double nsPerSample;
+} benchBaseline;
+
+static benchCase cases[BENCH_MAX_CASES];
+static int numCases = 0;
+static mdefloat* source = NULL;
+
+/*****************************************************************************/
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+/*****************************************************************************/
+
+/* the default case, which each dimension of the sweep varies in turn */
+static benchCase defaultCase(void)
+{
+  benchCase c;
+
+  memset(&c, 0, sizeof(c));
+  c.voices = 64;
+  c.numTranspositions = 5;
+  c.transpositionRange = 12;
+  c.grainLengthMS = 80;
+  c.rampType = DEFAULT_RAMP_TYPE;
+  c.channels = 2;
+  c.live = 0;
+  c.block = 64;
+  return c;
+}
+
+/*****************************************************************************/
+
+/* add a case to the sweep unless one with the same settings (i.e. the
+ * default case, which every dimension includes) is already there */
+static void addCase(benchCase c)
+{
+  int n = snprintf(c.name, BENCH_NAME_LEN,
+                   "voices=%d transp=%dx%g grain=%g ramp=%s ch=%d %s "
+                   "block=%d",
+                   c.voices, c.numTranspositions,
+                   (double)c.transpositionRange, (double)c.grainLengthMS,
+                   c.rampType, c.channels, c.live ? "live" : "static",
+                   c.block);
+
+  /* (the names of cases without threads are as they always were, so that
+   * older baselines still compare) */
+  if (c.threads && n > 0 && n < BENCH_NAME_LEN)
+    n += snprintf(c.name + n, BENCH_NAME_LEN - n, " threads=%d", c.threads);
+  if (c.internalBlock && n > 0 && n < BENCH_NAME_LEN)
+    snprintf(c.name + n, BENCH_NAME_LEN - n, " internal=%d", c.internalBlock);
+  for (int i = 0; i < numCases; ++i)
+    if (!strcmp(cases[i].name, c.name))
+      return;
+  if (numCases < BENCH_MAX_CASES)
+    cases[numCases++] = c;
+}
+
+/*****************************************************************************/
+
+static void makeSweep(void)
+{
+  static const int voices[] = { 1, 16, 64, 256, 1024 };
+  static const int numTranspositions[] = { 1, 5, 16 };
+  static const mdefloat transpositionRange[] = { 2, 12, 24 };
+  static const mdefloat grainLengthMS[] = { 30, 80, 500 };
+  static const char* rampType[] = { "TRAPEZOID", "HANNING", "KAISER",
+                                    "GAUSSIAN" };
+  static const int channels[] = { 1, 2, 8 };
+  static const int block[] = { 16, 64, 256, 1024 };
+  static const int threads[] = { 0, 2, 4, 8 };
+  static const int internalBlock[] = { 256, 512, 1024 };
+  benchCase c;
+
+#define SWEEP(field, values)                                            \
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)       \
+  {                                                                     \
+    c = defaultCase();                                                  \
+    c.field = values[i];                                                \
+    addCase(c);                                                         \
+  }
+
+  SWEEP(voices, voices);
+  SWEEP(numTranspositions, numTranspositions);
+  SWEEP(transpositionRange, transpositionRange);
+  SWEEP(grainLengthMS, grainLengthMS);
+  SWEEP(rampType, rampType);
+  SWEEP(channels, channels);
+  c = defaultCase();
+  c.live = 1;
+  addCase(c);
+  SWEEP(block, block);
+  /* thousands of grains, as one thread and then split over several */
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+  {
+    c = defaultCase();
+    c.voices = 4096;
+    c.threads = threads[i];
+    addCase(c);
+  }
+  /* 64-sample host blocks rendered in longer ticks */
+  SWEEP(internalBlock, internalBlock);
+#undef SWEEP
+}
+
+/*****************************************************************************/
+
+static void makeSource(void)
+{
+  long n = (long)BENCH_SR * BENCH_SOURCE_SECS;
+
+  source = malloc(sizeof(mdefloat) * n);
+  if (!source)
+  {
+    fprintf(stderr, "mdegranular-bench: out of memory\n");
+    exit(2);
+  }
+  for (long i = 0; i < n; ++i)
+    source[i] = (mdefloat)(0.5 * sin(i * 0.01) + 0.3 * sin(i * 0.0371));
+}
+
+/*****************************************************************************/
+
+/* give back a granulator and its output buffers (any of which may be NULL,
+ * as when setting it up failed part way) */
+static void freeGranulator(mdeGranular* g, mdefloat** outs, int channels)
+{
+  if (g)
+    mdeGranularFree(g);
+  for (int i = 0; i < channels; ++i)
+    free(outs[i]);
+  free(g);
+}
+
+/*****************************************************************************/
+
+/* render warmupSecs of audio to let the grains settle, then time secs of
+ * audio reps times, keeping the fastest */
+static int runCase(benchCase* c, double secs, double warmupSecs, int reps,
+                   unsigned seed)
+{
+  mdeGranular* g = calloc(1, sizeof(mdeGranular));
+  mdefloat* outs[BENCH_MAX_CHANNELS] = { NULL };
+  mdefloat transpositions[MAXTRANSPOSITIONS];
+  mdefloat in[BENCH_MAX_BLOCK];
+  long sourceLen = (long)BENCH_SR * BENCH_SOURCE_SECS;
+  long liveLen = (long)BENCH_SR * BENCH_LIVE_SECS;
+  long ticks = (long)(secs * BENCH_SR / c->block) + 1;
+  long warmup = (long)(warmupSecs * BENCH_SR / c->block) + 1;
+  long pos = 0;
+  double best = -1.0;
+  double start;
+
+  if (!g)
+    return 0;
+  for (int i = 0; i < c->channels; ++i)
+    if (!(outs[i] = calloc(c->block, sizeof(mdefloat))))
+    {
+      fprintf(stderr, "mdegranular-bench: out of memory\n");
+      freeGranulator(g, outs, c->channels);
+      return 0;
+    }
+  g->samplingRate = BENCH_SR;
+  /* what a host goes through to create the object and start DSP */
+  start = now();
+  if (mdeGranularInit1(g, c->voices, c->channels) ||
+      mdeGranularInit2(g, c->block, 10, outs) || !mdeGranularDidInit(g))
+  {
+    fprintf(stderr, "mdegranular-bench: couldn't initialise %s\n", c->name);
+    freeGranulator(g, outs, c->channels);
+    return 0;
+  }
+  if (c->live)
+    mdeGranularInit3(g, NULL, BENCH_LIVE_SECS * 1000, liveLen);
+  else
+    mdeGranularInit3(g, source, BENCH_SOURCE_SECS * 1000, sourceLen);
+  c->initUS = (now() - start) / 1e3;
+  for (int i = 0; i < c->numTranspositions; ++i)
+    transpositions[i] = c->numTranspositions == 1
+      ? 0
+      : -c->transpositionRange + 2 * c->transpositionRange * i
+        / (c->numTranspositions - 1);
+  mdeGranularSetTranspositions(g, c->numTranspositions, transpositions);
+  mdeGranularSetGrainLengthMS(g, c->grainLengthMS);
+  mdeGranularSetRampType(g, (char*)c->rampType);
+  mdeGranularSetSeed(g, seed);
+  /* the pool is shared, so each case sizes it for itself */
+  if (c->threads)
+    mdeGranularSetPoolSize(g, c->threads - 1);
+  mdeGranularSetThreads(g, c->threads);
+  mdeGranularSetInternalBlock(g, c->internalBlock);
+  mdeGranularOn(g);
+  for (int r = 0; r <= reps; ++r)
+  {
+    /* the first pass is the warmup */
+    long n = r ? ticks : warmup;
+    double ns;
+
+    start = now();
+    for (long t = 0; t < n; ++t)
+    {
+      if (c->live)
+        for (int i = 0; i < c->block; ++i, ++pos)
+          in[i] = source[pos % sourceLen];
+      mdeGranularPerform(g, c->live ? in : NULL, outs, c->block);
+    }
+    ns = (now() - start) / ((double)n * c->block);
+    /* all of the object's own memory (including what's mapped for huge
+     * pages) is in its arena; by the end of the warmup the threads and tick
+     * size have been swapped in, and what they replaced is still held */
+    if (!r)
+      c->memoryKB = (double)(g->arena.reserved +
+                             (long)sizeof(mdeGranular)) / 1024.0;
+    if (r && (best < 0 || ns < best))
+      best = ns;
+  }
+  c->nsPerSample = best;
+  /* one second of audio at BENCH_SR costs nsPerSample * BENCH_SR ns, so a
+   * core could run this many of these voices in real time (with threads,
+   * that time was spread over that many cores) */
+  c->voicesPerCore = c->voices * 1e9 / (best * BENCH_SR) /
+    (c->threads > 1 ? c->threads : 1);
+  freeGranulator(g, outs, c->channels);
+  return 1;
+}
+
+/*****************************************************************************/
+
+static int writeJSON(const char* file, double secs, int reps, unsigned seed)
+{
+  FILE* fp = fopen(file, "w");
+
+  if (!fp)
+  {
+    fprintf(stderr, "mdegranular-bench: can't write %s\n", file);
+    return 0;
+  }
+  fprintf(fp, "{\n  \"version\": \"%s\",\n", VERSION);
+  fprintf(fp, "  \"mdefloat\": \"%s\",\n",
+          sizeof(mdefloat) == sizeof(double) ? "double" : "float");
+  fprintf(fp, "  \"sampling_rate\": %d,\n", BENCH_SR);
+  fprintf(fp, "  \"seconds\": %g,\n  \"repetitions\": %d,\n", secs, reps);
+  fprintf(fp, "  \"seed\": %u,\n  \"cases\": [\n", seed);
+  for (int i = 0; i < numCases; ++i)
+  {
+    benchCase* c = &cases[i];
+
+    fprintf(fp, "    {\"name\": \"%s\", \"voices\": %d, "
+            "\"transpositions\": %d, \"transposition_range\": %g, "
+            "\"grain_ms\": %g, \"ramp\": \"%s\", \"channels\": %d, "
+            "\"live\": %d, \"block\": %d, \"threads\": %d, "
+            "\"internal_block\": %d, "
+            "\"ns_per_sample\": %.3f, \"voices_per_core_48k\": %.1f, "
+            "\"init_us\": %.1f, \"memory_kb\": %.1f}%s\n",
+            c->name, c->voices, c->numTranspositions,
+            (double)c->transpositionRange, (double)c->grainLengthMS,
+            c->rampType, c->channels, c->live, c->block, c->threads,
+            c->internalBlock,
+            c->nsPerSample,
+            c->voicesPerCore, c->initUS, c->memoryKB,
+            i < numCases - 1 ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* read the name and ns_per_sample of each case in a file written by
+ * writeJSON; nothing more of JSON is understood than that */
+static int readBaseline(const char* file, benchBaseline* base, int max)
+{
+  FILE* fp = fopen(file, "r");
+  char* text;
+  char* p;
+  long len;
+  int n = 0;
+
+  if (!fp)
+  {
+    fprintf(stderr, "mdegranular-bench: can't read %s\n", file);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  text = calloc(len + 1, 1);
+  if (!text || fread(text, 1, len, fp) != (size_t)len)
+  {
+    fprintf(stderr, "mdegranular-bench: can't read %s\n", file);
+    fclose(fp);
+    free(text);
+    return -1;
+  }
+  fclose(fp);
+  p = text;
+  while (n < max && (p = strstr(p, "\"name\": \"")))
+  {
+    char* end;
+    char* ns;
+
+    p += strlen("\"name\": \"");
+    end = strchr(p, '"');
+    ns = strstr(p, "\"ns_per_sample\": ");
+    if (!end || !ns || end - p >= BENCH_NAME_LEN)
+      break;
+    memcpy(base[n].name, p, end - p);
+    base[n].name[end - p] = '\0';
+    base[n].nsPerSample = strtod(ns + strlen("\"ns_per_sample\": "), NULL);
+    ++n;
+    p = end;
+  }
+  free(text);
+  return n;
+}
+
+/*****************************************************************************/
+
+/* a case regresses when it's more than tolerance (a fraction) slower than
+ * the baseline; returns the number of regressions */
+static int compare(benchBaseline* base, int numBase, double tolerance)
+{
+  int regressions = 0;
+
+  printf("\n%-80s %9s %9s %7s\n", "case", "base", "now", "change");
+  for (int i = 0; i < numCases; ++i)
+  {
+    benchCase* c = &cases[i];
+    benchBaseline* b = NULL;
+    double change;
+
+    for (int j = 0; j < numBase; ++j)
+      if (!strcmp(base[j].name, c->name))
+        b = &base[j];
+    if (!b || b->nsPerSample <= 0)
+    {
+      printf("%-80s %9s %9.2f %7s\n", c->name, "-", c->nsPerSample, "new");
+      continue;
+    }
+    change = c->nsPerSample / b->nsPerSample - 1.0;
+    printf("%-80s %9.2f %9.2f %+6.1f%%%s\n", c->name, b->nsPerSample,
+           c->nsPerSample, change * 100,
+           change > tolerance ? "  REGRESSION" : "");
+    if (change > tolerance)
+      ++regressions;
+  }
+  if (regressions)
+    printf("\n%d of %d cases are more than %g%% slower than the baseline\n",
+           regressions, numCases, tolerance * 100);
+  else
+    printf("\nno regressions (tolerance %g%%)\n", tolerance * 100);
+  return regressions;
+}
+
+/*****************************************************************************/
+
+/* a counter of dTLB load misses in this thread, user space only; -1 if the
+ * kernel or hardware won't give us one (e.g. perf_event_paranoid, or in a
+ * VM) */
+static int tlbCounter(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+/*****************************************************************************/
+
+/* KB of this process's memory backed by transparent huge pages, or -1 */
+static long anonHugeKB(void)
+{
+  long kb = -1;
+#ifdef __linux__
+  FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+
+  if (!fp)
+    return -1;
+  while (fgets(line, sizeof(line), fp))
+    if (sscanf(line, "AnonHugePages: %ld", &kb) == 1)
+      break;
+  fclose(fp);
+#endif
+  return kb;
+}
+
+/*****************************************************************************/
+
+/* render BENCH_TLB_VOICES voices from a BENCH_TLB_SECS buffer~ (copied in as
+ * the Max object does), with huge pages or not, keeping the fastest of reps
+ * and the dTLB misses per sample of that rep (-1 if they can't be counted) */
+static int runTLB(float* buffer, int hugePages, double secs, int reps,
+                  unsigned seed, double* nsPerSample, double* missesPerSample,
+                  long* hugeKB)
+{
+  mdeGranular* g = calloc(1, sizeof(mdeGranular));
+  mdefloat* outs[2] = { NULL };
+  long n = (long)BENCH_SR * BENCH_TLB_SECS;
+  long ticks = (long)(secs * BENCH_SR / 64) + 1;
+  int counter;
+  long copied;
+
+  if (!g)
+    return 0;
+  for (int i = 0; i < 2; ++i)
+    if (!(outs[i] = calloc(64, sizeof(mdefloat))))
+    {
+      fprintf(stderr, "mdegranular-bench: out of memory\n");
+      freeGranulator(g, outs, 2);
+      return 0;
+    }
+  g->samplingRate = BENCH_SR;
+  if (mdeGranularInit1(g, BENCH_TLB_VOICES, 2))
+  {
+    fprintf(stderr, "mdegranular-bench: couldn't initialise\n");
+    freeGranulator(g, outs, 2);
+    return 0;
+  }
+  mdeGranularSetHugePages(g, hugePages);
+  if (mdeGranularInit2(g, 64, 10, outs) || !mdeGranularDidInit(g))
+  {
+    fprintf(stderr, "mdegranular-bench: couldn't initialise\n");
+    freeGranulator(g, outs, 2);
+    return 0;
+  }
+  copied = mdeGranularCopyFloatSamples(g, buffer, n);
+  if (copied < n ||
+      mdeGranularInit3(g, g->theSamples, BENCH_TLB_SECS * 1000, copied) < 0)
+  {
+    fprintf(stderr, "mdegranular-bench: couldn't copy the buffer\n");
+    freeGranulator(g, outs, 2);
+    return 0;
+  }
+  /* (only once there's nothing left to fail, so it's always closed) */
+  counter = tlbCounter();
+  *hugeKB = anonHugeKB();
+  mdeGranularSetSeed(g, seed);
+  mdeGranularOn(g);
+  *nsPerSample = -1;
+  *missesPerSample = -1;
+  for (int r = 0; r <= reps; ++r)
+  {
+    /* the first pass is the warmup */
+    long count = r ? ticks : ticks / 4 + 1;
+    long long misses = -1;
+    double start;
+    double ns;
+
+#ifdef __linux__
+    if (counter >= 0)
+    {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    start = now();
+    for (long t = 0; t < count; ++t)
+      mdeGranularPerform(g, NULL, outs, 64);
+    ns = (now() - start) / ((double)count * 64);
+#ifdef __linux__
+    if (counter >= 0)
+    {
+      ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+        misses = -1;
+    }
+#endif
+    if (r && (*nsPerSample < 0 || ns < *nsPerSample))
+    {
+      *nsPerSample = ns;
+      *missesPerSample = misses < 0 ? -1 : (double)misses / (count * 64.0);
+    }
+  }
+#ifdef __linux__
+  if (counter >= 0)
+    close(counter);
+#endif
+  freeGranulator(g, outs, 2);
+  return 1;
+}
+
+/*****************************************************************************/
+
+static int tlbBench(double secs, int reps, unsigned seed)
+{
+  long n = (long)BENCH_SR * BENCH_TLB_SECS;
+  float* buffer = malloc(sizeof(float) * n);
+  double ns[2];
+  double misses[2];
+  long hugeKB[2];
+
+  if (!buffer)
+  {
+    fprintf(stderr, "mdegranular-bench: out of memory\n");
+    return 2;
+  }
+  for (long i = 0; i < n; ++i)
+    buffer[i] = (float)(0.5 * sin(i * 0.01) + 0.3 * sin(i * 0.0371));
+  printf("mdeGranular~ %s TLB benchmark: %s samples, %dHz, %ds buffer~, "
+         "%d voices, %gs x %d\n\n", VERSION,
+         sizeof(mdefloat) == sizeof(double) ? "double" : "float", BENCH_SR,
+         BENCH_TLB_SECS, BENCH_TLB_VOICES, secs, reps);
+  printf("%-12s %9s %16s %16s\n", "HugePages", "ns/sample",
+         "dTLB misses/smp", "AnonHugePages KB");
+  for (int h = 0; h < 2; ++h)
+  {
+    if (!runTLB(buffer, h, secs, reps, seed, &ns[h], &misses[h], &hugeKB[h]))
+    {
+      free(buffer);
+      return 2;
+    }
+    printf("%-12d %9.2f ", h, ns[h]);
+    if (misses[h] < 0)
+      printf("%16s ", "n/a");
+    else
+      printf("%16.3f ", misses[h]);
+    if (hugeKB[h] < 0)
+      printf("%16s\n", "n/a");
+    else
+      printf("%16ld\n", hugeKB[h]);
+    fflush(stdout);
+  }
+  printf("\ntime %+.1f%%", (ns[1] / ns[0] - 1.0) * 100);
+  if (misses[0] > 0 && misses[1] >= 0)
+    printf(", dTLB misses %+.1f%%\n", (misses[1] / misses[0] - 1.0) * 100);
+  else
+    printf(" (dTLB misses can't be counted here: see "
+           "/proc/sys/kernel/perf_event_paranoid)\n");
+  free(buffer);
+  return 0;
+}
+
+/*****************************************************************************/
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: mdegranular-bench [-o out.json] [-c baseline.json] "
+          "[-t tolerance%%]\n"
+          "                         [-s seconds] [-r repetitions] "
+          "[-f filter] [-q] [-T]\n"
+          "  -o file  write the results as JSON\n"
+          "  -c file  compare with a baseline written by -o; exit status 1 "
+          "if any case\n"
+          "           is more than the tolerance (default 10%%) slower\n"
+          "  -s secs  seconds of audio timed per repetition (default 2)\n"
+          "  -r n     repetitions per case, the fastest is kept "
+          "(default 5)\n"
+          "  -f text  only run cases whose name contains text, e.g. "
+          "ch=8 or live\n"
+          "  -q       quick: -s 0.5 -r 3\n"
+          "  -T       instead of the sweep, compare a %ds buffer~ read by %d "
+          "voices\n"
+          "           with HugePages 0 and 1, counting dTLB misses\n",
+          BENCH_TLB_SECS, BENCH_TLB_VOICES);
+}
+
+/*****************************************************************************/
+
+int main(int argc, char** argv)
+{
+  const char* outFile = NULL;
+  const char* baseFile = NULL;
+  const char* filter = NULL;
+  double tolerance = 0.1;
+  double secs = 2.0;
+  int reps = 5;
+  unsigned seed = 1;
+  int regressions = 0;
+  int tlb = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+    const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (!strcmp(arg, "-q"))
+    {
+      secs = 0.5;
+      reps = 3;
+      continue;
+    }
+    if (!strcmp(arg, "-T"))
+    {
+      tlb = 1;
+      continue;
+    }
+    if (!val || arg[0] != '-' || strlen(arg) != 2)
+    {
+      usage();
+      return 2;
+    }
+    switch (arg[1])
+    {
+      case 'o': outFile = val; break;
+      case 'c': baseFile = val; break;
+      case 't': tolerance = atof(val) / 100.0; break;
+      case 's': secs = atof(val); break;
+      case 'r': reps = atoi(val); break;
+      case 'f': filter = val; break;
+      default:
+        usage();
+        return 2;
+    }
+    ++i;
+  }
+  if (secs <= 0 || reps < 1)
+  {
+    usage();
+    return 2;
+  }
+  if (tlb)
+    return tlbBench(secs, reps, seed);
+  makeSweep();
+  if (filter)
+  {
+    int n = 0;
+
+    for (int i = 0; i < numCases; ++i)
+      if (strstr(cases[i].name, filter))
+        cases[n++] = cases[i];
+    numCases = n;
+  }
+  makeSource();
+  printf("mdeGranular~ %s benchmark: %s samples, %dHz, %gs x %d\n\n",
+         VERSION, sizeof(mdefloat) == sizeof(double) ? "double" : "float",
+         BENCH_SR, secs, reps);
+  printf("%-80s %9s %12s %9s %9s\n", "case", "ns/sample", "voices/core",
+         "init us", "KB");
+  for (int i = 0; i < numCases; ++i)
+  {
+    if (!runCase(&cases[i], secs, 0.5, reps, seed))
+      return 2;
+    printf("%-80s %9.2f %12.0f %9.1f %9.0f\n", cases[i].name,
+           cases[i].nsPerSample, cases[i].voicesPerCore, cases[i].initUS,
+           cases[i].memoryKB);
+    fflush(stdout);
+  }
+  if (outFile && !writeJSON(outFile, secs, reps, seed))
+    return 2;
+  if (baseFile)
+  {
+    benchBaseline base[BENCH_MAX_CASES];
+    int numBase = readBaseline(baseFile, base, BENCH_MAX_CASES);
+
+    if (numBase < 0)
+      return 2;
+    regressions = compare(base, numBase, tolerance);
+  }
+  free(source);
+  return regressions ? 1 : 0;
+}
@@ -36,13 +36,39 @@
  *
  *****************************************************************************/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* for memfd_create() */
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <float.h>
 #include <ctype.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+/* sound files are granulated straight from a mapping of them (see
+ * mdeGranularMapFile()) */
+#if !defined(_WIN32)
+#define MDE_MAP_FILES 1
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+/* worker threads (see mdeGranularSetThreads()) need pthreads */
+#if !defined(_WIN32)
+#define MDE_THREADS 1
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "mdeGranular~.h"
 
 //------------------------------------------------------------------------------
@@ -57,196 +83,750 @@
 static FILE* DebugFP = NULL;
 #endif
 
+/* see MESSAGES, RENDER AHEAD and RESIZING THE LIVE BUFFER */
+static void mdeGranularQueueInit(mdeGranular* g);
+static void mdeGranularQueueFree(mdeGranular* g);
+static void mdeGranularCollect(mdeGranular* g);
+static void mdeGranularAheadUpdate(mdeGranular* g);
+static int mdeGranularAheadRunning(mdeGranular* g);
+static long mdeGranularAheadXruns(mdeGranular* g);
+static void mdeGranularAheadFree(mdeGranular* g);
+static int mdeGranularSendTick(mdeGranular* g, int hostChanged);
+static void mdeGranularResizeInput(mdeGranular* g, mdefloat* in, long nsamps,
+                                   long li);
+static void mdeGranularResizeRestart(mdeGranular* g);
+static void mdeGranularResizeFree(mdeGranular* g);
+/* see THREADS, LAYOUTS and SOURCES */
+static int mdeGranularJobsBusy(mdeGranular* g);
+static void mdeGranularJobsWait(mdeGranular* g);
+static int mdeGranularThreadsAsked(mdeGranular* g, long threads);
+static mdeGranularLayout* mdeGranularLayoutNew(mdeGranular* g, int maxVoices,
+                                               int threads, long tick);
+static void mdeGranularLayoutSet(mdeGranular* g, mdeGranularLayout* l);
+static void mdeGranularLayoutsFree(mdeGranular* g);
+static mdeGranularSource* mdeGranularSourceNew(mdeGranular* g,
+                                               mdefloat* samples,
+                                               mdefloat samplesMS,
+                                               mdefloat numSamples);
+static int mdeGranularSourceInstall(mdeGranular* g, mdeGranularSource* s,
+                                    char warn);
+static int mdeGranularSourceSend(mdeGranular* g, mdeGranularSource* s);
+static void mdeGranularSourceFree(mdeGranular* g, mdeGranularSource* s);
+static void mdeGranularCopyWarn(mdeGranular* g, mdefloat allocatedMS,
+                                long nsamps);
+static int mdeGranularQueuePush(mdeGranular* g, mdeGranularCommand* c,
+                                mdefloat* list);
+static void mdeGranularSamplesStartMS(mdeGranular* g, mdefloat f, char warn);
+static void mdeGranularSamplesEndMS(mdeGranular* g, mdefloat f, char warn);
+static long mdeGranularSourceLength(mdeGranular* g, mdeGranularSource* s,
+                                    mdefloat* ms);
+static void mdeGranularSentInit(mdeGranular* g);
+static void mdeGranularSentSamples(mdeGranular* g, long n, mdefloat ms);
+
+/* see LAYOUTS */
+enum
+{
+  MDE_RETIRED_LAYOUT,
+  MDE_RETIRED_SOURCE,
+  MDE_RETIRED_FIFO
+};
+
+struct _mdeGranularRetired
+{
+  mdeGranularRetired* next;
+  int what;
+};
+
+/* the grains etc., one of each for each voice */
+typedef struct
+{
+  /* how many layouts share these (only changed by senders) */
+  int users;
+  int maxVoices;
+  mdeGranularGrain* grains;
+  mdeGranularVoice* voices;
+  mdeGranularWake* sleepers;
+  int* sounding;
+} mdeGranularVoiceSet;
+
+struct _mdeGranularLayout
+{
+  mdeGranularRetired retired;
+  /* layouts are numbered as they're made, so that one older than the one
+   * installed (e.g. still waiting when a newer one was swapped in) never is */
+  uint64_t seq;
+  /* whichever of the queue, the renderer or the retired list it's on, plus
+   * one if it's the last sent (only changed by senders) */
+  int users;
+  long tick;
+  int threads;
+  int nPartitions;
+  /* the pool slot we had when this was made (-1 if none): the jobs, or NULL,
+   * are published in it when it's installed */
+  int slot;
+  mdeGranularVoiceSet* voices;
+  mdefloat* grainAmps;
+  mdefloat* grainScratch;
+  mdefloat* partitionSamples;
+  mdeGranularJobs* jobs;
+};
+//------------------------------------------------------------------------------
+
+/* see SOURCES */
+struct _mdeGranularSource
+{
+  mdeGranularRetired retired;
+  /* as given to mdeGranularInit3() (samples is NULL for live input) */
+  mdefloat* samples;
+  mdefloat samplesMS;
+  mdefloat numSamples;
+  /* where there's a new... flag, each group is swapped with ours when we're
+   * installed, so after that it's the old one, for mdeGranularSourceFree() */
+  char newLive;
+  mdefloat* theSamples;
+  long nTheSamples;
+  mdefloat theSamplesMS;
+  char newMirror;
+  mdefloat* mirror;
+  long nMirror;
+  char newFile;
+  void* fileMap;
+  long fileMapBytes;
+  mdefloat* fileSamples;
+  long nFileSamples;
+  char newClearMap;
+  unsigned* clearMap;
+  long nClearMap;
+};
+
+//------------------------------------------------------------------------------
+#pragma mark RAMPS
+
+/* 10.9.10: the ramp could only be changed when we were off, as the grains
+ * read it as they play. Now each ramp (type, length and table) is made in one
+ * go, usually by whoever sends the message (see mdeGranularQueuePush()), and
+ * swapped in at the start of a tick. New grains use the latest ramp; those
+ * already playing finish with the one they started with, so we keep up to
+ * MDE_RAMPS of them and only reuse a slot once no playing grain uses it. Old
+ * ramps are handed back to the senders to free so the audio thread never
+ * calls the allocator. */
+
+struct _mdeGranularRamp
+{
+  /* the next in the list of those waiting to be freed */
+  mdeGranularRamp* next;
+  char type[MDE_COMMAND_NAME_LEN];
+  mdefloat lenMS;
+  /* in samples, of each of up and down */
+  long len;
+  /* 1 once the ramp's been swapped in or refused (see mdeGranularRampSend()) */
+  char done;
+  /* these point into the same block, just after this struct */
+  mdefloat* up;
+  mdefloat* down;
+};
+//------------------------------------------------------------------------------
+
+/* make a ramp; NULL if the type's unknown or there's no memory */
+static mdeGranularRamp* mdeGranularRampNew(mdeGranular* g, const char* type,
+                                           mdefloat lenMS)
+{
+  mdeGranularRamp* r;
+  long len;
+
+  if (lenMS < (mdefloat)RAMPLENMINMS)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: Ramp Length (%fms) too small, setting to "
+              "min.: %fms", lenMS, RAMPLENMINMS);
+    lenMS = (mdefloat)RAMPLENMINMS;
+  }
+  len = ms2samples(g->samplingRate, lenMS);
+  /* the ramp up/down is in fact one contiguous block with the down being
+   * simply a pointer to the middle */
+  r = mdeArenaCalloc(&g->arena, 1,
+                     sizeof(mdeGranularRamp) + len * 2 * sizeof(mdefloat),
+                     "mdeGranularRampNew", g->warnings);
+  if (!r)
+    return NULL;
+  snprintf(r->type, sizeof(r->type), "%s", type);
+  r->lenMS = lenMS;
+  r->len = len;
+  r->up = (mdefloat*)(r + 1);
+  r->down = r->up + len;
+  /* remember: the 2.5 is CLM's mysterious 'beta' arg... */
+  if (!makeWindow(r->type, (int)len * 2, 2.5, r->up))
+  {
+    mdeArenaFree(&g->arena, r);
+    return NULL;
+  }
+  return r;
+}
+//------------------------------------------------------------------------------
+
+/* put a ramp on the list of those to be freed (by the next sender, or
+ * mdeGranularFree()) */
+static void mdeGranularRampRetire(mdeGranular* g, mdeGranularRamp* r)
+{
+  __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+  r->next = __atomic_load_n(&g->rampsDead, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&g->rampsDead, &r->next, r, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+//------------------------------------------------------------------------------
+
+/* free the retired ramps: only one thread may do this at a time (a sender,
+ * holding the queue's lock) */
+static void mdeGranularRampsCollect(mdeGranular* g)
+{
+  mdeGranularRamp* r = __atomic_exchange_n(&g->rampsDead, NULL,
+                                           __ATOMIC_ACQUIRE);
+  mdeGranularRamp* next;
+
+  for (; r; r = next)
+  {
+    next = r->next;
+    if (r == g->rampSent)
+      g->rampSent = NULL;
+    mdeArenaFree(&g->arena, r);
+  }
+}
+//------------------------------------------------------------------------------
+
+/* whether any playing grain is using the ramp in -slot- */
+static int mdeGranularRampUsed(mdeGranular* g, int slot)
+{
+  if (g->grains)
+    for (int i = 0; i < g->maxVoices; ++i)
+      if (g->grains[i].status == ON && g->grains[i].ramp == slot)
+        return 1;
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+/* swap in rampNext if there's a slot free for it, otherwise leave it for
+ * the next tick (mdeGranularGo() tries again) */
+static void mdeGranularRampSwap(mdeGranular* g)
+{
+  mdeGranularRamp* r = g->rampNext;
+  mdeGranularRamp* old = g->ramps[g->ramp];
+  int slot = old ? -1 : g->ramp;
+  int s;
+
+  for (int i = 1; i < MDE_RAMPS && slot < 0; ++i)
+  {
+    s = (g->ramp + i) % MDE_RAMPS;
+    if (!g->ramps[s] || !mdeGranularRampUsed(g, s))
+      slot = s;
+  }
+  if (slot < 0)
+    return;
+  if (g->ramps[slot])
+    mdeGranularRampRetire(g, g->ramps[slot]);
+  g->ramps[slot] = r;
+  g->ramp = slot;
+  g->rampNext = NULL;
+  /* if we're fading in or out, carry on from the same point in the new ramp */
+  if (old)
+    g->statusRampIndex = g->statusRampIndex * r->len / old->len;
+  g->rampUp = r->up;
+  g->rampDown = r->down;
+  g->rampLenSamples = r->len;
+  g->rampLenMS = r->lenMS;
+  mdeGranularStoreRampType(g, r->type);
+  __atomic_store_n(&g->rampNow, r, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+  /* when we're off, reinitialize the grains now we have a different ramp, as
+   * we always did--this will only happen if we have samples already so
+   * should be ignored if we're at the init stage. When we're running they
+   * carry on with the old one. */
+  if (g->status == OFF)
+    mdeGranularInitGrains(g);
+}
+//------------------------------------------------------------------------------
+
+/* whether a ramp of -lenMS- will do for grains of -grainLengthMS- */
+static int mdeGranularRampLenOK(mdefloat lenMS, mdefloat grainLengthMS,
+                                char warn)
+{
+  mdefloat halfgrainlength = grainLengthMS * (mdefloat)0.5;
+
+  if (lenMS > halfgrainlength)
+  {
+    if (warn)
+    {
+      mdePost("mdeGranular~:");
+      mdePost("              Ramp Length (%f) must be a maximum of half ",
+              lenMS);
+      mdePost("              the grain length (%f, half = %f).",
+              grainLengthMS, halfgrainlength);
+      mdePost("              Ignoring.");
+    }
+    return 0;
+  }
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+/* swap in a new ramp (called by the audio thread, which mustn't -warn-, or
+ * by the setters whilst it's not rendering) */
+static void mdeGranularRampInstall(mdeGranular* g, mdeGranularRamp* r,
+                                   char warn)
+{
+  if (!mdeGranularRampLenOK(r->lenMS, g->grainLengthMS, warn))
+  {
+    mdeGranularRampRetire(g, r);
+    return;
+  }
+  if (g->rampNext)
+    mdeGranularRampRetire(g, g->rampNext);
+  g->rampNext = r;
+  mdeGranularRampSwap(g);
+}
+//------------------------------------------------------------------------------
+
+/* the ramp a RAMP_TYPE or RAMP_LEN_MS message changes: the last one sent
+ * or if that's been dealt with, the current one (NULL before there are
+ * any). Called by senders holding the queue's lock. */
+static mdeGranularRamp* mdeGranularRampBase(mdeGranular* g)
+{
+  mdeGranularRamp* base = g->rampSent;
+
+  if (!base || __atomic_load_n(&base->done, __ATOMIC_ACQUIRE))
+    base = __atomic_load_n(&g->rampNow, __ATOMIC_ACQUIRE);
+  return base;
+}
+//------------------------------------------------------------------------------
+
+/* make the ramp for a RAMP_TYPE or RAMP_LEN_MS message from its base (see
+ * above). Called by senders holding the queue's lock. Returns 0 if the
+ * message should be dropped: when there's no ramp yet to change there's
+ * nothing for the audio thread to do, so what was asked for is just
+ * remembered for mdeGranularInit2() to make the first ramp with. */
+static int mdeGranularRampSend(mdeGranular* g, mdeGranularCommand* c)
+{
+  mdeGranularRamp* base;
+
+  if (c->what != MDE_CMD_RAMP_TYPE && c->what != MDE_CMD_RAMP_LEN_MS)
+    return 1;
+  mdeGranularRampsCollect(g);
+  base = mdeGranularRampBase(g);
+  if (!base)
+  {
+    if (c->what == MDE_CMD_RAMP_TYPE)
+      mdeGranularStoreRampType(g, c->name);
+    else
+      g->rampLenAsked = c->f[0];
+    return 0;
+  }
+  if (c->what == MDE_CMD_RAMP_TYPE)
+    c->ramp = mdeGranularRampNew(g, c->name, base->lenMS);
+  else
+    c->ramp = mdeGranularRampNew(g, base->type, c->f[0]);
+  if (!c->ramp)
+    return 0;
+  g->rampSent = c->ramp;
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularFree() once nothing else can be using the ramps */
+static void mdeGranularRampsFree(mdeGranular* g)
+{
+  for (int i = 0; i < MDE_RAMPS; ++i)
+    if (g->ramps[i])
+    {
+      mdeArenaFree(&g->arena, g->ramps[i]);
+      g->ramps[i] = NULL;
+    }
+  if (g->rampNext)
+    mdeArenaFree(&g->arena, g->rampNext);
+  g->rampNext = NULL;
+  mdeGranularRampsCollect(g);
+  g->rampNow = NULL;
+  g->rampSent = NULL;
+  g->rampUp = NULL;
+  g->rampDown = NULL;
+}
+
 //------------------------------------------------------------------------------
 #pragma mark Set methods:
 
-void mdeGranularSetActiveVoices(mdeGranular* g, mdefloat activeVoices)
+/* whether -activeVoices- will do with -maxVoices- */
+static int mdeGranularActiveVoicesOK(mdefloat activeVoices, int maxVoices,
+                                     char warn)
+{
+  int av = (int)activeVoices;
+
+  if (av >= 0 && av <= maxVoices)
+    return 1;
+  if (warn)
+  {
+    mdePost("mdeGranular~:");
+    mdePost("              argument %d is invalid for active voices", av);
+    mdePost("              (max voices = %d)", maxVoices);
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularActiveVoices(mdeGranular* g, mdefloat activeVoices,
+                                    char warn)
 {
   int av = (int)activeVoices;
 
-  if (av >= 0 && av <= g->maxVoices)
+  if (mdeGranularActiveVoicesOK(activeVoices, g->maxVoices, warn))
   {
     g->activeVoices = av;
     if (g->grains)
       for (int i = 0; i < g->maxVoices; ++i)
       {
-        g->grains[i].activeStatus = (i >= av ? INACTIVE : ACTIVE);
-        g->grains[i].doDelay = 1;
+        g->voices[i].activeStatus = (i >= av ? INACTIVE : ACTIVE);
+        g->voices[i].doDelay = 1;
+        /* voices that had finished have to be woken up again; those still
+         * scheduled will notice the change when they're next initialised */
+        if (i < av && !g->voices[i].scheduled)
+          mdeGranularSleep(g, i, g->clock);
       }
   }
-  else if (g->warnings)
-  {
-    post("mdeGranular~:");
-    post("              argument %d is invalid for active voices",
-         (int)activeVoices);
-    post("              (max voices = %d)", g->maxVoices);
-  }
+}
+
+void mdeGranularSetActiveVoices(mdeGranular* g, mdefloat activeVoices)
+{
+  mdeGranularActiveVoices(g, activeVoices, g->warnings);
 }
 
 //------------------------------------------------------------------------------
 
 void mdeGranularSetMaxVoices(mdeGranular* g, mdefloat maxVoices)
 {
+  mdeGranularLayout* base = g->layoutSent;
+  mdeGranularLayout* l;
   int mv = (int)maxVoices;
 
   if (mv > 0)
   {
-    g->maxVoices = mv;
-    if (g->grains)
-      mdeFree(g->grains);
-    g->grains = mdeCalloc(mv, sizeof(mdeGranularGrain),
-                          "mdeGranularSetMaxVoices", g->warnings);
-    if (mv < g->activeVoices)
-      g->activeVoices = mv;
-    mdeGranularSetActiveVoices(g, (mdefloat)g->activeVoices);
-    /* init each grain/voice */
-    mdeGranularInitGrains(g);
+    mdeGranularLock(g);
+    /* the grains etc. are made in a new layout (see LAYOUTS), which is
+     * swapped in here rather than at the start of a tick */
+    l = mdeGranularLayoutNew(g, mv, base ? base->threads : 1,
+                             base ? base->tick : 0);
+    if (l)
+      mdeGranularLayoutSet(g, l);
+    mdeGranularUnlock(g);
   }
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetRampType(mdeGranular* g, char* type)
+static void mdeGranularRampType(mdeGranular* g, char* type, char warn)
 {
-  /* 10.9.10: don't change the ramp unless we're off and therefore not using
-   * the ramp array */
-  if (g->status != OFF)
+  mdeGranularRamp* r;
+
+  /* until Init2 has made the first ramp we only need to remember the type */
+  if (!g->rampNow)
   {
-    if (g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              Can't change ramp type whilst object is running ");
-      post("              or ramping down. Ignoring.");
-    }
+    mdeGranularStoreRampType(g, type);
     return;
   }
-  mdeGranularStoreRampType(g, type);
-  mdeGranularInitGrains(g);
-  makeWindow(g->rampType, g->rampLenSamples * 2, 2.5, g->rampUp);
+  r = mdeGranularRampNew(g, type, g->rampLenMS);
+  if (r)
+    mdeGranularRampInstall(g, r, warn);
+}
+
+void mdeGranularSetRampType(mdeGranular* g, char* type)
+{
+  mdeGranularRampType(g, type, g->warnings);
+  g->sent.rampLenMS = g->rampNext ? g->rampNext->lenMS : g->rampLenMS;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS)
+static void mdeGranularRampLen(mdeGranular* g, mdefloat rampLenMS, char warn)
 {
-  mdefloat halfgrainlength = g->grainLengthMS * (mdefloat)0.5;
-  mdefloat* oldramp = g->rampUp;
-  /* post("\nSETRAMPLENMS: %fms (srate=%f)", rampLenMS, g->samplingRate);
+  mdeGranularRamp* r = mdeGranularRampNew(g, g->rampType, rampLenMS);
+
+  /* mdePost("\nSETRAMPLENMS: %fms (srate=%f)", rampLenMS, g->samplingRate);
      return;  */
+  if (r)
+    mdeGranularRampInstall(g, r, warn);
+  /* mdePost("\nSETRAMPLENMS: now %f", g->rampLenMS); */
+}
 
-  /* 10.9.10: don't change the ramp unless we're off and therefore not using
-   * the ramp array */
-  if (g->status != OFF)
-  {
-    if (g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              Can't change ramp length whilst object is running ");
-      post("              or ramping down. Ignoring.");
-    }
+void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS)
+{
+  mdeGranularRampLen(g, rampLenMS, g->warnings);
+  g->sent.rampLenMS = g->rampNext ? g->rampNext->lenMS : g->rampLenMS;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularTranspositionOffset(mdeGranular* g, mdefloat f)
+{
+  /* f is semitones */
+  g->transpositionOffsetST = f;
+  g->transpositionOffset = st2src(f, g->octaveSize, g->octaveDivisions);
+}
+
+/* (the setters called directly, rather than by mdeGranularApply(), keep what
+ * senders check against in step: see mdeGranularCheck()) */
+void mdeGranularSetTranspositionOffsetST(mdeGranular* g, mdefloat f)
+{
+  mdeGranularTranspositionOffset(g, f);
+  g->sent.transpositionOffset = g->transpositionOffset;
+}
+//------------------------------------------------------------------------------
+
+/* a live buffer of -sizeMS- won't do, with grains of -grainLengthMS- and
+ * -bufferMS- being granulated */
+static void mdeGranularLiveBufferSizeWarn(mdeGranular* g, mdefloat sizeMS,
+                                          mdefloat grainLengthMS,
+                                          mdefloat bufferMS)
+{
+  if (!g->warnings)
     return;
+  mdePost("mdeGranular~:");
+  if (grainLengthMS > sizeMS)
+  {
+    mdePost("              Can't change maximim buffer size to %f as your ",
+            sizeMS);
+    mdePost("              grain length is %f (i.e. larger).  Ignoring.",
+            grainLengthMS);
   }
-  if (rampLenMS < (mdefloat)RAMPLENMINMS)
+  else
   {
-    if (g->warnings)
-      post("mdeGranular~: Ramp Length (%fms) too small, setting to min.: %fms",
-           rampLenMS, RAMPLENMINMS);
-    rampLenMS = (mdefloat)RAMPLENMINMS;
+    mdePost("              Can't change maximim buffer size to %f as ",
+            sizeMS);
+    mdePost("              %fms of it is being granulated.  Ignoring.",
+            bufferMS);
   }
-  if (rampLenMS > halfgrainlength)
+}
+//------------------------------------------------------------------------------
+
+/* whether a live buffer of -n- samples (-sizeMS-) will do; the audio thread
+ * mustn't -warn- (see mdeGranularResizeCollect()) */
+static int mdeGranularLiveBufferSizeOK(mdeGranular* g, mdefloat sizeMS, long n,
+                                       char warn)
+{
+  /* 3.4.10 don't allow us to set a max buffer size < the grain
+   * length--without checking we'd have a crash! Nor one shorter than what
+   * we're granulating in it */
+  if (g->grainLengthMS > sizeMS ||
+      (g->theSamples && g->samples == g->theSamples && n < g->nBufferSamples))
   {
-    if (g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              Ramp Length (%f) must be a maximum of half ",
-           rampLenMS);
-      post("              the grain length (%f, half = %f).",
-           g->grainLengthMS, halfgrainlength);
-      post("              Ignoring.");
-    }
-    return;
+    if (warn)
+      mdeGranularLiveBufferSizeWarn(g, sizeMS, g->grainLengthMS,
+                                    g->BufferSamplesMS);
+    return 0;
   }
-  g->rampLenMS = rampLenMS;
-  g->rampLenSamples = ms2samples(g->samplingRate, g->rampLenMS);
-  /* the ramp up/down is in fact one contiguous block with the down being
-   * simply a pointer to the middle */
-  /* todo: don't malloc here if we're using the ramp: in fact only allow ramps
-     to be changed when object is off */
-  g->rampUp = mdeCalloc(g->rampLenSamples * 2, sizeof(mdefloat),
-                        "mdeGranularSetRampLenMS", g->warnings);
-  g->rampDown = g->rampUp + g->rampLenSamples;
-  /* remember: the 2.5 is CLM's mysterious 'beta' arg... */
-  makeWindow(g->rampType, g->rampLenSamples * 2, 2.5, g->rampUp);
-  /* reinitialize the grains now we have a different ramp length--this will
-   * only happen if we have samples already so should be ignored if we're at
-   * the init stage */
-  mdeGranularInitGrains(g);
-  if (oldramp)
-    mdeFree(oldramp);
-  /* post("\nSETRAMPLENMS: now %f", g->rampLenMS); */
+  return 1;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetTranspositionOffsetST(mdeGranular* g, mdefloat f)
+/* install a new live buffer (into which the samples in use have been copied)
+ * and return the old one */
+static mdefloat* mdeGranularSwapLiveBuffer(mdeGranular* g, mdefloat* samples,
+                                           long n, mdefloat sizeMS)
 {
-  /* f is semitones */
-  g->transpositionOffsetST = f;
-  g->transpositionOffset = st2src(f, g->octaveSize, g->octaveDivisions);
+  mdefloat* old = g->theSamples;
+
+  g->theSamples = samples;
+  /* (senders read it: see mdeGranularSourceNew()) */
+  __atomic_store_n(&g->nAllocatedBufferSamples, n, __ATOMIC_RELEASE);
+  g->AllocatedBufferMS = sizeMS;
+  if ((old && g->samples == old) || (g->live && !g->samplesMirrored))
+    g->samples = samples;
+  if (g->samplesGuarded)
+    mdeGranularMirrorGuards(g->samples, g->nBufferSamples);
+  return old;
+}
+//------------------------------------------------------------------------------
+
+/* allocate a live buffer of -sizeMS- and swap it in; returns 1 if we did */
+static int mdeGranularAllocLiveBuffer(mdeGranular* g, mdefloat sizeMS)
+{
+  int numSamples = ms2samples(g->samplingRate, sizeMS);
+  mdefloat* samples;
+
+  if (!mdeGranularLiveBufferSizeOK(g, sizeMS, numSamples, 1))
+    return 0;
+  samples = mdeGranularAllocSamples(g, numSamples, g->warnings);
+  if (!samples)
+    return 0;
+  /* keep what's been recorded (or copied from a buffer~) */
+  if (g->theSamples && g->samples == g->theSamples)
+    memcpy(samples, g->theSamples, g->nBufferSamples * sizeof(mdefloat));
+  mdeGranularResizeRestart(g);
+  mdeGranularFreeSamples(g, mdeGranularSwapLiveBuffer(g, samples, numSamples,
+                                                      sizeMS));
+  return 1;
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularSetLiveBufferSize(mdeGranular* g, mdefloat sizeMS)
 {
-  /* 7/3/06: only malloc if we're off and therefore not accessing previously
-     allocated memory! */
-  if (g->status == OFF)
+  if (mdeGranularAllocLiveBuffer(g, sizeMS))
+    g->liveBufferFixed = 1;
+}
+//------------------------------------------------------------------------------
+
+/* Until MaxLiveBufferMS is sent, the live buffer isn't allocated until it's
+ * needed (by Init3() or, in Max, for a copy of a buffer~), and then only big
+ * enough for the samples needed plus this many more: room for the present
+ * grain length at the highest transposition, so that a slightly longer
+ * window won't need a new one. It used to be 10 seconds for every object,
+ * live or not. */
+static long mdeGranularLiveHeadroom(mdeGranular* g)
+{
+  mdefloat top = (mdefloat)1.0;
+
+  for (int i = 0; i < g->numTranspositions; ++i)
+    if (g->config->srcs[i] * g->transpositionOffset > top)
+      top = g->config->srcs[i] * g->transpositionOffset;
+  return (long)ceil(g->grainLength * top);
+}
+//------------------------------------------------------------------------------
+
+/* make sure there's room in the live buffer for -n- samples; returns 0 if
+ * there still isn't */
+static int mdeGranularNeedLiveBuffer(mdeGranular* g, long n)
+{
+  if (n <= g->nAllocatedBufferSamples)
+    return 1;
+  if (g->liveBufferFixed)
+    return 0;
+  mdeGranularAllocLiveBuffer(g, samples2ms(g->samplingRate, n +
+                                           mdeGranularLiveHeadroom(g)));
+  return n <= g->nAllocatedBufferSamples;
+}
+//------------------------------------------------------------------------------
+
+/* the live buffer (of -allocatedMS-) is too small for -samplesMS- */
+static void mdeGranularLiveBufferWarn(mdeGranular* g, mdefloat allocatedMS,
+                                      mdefloat samplesMS)
+{
+  if (g->warnings)
   {
-    /* 3.4.10 don't allow us to set a max buffer size < the grain
-       length--without checking we'd have a crash! */
-    if (g->grainLengthMS > sizeMS && g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              Can't change maximim buffer size to %f as your ",
-           sizeMS);
-      post("              grain length is %f (i.e. larger).  Ignoring.",
-           g->BufferSamplesMS);
-    }
-    else
+    mdePost("mdeGranular~:");
+    mdePost("              The allocated live sample buffer is only ");
+    mdePost("              %fms so your request for %fms is invalid.",
+            allocatedMS, samplesMS);
+    mdePost("              Please send the object a \"MaxLiveBufferMS\" ");
+    mdePost("              message to increase this (preferably do "
+            "this at");
+    mdePost("              the beginning of your performance, allocating ");
+    mdePost("              enough for all the performance's needs).");
+  }
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetMirrorLiveBuffer(mdeGranular* g, long l)
+{
+  if (l != 0 && l != 1)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: MirrorLiveBuffer should be 1 or 0.");
+    return;
+  }
+  /* senders take turns, so no On can be sent whilst we look; the renderer
+   * changes the status as it ramps up or down, hence the atomic read */
+  mdeGranularLock(g);
+  /* same as SetLiveBufferSize: the mapping might be swapped so we have to be
+   * off */
+  if (__atomic_load_n(&g->status, __ATOMIC_ACQUIRE) != OFF)
+  {
+    if (g->warnings)
     {
-      int numSamples = ms2samples(g->samplingRate, sizeMS);
-      mdefloat* old = g->theSamples;
-      g->theSamples = mdeCalloc(numSamples, sizeof(mdefloat),
-                                "mdeGranularSetLiveBufferSize", g->warnings);
-      g->nAllocatedBufferSamples = numSamples;
-      g->AllocatedBufferMS = sizeMS;
-      if (g->live)
-        g->samples = g->theSamples;
-      if (old)
-        mdeFree(old);
+      mdePost("mdeGranular~:");
+      mdePost("              Can't change MirrorLiveBuffer while object is ");
+      mdePost("              running (or ramping down)!");
     }
   }
-  else if (g->warnings)
+  else
   {
-    post("mdeGranular~:");
-    post("              Can't change buffer size while object is running ");
-    post("              (or ramping down)!");
+    g->mirrorLive = (char)l;
+    /* if we're granulating live, send the samples again, with the size we
+     * were last given (the mirror may have rounded the ring up), and the
+     * mapping's made or unmapped with them (see SOURCES) */
+    if (g->liveSentN)
+      mdeGranularSendSamples(g, NULL, g->liveSentMS,
+                             (mdefloat)g->liveSentN);
   }
+  mdeGranularUnlock(g);
+}
+//------------------------------------------------------------------------------
+
+/* whether -l- will do for the switch called -name- */
+static int mdeGranularSwitchOK(long l, const char* name, char warn)
+{
+  if (l == 0 || l == 1)
+    return 1;
+  if (warn)
+    mdePost("mdeGranular~: %s should be 1 or 0.", name);
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetHugePages(mdeGranular* g, long l)
+{
+  if (!mdeGranularSwitchOK(l, "HugePages", g->warnings))
+    return;
+  __atomic_store_n(&g->arena.hugePages, (char)l, __ATOMIC_RELAXED);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetFixedPhase(mdeGranular* g, long l)
+{
+  if (!mdeGranularSwitchOK(l, "FixedPhase", g->warnings))
+    return;
+  /* current is kept up to date in fixed-point mode so grains already
+   * sounding just carry on from there */
+  if (l && !g->fixedPhase && g->grains)
+    for (int i = 0; i < g->maxVoices; ++i)
+    {
+      g->grains[i].phase = mdeGranularPhase(g->grains[i].current);
+      g->grains[i].phaseInc = mdeGranularPhase(g->grains[i].inc);
+    }
+  g->fixedPhase = (char)l;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetSeed(mdeGranular* g, mdefloat seed)
+{
+  mdeGranularRandomSeed(&g->rng, (uint64_t)(int64_t)seed);
+  g->nextRandom = MDE_RANDOM_BATCH;
+  /* the grains have to start again for the result to depend only on the
+   * seed, just as when they're restarted after a new grain length etc. */
+  mdeGranularInitGrains(g);
+}
+//------------------------------------------------------------------------------
+
+/* whether -f- will do for -name-, which has to be positive */
+static int mdeGranularPositiveOK(mdefloat f, const char* name, char warn)
+{
+  if (f > 0.0)
+    return 1;
+  if (warn)
+    mdePost("mdeGranular~: %s must be > 0: %f!", name, f);
+  return 0;
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularOctaveSize(mdeGranular* g, mdefloat size)
 {
-  if (size > 0.0)
+  if (mdeGranularPositiveOK(size, "OctaveSize", g->warnings))
+  {
     g->octaveSize = size;
-  else if (g->warnings)
-    post("mdeGranular~: OctaveSize must be > 0: %f!", size);
+    g->sent.octaveSize = size;
+  }
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularOctaveDivisions(mdeGranular* g, mdefloat divs)
 {
-  if (divs > 0.0)
+  if (mdeGranularPositiveOK(divs, "OctaveDivisions", g->warnings))
+  {
     g->octaveDivisions = divs;
-  else if (g->warnings)
-    post("mdeGranular~: OctaveDivisions must be > 0: %f!", divs);
+    g->sent.octaveDivisions = divs;
+  }
 }
 //------------------------------------------------------------------------------
 
@@ -268,23 +848,28 @@ mdefloat maxFloat(mdefloat* array, int size)
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
+/* whether a grain length of -f- will do with a ramp of -rampLenMS- and
+ * -nBufferSamples- to granulate at a transposition of up to -highestSRC-
+ * (before the offset) */
+static int mdeGranularGrainLengthOK(mdeGranular* g, mdefloat f,
+                                    mdefloat rampLenMS, long nBufferSamples,
+                                    mdefloat highestSRC,
+                                    mdefloat transpositionOffset, char warn)
 {
   mdefloat sr = g->samplingRate;
   int lenSamples = ms2samples(sr, f);
-  mdefloat highestSRC = maxFloat(g->srcs, g->numTranspositions);
-  int sampsNeeded = lenSamples * highestSRC * g->transpositionOffset;
+  int sampsNeeded = lenSamples * highestSRC * transpositionOffset;
 
-  if (f <= (2 * g->rampLenMS))
+  if (f <= (2 * rampLenMS))
   {
-    if (g->warnings)
+    if (warn)
     {
-      post("mdeGranular~:");
-      post("              grain length (%f) too small for ", f);
-      post("              given ramp length (%f).", g->rampLenMS);
-      post("              Ignoring.");
+      mdePost("mdeGranular~:");
+      mdePost("              grain length (%f) too small for ", f);
+      mdePost("              given ramp length (%f).", rampLenMS);
+      mdePost("              Ignoring.");
     }
-    return;
+    return 0;
   }
   /*
    * 1/5/08: we used to demand that we had twice as many samples in the buffer
@@ -292,31 +877,45 @@ void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
   /*
      if (g->nBufferSamples && sampsNeeded >= (g->nBufferSamples / 2)) {
    */
-  if (g->nBufferSamples && sampsNeeded >= g->nBufferSamples)
+  if (nBufferSamples && sampsNeeded >= nBufferSamples)
   {
     mdefloat msneeded = samples2ms(sr, sampsNeeded);
-    if (g->warnings)
+    if (warn)
     {
-      post("mdeGranular~:");
-      post("              Live (internal) sample buffer is too short for ");
-      post("              requested grain length with given transpositions.");
-      post("              Buffer should generally be twice the grain length.");
-      post("              (Use the 'set msXXX' message to set the internal ");
-      post("              buffer size in millisecs.)");
-      post("              (%d samples (%fms) in buffer, ",
-           g->nBufferSamples, samples2ms(sr, g->nBufferSamples));
-      post("              %d (%fms) samples in grain, ",
-           lenSamples, samples2ms(sr, lenSamples));
-      post("              %d (%fms) samples needed for highest transposition)",
-           sampsNeeded, msneeded);
-      post("              Min buffer size should be %f",
-           msneeded * 2.0f);
-      post("              Ignoring.");
+      mdePost("mdeGranular~:");
+      mdePost("              Live (internal) sample buffer is too short for ");
+      mdePost("              requested grain length with given "
+              "transpositions.");
+      mdePost("              Buffer should generally be twice the grain "
+              "length.");
+      mdePost("              (Use the 'set msXXX' message to set the "
+              "internal ");
+      mdePost("              buffer size in millisecs.)");
+      mdePost("              (%ld samples (%fms) in buffer, ",
+              nBufferSamples, samples2ms(sr, nBufferSamples));
+      mdePost("              %d (%fms) samples in grain, ",
+              lenSamples, samples2ms(sr, lenSamples));
+      mdePost("              %d (%fms) samples needed for highest "
+              "transposition)", sampsNeeded, msneeded);
+      mdePost("              Min buffer size should be %f",
+              msneeded * 2.0f);
+      mdePost("              Ignoring.");
     }
-    return;
+    return 0;
   }
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularGrainLength(mdeGranular* g, mdefloat f, char warn)
+{
+  mdefloat highestSRC = maxFloat(g->config->srcs, g->numTranspositions);
+
+  if (!mdeGranularGrainLengthOK(g, f, g->rampLenMS, g->nBufferSamples,
+                                highestSRC, g->transpositionOffset, warn))
+    return;
   g->grainLengthMS = f;
-  g->grainLength = lenSamples;
+  g->grainLength = ms2samples(g->samplingRate, f);
   /* now we have a different grain length (which could be suddenly
    * much longer) we should have a delay the next time the grain is
    * initialised */
@@ -327,6 +926,13 @@ void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
      mdeGranularDoGrainDelays(g);
    */
 }
+
+void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f)
+{
+  mdeGranularGrainLength(g, f, g->warnings);
+  g->sent.grainLengthMS = g->grainLengthMS;
+  g->sent.grainLength = g->grainLength;
+}
 //------------------------------------------------------------------------------
 
 void mdeGranularDoGrainDelays(mdeGranular* g)
@@ -334,7 +940,7 @@ void mdeGranularDoGrainDelays(mdeGranular* g)
   if (g->grains)
     for (int i = 0; i < g->maxVoices; ++i)
     {
-      g->grains[i].doDelay = 1;
+      g->voices[i].doDelay = 1;
     }
 }
 //------------------------------------------------------------------------------
@@ -358,7 +964,7 @@ void mdeGranularSmoothMode(mdeGranular* g)
   if (g->grains)
     for (int i = 0; i < av; ++i)
     {
-      g->grains[i].doDelay = delay;
+      g->voices[i].doDelay = delay;
       delay += dinc;
     }
 }
@@ -411,47 +1017,76 @@ void mdeGranularSetGrainLengthDeviation(mdeGranular* g, mdefloat f)
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularPortion(mdeGranular* g, mdefloat position,
-                        mdefloat width)
+/* whether -position- and -width- (percentages) will do for a portion */
+static int mdeGranularPortionOK(mdefloat position, mdefloat width, char warn)
 {
   if (width <= (mdefloat)0.0 || width > (mdefloat)100.0 ||
       position < (mdefloat)0.0 || position > (mdefloat)100.0)
   {
-    if (g->warnings)
+    if (warn)
     {
-      post("mdeGranular~:");
-      post("              mdeGranularPortion: position and width are in ");
-      post("              percentages so >= 0 and <= 100.");
-      post("              (position = %f, width = %f).");
-      post("              Ignoring.");
+      mdePost("mdeGranular~:");
+      mdePost("              mdeGranularPortion: position and width are in ");
+      mdePost("              percentages so >= 0 and <= 100.");
+      mdePost("              (position = %f, width = %f).", position, width);
+      mdePost("              Ignoring.");
     }
+    return 0;
   }
-  else
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+/* where (in millisecs) the portion at -position- and -width- of -buf_ms-
+ * starts and ends */
+static void mdeGranularPortionMS(mdefloat buf_ms, mdefloat position,
+                                 mdefloat width, mdefloat* start,
+                                 mdefloat* end)
+{
+  mdefloat width_ms = buf_ms * width * (mdefloat)0.01;
+  mdefloat half_width_ms = width_ms * (mdefloat)0.5;
+  mdefloat pos_ms = buf_ms * position * (mdefloat).01;
+
+  *start = pos_ms - half_width_ms;
+  *end = pos_ms + half_width_ms;
+  if (*start < (mdefloat)0)
+  {
+    *start = (mdefloat)0;
+    *end = width_ms;
+  }
+  /* it's feasible that this would still result in start < 0 but that will be
+   * picked up and dealt with later on */
+  if (*end > buf_ms)
+  {
+    *end = buf_ms;
+    *start = buf_ms - width_ms;
+  }
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularPortionSet(mdeGranular* g, mdefloat position,
+                                  mdefloat width, char warn)
+{
+  mdefloat start;
+  mdefloat end;
+
+  if (mdeGranularPortionOK(position, width, warn))
   {
-    mdefloat buf_ms = g->BufferSamplesMS;
-    mdefloat width_ms = buf_ms * width * (mdefloat)0.01;
-    mdefloat half_width_ms = width_ms * (mdefloat)0.5;
-    mdefloat pos_ms = buf_ms * position * (mdefloat).01;
-    mdefloat start = pos_ms - half_width_ms;
-    mdefloat end = pos_ms + half_width_ms;
+    mdeGranularPortionMS(g->BufferSamplesMS, position, width, &start, &end);
     g->portionPosition = position;
     g->portionWidth = width;
-    if (start < (mdefloat)0)
-    {
-      start = (mdefloat)0;
-      end = width_ms;
-    }
-    /* it's feasible that this would still result in start < 0 but that will be
-     * picked up and dealt with later on */
-    if (end > buf_ms)
-    {
-      end = buf_ms;
-      start = buf_ms - width_ms;
-    }
-    mdeGranularSetSamplesStartMS(g, start);
-    mdeGranularSetSamplesEndMS(g, end);
+    mdeGranularSamplesStartMS(g, start, warn);
+    mdeGranularSamplesEndMS(g, end, warn);
   }
 }
+
+void mdeGranularPortion(mdeGranular* g, mdefloat position,
+                        mdefloat width)
+{
+  mdeGranularPortionSet(g, position, width, g->warnings);
+  g->sent.portionPosition = g->portionPosition;
+  g->sent.portionWidth = g->portionWidth;
+}
 //------------------------------------------------------------------------------
 
 void mdeGranularPortionPosition(mdeGranular* g, mdefloat position)
@@ -464,68 +1099,102 @@ void mdeGranularPortionWidth(mdeGranular* g, mdefloat width)
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f)
+/* where a start point of -f- ms falls in a buffer of -n- samples (-ms- of
+ * them): returns it in samples and puts it in -pointMS- */
+static long mdeGranularStartPoint(mdeGranular* g, mdefloat f, long n,
+                                  mdefloat ms, mdefloat* pointMS, char warn)
 {
-  g->samplesStartMS = f;
-  g->samplesStart = ms2samples(g->samplingRate, f);
-  if (g->samplesStart < 0)
+  long start = ms2samples(g->samplingRate, f);
+
+  *pointMS = f;
+  if (start < 0)
   {
-    g->samplesStart = 0;
-    g->samplesStartMS = samples2ms(g->samplingRate, g->samplesStart);
-    if ((f != (mdefloat)DBL_MIN) && (f != (mdefloat)0.0) && g->warnings)
+    start = 0;
+    *pointMS = samples2ms(g->samplingRate, start);
+    if ((f != (mdefloat)DBL_MIN) && (f != (mdefloat)0.0) && warn)
     {
-      post("mdeGranular~:");
-      post("              %fms is too low for start point in buffer ", f);
-      post("              Setting to %fms", g->samplesStartMS);
+      mdePost("mdeGranular~:");
+      mdePost("              %fms is too low for start point in buffer ", f);
+      mdePost("              Setting to %fms", *pointMS);
     }
   }
-  if (g->samplesStart >= g->nBufferSamples)
+  if (start >= n)
   {
-    g->samplesStart = g->nBufferSamples - 1;
-    g->samplesStartMS = samples2ms(g->samplingRate, g->samplesStart);
-    if ((f != g->BufferSamplesMS) && g->warnings)
+    start = n - 1;
+    *pointMS = samples2ms(g->samplingRate, start);
+    if ((f != ms) && warn)
     {
-      post("mdeGranular~: ");
-      post("              %fms is too high for start point in buffer.", f);
-      post("              Setting to %fms", g->samplesStartMS);
+      mdePost("mdeGranular~: ");
+      mdePost("              %fms is too high for start point in buffer.", f);
+      mdePost("              Setting to %fms", *pointMS);
     }
   }
+  return start;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetSamplesEndMS(mdeGranular* g, mdefloat f)
+/* the same for an end point */
+static long mdeGranularEndPoint(mdeGranular* g, mdefloat f, long n,
+                                mdefloat ms, mdefloat* pointMS, char warn)
 {
-  if (!g->nBufferSamples)
-    error("mdeGranular~: No samples in buffer %s", g->BufferName);
-  g->samplesEndMS = f;
-  g->samplesEnd = ms2samples(g->samplingRate, f);
-  /* at init we call this function with DBL_MIN to trigger this clause */
-  if (g->samplesEnd >= g->nBufferSamples ||
-      g->samplesEndMS == (mdefloat)DBL_MIN)
+  long end = ms2samples(g->samplingRate, f);
+
+  if (!n && warn)
+    mdeError("mdeGranular~: No samples in buffer %s", g->config->BufferName);
+  *pointMS = f;
+  /* at init we're called with DBL_MIN to trigger this clause */
+  if (end >= n || f == (mdefloat)DBL_MIN)
   {
     /* we take samples away as we need these for 4-point interpolating
      * lookup. */
-    g->samplesEnd = g->nBufferSamples - 1;
-    g->samplesEndMS = samples2ms(g->samplingRate, g->samplesEnd);
-    if ((f != (mdefloat)DBL_MIN) && (f != g->BufferSamplesMS) && g->warnings)
+    end = n - 1;
+    *pointMS = samples2ms(g->samplingRate, end);
+    if ((f != (mdefloat)DBL_MIN) && (f != ms) && warn)
     {
-      post("mdeGranular~:");
-      post("              %fms is too high for end point in buffer (%s: %f)",
-           f, g->BufferName, g->BufferSamplesMS);
-      post("              Setting to %fms", g->samplesEndMS);
+      mdePost("mdeGranular~:");
+      mdePost("              %fms is too high for end point in buffer (%s: %f)",
+              f, g->config->BufferName, ms);
+      mdePost("              Setting to %fms", *pointMS);
     }
   }
-  if (g->samplesEnd < 0)
+  if (end < 0)
   {
-    g->samplesEnd = 0;
-    g->samplesEndMS = samples2ms(g->samplingRate, g->samplesEnd);
-    if (g->warnings)
+    end = 0;
+    *pointMS = samples2ms(g->samplingRate, end);
+    if (warn)
     {
-      post("mdeGranular~:");
-      post("              %fms is too low for end point in buffer.", f);
-      post("              Setting to %fms", g->samplesEndMS);
+      mdePost("mdeGranular~:");
+      mdePost("              %fms is too low for end point in buffer.", f);
+      mdePost("              Setting to %fms", *pointMS);
     }
   }
+  return end;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularSamplesStartMS(mdeGranular* g, mdefloat f, char warn)
+{
+  g->samplesStart = mdeGranularStartPoint(g, f, g->nBufferSamples,
+                                          g->BufferSamplesMS,
+                                          &g->samplesStartMS, warn);
+}
+
+void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f)
+{
+  mdeGranularSamplesStartMS(g, f, g->warnings);
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularSamplesEndMS(mdeGranular* g, mdefloat f, char warn)
+{
+  g->samplesEnd = mdeGranularEndPoint(g, f, g->nBufferSamples,
+                                      g->BufferSamplesMS, &g->samplesEndMS,
+                                      warn);
+}
+
+void mdeGranularSetSamplesEndMS(mdeGranular* g, mdefloat f)
+{
+  mdeGranularSamplesEndMS(g, f, g->warnings);
 }
 //------------------------------------------------------------------------------
 
@@ -535,52 +1204,58 @@ void warnGrain2BufferLength(mdeGranular* g)
 
   if ((availableBuffer < g->grainLengthMS) && g->warnings)
   {
-    post("mdeGranular~:");
-    post("                you are using only %fms of your buffer but have a ",
-         availableBuffer);
-    post("                grain length of %fms so no grains can be output.",
-         g->grainLengthMS);
-    post("                Note that if you are using upwards transposition");
-    post("                you will need more of your buffer for a given grain");
-    post("                length before output can be heard.");
+    mdePost("mdeGranular~:");
+    mdePost("                you are using only %fms of your buffer but "
+            "have a ", availableBuffer);
+    mdePost("                grain length of %fms so no grains can be output.",
+            g->grainLengthMS);
+    mdePost("                Note that if you are using upwards transposition");
+    mdePost("                you will need more of your buffer for a given "
+            "grain");
+    mdePost("                length before output can be heard.");
   }
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularSetDensity(mdeGranular* g, mdefloat f)
 {
-  /* post("density %f", f); */
+  /* mdePost("density %f", f); */
   if (f >= (mdefloat)0.0 && f <= (mdefloat)100.0)
     g->density = f;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetActiveChannels(mdeGranular* g, long l)
+/* -l- active channels, or as near to it as we can get */
+static long mdeGranularActiveChannels(mdeGranular* g, long l, char warn)
 {
   if (l > g->numChannels)
   {
-    if (g->warnings)
+    if (warn)
     {
-      post("mdeGranular~:");
-      post("              ActiveChannels (%d) cannot be greater than the ",
-           l);
-      post("              number of outlet channels (%d).", g->numChannels);
-      post("              Setting to %d.", g->numChannels);
+      mdePost("mdeGranular~:");
+      mdePost("              ActiveChannels (%ld) cannot be greater than the ",
+              l);
+      mdePost("              number of outlet channels (%d).", g->numChannels);
+      mdePost("              Setting to %d.", g->numChannels);
     }
-    g->activeChannels = g->numChannels;
+    return g->numChannels;
   }
-  else if (l < 1)
+  if (l < 1)
   {
-    if (g->warnings)
+    if (warn)
     {
-      post("mdeGranular~: ");
-      post("              ActiveChannels (%d) cannot be less than 1. ", l);
-      post("              Setting to 1.");
+      mdePost("mdeGranular~: ");
+      mdePost("              ActiveChannels (%ld) cannot be less than 1. ", l);
+      mdePost("              Setting to 1.");
     }
-    g->activeChannels = 1;
+    return 1;
   }
-  else
-    g->activeChannels = l;
+  return l;
+}
+
+void mdeGranularSetActiveChannels(mdeGranular* g, long l)
+{
+  g->activeChannels = mdeGranularActiveChannels(g, l, g->warnings);
 }
 //------------------------------------------------------------------------------
 
@@ -589,7 +1264,7 @@ void mdeGranularSetWarnings(mdeGranular* g, long l)
   if (l == 0 || l == 1)
     g->warnings = (char)l;
   else
-    post("mdegranular~: Warnings should be 1 or 0.");
+    mdePost("mdegranular~: Warnings should be 1 or 0.");
 }
 //------------------------------------------------------------------------------
 
@@ -597,7 +1272,7 @@ void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f)
 {
   static const mdefloat min = (mdefloat)0.00001;
 
-  /* post("grainAmp %f", f); */
+  /* mdePost("grainAmp %f", f); */
   if (g && f >= (mdefloat)0.0 && f <= (mdefloat)100.0)
   {
     if (mdeGranularAtTargetGrainAmp(g) &&
@@ -612,7 +1287,8 @@ void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f)
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularSetTranspositions(mdeGranular* g, int num, mdefloat* list)
+static void mdeGranularTranspositions(mdeGranular* g, int num,
+                                      mdefloat* list)
 {
   mdefloat st;
   mdefloat noTransp[] = { (mdefloat)0.0 };
@@ -629,29 +1305,480 @@ void mdeGranularSetTranspositions(mdeGranular* g, int num, mdefloat* list)
   for (int i = 0; i < num && i < MAXTRANSPOSITIONS; ++i)
   {
     st = *list++;
-    g->transpositions[i] = st;
-    g->srcs[i] = st2src(st, g->octaveSize, g->octaveDivisions);
+    g->config->transpositions[i] = st;
+    g->config->srcs[i] = st2src(st, g->octaveSize, g->octaveDivisions);
   }
 }
 //------------------------------------------------------------------------------
 
+void mdeGranularSetTranspositions(mdeGranular* g, int num, mdefloat* list)
+{
+  mdeGranularTranspositions(g, num, list);
+  g->sent.highestSRC = maxFloat(g->config->srcs, g->numTranspositions);
+}
+//------------------------------------------------------------------------------
+
 void mdeGranularOn(mdeGranular* g)
 {
   if (g->status != STARTING && g->status != ON)
   {
     mdeGranularClearTheSamples(g);
-    g->status = STARTING;
+    __atomic_store_n(&g->status, STARTING, __ATOMIC_RELEASE);
+  }
+}
+//------------------------------------------------------------------------------
+
+/* silence chunk -c- of the ring, if it's not clean already */
+static void mdeGranularClearChunk(mdeGranular* g, long c)
+{
+  long n = g->nBufferSamples;
+  long from = c * MDE_CLEAR_CHUNK;
+  long to = from + MDE_CLEAR_CHUNK > n ? n : from + MDE_CLEAR_CHUNK;
+
+  if (g->clearMap[c] == g->clearEpoch)
+    return;
+  g->clearMap[c] = g->clearEpoch;
+  /* what's before the write pointer has been written since we were cleared */
+  if (from < g->clearWritten)
+    from = g->clearWritten;
+  if (from >= to)
+    return;
+  silence(g->samples + from, to - from);
+  if (g->samplesGuarded && (from < MDE_GUARD_SAMPLES ||
+                            to > n - MDE_GUARD_SAMPLES))
+    mdeGranularMirrorGuards(g->samples, n);
+}
+//------------------------------------------------------------------------------
+
+/* make sure the samples from -lo- to -hi- (which may be outside the ring as
+ * they wrap) and those either side that interpolation might read are clean */
+static void mdeGranularClearSpan(mdeGranular* g, mdefloat lo, mdefloat hi)
+{
+  long n = g->nBufferSamples;
+  long p = (long)floor(lo) - MDE_GUARD_SAMPLES;
+  long last = (long)ceil(hi) + MDE_GUARD_SAMPLES;
+  long i;
+  long c;
+
+  if (g->clearWritten >= n || n <= 0)
+    return;
+  if (last - p >= n)
+  {
+    p = 0;
+    last = n - 1;
+  }
+  while (p <= last)
+  {
+    i = p % n;
+    if (i < 0)
+      i += n;
+    c = i / MDE_CLEAR_CHUNK;
+    mdeGranularClearChunk(g, c);
+    /* on to the start of the next chunk (or of the ring) */
+    p += ((c + 1) * MDE_CLEAR_CHUNK > n ? n : (c + 1) * MDE_CLEAR_CHUNK) - i;
+  }
+}
+//------------------------------------------------------------------------------
+
+/* called at the start of each tick: silence the next -chunks- chunks, those
+ * of the ring (unless it's all been written by now) and then those of our own
+ * buffer beyond it and its guard samples */
+static void mdeGranularClearStep(mdeGranular* g, long chunks)
+{
+  long n = g->nBufferSamples;
+  long total = g->samples == g->theSamples ?
+    g->nAllocatedBufferSamples + MDE_GUARD_SAMPLES : n;
+  long from;
+
+  if (g->clearWritten >= n && g->clearNext < g->nClearMap)
+    g->clearNext = g->nClearMap;
+  for (; g->clearing && chunks > 0; --chunks, ++g->clearNext)
+  {
+    if (g->clearNext < g->nClearMap)
+    {
+      mdeGranularClearChunk(g, g->clearNext);
+      continue;
+    }
+    from = n + MDE_GUARD_SAMPLES +
+      (g->clearNext - g->nClearMap) * MDE_CLEAR_CHUNK;
+    if (from >= total)
+      g->clearing = 0;
+    else
+      silence(g->samples + from, from + MDE_CLEAR_CHUNK > total ?
+              total - from : MDE_CLEAR_CHUNK);
   }
 }
 //------------------------------------------------------------------------------
 
+/* finish clearing now: the ring's about to change and there's no clear map
+ * for the new one (see mdeGranularSourceInstall()) */
+static void mdeGranularClearFinish(mdeGranular* g)
+{
+  if (g->clearing && g->samples)
+    mdeGranularClearStep(g, LONG_MAX);
+  g->clearing = 0;
+}
+//------------------------------------------------------------------------------
+
+/* Clearing the live buffer used to mean silencing all of it there and then:
+ * megabytes, on the audio thread, for a long one. Now it's cleared a few
+ * chunks a tick, and until that's done mdeGranularGrainInit() makes sure
+ * that any chunk a grain is going to read is clean first, so what hasn't been
+ * written since reads as silence just as before. */
 void mdeGranularClearTheSamples(mdeGranular* g)
 {
-  if (g->live && g->theSamples)
+  if (g->live && (g->samplesMirrored || g->theSamples))
   {
-    silence(g->theSamples, g->nAllocatedBufferSamples);
     g->liveIndex = 0;
+    if (g->clearMap && g->samples)
+    {
+      /* every chunk's dirty again */
+      if (!++g->clearEpoch)
+      {
+        memset(g->clearMap, 0, g->nClearMap * sizeof(unsigned));
+        g->clearEpoch = 1;
+      }
+      g->clearing = 1;
+      g->clearWritten = 0;
+      g->clearNext = 0;
+      /* grains that were set going before we were cleared */
+      if (g->grains)
+        for (int i = 0; i < g->maxVoices; ++i)
+          if (g->grains[i].status == ON)
+            mdeGranularClearSpan(g, g->voices[i].start, g->voices[i].end);
+    }
+    else if (g->samplesMirrored)
+      /* clearing one half of the mapping clears the other */
+      silence(g->mirrorSamples, g->nMirrorSamples);
+    else
+      silence(g->theSamples - MDE_GUARD_SAMPLES,
+              g->nAllocatedBufferSamples + 2 * MDE_GUARD_SAMPLES);
+    mdeGranularResizeRestart(g);
+  }
+}
+//------------------------------------------------------------------------------
+
+mdefloat* mdeGranularAllocSamples(mdeGranular* g, long numSamples, char warn)
+{
+  mdefloat* ret = mdeArenaCalloc(&g->arena, numSamples + 2 * MDE_GUARD_SAMPLES,
+                                 sizeof(mdefloat), "mdeGranularAllocSamples",
+                                 warn);
+
+  return ret ? ret + MDE_GUARD_SAMPLES : NULL;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularFreeSamples(mdeGranular* g, mdefloat* samples)
+{
+  if (samples)
+    mdeArenaFree(&g->arena, samples - MDE_GUARD_SAMPLES);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularMirrorGuards(mdefloat* samples, long numSamples)
+{
+  if (samples && numSamples > 0)
+    for (long i = 0; i < MDE_GUARD_SAMPLES; ++i)
+    {
+      /* the modulo is only for (silly) buffers shorter than the guards */
+      samples[numSamples + i] = samples[i % numSamples];
+      samples[-1 - i] = samples[numSamples - 1 - (i % numSamples)];
+    }
+}
+//------------------------------------------------------------------------------
+
+long mdeGranularMirrorSize(long numSamples)
+{
+#ifdef __linux__
+  long page = sysconf(_SC_PAGESIZE);
+  long perPage;
+
+  if (page <= 0 || page % (long)sizeof(mdefloat))
+    return 0;
+  perPage = page / (long)sizeof(mdefloat);
+  return ((numSamples + perPage - 1) / perPage) * perPage;
+#else
+  return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+mdefloat* mdeGranularMapMirror(long numSamples, char warn)
+{
+#ifdef __linux__
+  size_t bytes = (size_t)numSamples * sizeof(mdefloat);
+  char* base = MAP_FAILED;
+  int fd;
+
+  if (numSamples <= 0)
+    return NULL;
+  fd = memfd_create("mdeGranular~", MFD_CLOEXEC);
+  if (fd < 0)
+  {
+    if (warn)
+      mdePost("mdeGranular~: couldn't create a mirrored live buffer.");
+    return NULL;
+  }
+  if (ftruncate(fd, (off_t)bytes) == 0)
+  {
+    /* reserve twice the address space then map the same (zeroed) memory
+     * into both halves */
+    base = mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0);
+    if (base != MAP_FAILED &&
+        (mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+              fd, 0) == MAP_FAILED ||
+         mmap(base + bytes, bytes, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+      munmap(base, 2 * bytes);
+      base = MAP_FAILED;
+    }
+  }
+  /* the mappings keep the memory alive */
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    if (warn)
+      mdePost("mdeGranular~: couldn't map a mirrored live buffer.");
+    return NULL;
+  }
+  return (mdefloat*)base;
+#else
+  if (warn)
+    mdePost("mdeGranular~: mirrored live buffers aren't available here.");
+  return NULL;
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularUnmapMirror(mdefloat* samples, long numSamples)
+{
+#ifdef __linux__
+  if (samples)
+    munmap(samples, 2 * (size_t)numSamples * sizeof(mdefloat));
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* little-endian fields of a WAV header */
+static unsigned long mdeGranularWavU32(const unsigned char* p)
+{
+  return (unsigned long)p[0] | (unsigned long)p[1] << 8 |
+    (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long long mdeGranularWavU64(const unsigned char* p)
+{
+  return mdeGranularWavU32(p) | (unsigned long long)mdeGranularWavU32(p + 4)
+    << 32;
+}
+//------------------------------------------------------------------------------
+
+/* how a file's to be read if it wasn't said: 1 if its extension says it's
+ * raw samples (.raw, or .f32/.f64 for the size of mdefloat), -1 if it says
+ * they're the wrong size, otherwise 0 (a WAV) */
+static int mdeGranularRawExtension(const char* path)
+{
+  const char* dot = strrchr(path, '.');
+  const char* mine = sizeof(mdefloat) == sizeof(double) ? ".f64" : ".f32";
+
+  if (!dot || strchr(dot, '/'))
+    return 0;
+  if (!strcasecmp(dot, ".raw") || !strcasecmp(dot, mine))
+    return 1;
+  if (!strcasecmp(dot, ".f32") || !strcasecmp(dot, ".f64"))
+    return -1;
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+/* Find the samples in the -bytes- of a mapped file: with -raw- it's nothing
+ * but IEEE floats the size of mdefloat, otherwise it has to be a mono WAV
+ * (or RF64, for files over 4GB) of such samples. Sets -offset- and -n- (the
+ * number of samples) and, for a WAV, -samplingRate-. Returns 0 if the file
+ * isn't one we can granulate in place. (WAVs are little-endian, as are all
+ * the machines we run on.) */
+static int mdeGranularFindFileSamples(const unsigned char* file, long bytes,
+                                      int raw, long* offset, long* n,
+                                      mdefloat* samplingRate, char warn)
+{
+  const unsigned char* p = file + 12;
+  const unsigned char* end = file + bytes;
+  unsigned long long dataBytes = 0;
+  unsigned long long ds64Bytes = 0;
+  int format = 0, channels = 0, bits = 0;
+
+  *offset = 0;
+  if (raw)
+  {
+    /* anything left over means it isn't what we were told it is */
+    if (bytes % (long)sizeof(mdefloat))
+    {
+      if (warn)
+      {
+        mdePost("mdeGranular~:");
+        mdePost("              A raw file has to be a whole number of");
+        mdePost("              %d-bit float samples.",
+                8 * (int)sizeof(mdefloat));
+      }
+      return 0;
+    }
+    *n = bytes / (long)sizeof(mdefloat);
+    return 1;
+  }
+  if (bytes < 12 || (memcmp(file, "RIFF", 4) && memcmp(file, "RF64", 4)) ||
+      memcmp(file + 8, "WAVE", 4))
+    format = -1;
+  while (format >= 0 && p + 8 <= end && !*offset)
+  {
+    unsigned long long size = mdeGranularWavU32(p + 4);
+
+    if (!memcmp(p, "ds64", 4) && size >= 16 && p + 24 <= end)
+      ds64Bytes = mdeGranularWavU64(p + 16);
+    else if (!memcmp(p, "fmt ", 4) && size >= 16 && p + 24 <= end)
+    {
+      format = p[8] | p[9] << 8;
+      channels = p[10] | p[11] << 8;
+      *samplingRate = (mdefloat)mdeGranularWavU32(p + 12);
+      bits = p[22] | p[23] << 8;
+      /* WAVE_FORMAT_EXTENSIBLE: the format's at the start of the GUID */
+      if (format == 0xFFFE && size >= 40 && p + 34 <= end)
+        format = p[32] | p[33] << 8;
+    }
+    else if (!memcmp(p, "data", 4))
+    {
+      *offset = p + 8 - file;
+      dataBytes = size == 0xFFFFFFFF && ds64Bytes ? ds64Bytes : size;
+    }
+    /* chunks are padded to an even length */
+    p += 8 + size + (size & 1);
+  }
+  if (!*offset || format != 3 || channels != 1 ||
+      bits != 8 * (int)sizeof(mdefloat) ||
+      *offset % (long)sizeof(mdefloat))
+  {
+    if (warn)
+    {
+      mdePost("mdeGranular~:");
+      mdePost("              Only mono WAV files of %d-bit float samples",
+              8 * (int)sizeof(mdefloat));
+      mdePost("              can be granulated from disk (or raw files of");
+      mdePost("              them: add raw, or name them .raw or %s).",
+              sizeof(mdefloat) == sizeof(double) ? ".f64" : ".f32");
+    }
+    return 0;
+  }
+  /* a file that's still being written may be shorter than it says */
+  if (dataBytes > (unsigned long long)(bytes - *offset))
+    dataBytes = (unsigned long long)(bytes - *offset);
+  *n = (long)(dataBytes / sizeof(mdefloat));
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularMapFile(mdeGranular* g, const char* path, int raw)
+{
+#ifdef MDE_MAP_FILES
+  struct stat st;
+  void* map = MAP_FAILED;
+  long bytes = 0;
+  long offset = 0;
+  long n = 0;
+  long usable;
+  mdefloat samplingRate = g->samplingRate;
+  mdeGranularSource* s;
+  int ret = 1;
+  int fd;
+
+  if (!raw && (raw = mdeGranularRawExtension(path)) < 0)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: %s isn't %d-bit float samples.", path,
+              8 * (int)sizeof(mdefloat));
+    return 1;
+  }
+  fd = open(path, O_RDONLY);
+  if (fd >= 0)
+  {
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      bytes = (long)st.st_size;
+      map = mmap(NULL, (size_t)bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    /* the mapping keeps the file open */
+    close(fd);
   }
+  if (map == MAP_FAILED)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: couldn't open %s", path);
+    return 1;
+  }
+  if (!mdeGranularFindFileSamples(map, bytes, raw, &offset, &n,
+                                  &samplingRate, g->warnings) || n <= 0)
+  {
+    munmap(map, (size_t)bytes);
+    return 1;
+  }
+#ifdef MADV_WILLNEED
+  /* start reading it in now, on our thread, so the grains (on the audio
+   * thread) aren't the first to touch its pages */
+  madvise(map, (size_t)bytes, MADV_WILLNEED);
+#endif
+  if (samplingRate != g->samplingRate && g->warnings)
+  {
+    mdePost("mdeGranular~:");
+    mdePost("              %s is at %fHz but we're running at %fHz;", path,
+            samplingRate, g->samplingRate);
+    mdePost("              it won't be resampled.");
+  }
+  strncpy(g->config->BufferName, path, sizeof(g->config->BufferName) - 1);
+  /* Init3 takes the length as an mdefloat, which (if it's a float) can't
+   * hold every length of a long file: lose the odd sample rather than read
+   * past the end of the mapping */
+  usable = n;
+  while ((long)(mdefloat)usable > n)
+    --usable;
+  /* the mapping goes in with the samples, and whatever we were granulating
+   * before, file or not, comes back in the source to be unmapped (see
+   * SOURCES) */
+  mdeGranularLock(g);
+  s = mdeGranularSourceNew(g, (mdefloat*)((char*)map + offset),
+                           (mdefloat)(usable / (g->samplingRate * 0.001)),
+                           (mdefloat)usable);
+  if (s)
+  {
+    s->fileMap = map;
+    s->fileMapBytes = bytes;
+    s->fileSamples = s->samples;
+    s->nFileSamples = n;
+    ret = mdeGranularSourceSend(g, s);
+  }
+  else
+    munmap(map, (size_t)bytes);
+  mdeGranularCollect(g);
+  mdeGranularUnlock(g);
+  return ret;
+#else
+  UNUSED(path);
+  if (g->warnings)
+    mdePost("mdeGranular~: sound files can't be granulated from disk here.");
+  return 1;
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularUnmapFile(mdeGranular* g)
+{
+#ifdef MDE_MAP_FILES
+  if (g->fileMap)
+    munmap(g->fileMap, (size_t)g->fileMapBytes);
+#endif
+  g->fileMap = NULL;
+  g->fileMapBytes = 0;
+  g->fileSamples = NULL;
+  g->nFileSamples = 0;
 }
 //------------------------------------------------------------------------------
 
@@ -675,100 +1802,122 @@ void mdeGranularForceGrainReinit(mdeGranular* g)
 void mdeGranularOff(mdeGranular* g)
 {
   if (g->status != STOPPING && g->status != OFF)
-    g->status = STOPPING;
+    __atomic_store_n(&g->status, STOPPING, __ATOMIC_RELEASE);
 }
 //------------------------------------------------------------------------------
 
+/* (these two are asked by senders) */
 int mdeGranularIsOn(mdeGranular* g)
 {
-  return (g->status == ON);
+  return __atomic_load_n(&g->status, __ATOMIC_ACQUIRE) == ON;
 }
 //------------------------------------------------------------------------------
 
 int mdeGranularIsOff(mdeGranular* g)
 {
-  return (g->status == OFF);
+  return __atomic_load_n(&g->status, __ATOMIC_ACQUIRE) == OFF;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularGrainPrint(mdeGranularGrain* gg)
+void mdeGranularGrainPrint(mdeGranular* g, int voice)
 {
-  post("mdeGranular~ grain info:");
-  post("length %ld", gg->length);
-  post("start %f", gg->start);
-  post("end %f", gg->end);
-  post("endRampUp %ld", gg->endRampUp);
-  post("startRampDown %ld", gg->startRampDown);
-  post("current %f", gg->current);
-  post("icurrent %ld", gg->icurrent);
-  post("rampi %ld", gg->rampi);
-  post("inc %f", gg->inc);
-  post("backwards %d", gg->backwards);
-  post("status %d", gg->status);
-  post("activeStatus %d", gg->activeStatus);
-  post("channel %d", gg->channel);
-  post("doDelay %d", gg->doDelay);
-  post("firstDelay %ld", gg->firstDelay);
-  post("firstDelayCounter %ld", gg->firstDelayCounter);
+  mdeGranularGrain* gg = &g->grains[voice];
+  mdeGranularVoice* gv = &g->voices[voice];
+
+  mdePost("mdeGranular~ grain info:");
+  mdePost("length %d", gg->length);
+  mdePost("start %f", gv->start);
+  mdePost("end %f", gv->end);
+  mdePost("endRampUp %d", gg->endRampUp);
+  mdePost("startRampDown %d", gg->startRampDown);
+  mdePost("current %f", gg->current);
+  mdePost("icurrent %d", gg->icurrent);
+  mdePost("rampi %d", gg->rampi);
+  mdePost("inc %f", gg->inc);
+  mdePost("phase %lld", (long long)gg->phase);
+  mdePost("phaseInc %lld", (long long)gg->phaseInc);
+  mdePost("status %d", gg->status);
+  mdePost("activeStatus %d", gv->activeStatus);
+  mdePost("channel %d", gg->channel);
+  mdePost("doDelay %d", gv->doDelay);
+  mdePost("firstDelay %d", gv->firstDelay);
+  mdePost("delay %d", gg->delay);
+  mdePost("scheduled %d", gv->scheduled);
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularPrint(mdeGranular* g)
 {
-  post("mdeGranular~ data structure info:");
+  mdePost("mdeGranular~ data structure info:");
 
   for (int i = 0; i < g->rampLenSamples; ++i)
   {
-    post("i = %d: rampUp = %f, rampDown = %f",
-         i,
-         g->rampUp[i],
-         g->rampDown[i]);
+    mdePost("i = %d: rampUp = %f, rampDown = %f",
+            i,
+            g->rampUp[i],
+            g->rampDown[i]);
   }
   /* print the grain amps array */
   /*
      for (i = 0; i < g->nOutputSamples; ++i)
-      post("i = %d: grainAmps = %f",
-           i, g->grainAmps[i]);
+      mdePost("i = %d: grainAmps = %f",
+              i, g->grainAmps[i]);
    */
-  post("rampType = %s", g->rampType);
-  post("maxVoices %d", g->maxVoices);
-  post("activeVoices %d", g->activeVoices);
-  post("samplingRate %f", g->samplingRate);
-  post("transpositionOffsetST %f", g->transpositionOffsetST);
-  post("transpositionOffset %f", g->transpositionOffset);
-  post("numTranspositions %d", g->numTranspositions);
-  post("grainLengthMS %f", g->grainLengthMS);
-  post("grainLength %d", g->grainLength);
-  post("grainLengthDeviation %f", g->grainLengthDeviation);
-  post("numChannels %d", g->numChannels);
-  post("activeChannels %d", g->activeChannels);
-  post("nOutputSamples %ld", g->nOutputSamples);
-  post("BufferName: %s", g->BufferName);
-  post("nBufferSamples %ld", g->nBufferSamples);
-  post("BufferSamplesMS %f", g->BufferSamplesMS);
-  post("nAllocatedBufferSamples %ld", g->nAllocatedBufferSamples);
-  post("AllocatedBufferMS %f", g->AllocatedBufferMS);
-  post("samplesStartMS %f", g->samplesStartMS);
-  post("samplesStart %ld", g->samplesStart);
-  post("samplesEndMS %f", g->samplesEndMS);
-  post("samplesEnd %ld", g->samplesEnd);
-  post("rampLenMS %f", g->rampLenMS);
-  post("rampLenSamples %ld", g->rampLenSamples);
-  post("density %f", g->density);
-  post("status %d", g->status);
-  post("grainAmp %f", g->grainAmp);
-  post("lastGrainAmp %f", g->lastGrainAmp);
-  post("targetGrainAmp %f", g->targetGrainAmp);
-  post("grainAmpInc %f", g->grainAmpInc);
-  post("statusRampIndex %ld", g->statusRampIndex);
-  post("live %d", g->live);
-  post("liveIndex %ld", g->liveIndex);
-  post("OctaveSize %f", g->octaveSize);
-  post("OctaveDivisions %f", g->octaveDivisions);
-  post("PortionPosition %f", g->portionPosition);
-  post("PortionWidth %f", g->portionWidth);
-  post("============= Grain 1 =============");
-  mdeGranularGrainPrint(&g->grains[0]);
+  mdePost("rampType = %s", g->rampType);
+  mdePost("maxVoices %d", g->maxVoices);
+  mdePost("activeVoices %d", g->activeVoices);
+  mdePost("samplingRate %f", g->samplingRate);
+  mdePost("transpositionOffsetST %f", g->transpositionOffsetST);
+  mdePost("transpositionOffset %f", g->transpositionOffset);
+  mdePost("numTranspositions %d", g->numTranspositions);
+  mdePost("grainLengthMS %f", g->grainLengthMS);
+  mdePost("grainLength %d", g->grainLength);
+  mdePost("grainLengthDeviation %f", g->grainLengthDeviation);
+  mdePost("numChannels %d", g->numChannels);
+  mdePost("activeChannels %d", g->activeChannels);
+  mdePost("nOutputSamples %ld", g->nOutputSamples);
+  mdePost("hostBlock %ld", g->hostBlock);
+  mdePost("latency %ld samples", mdeGranularLatency(g));
+  mdePost("render ahead xruns %ld", mdeGranularAheadXruns(g));
+  mdePost("BufferName: %s", g->config->BufferName);
+  mdePost("nBufferSamples %ld", g->nBufferSamples);
+  mdePost("BufferSamplesMS %f", g->BufferSamplesMS);
+  mdePost("nAllocatedBufferSamples %ld", g->nAllocatedBufferSamples);
+  mdePost("AllocatedBufferMS %f", g->AllocatedBufferMS);
+  mdePost("samplesStartMS %f", g->samplesStartMS);
+  mdePost("samplesStart %ld", g->samplesStart);
+  mdePost("samplesEndMS %f", g->samplesEndMS);
+  mdePost("samplesEnd %ld", g->samplesEnd);
+  mdePost("rampLenMS %f", g->rampLenMS);
+  mdePost("rampLenSamples %ld", g->rampLenSamples);
+  mdePost("density %f", g->density);
+  mdePost("status %d", g->status);
+  mdePost("grainAmp %f", g->grainAmp);
+  mdePost("lastGrainAmp %f", g->lastGrainAmp);
+  mdePost("targetGrainAmp %f", g->targetGrainAmp);
+  mdePost("grainAmpInc %f", g->grainAmpInc);
+  mdePost("statusRampIndex %ld", g->statusRampIndex);
+  mdePost("live %d", g->live);
+  mdePost("liveIndex %ld", g->liveIndex);
+  mdePost("mirrorLive %d", g->mirrorLive);
+  mdePost("arena: %ld bytes reserved (%ld of them mapped), %ld in use, "
+          "hugePages %d", g->arena.reserved, g->arena.mapped, g->arena.used,
+          g->arena.hugePages);
+  mdePost("samplesMirrored %d", g->samplesMirrored);
+  mdePost("nMirrorSamples %ld", g->nMirrorSamples);
+  mdePost("fixedPhase %d", g->fixedPhase);
+  mdePost("clock %lld", (long long)g->clock);
+  mdePost("nSounding %d", g->nSounding);
+  mdePost("nSleepers %d", g->nSleepers);
+  mdePost("nPartitions %d", g->nPartitions);
+  mdePost("threads %d", g->threads);
+  mdePost("pool size %d", mdeGranularPoolSize());
+  mdePost("OctaveSize %f", g->octaveSize);
+  mdePost("OctaveDivisions %f", g->octaveDivisions);
+  mdePost("PortionPosition %f", g->portionPosition);
+  mdePost("PortionWidth %f", g->portionWidth);
+  mdePost("============= Grain 1 =============");
+  mdeGranularGrainPrint(g, 0);
 }
 //------------------------------------------------------------------------------
 
@@ -807,238 +1956,362 @@ void mdeGranularInitGrains(mdeGranular* g)
 {
   /* we can't do this until we have the samples! */
   if (g->samples)
+  {
     for (int i = 0; i < g->maxVoices; ++i)
     {
       mdeGranularGrainInit(&g->grains[i], g, 1);
     }
+    mdeGranularReschedule(g);
+  }
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularStoreRampType(mdeGranular* g, char* type)
+void mdeGranularReschedule(mdeGranular* g)
 {
-  char* new = mdeCalloc(strlen(type) + 1, sizeof(char),
-                        "mdeGranularStoreRampType", g->warnings);
-  char* old = g->rampType;
+  mdeGranularGrain* gg;
 
-  strcpy(new, type);
-  g->rampType = new;
-  if (old)
-    mdeFree(old);
+  if (!g->grains || !g->sleepers || !g->sounding)
+    return;
+  g->nSleepers = 0;
+  g->nSounding = 0;
+  for (int i = 0; i < g->maxVoices; ++i)
+  {
+    gg = &g->grains[i];
+    g->voices[i].scheduled = 0;
+    if (g->voices[i].activeStatus == ACTIVE || gg->status != OFF)
+      mdeGranularSleep(g, i, g->clock);
+  }
 }
 //------------------------------------------------------------------------------
 
-int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels)
+void mdeGranularSleep(mdeGranular* g, int voice, int64_t wake)
 {
-  unsigned seed = (unsigned int)clock();
-  /* post("%d %d", (int)maxVoices, (int)numChannels); */
+  mdeGranularWake* heap = g->sleepers;
+  int i;
+  int parent;
 
-  g->channelBuffers = NULL;
+  if (!heap || g->nSleepers >= g->maxVoices)
+    return;
+  /* sift up */
+  for (i = g->nSleepers++; i > 0; i = parent)
+  {
+    parent = (i - 1) / 2;
+    if (heap[parent].wake <= wake)
+      break;
+    heap[i] = heap[parent];
+  }
+  heap[i].wake = wake;
+  heap[i].voice = voice;
+  g->voices[voice].scheduled = 1;
+}
+//------------------------------------------------------------------------------
+
+/* take the earliest sleeper off the queue; only call when there is one */
+static mdeGranularWake mdeGranularWakeNext(mdeGranular* g)
+{
+  mdeGranularWake* heap = g->sleepers;
+  mdeGranularWake first = heap[0];
+  mdeGranularWake last = heap[--g->nSleepers];
+  int n = g->nSleepers;
+  int i = 0;
+  int child;
+
+  /* sift the last one down from the top */
+  while ((child = 2 * i + 1) < n)
+  {
+    if (child + 1 < n && heap[child + 1].wake < heap[child].wake)
+      ++child;
+    if (last.wake <= heap[child].wake)
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  if (n)
+    heap[i] = last;
+  return first;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularStoreRampType(mdeGranular* g, char* type)
+{
+  if (type != g->rampType)
+    strncpy(g->rampType, type, MDE_COMMAND_NAME_LEN - 1);
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularInit1(mdeGranular* g, int maxVoices, int numChannels)
+{
+  unsigned seed = (unsigned int)clock();
+  /* mdePost("%d %d", (int)maxVoices, (int)numChannels); */
+
+  g->channelBuffers = NULL;
   g->signalIn = NULL;
   g->grains = NULL;
+  g->voices = NULL;
+  g->sleepers = NULL;
+  g->sounding = NULL;
+  g->resize = NULL;
+  g->nSleepers = 0;
+  g->nSounding = 0;
+  g->nPartitions = 1;
+  g->planning = 0;
+  g->partitionSamples = NULL;
+  g->jobs = NULL;
+  g->threads = 1;
+  g->maxVoices = 0;
+  g->activeVoices = 0;
+  g->layout = NULL;
+  g->layoutSent = NULL;
+  g->layoutNext = NULL;
+  g->layoutWaiting = 0;
+  g->poolSlot = -1;
+  g->retired = NULL;
+  g->ahead = NULL;
+  g->renderAhead = 0;
+  g->queue = NULL;
+  g->ticks = 0;
+  g->internalBlock = 0;
+  g->hostBlock = 0;
+  g->fifo = NULL;
+  g->fifoNext = NULL;
+  g->fifoPos = 0;
+  g->fifoHaveInput = 0;
+  /* not known until init2 (the partitions need them) */
+  g->numChannels = 0;
+  g->nOutputSamples = 0;
+  g->clock = 0;
   g->theSamples = NULL;
+  g->nAllocatedBufferSamples = 0;
+  g->AllocatedBufferMS = (mdefloat)0.0;
   g->samples = NULL;
+  g->samplesGuarded = 0;
+  g->mirrorSamples = NULL;
+  g->nMirrorSamples = 0;
+  g->samplesMirrored = 0;
+  g->mirrorLive = 0;
+  g->liveSentMS = (mdefloat)0.0;
+  g->liveSentN = 0;
+  g->fileMap = NULL;
+  g->fileMapBytes = 0;
+  g->fileSamples = NULL;
+  g->nFileSamples = 0;
+  g->liveBufferFixed = 0;
+  g->clearing = 0;
+  g->clearWritten = 0;
+  g->clearNext = 0;
+  g->clearEpoch = 0;
+  g->clearMap = NULL;
+  g->nClearMap = 0;
+  g->fixedPhase = 0;
   g->rampUp = NULL;
   g->rampDown = NULL;
+  for (int i = 0; i < MDE_RAMPS; ++i)
+    g->ramps[i] = NULL;
+  g->ramp = 0;
+  g->rampNow = NULL;
+  g->rampNext = NULL;
+  g->rampSent = NULL;
+  g->rampsDead = NULL;
+  g->rampLenAsked = (mdefloat)0.0;
   g->grainAmps = NULL;
-  g->rampType = NULL;
+  g->grainScratch = NULL;
   g->octaveSize = (mdefloat)2.0;
   g->octaveDivisions = (mdefloat)12.0;
   g->portionPosition = (mdefloat)0.0;
   g->portionWidth = (mdefloat)100.0;
+  g->numTranspositions = 0;
 
-  srand(seed);
   g->warnings = 1;
-  g->status = OFF;
+  mdeArenaInit(&g->arena);
+  g->config = mdeArenaCalloc(&g->arena, 1, sizeof(mdeGranularConfig),
+                             "mdeGranularInit1", g->warnings);
+  if (!g->config)
+    return -1;
+  mdeGranularQueueInit(g);
+  /* until we're given a seed, make sure that no two granulators (even those
+   * created at the same time) sound the same */
+  mdeGranularRandomSeed(&g->rng, (uint64_t)seed ^
+                        ((uint64_t)(uintptr_t)g << 16));
+  g->nextRandom = MDE_RANDOM_BATCH;
+  __atomic_store_n(&g->status, OFF, __ATOMIC_RELEASE);
   g->statusRampIndex = 0;
   mdeGranularSetMaxVoices(g, maxVoices);
+  if (!g->layoutSent)
+    return -1;
   /* set all the voices active */
   mdeGranularSetActiveVoices(g, maxVoices);
   mdeGranularSetTranspositions(g, 0, NULL);
   g->numChannels = numChannels;
   g->activeChannels = numChannels;
   if (g->channelBuffers)
-    mdeFree(g->channelBuffers);
-  g->channelBuffers = mdeCalloc(numChannels, sizeof(mdefloat*),
-                                "mdeGranularInit1", g->warnings);
+    mdeArenaFree(&g->arena, g->channelBuffers);
+  g->channelBuffers = mdeArenaCalloc(&g->arena, numChannels,
+                                     sizeof(mdefloat*), "mdeGranularInit1",
+                                     g->warnings);
   /* call inlet methods */
   mdeGranularSetTranspositionOffsetST(g, (mdefloat)0.0);
   mdeGranularSetGrainLengthDeviation(g, (mdefloat)10.0);
   mdeGranularSetDensity(g, (mdefloat)100.0);
-  /* do this so memory is not freed! */
-  g->rampType = NULL;
   mdeGranularStoreRampType(g, DEFAULT_RAMP_TYPE);
+  mdeGranularSentInit(g);
   return 0;
 }
 //------------------------------------------------------------------------------
 
+/* the tick is the host's block unless we've been asked for a longer one, in
+ * which case it's a whole number of host blocks */
+static long mdeGranularTickSize(mdeGranular* g)
+{
+  long host = g->hostBlock;
+  long internal = __atomic_load_n(&g->internalBlock, __ATOMIC_RELAXED);
+
+  if (host <= 0 || internal <= host)
+    return host;
+  return host * ((internal + host - 1) / host);
+}
+//------------------------------------------------------------------------------
+
 int mdeGranularInit2(mdeGranular* g, long nOutputSamples, mdefloat rampLenMS,
                      mdefloat** channelBuffers)
 {
+  int ret = 0;
+  int first;
+  long host;
+
   if (g)
   {
     /* 2/4/08: samplingRate has been set in mdeGranular_tildeDSP before this
        function is called;  just make sure though... */
     if (!g->samplingRate)
-      error("mdeGranular~: sampling rate has not been set!");
-    /* 2/4/08 these two calls used to be done in init1 */
-    if (!mdeGranularDidInit(g))
+      mdeError("mdeGranular~: sampling rate has not been set!");
+    mdeGranularLock(g);
+    first = !mdeGranularDidInit(g);
+    /* 2/4/08 these two calls used to be done in init1 (a ramp length sent
+     * before there was a ramp takes precedence) */
+    if (first)
     {
-      mdeGranularSetGrainLengthMS(g, (mdefloat)50.0);
-      mdeGranularSetRampLenMS(g, rampLenMS);
+      mdeGranularGrainLength(g, (mdefloat)50.0, g->warnings);
+      mdeGranularSetRampLenMS(g, g->rampLenAsked > 0 ? g->rampLenAsked
+                              : rampLenMS);
+      /* what senders check against (see mdeGranularCheck()): a grain length
+       * sent already is still waiting to be applied after this one */
+      if (!g->sent.grainLengthMS)
+      {
+        g->sent.grainLengthMS = g->grainLengthMS;
+        g->sent.grainLength = g->grainLength;
+      }
     }
-    g->nOutputSamples = nOutputSamples;
+    host = g->hostBlock;
+    g->hostBlock = nOutputSamples;
     /* Copy the memory addresses of the output channels into the object. PD does
        it this way, Max used to do it this way but now it happens in the perform
-       routine */
-    if (channelBuffers)
+       routine (and after the first time, when we might be rendering, it
+       always does: see mdeGranularRenderTick()) */
+    if (channelBuffers && first)
       for (int i = 0; i < g->numChannels; ++i)
       {
         g->channelBuffers[i] =  channelBuffers[i];
       }
     /* can't call the inlet method here, have to set it directly */
-    if (!mdeGranularDidInit(g))
+    if (first)
     {
       g->grainAmp = 0.5;
       g->targetGrainAmp = g->grainAmp;
       g->lastGrainAmp = g->grainAmp;
     }
-    if (g->grainAmps)
-      mdeFree(g->grainAmps);
-    g->grainAmps = mdeCalloc(g->nOutputSamples, sizeof(mdefloat),
-                             "mdeGranularInit2", g->warnings);
-    if (!g->grainAmps)
-      error("mdeGranular~: can't allocate memory for the grain amplitudes!");
+    ret = mdeGranularSendTick(g, host != nOutputSamples);
+    mdeGranularUnlock(g);
+    mdeGranularAheadUpdate(g);
   }
-  return 0;
+  return ret;
 }
 //------------------------------------------------------------------------------
 
 int mdeGranularDidInit(mdeGranular* g)
 {
-  return g->grainAmps ? 1 : 0;
-}
-//------------------------------------------------------------------------------
-
-void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize)
-{
-  mdefloat srate = (mdefloat)sys_getsr();
-  mdeGranular* g = &x->x_g;
-
-  if ((bufsize < MINLIVEBUFSIZE))
-  {
-    if (g->warnings)
-      post("mdeGranular~: Minimum buffer size is %f millisecs, ignoring %f",
-           MINLIVEBUFSIZE, bufsize);
-    return;
-  }
-  if (mdeGranularInit3(g, NULL, bufsize, ms2samples(srate, bufsize))
-      < 0)
-    post("mdeGranular~: couldn't init Granular object \n\
-                        for live granulation");
+  return g->layoutSent && g->layoutSent->tick > 0 ? 1 : 0;
 }
 //------------------------------------------------------------------------------
 
 int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
                      mdefloat numSamples)
 {
-  /* post("mdeGranularInit3"); */
-  /* we were given the name of a buffer to granulate */
-  if (samples)
-  {
-    g->samples = samples;
-    g->live = 0;
-  }
-  else/* live input */
-  /* this should only happen at the init stage... */
-  {
-    if (!g->theSamples)
-      /* don't just set max size to samplesMS, rather at init set to 10secs */
-      /* mdeGranularSetLiveBufferSize(g, samplesMS); */
-      mdeGranularSetLiveBufferSize(g, (mdefloat)10000);
-    g->samples = g->theSamples;
-    if (numSamples > g->nAllocatedBufferSamples)
-    {
-      if (g->warnings)
-      {
-        post("mdeGranular~:");
-        post("              The allocated live sample buffer is only ");
-        post("              %fms so your request for %fms is invalid.",
-             g->AllocatedBufferMS, samplesMS);
-        post("              Please send the object a \"MaxLiveBufferMS\" ");
-        post("              message to increase this (preferably do this at");
-        post("              the beginning of your performance, allocating ");
-        post("              enough for all the performance's needs).");
-      }
-      return 1;
-    }
-    g->live = 1;
-    g->liveIndex = 0;
-  }
-  g->nBufferSamples = (long)numSamples;
-  g->BufferSamplesMS = samplesMS;
-  /* the DBL_MIN triggers setting the end to the end of the sample buffer */
-  mdeGranularSetSamplesEndMS(g, (mdefloat)DBL_MIN);
-  /* the DBL_MIN triggers setting the start to the beginning of the sample
-   * buffer */
-  mdeGranularSetSamplesStartMS(g, (mdefloat)DBL_MIN);
-  if (g->nBufferSamples < g->grainLength)
+  mdeGranularSource* s;
+  int ret = 1;
+  mdefloat ms;
+  long n;
+
+  /* mdePost("mdeGranularInit3"); */
+  /* whatever the samples need is made first, as when they're sent (see
+   * SOURCES), but then swapped in straight away */
+  mdeGranularLock(g);
+  s = mdeGranularSourceNew(g, samples, samplesMS, numSamples);
+  if (s)
   {
-    int ninetypc = (int)((mdefloat)g->nBufferSamples * (mdefloat)0.9);
-
-    mdefloat ninetypcf = samples2ms(g->samplingRate, ninetypc);
-    if (g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              length of buffer (%fms) to granulate is",
-           g->BufferSamplesMS);
-      post("              less than the grain length (%fms). Changing grain",
-           g->grainLengthMS);
-      post("              length to 90 per cent of buffer size (%fms).",
-           ninetypcf);
-    }
-    g->grainLength = ninetypc;
-    g->grainLengthMS = ninetypcf;
+    n = mdeGranularSourceLength(g, s, &ms);
+    mdeGranularJobsWait(g);
+    ret = mdeGranularSourceInstall(g, s, g->warnings);
+    if (!ret)
+      mdeGranularSentSamples(g, n, ms);
+    mdeGranularCollect(g);
   }
-  mdeGranularInitGrains(g);
-  return 0;
+  mdeGranularUnlock(g);
+  return ret;
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularFree(mdeGranular* g)
 {
 #if 1
-  if (g->grains)
+  mdeGranularAheadFree(g);
+  mdeGranularResizeFree(g);
+  mdeGranularQueueFree(g);
+  /* nothing's rendering now, so the layout that's installed, and any still
+   * waiting to be, can go with what's been retired */
+  mdeGranularLayoutsFree(g);
+  if (g->fifoNext)
   {
-    mdeFree(g->grains);
-    g->grains = NULL;
+    mdeArenaFree(&g->arena, g->fifoNext);
+    g->fifoNext = NULL;
   }
-  /* ramp down is just a pointer to the middle of rampUp so no need to free
-     it */
-  if (g->rampUp)
+  if (g->fifo)
   {
-    mdeFree(g->rampUp);
-    g->rampUp = NULL;
+    mdeArenaFree(&g->arena, g->fifo);
+    g->fifo = NULL;
   }
-  if (g->rampType)
+  mdeGranularCollect(g);
+  if (g->clearMap)
   {
-    mdeFree(g->rampType);
-    g->rampType = NULL;
+    mdeArenaFree(&g->arena, g->clearMap);
+    g->clearMap = NULL;
+    g->nClearMap = 0;
   }
-  if (g->channelBuffers)
+  if (g->config)
   {
-    mdeFree(g->channelBuffers);
-    g->channelBuffers = NULL;
+    mdeArenaFree(&g->arena, g->config);
+    g->config = NULL;
   }
-  if (g->grainAmps)
+  mdeGranularRampsFree(g);
+  if (g->channelBuffers)
   {
-    mdeFree(g->grainAmps);
-    g->grainAmps = NULL;
+    mdeArenaFree(&g->arena, g->channelBuffers);
+    g->channelBuffers = NULL;
   }
   if (g->theSamples)
   {
-    mdeFree(g->theSamples);
+    mdeGranularFreeSamples(g, g->theSamples);
     g->theSamples = NULL;
   }
+  if (g->mirrorSamples)
+  {
+    mdeGranularUnmapMirror(g->mirrorSamples, g->nMirrorSamples);
+    g->mirrorSamples = NULL;
+    g->nMirrorSamples = 0;
+    g->samplesMirrored = 0;
+  }
+  mdeGranularUnmapFile(g);
+  /* and whatever's left in the arena */
+  mdeArenaFreeAll(&g->arena);
 #endif
 }
 
@@ -1047,15 +2320,11 @@ void mdeGranularFree(mdeGranular* g)
 int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
                          int doFirstDelay)
 {
+  mdeGranularVoice* gv = &parent->voices[gg - parent->grains];
   int plen = parent->grainLength;
   long givenStart = parent->samplesStart;
   long givenEnd = parent->samplesEnd;
-  /* the grain's sample increment is a randomly chosen transposition from the
-   * parent multiplied by the offset from the parent  */
-  mdefloat inc =
-    parent->srcs[(int)between((mdefloat)0.0,
-                              (mdefloat)parent->numTranspositions)] *
-    parent->transpositionOffset;
+  mdefloat inc;
   int ramplength = parent->rampLenSamples;
   int length;
   mdefloat samplesNeeded;
@@ -1080,7 +2349,7 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
     givenEnd = parent->samplesStart;
   }
   /* fstart = (mdefloat)givenStart; */
-  if (gg->activeStatus == INACTIVE)
+  if (gv->activeStatus == INACTIVE)
   {
     /* we can switch this grain off now as it's come to the end of its ramp
      * down and it's been turned off */
@@ -1091,7 +2360,20 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
    *  accordingly. */
   if (plen < ramplength2)
     plen = ramplength2;
-  length = (int)randomlyDeviate((mdefloat)plen, parent->grainLengthDeviation);
+  length = (int)randomlyDeviate(parent, (mdefloat)plen,
+                                parent->grainLengthDeviation);
+  /* do density first: a grain that's skipped only needs its length (to know
+   * how long to stay silent) so we needn't choose a transposition, start or
+   * channel for it.  We can assume that density is >= 0 and <= 100 because of
+   * the set method that checks this. */
+  if (between(parent, (mdefloat)0.0, (mdefloat)100.0) > parent->density)
+    status = SKIPGRAIN;
+  /* the grain's sample increment is a randomly chosen transposition from the
+   * parent multiplied by the offset from the parent  */
+  inc = status == SKIPGRAIN ? (mdefloat)1.0 :
+        parent->config->srcs[(int)between(
+          parent, (mdefloat)0.0, (mdefloat)parent->numTranspositions)] *
+        parent->transpositionOffset;
   /* Get the number of live samples that will have been written by the time
    * this grain comes to an end. So bear in mind that if we're live, our sample
    * buffer will need to be > twice the grain length */
@@ -1132,10 +2414,10 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
        *  requested grain length */
       status = SKIPGRAIN;
   }
-  if (status)
+  if (status == ON)
   {
     /* given the above if/else, start should always be < max_start, right? */
-    st = between(min_start, max_start);
+    st = between(parent, min_start, max_start);
     /* if we're not transposing, no point interpolating all the time is there?
      * */
     if (inc == 1.0)
@@ -1156,6 +2438,10 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
     inc = 1.0;
   }
 
+  /* the fixed-point start is worked out before adding latestSample, which
+   * can be big enough (in a long live buffer) to lose us the fraction */
+  gg->phase = mdeGranularPhase(backwards ? nd : st);
+  gg->phaseInc = mdeGranularPhase(backwards ? -inc : inc);
   /* this may well push us off the end of the buffer in terms of numbers at
    * least, but this is moduloed back into bounds during interpolation
    * 1.8.10: only add latestSample if we're live, no?
@@ -1164,14 +2450,17 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
   {
     st += latestSample;
     nd += latestSample;
+    gg->phase += (int64_t)latestSample << MDE_PHASE_BITS;
   }
   gg->length = length;
-  /* post("length=%d", length); */
-  gg->start = backwards ? nd : st;
-  gg->end = backwards ? st : nd;
+  /* mdePost("length=%d", length); */
+  gv->start = backwards ? nd : st;
+  gv->end = backwards ? st : nd;
+  /* what it'll read has to be clean before it does */
+  if (parent->clearing && status == ON)
+    mdeGranularClearSpan(parent, st, nd);
   gg->inc = backwards ? -inc : inc;
-  gg->backwards = backwards ? 1 : 0;
-  gg->current = gg->start;
+  gg->current = gv->start;
   gg->status = status;
   gg->rampi = 0;
   gg->icurrent = 0;
@@ -1180,32 +2469,32 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
    */
   gg->endRampUp = ramplength;
   gg->startRampDown = length - ramplength;
-  /* channel is selected randomly */
-  gg->channel = (int)between((mdefloat)0.0, (mdefloat)parent->activeChannels);
-  /* post("gg->channel = %d", gg->channel); */
-  /* do density: we can assume that it is >= 0 and <= 100 because of the set
-   * method that checks this. */
-  if (between((mdefloat)0.0, (mdefloat)100.0) > parent->density)
-    gg->status = SKIPGRAIN;
+  gg->ramp = (short)parent->ramp;
+  /* channel is selected randomly (a skipped grain doesn't need one) */
+  if (status == ON)
+    gg->channel = (short)between(parent, (mdefloat)0.0,
+                               (mdefloat)parent->activeChannels);
+  /* mdePost("gg->channel = %d", gg->channel); */
   /* if requested, set a delay of the given number of samples or up to 200% the
    * grain length for this grain */
-  if (doFirstDelay || gg->doDelay)
+  if (doFirstDelay || gv->doDelay)
   {
     /* firstDelay is in samples not ms */
-    /* at init gg->doDelay has been initialized to 1 by the call to
+    /* at init gv->doDelay has been initialized to 1 by the call to
      * setmaxvoices (which calls setactivevoices, which sets doDelay
      * to 1) in init1 */
 #ifdef DEBUG
-    if (gg->doDelay > 1)
-      post("gg->doDelay=%d length=%d", gg->doDelay, gg->length);
+    if (gv->doDelay > 1)
+      mdePost("gv->doDelay=%d length=%d", gv->doDelay, gg->length);
 #endif
     /* i.e. doDelay could be the number of samples we already know we want to
      * delay for so use that, otherwise pick a random number */
-    gg->firstDelay = (gg->doDelay > 1) ? gg->doDelay :
-                     (long)between((mdefloat)0.0, gg->length * (mdefloat)2.0);
-    gg->firstDelayCounter = 0;
+    gv->firstDelay = (gv->doDelay > 1) ? gv->doDelay :
+                     (int)between(parent, (mdefloat)0.0,
+                                  gg->length * (mdefloat)2.0);
+    gg->delay = gv->firstDelay;
     /* don't do it next time! */
-    gg->doDelay = 0;
+    gv->doDelay = 0;
   }
 
 #ifdef DEBUG
@@ -1214,7 +2503,7 @@ int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
             "start %f (bufstart %ld), end %f (bufend %ld), inc %f, "
             "current %f, up %d, down %d, "
             "length %d latestSample %d ",
-            gg->start, givenStart, gg->end, givenEnd, gg->inc, gg->current,
+            gv->start, givenStart, gv->end, givenEnd, gg->inc, gg->current,
             gg->endRampUp, gg->startRampDown, gg->length, latestSample);
 #endif
 
@@ -1234,7 +2523,7 @@ mdefloat mdeGranularGetAmpForStatus(mdeGranular* g)
      */
     if (g->statusRampIndex >= g->rampLenSamples)
     {
-      g->status = ON;
+      __atomic_store_n(&g->status, ON, __ATOMIC_RELEASE);
       g->statusRampIndex = 0;
       result = 1.0;
     }
@@ -1243,7 +2532,7 @@ mdefloat mdeGranularGetAmpForStatus(mdeGranular* g)
     result = g->rampDown[g->statusRampIndex++];
     if (g->statusRampIndex >= g->rampLenSamples)
     {
-      g->status = OFF;
+      __atomic_store_n(&g->status, OFF, __ATOMIC_RELEASE);
       g->statusRampIndex = 0;
       result = 0.0;
       mdeGranularForceGrainReinit(g);
@@ -1270,7 +2559,6 @@ mdefloat mdeGranularGetAmpForStatus(mdeGranular* g)
 
 void mdeGranularGo(mdeGranular* g)
 {
-  mdeGranularGrain* gg;
   mdefloat statusRampVal;
   mdefloat* samp;
   long tickSize = g->nOutputSamples;
@@ -1285,8 +2573,8 @@ void mdeGranularGo(mdeGranular* g)
 
 #ifdef DEBUG
   if (!gamp || !g)
-    error("mdeGranular~: gamp is NULL!");
-  post("gamp %ld g %ld", gamp, g);
+    mdeError("mdeGranular~: gamp is NULL!");
+  mdePost("gamp %ld g %ld", gamp, g);
 #endif
 
   /* if we're at the target amp and the first number in our array is the same
@@ -1294,8 +2582,8 @@ void mdeGranularGo(mdeGranular* g)
    * ramp values (however, first time at target amp is not enough: we need to
    * fill the buffer with repeated target amps
    * */
-  /* post("gamp %f g %ld", *gamp, g); */
-  if (mdeGranularDidInit(g))
+  /* mdePost("gamp %f g %ld", *gamp, g); */
+  if (gamp)
   {
     if (!(mdeGranularAtTargetGrainAmp(g) && *gamp == g->grainAmp))
     {
@@ -1306,6 +2594,11 @@ void mdeGranularGo(mdeGranular* g)
     }
   }
 
+  /* a new ramp that was waiting for a slot to be free */
+  if (g->rampNext && !mdeGranularJobsBusy(g))
+    mdeGranularRampSwap(g);
+  if (g->clearing)
+    mdeGranularClearStep(g, MDE_CLEAR_CHUNKS);
   /* zero out the buffers first */
   for (int i = 0; i < g->numChannels; ++i)
   {
@@ -1313,11 +2606,7 @@ void mdeGranularGo(mdeGranular* g)
   }
   if (g->status && g->grains)
   {
-    for (int i = 0; i < g->maxVoices; ++i)
-    {
-      gg = &g->grains[i];
-      mdeGranularGrainMixIn(gg, g, g->channelBuffers[gg->channel], tickSize);
-    }
+    mdeGranularRunGrains(g, tickSize);
     if (g->status == STARTING || g->status == STOPPING)
     {
       for (int i = 0; i < tickSize; ++i)
@@ -1334,21 +2623,72 @@ void mdeGranularGo(mdeGranular* g)
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* parent,
-                           mdefloat* where, int howMany)
+void mdeGranularRunGrains(mdeGranular* g, long tickSize)
 {
-  mdefloat rampval;
-  mdefloat samp;
-  mdefloat out;
-  mdefloat* samples = parent->samples;
-  mdefloat inc = gg->inc;
+  int64_t end = g->clock + tickSize;
+  mdeGranularWake next;
+  long idle;
+  int kept = 0;
+  int voice;
 
-#if 0
-  if (gg == NULL)
-    post("gg is NULL!");
-  if (parent == NULL)
-    post("parent is NULL!");
-#endif
+  if (!g->sleepers || !g->sounding)
+    return;
+  if (g->nPartitions > 1)
+    silence(g->partitionSamples, g->nPartitions * g->numChannels *
+            (int)tickSize);
+  /* with threads, this one only plans what the grains will do (drawing
+   * random numbers, rescheduling etc. exactly as it would otherwise) and the
+   * pool then renders each partition's runs in that order */
+  g->planning = g->jobs && g->nPartitions > 1 && mdeGranularPoolSize();
+  if (g->planning)
+    mdeGranularJobsBegin(g->jobs);
+  /* first the grains that were sounding at the end of the last tick,
+   * compacting the list as some go to sleep */
+  for (int i = 0; i < g->nSounding; ++i)
+  {
+    voice = g->sounding[i];
+    idle = mdeGranularGrainMixIn(&g->grains[voice], g, 0, (int)tickSize);
+    if (!idle)
+      g->sounding[kept++] = voice;
+    else if (idle > 0)
+      mdeGranularSleep(g, voice, end + idle);
+    else
+      g->voices[voice].scheduled = 0;
+  }
+  g->nSounding = kept;
+  /* then those whose delay or skip ends somewhere in this tick; they start
+   * from that point in the tick */
+  while (g->nSleepers && g->sleepers[0].wake < end)
+  {
+    next = mdeGranularWakeNext(g);
+    idle = mdeGranularGrainMixIn(&g->grains[next.voice], g,
+                                 next.wake > g->clock ?
+                                 (int)(next.wake - g->clock) : 0,
+                                 (int)tickSize);
+    if (!idle)
+      g->sounding[g->nSounding++] = next.voice;
+    else if (idle > 0)
+      mdeGranularSleep(g, next.voice, end + idle);
+    else
+      g->voices[next.voice].scheduled = 0;
+  }
+  g->clock = end;
+  if (g->planning)
+    mdeGranularJobsRun(g->jobs);
+  if (g->nPartitions > 1)
+    mdeGranularMixPartitions(g, tickSize);
+  g->planning = 0;
+}
+//------------------------------------------------------------------------------
+
+long mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* parent,
+                           int from, int howMany)
+{
+  mdefloat* where;
+  long run;
+  long left;
+  long idle;
+  int i = from;
 
 #ifdef DEBUG
   static int file_count = 1;
@@ -1356,380 +2696,4389 @@ void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* parent,
 #endif
 
   /* only do it if there are samples to granulate and a buffer to write into */
-  if (samples && where)
-    for (int i = 0; i < howMany; ++i)
+  if (!parent->samples || !parent->grainScratch)
+    return 0;
+  where = mdeGranularGrainOutput(parent, gg);
+  if (!where)
+    return 0;
+  /* rather than stepping through the grain's state machine sample by sample,
+   * we work out how long the grain will stay in its current state (delayed,
+   * silent, sounding) and handle that whole run in one go */
+  while (i < howMany)
+  {
+    left = howMany - i;
+    /* are we in the initial delay part for this grain? if so just skip over
+     * as much of it as fits in this tick */
+    if (gg->delay)
+    {
+      run = gg->delay;
+      if (run > left)
+        run = left;
+      gg->delay -= (int)run;
+      i += run;
+      continue;
+    }
+    if (mdeGranularGrainExhausted(gg))
     {
-      /* are we in the initial delay part for this grain? */
-      if (gg->firstDelayCounter < gg->firstDelay)
-        gg->firstDelayCounter++;
-      else
-      {
-        if (mdeGranularGrainExhausted(gg))
-        {
 #ifdef DEBUG
-          if (DebugFP)
-          {
-            fprintf(DebugFP, "\n end grain");
-            fflush(DebugFP);
-            fclose(DebugFP);
-          }
-          sprintf(filename, "/temp/mdeGranular%03d.txt", file_count++);
-          DebugFP = fopen(filename, "w");
-          if (!DebugFP)
-            error("Can't open temp file.");
-          fprintf(DebugFP, "%f\n", inc);
-#endif
-          mdeGranularGrainInit(gg, parent, 0);
-          /* don't start back at the beginning--carry on from where we left
-           * off, i.e. plus i!!!!!  */
-          where = parent->channelBuffers[gg->channel] + i;
-          /* 4/8/04: gg->inc will probably have changed!  Not updating
-           * the inc local variable to reflect this was almost
-           * certainly causing buffer overruns and perhaps even
-           * crashes!  */
-          inc = gg->inc;
-        }
-        if (!(gg->status == OFF || gg->status == SKIPGRAIN))
-        {
-          if (inc == (mdefloat)1.0)
-          {
-            /* MDE Wed Sep 18 19:47:49 2013 -- we're all 64bit float since Max
-             * 6 but buffer~s are still 32bit (damn!) so we'll have to fudge
-             * things a little here
-               tmp = (long)gg->current % parent->nBufferSamples;
-               samp = parent->live ? *(samples + tmp) : *(fsamples + tmp);
-             */
-            samp = *(samples + ((long)gg->current % parent->nBufferSamples));
-          }
-          else
-            samp = interpolate(gg->current, samples, parent->nBufferSamples,
-                               gg->backwards); /*, parent->live);*/
-          rampval = mdeGranularGrainGetRampVal(gg, parent->rampUp,
-                                               parent->rampDown,
-                                               parent->rampLenSamples);
-          out = samp * rampval * parent->grainAmps[i];
-          *where += out;    /* mix with what's already there */
+      if (DebugFP)
+      {
+        fprintf(DebugFP, "\n end grain");
+        fflush(DebugFP);
+        fclose(DebugFP);
+      }
+      sprintf(filename, "/temp/mdeGranular%03d.txt", file_count++);
+      DebugFP = fopen(filename, "w");
+      if (!DebugFP)
+        mdeError("Can't open temp file.");
+      fprintf(DebugFP, "%f\n", gg->inc);
+#endif
+      if (parent->planning)
+        mdeGranularGrainUnplan(gg, parent);
+      mdeGranularGrainInit(gg, parent, 0);
+      /* an inactive voice stays exhausted (and silent) until it's switched
+       * back on, so it can be dropped until then */
+      if (gg->status == OFF)
+        return -1;
+      /* the channel will probably have changed; we carry on from where we
+       * left off via i */
+      where = mdeGranularGrainOutput(parent, gg);
+      /* go round again as the new grain may well start with a delay */
+      continue;
+    }
+    /* icurrent runs from 0 to length inclusive */
+    run = gg->length + 1 - gg->icurrent;
+    if (run > left)
+      run = left;
+    if (gg->status == OFF || gg->status == SKIPGRAIN)
+    {
+      /* no output but the grain must still use up its length before it's
+       * reinitialised */
+      gg->current += (mdefloat)run * gg->inc;
+      gg->phase += (int64_t)run * gg->phaseInc;
+      gg->icurrent += run;
+    }
+    else if (parent->planning)
+      mdeGranularGrainPlan(gg, parent, where, i, run);
+    else
+      mdeGranularGrainRenderRun(gg, parent, where + i, parent->grainAmps + i,
+                                parent->grainScratch, run);
+    i += run;
+  }
+  /* if the grain is going to be silent past the end of this tick, move it on
+   * to the end of that silence now so that the scheduler can leave it alone
+   * until then */
+  if (gg->delay)
+  {
+    idle = gg->delay;
+    gg->delay = 0;
+    return idle;
+  }
+  if ((gg->status == OFF || gg->status == SKIPGRAIN) &&
+      !mdeGranularGrainExhausted(gg))
+  {
+    idle = gg->length + 1 - gg->icurrent;
+    gg->current += (mdefloat)idle * gg->inc;
+    gg->phase += (int64_t)idle * gg->phaseInc;
+    gg->icurrent += idle;
+    return idle;
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+/* how the next -howMany- samples of a sounding grain divide into ramp up,
+ * steady state and ramp down (anything after those is silent) */
+static void mdeGranularGrainSegments(mdeGranularGrain* gg, long rampLen,
+                                     long howMany, long* up, long* steady,
+                                     long* down)
+{
+  long icurrent = gg->icurrent;
+  long run;
+  long done = 0;
+
+  *up = *steady = *down = 0;
+  /* ramp up */
+  run = gg->endRampUp - icurrent;
+  if (run > 0)
+  {
+    if (run > howMany)
+      run = howMany;
+    *up = run;
+    icurrent += run;
+    done = run;
+  }
+  /* steady state */
+  run = gg->startRampDown - icurrent;
+  if (run > 0 && done < howMany)
+  {
+    if (run > howMany - done)
+      run = howMany - done;
+    *steady = run;
+    done += run;
+  }
+  /* ramp down: 10.9.10: we shouldn't ever go over the ramp length but when
+   * changing ramp length we were getting crashes in accessing the ramp down,
+   * so anything after the end of the ramp is silent */
+  run = rampLen - gg->rampi;
+  if (run > 0 && done < howMany)
+  {
+    if (run > howMany - done)
+      run = howMany - done;
+    *down = run;
+  }
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainRenderRun(mdeGranularGrain* gg, mdeGranular* parent,
+                               mdefloat* where, mdefloat* gamp,
+                               mdefloat* scratch, long howMany)
+{
+  mdefloat* src = scratch;
+  mdeGranularRamp* ramp = parent->ramps[gg->ramp];
+  long up, steady, down;
+
+  if (parent->fixedPhase)
+    mdeGranularGrainReadFixed(gg, parent, src, howMany);
+  else
+    mdeGranularGrainRead(gg, parent, src, howMany);
+  if (ramp == NULL)
+  {
+    gg->icurrent += howMany;
+    return;
+  }
+  mdeGranularGrainSegments(gg, ramp->len, howMany, &up, &steady, &down);
+  if (up)
+    mixInWithEnvelope(where, src, ramp->up + gg->icurrent, gamp, up);
+  where += up;
+  src += up;
+  gamp += up;
+  if (steady)
+    mixIn(where, src, gamp, steady);
+  where += steady;
+  src += steady;
+  gamp += steady;
+  if (down)
+    mixInWithEnvelope(where, src, ramp->down + gg->rampi, gamp, down);
+  gg->icurrent += howMany;
+  gg->rampi += down;
+
 #ifdef DEBUG
-          if (rampval < (mdefloat)0.0 || rampval > (mdefloat)1.0)
-            post("rampval %f", rampval);
-          if (*where < (mdefloat) - 1.0 || *where > (mdefloat)1.0)
-            post("%f", *where);
-          if (DebugFP)
-            fprintf(DebugFP, "current %f icurrent %d sample %f ramp %f out %f "
-                    "where %f nsamples %d this %d\n",
-                    gg->current, gg->icurrent, samp, rampval, out, *where,
-                    parent->nOutputSamples, gg);
+  if (DebugFP)
+    fprintf(DebugFP, "current %f icurrent %ld rampi %ld run %ld this %p\n",
+            gg->current, gg->icurrent, gg->rampi, howMany, (void*)gg);
 #endif
-        }
-        /* let these go over the buffer size and modulo later to get the
-         * correct sample */
-        gg->current += inc;
-        /*
-           if (gg->current < 0)
-            post("gg->current=%f!", gg->current);
-         */
-        gg->icurrent++;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainAdvance(mdeGranularGrain* gg, mdeGranular* parent,
+                             long howMany)
+{
+  mdeGranularRamp* ramp = parent->ramps[gg->ramp];
+  long up, steady, down;
+
+  if (ramp)
+  {
+    mdeGranularGrainSegments(gg, ramp->len, howMany, &up, &steady, &down);
+    gg->rampi += down;
+  }
+  gg->icurrent += howMany;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainRead(mdeGranularGrain* gg, mdeGranular* parent,
+                          mdefloat* out, long howMany)
+{
+  mdefloat* samples = parent->samples;
+  long nBufferSamples = parent->nBufferSamples;
+  mdefloat period = (mdefloat)nBufferSamples;
+  mdefloat current = gg->current;
+  mdefloat inc = gg->inc;
+  /* the range of positions we can read from with plain pointer arithmetic:
+   * with guard samples that's the whole buffer, without we need to keep 2
+   * samples (plus a bit of slack for rounding) away from either end */
+  mdefloat lo = parent->samplesGuarded ? (mdefloat)0.0 : (mdefloat)3.0;
+  mdefloat hi = parent->samplesGuarded ? period : period - (mdefloat)4.0;
+  /* a mirrored live buffer is mapped twice back to back so we can read
+   * straight through its end */
+  long top = parent->samplesMirrored ? 2 * nBufferSamples : nBufferSamples;
+  long run;
+
+  if (parent->samplesMirrored)
+    hi = (mdefloat)top - (mdefloat)4.0;
+
+  /* current is allowed to go over the buffer size (live grains start at
+   * liveIndex) so bring it back into range once, here, rather than moduloing
+   * every sample */
+  if (current >= period || current < (mdefloat)0.0)
+    current -= period * (mdefloat)floor(current / period);
+  while (howMany > 0)
+  {
+    if (current >= period)
+      current -= period;
+    else if (current < (mdefloat)0.0)
+      current += period;
+    /* with the mirror, start in the second copy if we're going backwards (or
+     * are too close to the start) so the whole run can be read in one go */
+    if (parent->samplesMirrored && (inc < (mdefloat)0.0 || current < lo))
+      current += period;
+    if (inc == (mdefloat)1.0)
+    {
+      /* if we're not transposing, no point interpolating: current is a whole
+       * number here so just copy up to the end of the buffer */
+      long index = (long)current;
+
+      run = top - index;
+      if (run > howMany)
+        run = howMany;
+      memcpy(out, samples + index, run * sizeof(mdefloat));
+    }
+    else if (current >= lo && current < hi)
+    {
+      mdefloat last = current + (mdefloat)(howMany - 1) * inc;
+
+      /* usually the whole run fits; if not, how many positions before we'd
+       * go out of range? */
+      if (last >= lo && last < hi)
+        run = howMany;
+      else
+      {
+        run = inc > (mdefloat)0.0 ? (long)ceil((hi - current) / inc)
+              : (long)floor((current - lo) / -inc) + 1;
+        if (run > howMany)
+          run = howMany;
+        else if (run < 1)
+          run = 1;
+      }
+      interpolateSpan(out, samples, current, inc, run, inc < 0);
+    }
+    else
+    {
+      /* near the edge of a borrowed buffer: wrap the slow way */
+      run = 1;
+      *out = interpolate(current, samples, nBufferSamples, inc < 0);
+    }
+    current += (mdefloat)run * inc;
+    out += run;
+    howMany -= run;
+  }
+  gg->current = current;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainReadFixed(mdeGranularGrain* gg, mdeGranular* parent,
+                               mdefloat* out, long howMany)
+{
+  static const mdefloat scale = (mdefloat)(1.0 / (double)MDE_PHASE_ONE);
+  mdefloat* samples = parent->samples;
+  long nBufferSamples = parent->nBufferSamples;
+  int64_t period = (int64_t)nBufferSamples << MDE_PHASE_BITS;
+  int64_t phase = gg->phase;
+  int64_t inc = gg->phaseInc;
+  /* the same ranges as in mdeGranularGrainRead() */
+  int64_t lo = parent->samplesGuarded ? 0 : 3 * MDE_PHASE_ONE;
+  int64_t hi = parent->samplesGuarded ? period : period - 4 * MDE_PHASE_ONE;
+  long top = parent->samplesMirrored ? 2 * nBufferSamples : nBufferSamples;
+  int64_t last;
+  long run;
+
+  if (parent->samplesMirrored)
+    hi = ((int64_t)top << MDE_PHASE_BITS) - 4 * MDE_PHASE_ONE;
+  if (phase >= period || phase < 0)
+  {
+    phase %= period;
+    if (phase < 0)
+      phase += period;
+  }
+  while (howMany > 0)
+  {
+    if (phase >= period)
+      phase -= period;
+    else if (phase < 0)
+      phase += period;
+    if (parent->samplesMirrored && (inc < 0 || phase < lo))
+      phase += period;
+    if (inc == MDE_PHASE_ONE && !(phase & MDE_PHASE_MASK))
+    {
+      long index = (long)(phase >> MDE_PHASE_BITS);
+
+      run = top - index;
+      if (run > howMany)
+        run = howMany;
+      memcpy(out, samples + index, run * sizeof(mdefloat));
+    }
+    else if (phase >= lo && phase < hi)
+    {
+      last = phase + (int64_t)(howMany - 1) * inc;
+      if (last >= lo && last < hi)
+        run = howMany;
+      else
+      {
+        run = inc > 0 ? (long)((hi - phase + inc - 1) / inc)
+              : (long)((phase - lo) / -inc) + 1;
+        if (run > howMany)
+          run = howMany;
+        else if (run < 1)
+          run = 1;
       }
-      ++where;
+      interpolateSpanFixed(out, samples, phase, inc, run, inc < 0);
     }
+    else
+    {
+      run = 1;
+      *out = interpolateIndex((long)(phase >> MDE_PHASE_BITS),
+                              (mdefloat)(phase & MDE_PHASE_MASK) * scale,
+                              samples, nBufferSamples, inc < 0);
+    }
+    phase += (int64_t)run * inc;
+    out += run;
+    howMany -= run;
+  }
+  gg->phase = phase;
+  /* only for printing and for switching FixedPhase off again */
+  gg->current = (mdefloat)((double)phase / (double)MDE_PHASE_ONE);
 }
 //------------------------------------------------------------------------------
 
 void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in, long nsamps)
 {
-  mdefloat* samples = g->theSamples;
-  long i;
+  mdefloat* samples = g->samples;
   long li = g->liveIndex;
   long end = g->nBufferSamples;
+  long run;
 
-  if (samples)
+  if (samples && end > 0)
   {
-    samples += li;
-    for (i = 0; i < nsamps; ++i)
+    /* everything up to here's been written since we were cleared (which
+     * may already be further on, if the ring changed: see SourceInstall()) */
+    if (g->clearing && li + nsamps > g->clearWritten)
+      g->clearWritten = li + nsamps;
+    if (g->samplesMirrored && nsamps <= end)
+    {
+      /* whatever goes past the end of the ring lands at its start because
+       * the second half of the mapping is the first */
+      memcpy(samples + li, in, nsamps * sizeof(mdefloat));
+      li += nsamps;
+      if (li >= end)
+        li -= end;
+    }
+    else
     {
-      *samples++ = *in++;
-      if (++li == end)
+      /* and into the new buffer if the live buffer's being resized */
+      mdeGranularResizeInput(g, in, nsamps, li);
+      while (nsamps > 0)
       {
-        li = 0;
-        samples = g->theSamples;
+        run = end - li;
+        if (run > nsamps)
+          run = nsamps;
+        memcpy(samples + li, in, run * sizeof(mdefloat));
+        in += run;
+        nsamps -= run;
+        li += run;
+        if (li == end)
+          li = 0;
       }
+      if (g->samplesGuarded)
+        mdeGranularMirrorGuards(samples, end);
     }
     g->liveIndex = li;
   }
 }
 //------------------------------------------------------------------------------
 
-long mdeGranularCopyFloatSamples(mdeGranular* g, float* in, long nsamps)
+long mdeGranularCopyFloatSamples(mdeGranular* g, float* in, long nsamps)
+{
+  mdefloat* samples;
+  long i;
+  long num = nsamps;
+
+  if (!mdeGranularNeedLiveBuffer(g, nsamps))
+    mdeGranularCopyWarn(g, g->AllocatedBufferMS, nsamps);
+  if (num > g->nAllocatedBufferSamples)
+    num = g->nAllocatedBufferSamples;
+  samples = g->theSamples;
+  if (samples && in)
+  {
+    for (i = 0; i < num; ++i)
+    {
+      *samples++ = (mdefloat) * in++;
+    }
+  }
+  return num;
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularGrainExhausted(mdeGranularGrain* gg)
+{
+  return (gg->icurrent > gg->length);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularWelcome(void)
+{
+  mdePost("____________________________________________________");
+  mdePost("mdeGranular~");
+  mdePost("multi-channel, multi-voice, multi-transposition ");
+  mdePost("granular synthesis external for Max/MSP and PD");
+  mdePost("Version %s (%s %s)", VERSION, __TIME__, __DATE__);
+  mdePost("Michael Edwards ~ m@michael-edwards.org");
+  mdePost("____________________________________________________");
+}
+//------------------------------------------------------------------------------
+#pragma mark HELPER FUNCTIONS
+
+void silence(mdefloat* where, int numSamples)
+{
+  if (where)
+    memset(where, 0, numSamples * sizeof(mdefloat));
+}
+//------------------------------------------------------------------------------
+
+void mixIn(mdefloat* where, mdefloat* src, mdefloat* gamp, long numSamples)
+{
+  for (long i = 0; i < numSamples; ++i)
+    where[i] += src[i] * gamp[i];
+}
+//------------------------------------------------------------------------------
+
+void mixInWithEnvelope(mdefloat* where, mdefloat* src, mdefloat* env,
+                       mdefloat* gamp, long numSamples)
+{
+  for (long i = 0; i < numSamples; ++i)
+    where[i] += src[i] * env[i] * gamp[i];
+}
+//------------------------------------------------------------------------------
+
+mdefloat randomlyDeviate(mdeGranular* g, mdefloat number,
+                         mdefloat maxDeviation)
+{
+  mdefloat dev = between(g, (mdefloat)0.0, maxDeviation);
+  mdefloat ndev = number * (dev * (mdefloat)0.01);
+
+  if (flip(g))
+    ndev = -ndev;
+  return number + ndev;
+}
+//------------------------------------------------------------------------------
+
+void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown)
+{
+  mdefloat inc = (mdefloat)1.0 / (mdefloat)(rampLen - 1);
+  mdefloat f = (mdefloat)0.0;
+
+  for (int i = 0; i < rampLen; ++i, f += inc, ++rampUp, ++rampDown)
+  {
+    *rampUp = f;
+    *rampDown = 1.0f - f;
+  }
+}
+//------------------------------------------------------------------------------
+
+mdefloat st2src(mdefloat st, mdefloat octaveSize,
+                mdefloat octaveDivisions)
+{
+  return (mdefloat)pow(octaveSize, st / octaveDivisions);
+}
+//------------------------------------------------------------------------------
+
+long ms2samples(mdefloat samplingRate, mdefloat milliseconds)
+{
+  return (long)ceil((milliseconds * (mdefloat)0.001) * samplingRate);
+}
+//------------------------------------------------------------------------------
+
+mdefloat samples2ms(mdefloat samplingRate, int samples)
+{
+  return (mdefloat)1000.0 * ((mdefloat)samples / samplingRate);
+}
+//------------------------------------------------------------------------------
+mdefloat interpolate(mdefloat findex, mdefloat* samples, long numSamples,
+                     char backwards) /*, char live)*/
+{
+  long indexTrunc = (long)findex;
+
+  return interpolateIndex(indexTrunc, fabs(findex - (mdefloat)indexTrunc),
+                          samples, numSamples, backwards);
+}
+//------------------------------------------------------------------------------
+
+mdefloat interpolateIndex(long indexTrunc, mdefloat fraction,
+                          mdefloat* samples, long numSamples, char backwards)
+{
+  mdefloat a;
+  mdefloat b;
+  mdefloat c;
+  mdefloat d;
+  mdefloat* fp;
+  mdefloat* lastsamp;
+  mdefloat lastsampval;
+  mdefloat result;
+
+  if (!samples)
+    return (mdefloat)0.0;
+
+  /* do boundary sanity for circular buffer case */
+  indexTrunc %= numSamples;
+  /* could be the case if going backwards (% doesn't wrap as lisp's mod does so
+   * negative numbers remain negative)
+   */
+  if (indexTrunc < 0)
+  {
+    indexTrunc = numSamples + indexTrunc;
+  }
+  lastsamp = (mdefloat*)(samples + numSamples - 1);
+  lastsampval = *lastsamp;
+  /* some of these saw samples cast to long but since going 64 bit that no
+     longer works (too small?) */
+  fp = (mdefloat*)(samples + indexTrunc);
+  b = *fp;
+  if (backwards)
+  {
+    a = *(samples + ((indexTrunc + 1) % numSamples));
+    c = indexTrunc ? *(fp - 1) : lastsampval;
+    d = !indexTrunc ? *(lastsamp - 1) : (indexTrunc == 1 ?
+                                         lastsampval : *(fp - 2));
+  }
+  else
+  {
+    a = indexTrunc ? *(fp - 1) : lastsampval;
+    c = *(samples + ((indexTrunc + 1) % numSamples));
+    d = *(samples + ((indexTrunc + 2) % numSamples));
+  }
+
+  result = cubic(a, b, c, d, fraction);
+#ifdef DEBUG
+  if (result > 1.0)
+    mdePost("%f at index %d (numSamples: %d, a,b,c,d=%f %f %f %f)\n",
+            result, indexTrunc, numSamples, a, b, c, d);
+#endif
+
+  return result;
+}
+//------------------------------------------------------------------------------
+
+mdefloat cubic(mdefloat a, mdefloat b, mdefloat c, mdefloat d,
+               mdefloat fraction)
+{
+  mdefloat cminusb = c - b;
+
+  return (b + fraction * (cminusb - (mdefloat)0.5 * (fraction - (mdefloat)1.0)
+                          * ((a - d + (mdefloat)3.0 * cminusb) * fraction +
+                             (b - a - cminusb))));
+}
+//------------------------------------------------------------------------------
+#pragma mark SIMD INTERPOLATION
+
+/* The vectorised versions of interpolateSpan(). SSE2 is always there on
+ * x86-64; AVX2 (which gives us gathers) is compiled in with a target
+ * attribute and chosen at run time, so the externals don't need to be built
+ * with -mavx2 and still run on older machines. Each one returns how many
+ * samples it did; the caller finishes the rest in plain C. In all of them
+ * -step- is 1 when going forwards and -1 when backwards: the points either
+ * side of the index are then a = s[i - step], c = s[i + step] and
+ * d = s[i + 2 * step], as in interpolate(). */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MDE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#ifdef MDE_X86_SIMD
+#ifdef MDEFLOAT_DOUBLE
+
+static long interpolateSpanSSE2(mdefloat* out, mdefloat* s, mdefloat findex,
+                                mdefloat inc, long howMany, long step)
+{
+  const __m128d lanes = _mm_set_pd(1.0, 0.0);
+  const __m128d vinc = _mm_set1_pd(inc);
+  const __m128d vstart = _mm_set1_pd(findex);
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d three = _mm_set1_pd(3.0);
+  int idx[4];
+  long i;
+
+  for (i = 0; i + 2 <= howMany; i += 2)
+  {
+    __m128d x = _mm_add_pd(vstart, _mm_mul_pd(_mm_add_pd(
+                             _mm_set1_pd((double)i), lanes), vinc));
+    __m128i vi = _mm_cvttpd_epi32(x);
+    __m128d f = _mm_sub_pd(x, _mm_cvtepi32_pd(vi));
+    __m128d a, b, c, d, cmb, t;
+
+    _mm_storeu_si128((__m128i*)idx, vi);
+    a = _mm_set_pd(s[idx[1] - step], s[idx[0] - step]);
+    b = _mm_set_pd(s[idx[1]], s[idx[0]]);
+    c = _mm_set_pd(s[idx[1] + step], s[idx[0] + step]);
+    d = _mm_set_pd(s[idx[1] + 2 * step], s[idx[0] + 2 * step]);
+    cmb = _mm_sub_pd(c, b);
+    t = _mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_sub_pd(a, d),
+                                         _mm_mul_pd(three, cmb)), f),
+                   _mm_sub_pd(_mm_sub_pd(b, a), cmb));
+    t = _mm_sub_pd(cmb, _mm_mul_pd(_mm_mul_pd(half, _mm_sub_pd(f, one)), t));
+    _mm_storeu_pd(out + i, _mm_add_pd(b, _mm_mul_pd(f, t)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static long interpolateSpanAVX2(mdefloat* out, mdefloat* s, mdefloat findex,
+                                mdefloat inc, long howMany, long step)
+{
+  const __m256d lanes = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+  const __m256d vinc = _mm256_set1_pd(inc);
+  const __m256d vstart = _mm256_set1_pd(findex);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d three = _mm256_set1_pd(3.0);
+  long i;
+
+  for (i = 0; i + 4 <= howMany; i += 4)
+  {
+    __m256d x = _mm256_add_pd(vstart, _mm256_mul_pd(_mm256_add_pd(
+                                _mm256_set1_pd((double)i), lanes), vinc));
+    __m128i vi = _mm256_cvttpd_epi32(x);
+    __m256d f = _mm256_sub_pd(x, _mm256_cvtepi32_pd(vi));
+    __m256d a = _mm256_i32gather_pd(s - step, vi, 8);
+    __m256d b = _mm256_i32gather_pd(s, vi, 8);
+    __m256d c = _mm256_i32gather_pd(s + step, vi, 8);
+    __m256d d = _mm256_i32gather_pd(s + 2 * step, vi, 8);
+    __m256d cmb = _mm256_sub_pd(c, b);
+    __m256d t = _mm256_add_pd(
+      _mm256_mul_pd(_mm256_add_pd(_mm256_sub_pd(a, d),
+                                  _mm256_mul_pd(three, cmb)), f),
+      _mm256_sub_pd(_mm256_sub_pd(b, a), cmb));
+
+    t = _mm256_sub_pd(cmb, _mm256_mul_pd(_mm256_mul_pd(
+                                           half, _mm256_sub_pd(f, one)), t));
+    _mm256_storeu_pd(out + i, _mm256_add_pd(b, _mm256_mul_pd(f, t)));
+  }
+  return i;
+}
+
+#else /* float */
+
+static long interpolateSpanSSE2(mdefloat* out, mdefloat* s, mdefloat findex,
+                                mdefloat inc, long howMany, long step)
+{
+  const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  const __m128 vinc = _mm_set1_ps(inc);
+  const __m128 vstart = _mm_set1_ps(findex);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 three = _mm_set1_ps(3.0f);
+  int idx[4];
+  long i;
+
+  for (i = 0; i + 4 <= howMany; i += 4)
+  {
+    __m128 x = _mm_add_ps(vstart, _mm_mul_ps(_mm_add_ps(
+                            _mm_set1_ps((float)i), lanes), vinc));
+    __m128i vi = _mm_cvttps_epi32(x);
+    __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(vi));
+    __m128 a, b, c, d, cmb, t;
+
+    _mm_storeu_si128((__m128i*)idx, vi);
+    a = _mm_set_ps(s[idx[3] - step], s[idx[2] - step],
+                   s[idx[1] - step], s[idx[0] - step]);
+    b = _mm_set_ps(s[idx[3]], s[idx[2]], s[idx[1]], s[idx[0]]);
+    c = _mm_set_ps(s[idx[3] + step], s[idx[2] + step],
+                   s[idx[1] + step], s[idx[0] + step]);
+    d = _mm_set_ps(s[idx[3] + 2 * step], s[idx[2] + 2 * step],
+                   s[idx[1] + 2 * step], s[idx[0] + 2 * step]);
+    cmb = _mm_sub_ps(c, b);
+    t = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_sub_ps(a, d),
+                                         _mm_mul_ps(three, cmb)), f),
+                   _mm_sub_ps(_mm_sub_ps(b, a), cmb));
+    t = _mm_sub_ps(cmb, _mm_mul_ps(_mm_mul_ps(half, _mm_sub_ps(f, one)), t));
+    _mm_storeu_ps(out + i, _mm_add_ps(b, _mm_mul_ps(f, t)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static long interpolateSpanAVX2(mdefloat* out, mdefloat* s, mdefloat findex,
+                                mdefloat inc, long howMany, long step)
+{
+  const __m256 lanes = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f,
+                                     3.0f, 2.0f, 1.0f, 0.0f);
+  const __m256 vinc = _mm256_set1_ps(inc);
+  const __m256 vstart = _mm256_set1_ps(findex);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 three = _mm256_set1_ps(3.0f);
+  long i;
+
+  for (i = 0; i + 8 <= howMany; i += 8)
+  {
+    __m256 x = _mm256_add_ps(vstart, _mm256_mul_ps(_mm256_add_ps(
+                               _mm256_set1_ps((float)i), lanes), vinc));
+    __m256i vi = _mm256_cvttps_epi32(x);
+    __m256 f = _mm256_sub_ps(x, _mm256_cvtepi32_ps(vi));
+    __m256 a = _mm256_i32gather_ps(s - step, vi, 4);
+    __m256 b = _mm256_i32gather_ps(s, vi, 4);
+    __m256 c = _mm256_i32gather_ps(s + step, vi, 4);
+    __m256 d = _mm256_i32gather_ps(s + 2 * step, vi, 4);
+    __m256 cmb = _mm256_sub_ps(c, b);
+    __m256 t = _mm256_add_ps(
+      _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(a, d),
+                                  _mm256_mul_ps(three, cmb)), f),
+      _mm256_sub_ps(_mm256_sub_ps(b, a), cmb));
+
+    t = _mm256_sub_ps(cmb, _mm256_mul_ps(_mm256_mul_ps(
+                                           half, _mm256_sub_ps(f, one)), t));
+    _mm256_storeu_ps(out + i, _mm256_add_ps(b, _mm256_mul_ps(f, t)));
+  }
+  return i;
+}
+
+#endif /* MDEFLOAT_DOUBLE */
+
+/* 0 = not checked yet, 1 = SSE2 only, 2 = AVX2 too. Checking more than once
+ * (from different threads) is harmless as they all get the same answer, but
+ * the loads and stores are atomic so that's all that can happen. */
+static int mdeSimdLevel = 0;
+
+#endif /* MDE_X86_SIMD */
+//------------------------------------------------------------------------------
+
+/* do as much of the span as we can with the widest kernel we have; returns
+ * how many samples that was (0 if there's no SIMD) */
+static long interpolateSpanSimd(mdefloat* out, mdefloat* samples,
+                                mdefloat findex, mdefloat inc, long howMany,
+                                long step)
+{
+#ifdef MDE_X86_SIMD
+  int level = __atomic_load_n(&mdeSimdLevel, __ATOMIC_RELAXED);
+
+  if (!level)
+  {
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? 2 : 1;
+    __atomic_store_n(&mdeSimdLevel, level, __ATOMIC_RELAXED);
+  }
+  if (level == 2)
+    return interpolateSpanAVX2(out, samples, findex, inc, howMany, step);
+  return interpolateSpanSSE2(out, samples, findex, inc, howMany, step);
+#else
+  UNUSED(out);
+  UNUSED(samples);
+  UNUSED(findex);
+  UNUSED(inc);
+  UNUSED(howMany);
+  UNUSED(step);
+  return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+void interpolateSpan(mdefloat* out, mdefloat* samples, mdefloat findex,
+                     mdefloat inc, long howMany, char backwards)
+{
+  long step = backwards ? -1 : 1;
+  long i = interpolateSpanSimd(out, samples, findex, inc, howMany, step);
+
+  for (; i < howMany; ++i)
+  {
+    mdefloat x = findex + (mdefloat)i * inc;
+    long index = (long)x;
+    mdefloat* fp = samples + index;
+
+    out[i] = cubic(*(fp - step), *fp, *(fp + step), *(fp + 2 * step),
+                   x - (mdefloat)index);
+  }
+}
+//------------------------------------------------------------------------------
+
+void interpolateSpanFixed(mdefloat* out, mdefloat* samples, int64_t phase,
+                          int64_t inc, long howMany, char backwards)
+{
+  static const mdefloat scale = (mdefloat)(1.0 / (double)MDE_PHASE_ONE);
+  long step = backwards ? -1 : 1;
+  /* going backwards the last position is the lowest; measuring from the
+   * lowest keeps all the positions the kernels see >= 0 */
+  int64_t lowest = inc < 0 ? phase + (int64_t)(howMany - 1) * inc : phase;
+  int64_t base = lowest & ~MDE_PHASE_MASK;
+  int64_t rel = phase - base;
+  mdefloat* s = samples + (long)(base >> MDE_PHASE_BITS);
+  long i = interpolateSpanSimd(out, s, (mdefloat)rel * scale,
+                               (mdefloat)inc * scale, howMany, step);
+
+  for (; i < howMany; ++i)
+  {
+    int64_t p = rel + (int64_t)i * inc;
+    mdefloat* fp = s + (long)(p >> MDE_PHASE_BITS);
+
+    out[i] = cubic(*(fp - step), *fp, *(fp + step), *(fp + 2 * step),
+                   (mdefloat)(p & MDE_PHASE_MASK) * scale);
+  }
+}
+//------------------------------------------------------------------------------
+
+int64_t mdeGranularPhase(double x)
+{
+  return (int64_t)floor(x * (double)MDE_PHASE_ONE + 0.5);
+}
+//------------------------------------------------------------------------------
+
+mdefloat between(mdeGranular* g, mdefloat min, mdefloat max)
+{
+  /* 2/4/08 the code used to be (mdefloat)(RAND_MAX + 1) but
+   * with MacIntel this obviously caused wraparound to a negative
+   * int and a negative number to be returned when min and
+   * max were both positive!  Should have seen that one coming....
+   * now we use only as many bits as an mdefloat can hold exactly, so that
+   * r / div is always < 1 */
+#ifdef MDEFLOAT_DOUBLE
+  static const int shift = 0;
+  static const mdefloat div = (mdefloat)4294967296.0;
+#else
+  static const int shift = 8;
+  static const mdefloat div = (mdefloat)16777216.0;
+#endif
+
+  if (min == max)
+    return min;
+  else
+  {
+    mdefloat r = (mdefloat)(mdeGranularRandom32(g) >> shift);
+    mdefloat diff = max - min;
+    mdefloat scaler = diff / div;
+    return (min + (r * scaler));
+  }
+}
+//------------------------------------------------------------------------------
+
+int flip(mdeGranular* g)
+{
+  return (int)(mdeGranularRandom32(g) >> 31);
+}
+//------------------------------------------------------------------------------
+
+/* the SplitMix64 output function: a good 64-bit hash, so counter-based use
+ * (hashing key + counter * golden ratio) is just SplitMix64 itself */
+static uint64_t mdeGranularMix64(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularRandomSeed(mdeGranularRandom* r, uint64_t seed)
+{
+  /* hash the seed so that neighbouring seeds give unrelated sequences */
+  r->key = mdeGranularMix64(seed + 0x9E3779B97F4A7C15ULL);
+  r->counter = 0;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularRandomFill(mdeGranularRandom* r, uint32_t* out, int howMany)
+{
+  uint64_t key = r->key;
+  uint64_t counter = r->counter;
+
+  /* each number depends only on its place in the sequence, so there's no
+   * dependency from one iteration to the next */
+  for (int i = 0; i < howMany; ++i)
+    out[i] = (uint32_t)(mdeGranularMix64(key + (counter + (uint64_t)i + 1) *
+                                         0x9E3779B97F4A7C15ULL) >> 32);
+  r->counter = counter + (uint64_t)howMany;
+}
+//------------------------------------------------------------------------------
+
+uint32_t mdeGranularRandom32(mdeGranular* g)
+{
+  if (g->nextRandom >= MDE_RANDOM_BATCH)
+  {
+    mdeGranularRandomFill(&g->rng, g->config->randoms, MDE_RANDOM_BATCH);
+    g->nextRandom = 0;
+  }
+  return g->config->randoms[g->nextRandom++];
+}
+//------------------------------------------------------------------------------
+
+#pragma mark THREADS
+
+/* With more than MDE_PARTITION_VOICES voices, each partition of them mixes
+ * into its own buffers, which are added into the outlets at the end of the
+ * tick in partition order; how the partitions were rendered, and by which
+ * thread, therefore makes no difference to the output.
+ *
+ * The threads that render them are shared by every granulator in the
+ * process. A granulator that's been told to use threads has a slot in the
+ * pool for as long as it does. Each tick it plans its partitions, marks them
+ * free and wakes any idle workers, then takes partitions itself until there
+ * are none left. Nothing is locked: the partitions are handed out with an
+ * atomic counter and each belongs to whoever changes its state first.
+ * Workers render into buffers of their own, so the audio thread never has to
+ * wait for one for long: whatever a worker hasn't finished within
+ * MDE_JOIN_WAIT of the tick the audio thread takes back and renders itself,
+ * and the worker's effort is wasted. Until such a worker's done, its
+ * partition's grains are rendered as they're visited rather than planned, and
+ * nothing else it might be reading changes: messages, new ramps and new
+ * buffers wait for it. */
+
+#ifdef MDE_THREADS
+/* what's become of each partition this tick */
+enum
+{
+  /* it's been planned and nobody's taken it yet */
+  MDE_JOB_FREE,
+  /* a worker's rendering it */
+  MDE_JOB_CLAIMED,
+  /* a worker's rendered it, into the jobs' own buffers */
+  MDE_JOB_DONE,
+  /* the audio thread has it (it renders into partitionSamples) */
+  MDE_JOB_AUDIO
+};
+
+struct _mdeGranularJobs
+{
+  mdeGranular* g;
+  /* which of the pool's slots is ours */
+  int slot;
+  /* these all live in the same block as we do (see mdeGranularJobsNew()) */
+  mdeGranularRenderList* lists;
+  int nLists;
+  /* for each list: what's become of it (above); how many workers are
+   * rendering it (or about to try); and 1 if the audio thread's rendering
+   * its grains as they're visited this tick (see mdeGranularJobsBegin()) */
+  int* state;
+  int* busy;
+  char* direct;
+  /* what the workers render into: numChannels buffers of nOutputSamples for
+   * each list, then one of scratch for each */
+  mdefloat* outs;
+  /* how many partitions there are and the next one to be taken */
+  int nJobs;
+  int nextJob;
+  /* how many workers are taking partitions from us, and the most that may */
+  int helpers;
+  int maxHelpers;
+};
+
+typedef struct
+{
+  mdeGranularJobs* jobs;
+  /* how many workers are looking at jobs: until it's 0 they may not be
+   * freed or changed */
+  int users;
+  /* 1 whilst a granulator has the slot (see mdeGranularPoolClaim()) */
+  char claimed;
+} mdeGranularPoolSlot;
+
+typedef struct
+{
+  /* lock and wake are only for idle workers to sleep on; control serialises
+   * resizing and the claiming of slots (by senders: never the audio
+   * thread) */
+  pthread_mutex_t lock;
+  pthread_mutex_t control;
+  pthread_cond_t wake;
+  pthread_t threads[MDE_MAX_THREADS];
+  /* -1 until it's been set or first needed */
+  int nThreads;
+  int priority;
+  char quit;
+  /* incremented each time a tick's partitions are handed out; how many
+   * workers are asleep (or about to be) */
+  unsigned epoch;
+  int sleeping;
+  mdeGranularPoolSlot slots[MDE_POOL_SLOTS];
+} mdeGranularPool;
+
+static mdeGranularPool mdePool =
+{
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, { 0 }, -1, 0, 0, 0, 0, { { NULL, 0, 0 } }
+};
+//------------------------------------------------------------------------------
+
+/* seconds, for timing the workers */
+static double mdeGranularNow(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+//------------------------------------------------------------------------------
+
+/* tell the CPU we're spinning */
+static void mdeGranularPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* a worker renders partition -job- into the jobs' own buffers */
+static void mdeGranularJobsRender(mdeGranularJobs* j, int job)
+{
+  mdeGranular* g = j->g;
+  long n = g->nOutputSamples;
+  mdefloat* out = j->outs + job * g->numChannels * n;
+
+  silence(out, g->numChannels * (int)n);
+  mdeGranularRenderPartition(g, &j->lists[job], out,
+                             j->outs + (j->nLists * g->numChannels + job) * n,
+                             1);
+}
+//------------------------------------------------------------------------------
+
+/* a worker takes partitions until there are none left; returns 1 if it
+ * rendered any */
+static int mdeGranularJobsWork(mdeGranularJobs* j)
+{
+  int job;
+  int state;
+  int did = 0;
+
+  while ((job = __atomic_fetch_add(&j->nextJob, 1, __ATOMIC_ACQ_REL))
+         < __atomic_load_n(&j->nJobs, __ATOMIC_ACQUIRE))
+  {
+    /* busy first, so that the audio thread can't miss us */
+    __atomic_fetch_add(&j->busy[job], 1, __ATOMIC_SEQ_CST);
+    state = MDE_JOB_FREE;
+    if (__atomic_compare_exchange_n(&j->state[job], &state, MDE_JOB_CLAIMED,
+                                    0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+      mdeGranularJobsRender(j, job);
+      /* unless the audio thread gave up on us meanwhile */
+      state = MDE_JOB_CLAIMED;
+      __atomic_compare_exchange_n(&j->state[job], &state, MDE_JOB_DONE, 0,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+      did = 1;
+    }
+    /* the last we touch of the partition */
+    __atomic_fetch_sub(&j->busy[job], 1, __ATOMIC_RELEASE);
+  }
+  return did;
+}
+//------------------------------------------------------------------------------
+
+/* a worker looks for partitions in -slot-; returns 1 if it rendered any */
+static int mdeGranularPoolVisit(mdeGranularPoolSlot* slot)
+{
+  mdeGranularJobs* j;
+  int did = 0;
+
+  if (!__atomic_load_n(&slot->jobs, __ATOMIC_RELAXED))
+    return 0;
+  /* whilst we're a user the jobs stay as they are */
+  __atomic_fetch_add(&slot->users, 1, __ATOMIC_SEQ_CST);
+  j = __atomic_load_n(&slot->jobs, __ATOMIC_SEQ_CST);
+  if (j && __atomic_load_n(&j->nextJob, __ATOMIC_RELAXED) <
+      __atomic_load_n(&j->nJobs, __ATOMIC_RELAXED))
+  {
+    if (__atomic_fetch_add(&j->helpers, 1, __ATOMIC_RELAXED) <
+        __atomic_load_n(&j->maxHelpers, __ATOMIC_RELAXED))
+      did = mdeGranularJobsWork(j);
+    __atomic_fetch_sub(&j->helpers, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_sub(&slot->users, 1, __ATOMIC_RELEASE);
+  return did;
+}
+//------------------------------------------------------------------------------
+
+static void* mdeGranularPoolWorker(void* arg)
+{
+  struct timespec until;
+  unsigned epoch;
+  int did;
+
+  UNUSED(arg);
+  while (!__atomic_load_n(&mdePool.quit, __ATOMIC_ACQUIRE))
+  {
+    epoch = __atomic_load_n(&mdePool.epoch, __ATOMIC_SEQ_CST);
+    did = 0;
+    for (int i = 0; i < MDE_POOL_SLOTS; ++i)
+      did |= mdeGranularPoolVisit(&mdePool.slots[i]);
+    if (did)
+      continue;
+    /* sleep until the next tick's handed out; the wake-up's sent without the
+     * lock so we might miss it, but then we only sleep for a while */
+    pthread_mutex_lock(&mdePool.lock);
+    __atomic_fetch_add(&mdePool.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mdePool.epoch, __ATOMIC_SEQ_CST) == epoch &&
+        !__atomic_load_n(&mdePool.quit, __ATOMIC_ACQUIRE))
+    {
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += MDE_POOL_NAP;
+      if (until.tv_nsec >= 1000000000)
+      {
+        until.tv_nsec -= 1000000000;
+        ++until.tv_sec;
+      }
+      pthread_cond_timedwait(&mdePool.wake, &mdePool.lock, &until);
+    }
+    __atomic_fetch_sub(&mdePool.sleeping, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mdePool.lock);
+  }
+  return NULL;
+}
+//------------------------------------------------------------------------------
+
+/* wake any idle workers: called by the audio thread, so without the lock */
+static void mdeGranularPoolWake(void)
+{
+  __atomic_fetch_add(&mdePool.epoch, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&mdePool.sleeping, __ATOMIC_SEQ_CST))
+    pthread_cond_broadcast(&mdePool.wake);
+}
+//------------------------------------------------------------------------------
+
+/* call with the control lock held */
+static void mdeGranularPoolApplyPriority(pthread_t thread, char warn)
+{
+  struct sched_param param;
+  int policy = mdePool.priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = mdePool.priority;
+  if (pthread_setschedparam(thread, policy, &param) && warn)
+    mdePost("mdeGranular~: couldn't set the pool's thread priority to %d.",
+            mdePool.priority);
+}
+//------------------------------------------------------------------------------
+
+/* call with the control lock held; returns how many threads are running */
+static int mdeGranularPoolResize(int nThreads, char warn)
+{
+  int old = mdePool.nThreads > 0 ? mdePool.nThreads : 0;
+
+  if (old)
+  {
+    /* workers finish what they've taken before they go */
+    pthread_mutex_lock(&mdePool.lock);
+    __atomic_store_n(&mdePool.quit, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&mdePool.wake);
+    pthread_mutex_unlock(&mdePool.lock);
+    for (int i = 0; i < old; ++i)
+      pthread_join(mdePool.threads[i], NULL);
+    __atomic_store_n(&mdePool.quit, 0, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&mdePool.nThreads, 0, __ATOMIC_RELAXED);
+  for (int i = 0; i < nThreads; ++i)
+  {
+    if (pthread_create(&mdePool.threads[i], NULL, mdeGranularPoolWorker,
+                       NULL))
+    {
+      if (warn)
+        mdePost("mdeGranular~: could only start %d of %d pool threads.", i,
+                nThreads);
+      break;
+    }
+    if (mdePool.priority)
+      mdeGranularPoolApplyPriority(mdePool.threads[i], warn && !i);
+    __atomic_store_n(&mdePool.nThreads, i + 1, __ATOMIC_RELAXED);
+  }
+  return mdePool.nThreads;
+}
+//------------------------------------------------------------------------------
+
+/* wait until no worker's looking at our jobs */
+static void mdeGranularJobsQuiesce(mdeGranularJobs* j)
+{
+  while (__atomic_load_n(&mdePool.slots[j->slot].users, __ATOMIC_SEQ_CST))
+    mdeGranularPause();
+}
+//------------------------------------------------------------------------------
+
+/* make the jobs for layout -l-: the lists, with room for MDE_PARTITION_RUNS
+ * runs each, and everything else there is one of for each partition, all in
+ * one block with the jobs themselves (each array starting on its own cache
+ * line). Called by senders; NULL if there's no memory */
+static mdeGranularJobs* mdeGranularJobsNew(mdeGranular* g,
+                                           mdeGranularLayout* l)
+{
+  mdeGranularJobs* j;
+  long n = l->nPartitions;
+  size_t sizes[8];
+  size_t bytes = 0;
+  char* p;
+
+  sizes[0] = sizeof(mdeGranularJobs);
+  sizes[1] = n * sizeof(mdeGranularRenderList);
+  sizes[2] = n * MDE_PARTITION_RUNS * sizeof(mdeGranularRender);
+  sizes[3] = n * MDE_PARTITION_RUNS * sizeof(mdeGranularGrain);
+  sizes[4] = n * (g->numChannels + 1) * l->tick * sizeof(mdefloat);
+  sizes[5] = n * sizeof(int);
+  sizes[6] = n * sizeof(int);
+  sizes[7] = n * sizeof(char);
+  for (int i = 0; i < 8; ++i)
+  {
+    sizes[i] = (sizes[i] + MDE_CACHE_LINE - 1) & ~(size_t)(MDE_CACHE_LINE - 1);
+    bytes += sizes[i];
+  }
+  j = mdeArenaCalloc(&g->arena, 1, bytes, "mdeGranularJobsNew", g->warnings);
+  if (!j)
+    return NULL;
+  p = (char*)j + sizes[0];
+  j->lists = (mdeGranularRenderList*)p;
+  p += sizes[1];
+  for (int i = 0; i < n; ++i)
+  {
+    j->lists[i].runs = (mdeGranularRender*)p + i * MDE_PARTITION_RUNS;
+    j->lists[i].ends = (mdeGranularGrain*)(p + sizes[2]) +
+      i * MDE_PARTITION_RUNS;
+    j->lists[i].size = MDE_PARTITION_RUNS;
+  }
+  p += sizes[2] + sizes[3];
+  j->outs = (mdefloat*)p;
+  p += sizes[4];
+  j->state = (int*)p;
+  p += sizes[5];
+  j->busy = (int*)p;
+  p += sizes[6];
+  j->direct = p;
+  j->g = g;
+  j->slot = l->slot;
+  j->nLists = (int)n;
+  j->maxHelpers = l->threads - 1;
+  /* nobody may take a partition until the first tick hands them out */
+  for (int i = 0; i < j->nLists; ++i)
+    j->state[i] = MDE_JOB_AUDIO;
+  j->nextJob = j->nLists;
+  j->nJobs = j->nLists;
+  return j;
+}
+//------------------------------------------------------------------------------
+
+/* called by senders once the jobs have been unpublished (see
+ * mdeGranularLayoutInstall()) */
+static void mdeGranularJobsFree(mdeGranular* g, mdeGranularJobs* j)
+{
+  if (!j)
+    return;
+  /* (a worker still rendering a partition it was too late with is a user
+   * too) */
+  if (j->slot >= 0)
+    mdeGranularJobsQuiesce(j);
+  mdeArenaFree(&g->arena, j);
+}
+//------------------------------------------------------------------------------
+
+/* claim a slot in the pool for our jobs (into g->poolSlot), starting the
+ * pool if it hasn't been yet; returns 0 if there's no room for us */
+static int mdeGranularPoolClaim(mdeGranular* g)
+{
+  long cores;
+
+  pthread_mutex_lock(&mdePool.control);
+  for (int i = 0; i < MDE_POOL_SLOTS && g->poolSlot < 0; ++i)
+    if (!mdePool.slots[i].claimed)
+    {
+      mdePool.slots[i].claimed = 1;
+      g->poolSlot = i;
+    }
+  /* the first granulator to want threads starts the pool, one thread for
+   * each core but the one we're on, unless it's already been sized */
+  if (g->poolSlot >= 0 && mdePool.nThreads < 0)
+  {
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > MDE_MAX_THREADS)
+      cores = MDE_MAX_THREADS;
+    mdeGranularPoolResize(cores > 1 ? (int)cores - 1 : 0, g->warnings);
+  }
+  pthread_mutex_unlock(&mdePool.control);
+  return g->poolSlot >= 0;
+}
+#endif /* MDE_THREADS */
+//------------------------------------------------------------------------------
+
+/* give our slot back to the pool once no layout that might publish jobs in
+ * it is installed or on its way (called by senders, and by
+ * mdeGranularFree() when nothing is) */
+static void mdeGranularPoolRelease(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  mdeGranularLayout* l = __atomic_load_n(&g->layout, __ATOMIC_ACQUIRE);
+
+  if (g->poolSlot < 0 || (l && (l != g->layoutSent || l->jobs)))
+    return;
+  __atomic_store_n(&mdePool.slots[g->poolSlot].jobs, NULL, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&mdePool.slots[g->poolSlot].users, __ATOMIC_SEQ_CST))
+    mdeGranularPause();
+  pthread_mutex_lock(&mdePool.control);
+  mdePool.slots[g->poolSlot].claimed = 0;
+  pthread_mutex_unlock(&mdePool.control);
+  g->poolSlot = -1;
+#else
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+#ifdef MDE_THREADS
+/* the audio thread takes partition -job- from -from- (its state); returns 1
+ * if it's now ours */
+static int mdeGranularJobsClaim(mdeGranularJobs* j, int job, int from)
+{
+  return __atomic_compare_exchange_n(&j->state[job], &from, MDE_JOB_AUDIO, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+//------------------------------------------------------------------------------
+
+/* the audio thread renders partition -job- */
+static void mdeGranularJobsTake(mdeGranularJobs* j, int job)
+{
+  mdeGranular* g = j->g;
+  long n = g->nOutputSamples;
+
+  mdeGranularRenderPartition(g, &j->lists[job], g->partitionSamples +
+                             job * g->numChannels * n, g->grainScratch, 0);
+}
+//------------------------------------------------------------------------------
+
+/* the audio thread renders what's left of partition -job- straight away
+ * and the rest of its grains as they're visited (see mdeGranularGrainPlan())
+ */
+static void mdeGranularJobsFlush(mdeGranularJobs* j, int job)
+{
+  mdeGranularJobsTake(j, job);
+  j->lists[job].n = 0;
+  j->direct[job] = 1;
+}
+//------------------------------------------------------------------------------
+
+/* copy the positions of the grains a worker rendered back into the voices */
+static void mdeGranularJobsFinish(mdeGranularJobs* j, int job)
+{
+  mdeGranularRenderList* list = &j->lists[job];
+  mdeGranularGrain* gg;
+
+  for (int i = 0; i < list->n; ++i)
+    if (list->runs[i].voice >= 0)
+    {
+      gg = &j->g->grains[list->runs[i].voice];
+      gg->current = list->ends[i].current;
+      gg->phase = list->ends[i].phase;
+    }
+}
+#endif /* MDE_THREADS */
+//------------------------------------------------------------------------------
+
+/* whether a worker's still rendering a partition of ours that it was too
+ * late with, in which case nothing it might be reading may change yet */
+static int mdeGranularJobsBusy(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  mdeGranularJobs* j = g->jobs;
+
+  if (j)
+    for (int i = 0; i < j->nJobs; ++i)
+      if (__atomic_load_n(&j->busy[i], __ATOMIC_ACQUIRE))
+        return 1;
+#else
+  UNUSED(g);
+#endif
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+/* wait (not on the audio thread) until mdeGranularJobsBusy() is 0 */
+static void mdeGranularJobsWait(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  struct timespec wait = { 0, 100000 };
+
+  while (mdeGranularJobsBusy(g))
+    nanosleep(&wait, NULL);
+#else
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularJobsBegin(mdeGranularJobs* j)
+{
+#ifdef MDE_THREADS
+  /* a partition a worker's still rendering from last time (see
+   * mdeGranularJobsRun()) is rendered as its grains are visited and its list
+   * left alone */
+  for (int i = 0; i < j->nJobs; ++i)
+  {
+    j->direct[i] = __atomic_load_n(&j->busy[i], __ATOMIC_ACQUIRE) != 0;
+    if (!j->direct[i])
+      j->lists[i].n = 0;
+  }
+#else
+  UNUSED(j);
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularJobsRun(mdeGranularJobs* j)
+{
+#ifdef MDE_THREADS
+  mdeGranular* g = j->g;
+  int n = j->nJobs;
+  int job;
+  int state;
+  int pending;
+  double until;
+
+  /* (the releases make what we've planned visible to whoever takes each
+   * partition) */
+  for (int i = 0; i < n; ++i)
+    __atomic_store_n(&j->state[i], j->direct[i] ? MDE_JOB_AUDIO :
+                     MDE_JOB_FREE, __ATOMIC_RELEASE);
+  __atomic_store_n(&j->nextJob, 0, __ATOMIC_RELEASE);
+  mdeGranularPoolWake();
+  until = mdeGranularNow() +
+    MDE_JOIN_WAIT * (double)g->nOutputSamples / (double)g->samplingRate;
+  while ((job = __atomic_fetch_add(&j->nextJob, 1, __ATOMIC_ACQ_REL)) < n)
+    if (mdeGranularJobsClaim(j, job, MDE_JOB_FREE))
+      mdeGranularJobsTake(j, job);
+  /* wait for the workers, though not for long */
+  do
+  {
+    pending = 0;
+    for (int i = 0; i < n; ++i)
+    {
+      state = __atomic_load_n(&j->state[i], __ATOMIC_ACQUIRE);
+      /* one handed to a worker that hasn't got round to it */
+      if (state == MDE_JOB_FREE && mdeGranularJobsClaim(j, i, MDE_JOB_FREE))
+        mdeGranularJobsTake(j, i);
+      else if (state == MDE_JOB_FREE || state == MDE_JOB_CLAIMED)
+        pending = 1;
+    }
+    if (pending)
+      mdeGranularPause();
+  } while (pending && mdeGranularNow() < until);
+  /* whatever's still not done we render ourselves */
+  for (int i = 0; i < n; ++i)
+    while ((state = __atomic_load_n(&j->state[i], __ATOMIC_ACQUIRE)) ==
+           MDE_JOB_FREE || state == MDE_JOB_CLAIMED)
+      if (mdeGranularJobsClaim(j, i, state))
+      {
+        mdeGranularJobsTake(j, i);
+        break;
+      }
+  for (int i = 0; i < n; ++i)
+    if (__atomic_load_n(&j->state[i], __ATOMIC_ACQUIRE) == MDE_JOB_DONE)
+      mdeGranularJobsFinish(j, i);
+#else
+  UNUSED(j);
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* how many threads we may render with when asked for -threads- */
+static int mdeGranularThreadsAsked(mdeGranular* g, long threads)
+{
+#ifdef MDE_THREADS
+  if (threads > MDE_MAX_THREADS)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: can't render with more than %d threads.",
+              MDE_MAX_THREADS);
+    threads = MDE_MAX_THREADS;
+  }
+  return threads > 1 ? (int)threads : 1;
+#else
+  if (threads > 1 && g->warnings)
+    mdePost("mdeGranular~: threads aren't available here.");
+  return 1;
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetThreads(mdeGranular* g, long threads)
+{
+  mdeGranularLayout* base = g->layoutSent;
+  mdeGranularLayout* l;
+  int t = mdeGranularThreadsAsked(g, threads);
+
+  /* the jobs are made in a new layout (see LAYOUTS), as for
+   * mdeGranularSetMaxVoices() */
+  if (!base || t == base->threads)
+    return;
+  mdeGranularLock(g);
+  l = mdeGranularLayoutNew(g, 0, t, base->tick);
+  if (l)
+    mdeGranularLayoutSet(g, l);
+  mdeGranularUnlock(g);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetPoolSize(mdeGranular* g, long size)
+{
+#ifdef MDE_THREADS
+  if (size < 0)
+    size = 0;
+  if (size > MDE_MAX_THREADS)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: the pool can't have more than %d threads.",
+              MDE_MAX_THREADS);
+    size = MDE_MAX_THREADS;
+  }
+  pthread_mutex_lock(&mdePool.control);
+  mdeGranularPoolResize((int)size, g->warnings);
+  pthread_mutex_unlock(&mdePool.control);
+#else
+  if (size > 0 && g->warnings)
+    mdePost("mdeGranular~: threads aren't available here.");
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetPoolPriority(mdeGranular* g, long priority)
+{
+#ifdef MDE_THREADS
+  int min = sched_get_priority_min(SCHED_FIFO);
+  int max = sched_get_priority_max(SCHED_FIFO);
+
+  if (priority > 0 && (priority < min || priority > max))
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: pool priority should be 0 or from %d to %d.",
+              min, max);
+    priority = priority < min ? min : max;
+  }
+  pthread_mutex_lock(&mdePool.control);
+  mdePool.priority = priority > 0 ? (int)priority : 0;
+  for (int i = 0; i < mdePool.nThreads; ++i)
+    mdeGranularPoolApplyPriority(mdePool.threads[i], g->warnings && !i);
+  pthread_mutex_unlock(&mdePool.control);
+#else
+  UNUSED(priority);
+  if (g->warnings)
+    mdePost("mdeGranular~: threads aren't available here.");
+#endif
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularPoolSize(void)
+{
+#ifdef MDE_THREADS
+  int n = __atomic_load_n(&mdePool.nThreads, __ATOMIC_RELAXED);
+
+  return n > 0 ? n : 0;
+#else
+  return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+mdefloat* mdeGranularGrainOutput(mdeGranular* g, mdeGranularGrain* gg)
+{
+  long partition;
+
+  if (g->nPartitions > 1)
+  {
+    partition = (gg - g->grains) / MDE_PARTITION_VOICES;
+    return g->partitionSamples +
+      (partition * g->numChannels + gg->channel) * g->nOutputSamples;
+  }
+  return g->channelBuffers[gg->channel];
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainPlan(mdeGranularGrain* gg, mdeGranular* g,
+                          mdefloat* where, int from, long howMany)
+{
+#ifdef MDE_THREADS
+  int voice = (int)(gg - g->grains);
+  int job = voice / MDE_PARTITION_VOICES;
+  mdeGranularJobs* j = g->jobs;
+  mdeGranularRenderList* list = &j->lists[job];
+  mdeGranularRender* r;
+
+  /* most voices have one run per tick, two when they start a new grain in
+   * the middle of it; only very short grains in a long tick need more, in
+   * which case we render the partition ourselves (in the same order) rather
+   * than make room */
+  if (!j->direct[job] && list->n == list->size)
+    mdeGranularJobsFlush(j, job);
+  if (j->direct[job])
+  {
+    mdeGranularGrainRenderRun(gg, g, where + from, g->grainAmps + from,
+                              g->grainScratch, howMany);
+    return;
+  }
+  g->voices[voice].render = list->n;
+  r = &list->runs[list->n++];
+  r->grain = *gg;
+  r->from = from;
+  r->howMany = (int)howMany;
+  r->voice = voice;
+#else
+  UNUSED(where);
+  UNUSED(from);
+#endif
+  mdeGranularGrainAdvance(gg, g, howMany);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularGrainUnplan(mdeGranularGrain* gg, mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  int voice = (int)(gg - g->grains);
+  int job = voice / MDE_PARTITION_VOICES;
+  mdeGranularRenderList* list = &g->jobs->lists[job];
+  int render = g->voices[voice].render;
+
+  /* the index may well be left over from an earlier tick */
+  if (!g->jobs->direct[job] && render < list->n &&
+      list->runs[render].voice == voice)
+    list->runs[render].voice = -1;
+#else
+  UNUSED(gg);
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularRenderPartition(mdeGranular* g, mdeGranularRenderList* list,
+                                mdefloat* out, mdefloat* scratch, int ends)
+{
+  long n = g->nOutputSamples;
+  mdeGranularRender* r = list->runs;
+  mdeGranularGrain grain;
+  mdeGranularGrain* gg;
+
+  for (int i = 0; i < list->n; ++i, ++r)
+  {
+    /* the plan's left as it is: the audio thread may have to render it again
+     * (see mdeGranularJobsRun()) */
+    grain = r->grain;
+    mdeGranularGrainRenderRun(&grain, g, out + grain.channel * n + r->from,
+                              g->grainAmps + r->from, scratch, r->howMany);
+    /* the planner moved the grain on but left its position to us */
+    if (ends)
+      list->ends[i] = grain;
+    else if (r->voice >= 0)
+    {
+      gg = &g->grains[r->voice];
+      gg->current = grain.current;
+      gg->phase = grain.phase;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularMixPartitions(mdeGranular* g, long tickSize)
+{
+  mdefloat* out;
+  mdefloat* in;
+#ifdef MDE_THREADS
+  mdeGranularJobs* j = g->planning ? g->jobs : NULL;
+#endif
+
+  for (int c = 0; c < g->numChannels; ++c)
+  {
+    out = g->channelBuffers[c];
+    if (!out)
+      continue;
+    for (int p = 0; p < g->nPartitions; ++p)
+    {
+      in = g->partitionSamples + ((long)p * g->numChannels + c) * tickSize;
+#ifdef MDE_THREADS
+      /* a partition a worker rendered is in its buffers instead */
+      if (j && __atomic_load_n(&j->state[p], __ATOMIC_RELAXED) ==
+          MDE_JOB_DONE)
+        in = j->outs + ((long)p * g->numChannels + c) * tickSize;
+#endif
+      for (long i = 0; i < tickSize; ++i)
+        out[i] += in[i];
+    }
+  }
+}
+//------------------------------------------------------------------------------
+
+#pragma mark LAYOUTS
+
+/* The grains, the partitions' buffers, the jobs and everything else that's
+ * the size of the voices or the tick used to be reallocated in place by
+ * whichever setter changed one of those, so had to wait for the audio
+ * thread. Now, as with ramps, the sender makes a new layout, based on the
+ * last one sent, and whoever renders the next tick swaps it in (see
+ * mdeGranularLayoutInstall()); the old one's retired for a sender to free.
+ * One with a new tick size has to wait for the start of the host's next
+ * block (see mdeGranularPerform()). Layouts that keep the same number of
+ * voices share the grains with the one before. Layouts and the other things
+ * the renderer hands back start with mdeGranularRetired so that they can be
+ * retired on the same list (the structs are at the top of the file). */
+
+/* hand something back to the senders to free (see mdeGranularCollect()):
+ * called by the renderer, so without a lock */
+static void mdeGranularRetire(mdeGranular* g, mdeGranularRetired* r, int what)
+{
+  r->what = what;
+  r->next = __atomic_load_n(&g->retired, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&g->retired, &r->next, r, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularVoicesUnref(mdeGranular* g, mdeGranularVoiceSet* v)
+{
+  if (!v || --v->users > 0)
+    return;
+  if (v->grains)
+    mdeArenaFree(&g->arena, v->grains);
+  if (v->voices)
+    mdeArenaFree(&g->arena, v->voices);
+  if (v->sleepers)
+    mdeArenaFree(&g->arena, v->sleepers);
+  if (v->sounding)
+    mdeArenaFree(&g->arena, v->sounding);
+  mdeArenaFree(&g->arena, v);
+}
+//------------------------------------------------------------------------------
+
+static mdeGranularVoiceSet* mdeGranularVoicesNew(mdeGranular* g, int mv)
+{
+  mdeGranularVoiceSet* v = mdeArenaCalloc(&g->arena, 1,
+                                          sizeof(mdeGranularVoiceSet),
+                                          "mdeGranularVoicesNew", g->warnings);
+
+  if (!v)
+    return NULL;
+  v->users = 1;
+  v->maxVoices = mv;
+  /* (the arena's blocks are all cache line aligned) */
+  v->grains = mdeArenaCalloc(&g->arena, mv, sizeof(mdeGranularGrain),
+                             "mdeGranularVoicesNew", g->warnings);
+  v->voices = mdeArenaCalloc(&g->arena, mv, sizeof(mdeGranularVoice),
+                             "mdeGranularVoicesNew", g->warnings);
+  v->sleepers = mdeArenaCalloc(&g->arena, mv, sizeof(mdeGranularWake),
+                               "mdeGranularVoicesNew", g->warnings);
+  v->sounding = mdeArenaCalloc(&g->arena, mv, sizeof(int),
+                               "mdeGranularVoicesNew", g->warnings);
+  if (!v->grains || !v->voices || !v->sleepers || !v->sounding)
+  {
+    mdeGranularVoicesUnref(g, v);
+    return NULL;
+  }
+  return v;
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularLayoutFree(mdeGranular* g, mdeGranularLayout* l)
+{
+  mdeGranularVoicesUnref(g, l->voices);
+  if (l->grainAmps)
+    mdeArenaFree(&g->arena, l->grainAmps);
+  if (l->grainScratch)
+    mdeArenaFree(&g->arena, l->grainScratch);
+  if (l->partitionSamples)
+    mdeArenaFree(&g->arena, l->partitionSamples);
+#ifdef MDE_THREADS
+  mdeGranularJobsFree(g, l->jobs);
+#endif
+  mdeArenaFree(&g->arena, l);
+}
+//------------------------------------------------------------------------------
+
+static void mdeGranularLayoutUnref(mdeGranular* g, mdeGranularLayout* l)
+{
+  if (l && --l->users == 0)
+    mdeGranularLayoutFree(g, l);
+}
+//------------------------------------------------------------------------------
+
+/* make a layout like the last one sent but with -maxVoices- new voices (0 to
+ * share its voices), -threads- and a tick of -tick- samples. Called by
+ * senders holding the queue's lock; NULL if there's no memory. If the
+ * threads can't be had we carry on without them. */
+static mdeGranularLayout* mdeGranularLayoutNew(mdeGranular* g, int maxVoices,
+                                               int threads, long tick)
+{
+  mdeGranularLayout* base = g->layoutSent;
+  mdeGranularLayout* l = mdeArenaCalloc(&g->arena, 1,
+                                        sizeof(mdeGranularLayout),
+                                        "mdeGranularLayoutNew", g->warnings);
+  int n;
+
+  if (!l)
+    return NULL;
+  l->seq = base ? base->seq + 1 : 1;
+  l->users = 1;
+  l->tick = tick;
+  l->threads = 1;
+  l->nPartitions = 1;
+  l->slot = g->poolSlot;
+  if (maxVoices > 0 || !base)
+    l->voices = mdeGranularVoicesNew(g, maxVoices > 0 ? maxVoices : 1);
+  else
+  {
+    l->voices = base->voices;
+    ++l->voices->users;
+  }
+  if (!l->voices)
+    goto fail;
+  if (tick > 0)
+  {
+    l->grainAmps = mdeArenaCalloc(&g->arena, tick, sizeof(mdefloat),
+                                  "mdeGranularLayoutNew", g->warnings);
+    l->grainScratch = mdeArenaCalloc(&g->arena, tick, sizeof(mdefloat),
+                                     "mdeGranularLayoutNew", g->warnings);
+    if (!l->grainAmps || !l->grainScratch)
+      goto fail;
+    /* each partition mixes into its own buffers (see THREADS) */
+    n = (l->voices->maxVoices + MDE_PARTITION_VOICES - 1) /
+      MDE_PARTITION_VOICES;
+    if (n > 1 && g->numChannels > 0)
+    {
+      l->partitionSamples =
+        mdeArenaCalloc(&g->arena, n * g->numChannels * tick, sizeof(mdefloat),
+                       "mdeGranularLayoutNew", g->warnings);
+      if (l->partitionSamples)
+        l->nPartitions = n;
+    }
+  }
+#ifdef MDE_THREADS
+  if (threads > 1)
+  {
+    if (g->poolSlot < 0 && !mdeGranularPoolClaim(g))
+    {
+      if (g->warnings)
+        mdePost("mdeGranular~: too many objects are rendering with "
+                "threads (the most is %d).", MDE_POOL_SLOTS);
+    }
+    else
+    {
+      l->slot = g->poolSlot;
+      l->threads = threads;
+      l->jobs = mdeGranularJobsNew(g, l);
+      if (!l->jobs)
+      {
+        if (g->warnings)
+          mdePost("mdeGranular~: no memory for threads; rendering without.");
+        l->threads = 1;
+      }
+    }
+  }
+#else
+  UNUSED(threads);
+#endif
+  return l;
+fail:
+  mdeGranularLayoutFree(g, l);
+  return NULL;
+}
+//------------------------------------------------------------------------------
+
+/* -l- is the last layout sent: the next is based on it */
+static void mdeGranularLayoutSent(mdeGranular* g, mdeGranularLayout* l)
+{
+  ++l->users;
+  mdeGranularLayoutUnref(g, g->layoutSent);
+  g->layoutSent = l;
+}
+//------------------------------------------------------------------------------
+
+/* swap in -l- (called by the renderer at the start of a tick, when no worker
+ * is still rendering for us, or by mdeGranularLayoutSet()) and retire the
+ * layout it replaces */
+static void mdeGranularLayoutInstall(mdeGranular* g, mdeGranularLayout* l)
+{
+  mdeGranularLayout* old = g->layout;
+  mdeGranularVoiceSet* v = l->voices;
+
+  if (old && l->seq <= old->seq)
+  {
+    mdeGranularRetire(g, &l->retired, MDE_RETIRED_LAYOUT);
+    return;
+  }
+  /* the tick only changes at the start of the host's block, when nothing
+   * else is rendering (see mdeGranularPerform()), so it's only written then */
+  if (g->nOutputSamples != l->tick)
+    g->nOutputSamples = l->tick;
+  g->grainAmps = l->grainAmps;
+  g->grainScratch = l->grainScratch;
+  g->partitionSamples = l->partitionSamples;
+  g->nPartitions = l->nPartitions;
+  g->jobs = l->jobs;
+  g->threads = l->threads;
+#ifdef MDE_THREADS
+  /* the workers find them in our slot (and the old ones are gone from it
+   * before they're freed) */
+  if (l->slot >= 0)
+    __atomic_store_n(&mdePool.slots[l->slot].jobs, l->jobs,
+                     __ATOMIC_SEQ_CST);
+#endif
+  __atomic_store_n(&g->layout, l, __ATOMIC_RELEASE);
+  if (!old || v != old->voices)
+  {
+    g->maxVoices = v->maxVoices;
+    g->grains = v->grains;
+    g->voices = v->voices;
+    g->sleepers = v->sleepers;
+    g->sounding = v->sounding;
+    g->nSleepers = 0;
+    g->nSounding = 0;
+    if (g->maxVoices < g->activeVoices)
+      g->activeVoices = g->maxVoices;
+    mdeGranularActiveVoices(g, (mdefloat)g->activeVoices, 0);
+    /* init each grain/voice */
+    mdeGranularInitGrains(g);
+  }
+  if (old)
+    mdeGranularRetire(g, &old->retired, MDE_RETIRED_LAYOUT);
+}
+//------------------------------------------------------------------------------
+
+/* swap in -l- straight away: only whilst nothing's rendering */
+static void mdeGranularLayoutSet(mdeGranular* g, mdeGranularLayout* l)
+{
+  mdeGranularLayoutSent(g, l);
+  mdeGranularJobsWait(g);
+  mdeGranularLayoutInstall(g, l);
+  mdeGranularCollect(g);
+}
+//------------------------------------------------------------------------------
+
+/* make the layout for a MAX_VOICES or THREADS message. Called by senders
+ * holding the queue's lock; returns 0 if the message should be dropped (it
+ * wouldn't change anything or there's no memory) */
+static int mdeGranularLayoutSend(mdeGranular* g, mdeGranularCommand* c)
+{
+  mdeGranularLayout* base = g->layoutSent;
+  int n;
+
+  if (c->what != MDE_CMD_MAX_VOICES && c->what != MDE_CMD_THREADS)
+    return 1;
+  if (!base)
+    return 0;
+  if (c->what == MDE_CMD_MAX_VOICES)
+  {
+    n = (int)c->f[0];
+    if (n <= 0)
+      return 0;
+    c->layout = mdeGranularLayoutNew(g, n, base->threads, base->tick);
+  }
+  else
+  {
+    n = mdeGranularThreadsAsked(g, (long)c->f[0]);
+    if (n == base->threads)
+      return 0;
+    c->layout = mdeGranularLayoutNew(g, 0, n, base->tick);
+  }
+  return c->layout != NULL;
+}
+//------------------------------------------------------------------------------
+
+/* leave -l- (with a new tick size) for mdeGranularPerform() to swap in at
+ * the start of the host's next block, instead of any still waiting there */
+static void mdeGranularLayoutPost(mdeGranular* g, mdeGranularLayout* l)
+{
+  mdeGranularLayoutSent(g, l);
+  mdeGranularLayoutUnref(g, __atomic_exchange_n(&g->layoutNext, l,
+                                                __ATOMIC_ACQ_REL));
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularPerform() at the start of the host's block, when
+ * nothing else is rendering */
+static void mdeGranularLayoutPoll(mdeGranular* g)
+{
+  mdeGranularLayout* l = __atomic_exchange_n(&g->layoutNext, NULL,
+                                             __ATOMIC_ACQUIRE);
+
+  if (l)
+    mdeGranularLayoutInstall(g, l);
+}
+//------------------------------------------------------------------------------
+
+/* whether the layout a message carries has to wait for the start of the
+ * host's block, i.e. it's new and changes the tick */
+static int mdeGranularLayoutWaits(mdeGranular* g, mdeGranularLayout* l)
+{
+  return l && l->tick != g->nOutputSamples &&
+    (!g->layout || l->seq > g->layout->seq);
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularFree(), once nothing's rendering: the layouts
+ * installed and waiting are retired like any other, and freed with the last
+ * one sent */
+static void mdeGranularLayoutsFree(mdeGranular* g)
+{
+  mdeGranularLayoutUnref(g, g->layoutNext);
+  g->layoutNext = NULL;
+  if (g->layout)
+  {
+#ifdef MDE_THREADS
+    if (g->layout->slot >= 0)
+      __atomic_store_n(&mdePool.slots[g->layout->slot].jobs, NULL,
+                       __ATOMIC_SEQ_CST);
+#endif
+    mdeGranularRetire(g, &g->layout->retired, MDE_RETIRED_LAYOUT);
+    g->layout = NULL;
+  }
+  mdeGranularCollect(g);
+  mdeGranularLayoutUnref(g, g->layoutSent);
+  g->layoutSent = NULL;
+  mdeGranularPoolRelease(g);
+  g->grains = NULL;
+  g->voices = NULL;
+  g->sleepers = NULL;
+  g->sounding = NULL;
+  g->nSleepers = 0;
+  g->nSounding = 0;
+  g->grainAmps = NULL;
+  g->grainScratch = NULL;
+  g->partitionSamples = NULL;
+  g->nPartitions = 1;
+  g->jobs = NULL;
+  g->threads = 1;
+}
+//------------------------------------------------------------------------------
+
+#pragma mark SOURCES
+
+/* New samples to granulate (mdeGranularInit3(), a sound file, a copy of a
+ * buffer~) used to be set up by whoever gave them to us, whilst holding the
+ * lock that kept the audio thread from rendering: growing the live buffer,
+ * mapping its mirror, unmapping the last file... Now the sender makes all
+ * that in a source and whoever renders the next tick only swaps its
+ * pointers with ours; the old ones go back to a sender in the source to be
+ * freed. (The struct's at the top of the file.) */
+
+/* called by senders, for sources that were installed or never will be */
+static void mdeGranularSourceFree(mdeGranular* g, mdeGranularSource* s)
+{
+  if (s->theSamples)
+    mdeGranularFreeSamples(g, s->theSamples);
+  mdeGranularUnmapMirror(s->mirror, s->nMirror);
+#ifdef MDE_MAP_FILES
+  if (s->fileMap)
+    munmap(s->fileMap, (size_t)s->fileMapBytes);
+#endif
+  if (s->clearMap)
+    mdeArenaFree(&g->arena, s->clearMap);
+  mdeArenaFree(&g->arena, s);
+}
+//------------------------------------------------------------------------------
+
+/* make a source for mdeGranularInit3()'s arguments. For live input that's a
+ * bigger live buffer if it needs one (see mdeGranularNeedLiveBuffer()), a
+ * mirror if we're to use one and a new clear map for the ring. Called by
+ * senders holding the queue's lock; NULL (having warned) if we couldn't. */
+static mdeGranularSource* mdeGranularSourceNew(mdeGranular* g,
+                                               mdefloat* samples,
+                                               mdefloat samplesMS,
+                                               mdefloat numSamples)
+{
+  mdeGranularSource* s = mdeArenaCalloc(&g->arena, 1,
+                                        sizeof(mdeGranularSource),
+                                        "mdeGranularSourceNew", g->warnings);
+  long n = (long)numSamples;
+  long room = __atomic_load_n(&g->nAllocatedBufferSamples, __ATOMIC_ACQUIRE);
+  long ring = n;
+  long size;
+
+  if (!s)
+    return NULL;
+  s->samples = samples;
+  s->samplesMS = samplesMS;
+  s->numSamples = numSamples;
+  /* a file we'd mapped is no longer needed when something else is to be
+   * granulated (mdeGranularMapFile() gives us the new one) */
+  s->newFile = 1;
+  /* for mdeGranularSetMirrorLiveBuffer() */
+  g->liveSentMS = samples ? (mdefloat)0.0 : samplesMS;
+  g->liveSentN = samples ? 0 : n;
+  if (samples)
+  {
+    /* the mirror and clear map are only for live input */
+    return s;
+  }
+  if (n > room && !__atomic_load_n(&g->liveBufferFixed, __ATOMIC_ACQUIRE))
+  {
+    size = n + mdeGranularLiveHeadroom(g);
+    s->theSamples = mdeGranularAllocSamples(g, size, g->warnings);
+    if (s->theSamples)
+    {
+      s->newLive = 1;
+      s->nTheSamples = size;
+      s->theSamplesMS = samples2ms(g->samplingRate, size);
+      room = size;
+    }
+  }
+  if (n > room)
+  {
+    mdeGranularLiveBufferWarn(g, samples2ms(g->samplingRate, room),
+                              samplesMS);
+    mdeGranularSourceFree(g, s);
+    return NULL;
+  }
+  /* a mirror, or none (the old one's unmapped either way) */
+  s->newMirror = 1;
+  size = g->mirrorLive ? mdeGranularMirrorSize(n) : 0;
+  if (size)
+  {
+    s->mirror = mdeGranularMapMirror(size, g->warnings);
+    if (s->mirror)
+    {
+      s->nMirror = size;
+      ring = size;
+    }
+    else if (g->warnings)
+      mdePost("mdeGranular~: falling back to an ordinary live buffer.");
+  }
+  /* one entry per chunk of the ring; if we can't have them we'll just clear
+   * it all at once like we used to */
+  s->newClearMap = 1;
+  size = (ring + MDE_CLEAR_CHUNK - 1) / MDE_CLEAR_CHUNK;
+  if (size > 0)
+    s->clearMap = mdeArenaCalloc(&g->arena, size, sizeof(unsigned),
+                                 "mdeGranularSourceNew", 0);
+  s->nClearMap = s->clearMap ? size : 0;
+  return s;
+}
+//------------------------------------------------------------------------------
+
+/* the grain length (in samples) to change to when the -n- samples (-ms-)
+ * to be granulated are fewer than there are in a grain of -grainLengthMS- */
+static int mdeGranularShortBuffer(mdeGranular* g, long n, mdefloat ms,
+                                  mdefloat grainLengthMS, char warn)
+{
+  int ninetypc = (int)((mdefloat)n * (mdefloat)0.9);
+
+  if (warn)
+  {
+    mdePost("mdeGranular~:");
+    mdePost("              length of buffer (%fms) to granulate is", ms);
+    mdePost("              less than the grain length (%fms). Changing grain",
+            grainLengthMS);
+    mdePost("              length to 90 per cent of buffer size (%fms).",
+            samples2ms(g->samplingRate, ninetypc));
+  }
+  return ninetypc;
+}
+//------------------------------------------------------------------------------
+
+/* how many samples (and -ms-) there'll be to granulate once -s- is swapped
+ * in */
+static long mdeGranularSourceLength(mdeGranular* g, mdeGranularSource* s,
+                                    mdefloat* ms)
+{
+  /* the ring has to be a whole number of pages (see below) */
+  if (!s->samples && s->mirror)
+  {
+    *ms = samples2ms(g->samplingRate, s->nMirror);
+    return s->nMirror;
+  }
+  *ms = s->samplesMS;
+  return (long)s->numSamples;
+}
+//------------------------------------------------------------------------------
+
+/* swap in -s- (called by the renderer at the start of a tick, which
+ * mustn't -warn-, or by mdeGranularInit3()) and retire it with what it
+ * replaced; returns 1 if it was refused */
+static int mdeGranularSourceInstall(mdeGranular* g, mdeGranularSource* s,
+                                    char warn)
+{
+  mdefloat* samples = s->samples;
+  mdefloat samplesMS = s->samplesMS;
+  mdefloat numSamples = s->numSamples;
+  mdefloat* p;
+  unsigned* map;
+  void* file;
+  long n;
+  long written = -1;
+  mdefloat ms;
+
+  if (!samples)
+  {
+    /* the live buffer might have been resized since it was sent */
+    if (!s->newLive && (long)numSamples > g->nAllocatedBufferSamples)
+    {
+      if (warn)
+        mdeGranularLiveBufferWarn(g, g->AllocatedBufferMS, samplesMS);
+      mdeGranularRetire(g, &s->retired, MDE_RETIRED_SOURCE);
+      return 1;
+    }
+    /* the ring's about to change. A new buffer (or mapping) is clean, but
+     * if it's to be the one we're still clearing, carry on clearing it a few
+     * chunks a tick over the new ring (below); only if there's no map for
+     * that do we have to finish now */
+    if (s->newLive || s->mirror)
+      g->clearing = 0;
+    else if (g->clearing && !s->clearMap)
+      mdeGranularClearFinish(g);
+    else if (g->clearing)
+      /* what's been recorded into it since it was cleared (none, if that
+       * was a mapping) */
+      written = g->samples != g->theSamples ? 0 :
+        g->clearWritten < g->nBufferSamples ? g->clearWritten :
+        g->nBufferSamples;
+  }
+  /* a buffer we're given mustn't be cleared, and the clear map's only for
+   * the ring */
+  else
+    g->clearing = 0;
+  if (s->newFile)
+  {
+    file = g->fileMap;
+    g->fileMap = s->fileMap;
+    s->fileMap = file;
+    n = g->fileMapBytes;
+    g->fileMapBytes = s->fileMapBytes;
+    s->fileMapBytes = n;
+    p = g->fileSamples;
+    g->fileSamples = s->fileSamples;
+    s->fileSamples = p;
+    n = g->nFileSamples;
+    g->nFileSamples = s->nFileSamples;
+    s->nFileSamples = n;
+  }
+  if (s->newLive)
+  {
+    p = g->theSamples;
+    g->theSamples = s->theSamples;
+    s->theSamples = p;
+    n = g->nAllocatedBufferSamples;
+    __atomic_store_n(&g->nAllocatedBufferSamples, s->nTheSamples,
+                     __ATOMIC_RELEASE);
+    s->nTheSamples = n;
+    ms = g->AllocatedBufferMS;
+    g->AllocatedBufferMS = s->theSamplesMS;
+    s->theSamplesMS = ms;
+  }
+  if (s->newMirror)
+  {
+    p = g->mirrorSamples;
+    g->mirrorSamples = s->mirror;
+    s->mirror = p;
+    n = g->nMirrorSamples;
+    g->nMirrorSamples = s->nMirror;
+    s->nMirror = n;
+  }
+  if (s->newClearMap)
+  {
+    map = g->clearMap;
+    g->clearMap = s->clearMap;
+    s->clearMap = map;
+    n = g->nClearMap;
+    g->nClearMap = s->nClearMap;
+    s->nClearMap = n;
+    g->clearEpoch = 0;
+  }
+  /* we were given the name of a buffer to granulate */
+  if (samples)
+  {
+    g->samples = samples;
+    g->live = 0;
+  }
+  else/* live input */
+  {
+    g->samples = g->theSamples;
+    g->live = 1;
+    g->liveIndex = 0;
+    if (g->mirrorSamples)
+    {
+      /* the ring has to be a whole number of pages so it might be a little
+       * longer than asked for */
+      g->samples = g->mirrorSamples;
+      numSamples = (mdefloat)g->nMirrorSamples;
+      samplesMS = samples2ms(g->samplingRate, g->nMirrorSamples);
+    }
+  }
+  g->samplesMirrored = g->samples && g->samples == g->mirrorSamples;
+  g->nBufferSamples = (long)numSamples;
+  g->BufferSamplesMS = samplesMS;
+  /* our own buffer (live, or a copy of a Max buffer~) has guard samples
+   * which have to be mirrored now we know where the end is; a PD array
+   * doesn't */
+  g->samplesGuarded = g->samples && g->samples == g->theSamples;
+  if (g->samplesGuarded)
+    mdeGranularMirrorGuards(g->samples, g->nBufferSamples);
+  /* whatever was being copied into a new live buffer may have changed */
+  if (written >= 0)
+  {
+    /* recording starts again at the top of the ring, and all of the new
+     * map's dirty: ClearChunk() leaves what was written alone */
+    g->clearEpoch = 1;
+    g->clearing = 1;
+    g->clearWritten = written;
+    g->clearNext = 0;
+  }
+  mdeGranularResizeRestart(g);
+  /* the DBL_MIN triggers setting the end to the end of the sample buffer */
+  mdeGranularSamplesEndMS(g, (mdefloat)DBL_MIN, warn);
+  /* the DBL_MIN triggers setting the start to the beginning of the sample
+   * buffer */
+  mdeGranularSamplesStartMS(g, (mdefloat)DBL_MIN, warn);
+  if (g->nBufferSamples < g->grainLength)
+  {
+    g->grainLength = mdeGranularShortBuffer(g, g->nBufferSamples,
+                                            g->BufferSamplesMS,
+                                            g->grainLengthMS, warn);
+    g->grainLengthMS = samples2ms(g->samplingRate, g->grainLength);
+  }
+  mdeGranularInitGrains(g);
+  mdeGranularRetire(g, &s->retired, MDE_RETIRED_SOURCE);
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+/* queue -s- (or without a queue, swap it in now); returns 1 if it was
+ * refused */
+static int mdeGranularSourceSend(mdeGranular* g, mdeGranularSource* s)
+{
+  mdeGranularCommand c;
+
+  memset(&c, 0, sizeof(c));
+  c.what = MDE_CMD_SAMPLES;
+  c.source = s;
+  if (mdeGranularQueuePush(g, &c, NULL))
+    return 0;
+  mdeGranularJobsWait(g);
+  /* (the sender's already been warned: see mdeGranularCheck()) */
+  return mdeGranularSourceInstall(g, s, 0);
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularSendSamples(mdeGranular* g, mdefloat* samples,
+                           mdefloat samplesMS, mdefloat numSamples)
+{
+  mdeGranularSource* s;
+  int ret = 1;
+
+  mdeGranularLock(g);
+  s = mdeGranularSourceNew(g, samples, samplesMS, numSamples);
+  if (s)
+    ret = mdeGranularSourceSend(g, s);
+  mdeGranularCollect(g);
+  mdeGranularUnlock(g);
+  return ret;
+}
+//------------------------------------------------------------------------------
+
+/* the live buffer (of -allocatedMS-) is too small for a copy of a buffer~
+ * -nsamps- long */
+static void mdeGranularCopyWarn(mdeGranular* g, mdefloat allocatedMS,
+                                long nsamps)
+{
+  if (g->warnings)
+  {
+    mdePost("mdeGranular~:");
+    mdePost("              The allocated live sample buffer is only ");
+    mdePost("              %fms but your buffer~ length is %fms ",
+            allocatedMS, (mdefloat)nsamps / (g->samplingRate * .001));
+    mdePost("              (assuming the buffer~'s sampling rate is the ");
+    mdePost("              same as the dac~'s).");
+    mdePost("              Please send the object a \"MaxLiveBufferMS\" ");
+    mdePost("              message to increase this (preferably do this at");
+    mdePost("              the beginning of your performance, allocating ");
+    mdePost("              enough for all the performance's needs).");
+  }
+}
+//------------------------------------------------------------------------------
+
+int mdeGranularSendFloatSamples(mdeGranular* g, float* in, long nsamps)
+{
+  mdeGranularSource* s = NULL;
+  mdefloat* samples;
+  long size;
+  long num = nsamps;
+  int ret = 1;
+
+  mdeGranularLock(g);
+  /* a new buffer the size of the live buffer, or bigger if it's not fixed
+   * and we need it to be (see mdeGranularNeedLiveBuffer()) */
+  size = __atomic_load_n(&g->nAllocatedBufferSamples, __ATOMIC_ACQUIRE);
+  if (num > size && !__atomic_load_n(&g->liveBufferFixed, __ATOMIC_ACQUIRE))
+    size = num + mdeGranularLiveHeadroom(g);
+  if (num > size)
+  {
+    mdeGranularCopyWarn(g, samples2ms(g->samplingRate, size), nsamps);
+    num = size;
+  }
+  samples = num > 0 && in ?
+    mdeGranularAllocSamples(g, size, g->warnings) : NULL;
+  if (samples)
+  {
+    for (long i = 0; i < num; ++i)
+      samples[i] = (mdefloat)in[i];
+    s = mdeGranularSourceNew(g, samples, samples2ms(g->samplingRate, num),
+                             (mdefloat)num);
+    if (s)
+    {
+      s->newLive = 1;
+      s->theSamples = samples;
+      s->nTheSamples = size;
+      s->theSamplesMS = samples2ms(g->samplingRate, size);
+      ret = mdeGranularSourceSend(g, s);
+    }
+    else
+      mdeGranularFreeSamples(g, samples);
+  }
+  mdeGranularCollect(g);
+  mdeGranularUnlock(g);
+  return ret;
+}
+//------------------------------------------------------------------------------
+
+#pragma mark RESIZING THE LIVE BUFFER
+
+/* MaxLiveBufferMS used to allocate (and zero) the new buffer there and then,
+ * on whichever thread sent it, and only when we were off. Now
+ * mdeGranularSend() starts a thread which allocates it and exits. Whoever
+ * renders the ticks then copies what's been recorded so far into it, a few
+ * ticks' worth a tick (writing new input into both buffers meanwhile), and
+ * swaps it in at the start of a tick. The next sender frees the old one and
+ * reports anything that went wrong (see mdeGranularResizeCollect()), as
+ * whoever renders the ticks can neither free nor post. Only one resize can
+ * be under way at a time. Without a thread the sender allocates it itself. */
+
+enum
+{
+  /* the thread's allocating the buffer */
+  MDE_RESIZE_ALLOCATING,
+  /* it's ready to be copied into... */
+  MDE_RESIZE_READY,
+  /* ...which is under way */
+  MDE_RESIZE_COPYING,
+  /* it's been swapped in and old is for the senders to free */
+  MDE_RESIZE_SWAPPED,
+  /* it wasn't wanted after all (see mdeGranularLiveBufferSizeOK()) */
+  MDE_RESIZE_REFUSED,
+  /* the thread couldn't allocate it */
+  MDE_RESIZE_FAILED,
+  /* the senders have finished with it */
+  MDE_RESIZE_IDLE
+};
+
+struct _mdeGranularResize
+{
+#ifdef MDE_THREADS
+  pthread_t thread;
+#endif
+  /* 1 whilst there's a thread to join */
+  char joinable;
+  /* 1 until the senders have finished with the buffers */
+  char busy;
+  int state;
+  mdefloat sizeMS;
+  long n;
+  /* when it's refused, the grain length and what was being granulated (for
+   * mdeGranularLiveBufferSizeWarn()) */
+  mdefloat refusedGrainMS;
+  mdefloat refusedBufferMS;
+  /* the new buffer and, once it's swapped in, the old one */
+  mdefloat* samples;
+  mdefloat* old;
+  /* how many of the samples in use have been copied into the new buffer */
+  long copied;
+};
+//------------------------------------------------------------------------------
+
+#ifdef MDE_THREADS
+static void* mdeGranularResizeThread(void* arg)
+{
+  mdeGranular* g = (mdeGranular*)arg;
+  mdeGranularResize* r = g->resize;
+
+  /* no warnings from this thread (PD's post() isn't thread-safe): the next
+   * sender reports failure */
+  r->samples = mdeGranularAllocSamples(g, r->n, 0);
+  __atomic_store_n(&r->state, r->samples ? MDE_RESIZE_READY
+                   : MDE_RESIZE_FAILED, __ATOMIC_RELEASE);
+  return NULL;
+}
+#endif
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularSend() when there's a queue */
+static void mdeGranularResizeStart(mdeGranular* g, mdefloat sizeMS)
+{
+  mdeGranularResize* r;
+
+  /* senders take turns */
+  mdeGranularLock(g);
+  mdeGranularCollect(g);
+  r = g->resize;
+  if (!r)
+  {
+    r = mdeArenaCalloc(&g->arena, 1, sizeof(mdeGranularResize),
+                       "mdeGranularResizeStart", g->warnings);
+    if (!r)
+    {
+      mdeGranularUnlock(g);
+      return;
+    }
+    __atomic_store_n(&g->resize, r, __ATOMIC_RELEASE);
+  }
+  if (__atomic_load_n(&r->busy, __ATOMIC_ACQUIRE))
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: the live buffer's still being resized. "
+              "Ignoring.");
+    mdeGranularUnlock(g);
+    return;
+  }
+  /* (what's granulated is checked again as it's copied) */
+  if (g->sent.grainLengthMS > sizeMS)
+  {
+    mdeGranularLiveBufferSizeWarn(g, sizeMS, g->sent.grainLengthMS,
+                                  g->sent.BufferSamplesMS);
+    mdeGranularUnlock(g);
+    return;
+  }
+  r->sizeMS = sizeMS;
+  r->n = ms2samples(g->samplingRate, sizeMS);
+  r->copied = 0;
+  r->busy = 1;
+  r->joinable = 0;
+#ifdef MDE_THREADS
+  __atomic_store_n(&r->state, MDE_RESIZE_ALLOCATING, __ATOMIC_RELEASE);
+  if (!pthread_create(&r->thread, NULL, mdeGranularResizeThread, g))
+    r->joinable = 1;
+#endif
+  if (!r->joinable)
+  {
+    /* no thread: allocate it here, and report failure straight away */
+    r->samples = mdeGranularAllocSamples(g, r->n, g->warnings);
+    if (r->samples)
+      __atomic_store_n(&r->state, MDE_RESIZE_READY, __ATOMIC_RELEASE);
+    else
+    {
+      __atomic_store_n(&r->state, MDE_RESIZE_IDLE, __ATOMIC_RELEASE);
+      r->busy = 0;
+      if (g->warnings)
+        mdePost("mdeGranular~: couldn't allocate a new live buffer.");
+    }
+  }
+  mdeGranularUnlock(g);
+}
+//------------------------------------------------------------------------------
+
+/* join the thread once it's allocated the buffer, then free whichever one
+ * the renderer's finished with and say why if it wasn't swapped in (called
+ * by senders holding the queue's lock) */
+static void mdeGranularResizeCollect(mdeGranular* g)
+{
+  mdeGranularResize* r = g->resize;
+  int state;
+
+  if (!r || !__atomic_load_n(&r->busy, __ATOMIC_ACQUIRE))
+    return;
+  state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+  if (state == MDE_RESIZE_ALLOCATING)
+    return;
+#ifdef MDE_THREADS
+  /* (it's done all it's going to) */
+  if (r->joinable)
+  {
+    pthread_join(r->thread, NULL);
+    r->joinable = 0;
+  }
+#endif
+  if (state == MDE_RESIZE_SWAPPED)
+    mdeGranularFreeSamples(g, r->old);
+  else if (state == MDE_RESIZE_REFUSED)
+  {
+    mdeGranularFreeSamples(g, r->samples);
+    mdeGranularLiveBufferSizeWarn(g, r->sizeMS, r->refusedGrainMS,
+                                  r->refusedBufferMS);
+  }
+  else if (state == MDE_RESIZE_FAILED)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: couldn't allocate a new live buffer.");
+  }
+  else
+    return;
+  r->samples = NULL;
+  r->old = NULL;
+  __atomic_store_n(&r->state, MDE_RESIZE_IDLE, __ATOMIC_RELAXED);
+  __atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/* called at the start of each tick: copy another chunk into the new buffer
+ * and once it's all there, swap it in */
+static void mdeGranularResizeStep(mdeGranular* g)
+{
+  mdeGranularResize* r = __atomic_load_n(&g->resize, __ATOMIC_ACQUIRE);
+  long n;
+  long run;
+
+  if (!r)
+    return;
+  switch (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE))
+  {
+    case MDE_RESIZE_READY:
+      r->copied = 0;
+      __atomic_store_n(&r->state, MDE_RESIZE_COPYING, __ATOMIC_RELEASE);
+      break;
+    case MDE_RESIZE_COPYING:
+      break;
+    default:
+      return;
+  }
+  /* checked every tick as what we're granulating might change meanwhile */
+  if (!mdeGranularLiveBufferSizeOK(g, r->sizeMS, r->n, 0))
+  {
+    r->refusedGrainMS = g->grainLengthMS;
+    r->refusedBufferMS = g->BufferSamplesMS;
+    __atomic_store_n(&r->state, MDE_RESIZE_REFUSED, __ATOMIC_RELEASE);
+    return;
+  }
+  /* and not until it's been cleared (see mdeGranularClearTheSamples()) */
+  if (g->clearing)
+    return;
+  /* only our own buffer's contents are needed: a PD array or the mirrored
+   * ring (or nothing at all) is granulated where it is */
+  n = g->theSamples && g->samples == g->theSamples ? g->nBufferSamples : 0;
+  run = n - r->copied;
+  if (run > MDE_RESIZE_TICKS * g->nOutputSamples)
+    run = MDE_RESIZE_TICKS * g->nOutputSamples;
+  if (run > 0)
+  {
+    memcpy(r->samples + r->copied, g->theSamples + r->copied,
+           run * sizeof(mdefloat));
+    r->copied += run;
+  }
+  if (r->copied < n)
+    return;
+  r->old = mdeGranularSwapLiveBuffer(g, r->samples, r->n, r->sizeMS);
+  __atomic_store_n(&g->liveBufferFixed, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->state, MDE_RESIZE_SWAPPED, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularCopyInputSamples() before it writes -nsamps- samples
+ * into the ring at -li-: whilst we're copying, write them into the new buffer
+ * too (if they're somewhere not copied yet, they will be again anyway) */
+static void mdeGranularResizeInput(mdeGranular* g, mdefloat* in, long nsamps,
+                                   long li)
+{
+  mdeGranularResize* r = __atomic_load_n(&g->resize, __ATOMIC_ACQUIRE);
+  long end = g->nBufferSamples;
+  long run;
+
+  if (!r || __atomic_load_n(&r->state, __ATOMIC_RELAXED) !=
+      MDE_RESIZE_COPYING || g->samples != g->theSamples)
+    return;
+  while (nsamps > 0)
+  {
+    run = end - li;
+    if (run > nsamps)
+      run = nsamps;
+    memcpy(r->samples + li, in, run * sizeof(mdefloat));
+    in += run;
+    nsamps -= run;
+    li += run;
+    if (li == end)
+      li = 0;
+  }
+}
+//------------------------------------------------------------------------------
+
+/* the samples being copied have been changed other than by new input, so
+ * start copying them again */
+static void mdeGranularResizeRestart(mdeGranular* g)
+{
+  mdeGranularResize* r = __atomic_load_n(&g->resize, __ATOMIC_ACQUIRE);
+
+  if (r && __atomic_load_n(&r->state, __ATOMIC_RELAXED) == MDE_RESIZE_COPYING)
+    r->copied = 0;
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularFree() */
+static void mdeGranularResizeFree(mdeGranular* g)
+{
+  mdeGranularResize* r = g->resize;
+
+  if (!r)
+    return;
+#ifdef MDE_THREADS
+  /* (it won't be long: all it does is allocate) */
+  if (r->joinable)
+    pthread_join(r->thread, NULL);
+#endif
+  if (r->busy)
+  {
+    if (r->state == MDE_RESIZE_SWAPPED)
+      mdeGranularFreeSamples(g, r->old);
+    else
+      mdeGranularFreeSamples(g, r->samples);
+  }
+  mdeArenaFree(&g->arena, r);
+  g->resize = NULL;
+}
+//------------------------------------------------------------------------------
+
+#pragma mark MESSAGES
+
+/* Messages from the host (mdeGranularSend() etc.) are never applied straight
+ * away, as in Max they can arrive on another thread whilst we're rendering.
+ * Instead they're put on a queue, stamped with the number of ticks started
+ * so far, and whoever renders the next tick applies them before it does so:
+ * the audio thread, or when rendering ahead our own thread, which applies
+ * only those stamped with the tick it's rendering or earlier. The queue is a
+ * ring with a single reader; senders are serialised by its lock (in Max
+ * there may be two of them), which the reader never takes: it never waits
+ * for anything. Whatever a message needs allocating (ramps, layouts,
+ * sources) is made by the sender and only swapped in by the reader, which
+ * hands back what it replaces on the retired lists for the next sender to
+ * free (see mdeGranularCollect()). */
+
+struct _mdeGranularQueue
+{
+#ifdef MDE_THREADS
+  /* (recursive) held by senders: see mdeGranularLock() */
+  pthread_mutex_t send;
+#endif
+  /* 1 once we've warned that the queue's full, until there's room again */
+  char warned;
+  /* the next command (and list) to apply and the next free one: the reader
+   * writes the heads, the senders the tails */
+  uint64_t head;
+  uint64_t tail;
+  uint64_t listHead;
+  uint64_t listTail;
+  mdeGranularCommand commands[MDE_COMMANDS];
+  /* lists are used in the same order as the messages that carry them */
+  mdefloat lists[MDE_COMMAND_LISTS][MAXTRANSPOSITIONS];
+};
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularInit1(); if it fails messages are applied straight
+ * away, as they used to be */
+static void mdeGranularQueueInit(mdeGranular* g)
+{
+  mdeGranularQueue* q = mdeArenaCalloc(&g->arena, 1, sizeof(mdeGranularQueue),
+                                       "mdeGranularQueueInit", g->warnings);
+#ifdef MDE_THREADS
+  pthread_mutexattr_t attr;
+
+  if (q)
+  {
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&q->send, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
+#endif
+  g->queue = q;
+  g->ticks = 0;
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularFree() */
+static void mdeGranularQueueFree(mdeGranular* g)
+{
+  mdeGranularQueue* q = g->queue;
+  mdeGranularCommand* c;
+
+  if (!q)
+    return;
+  /* what was made for messages that were never applied */
+  for (uint64_t i = q->head; i != q->tail; ++i)
+  {
+    c = &q->commands[i & (MDE_COMMANDS - 1)];
+    if (c->ramp)
+      mdeArenaFree(&g->arena, c->ramp);
+    mdeGranularLayoutUnref(g, c->layout);
+    if (c->source)
+      mdeGranularSourceFree(g, c->source);
+  }
+#ifdef MDE_THREADS
+  pthread_mutex_destroy(&q->send);
+#endif
+  mdeArenaFree(&g->arena, g->queue);
+  g->queue = NULL;
+}
+//------------------------------------------------------------------------------
+
+/* what senders check the messages they send against (see mdeGranularCheck())
+ * starts off as whatever's been set directly, by mdeGranularInit1() etc. */
+static void mdeGranularSentInit(mdeGranular* g)
+{
+  mdeGranularSent* v = &g->sent;
+
+  v->grainLengthMS = g->grainLengthMS;
+  v->grainLength = g->grainLength;
+  v->rampLenMS = g->rampLenMS;
+  v->nBufferSamples = g->nBufferSamples;
+  v->BufferSamplesMS = g->BufferSamplesMS;
+  v->highestSRC = maxFloat(g->config->srcs, g->numTranspositions);
+  v->transpositionOffset = g->transpositionOffset;
+  v->octaveSize = g->octaveSize;
+  v->octaveDivisions = g->octaveDivisions;
+  v->portionPosition = g->portionPosition;
+  v->portionWidth = g->portionWidth;
+}
+//------------------------------------------------------------------------------
+
+/* -n- samples (-ms-) are to be granulated, which shortens the grains if they
+ * don't fit (see mdeGranularSourceInstall()) */
+static void mdeGranularSentSamples(mdeGranular* g, long n, mdefloat ms)
+{
+  mdeGranularSent* v = &g->sent;
+
+  v->nBufferSamples = n;
+  v->BufferSamplesMS = ms;
+  if (n < v->grainLength)
+  {
+    v->grainLength = mdeGranularShortBuffer(g, n, ms, v->grainLengthMS, 0);
+    v->grainLengthMS = samples2ms(g->samplingRate, v->grainLength);
+  }
+}
+//------------------------------------------------------------------------------
+
+/* check -c- before it's sent, against what the messages sent before it
+ * will have done, and warn about it here rather than when it's applied,
+ * which is usually on the audio thread. Returns 0 if it's to be dropped;
+ * otherwise it might have been changed to what's to be applied. Called by
+ * senders holding the queue's lock. */
+static int mdeGranularCheck(mdeGranular* g, mdeGranularCommand* c)
+{
+  mdeGranularSent* v = &g->sent;
+  mdefloat f = c->f[0];
+  char w = g->warnings;
+  mdeGranularRamp* base;
+  mdefloat start;
+  mdefloat end;
+  mdefloat ms;
+  long n;
+
+  /* a new position or width is sent as a new portion, the other half being
+   * what the last one sent left it as */
+  if (c->what == MDE_CMD_PORTION_POSITION)
+  {
+    c->what = MDE_CMD_PORTION;
+    c->f[1] = v->portionWidth;
+  }
+  else if (c->what == MDE_CMD_PORTION_WIDTH)
+  {
+    c->what = MDE_CMD_PORTION;
+    c->f[0] = v->portionPosition;
+    c->f[1] = f;
+  }
+  switch (c->what)
+  {
+    case MDE_CMD_GRAIN_LENGTH_MS:
+      return mdeGranularGrainLengthOK(g, f, v->rampLenMS, v->nBufferSamples,
+                                      v->highestSRC, v->transpositionOffset,
+                                      w);
+    case MDE_CMD_SAMPLES_START_MS:
+      mdeGranularStartPoint(g, f, v->nBufferSamples, v->BufferSamplesMS, &ms,
+                            w);
+      break;
+    case MDE_CMD_SAMPLES_END_MS:
+      mdeGranularEndPoint(g, f, v->nBufferSamples, v->BufferSamplesMS, &ms,
+                          w);
+      break;
+    case MDE_CMD_ACTIVE_CHANNELS:
+      c->f[0] = (mdefloat)mdeGranularActiveChannels(g, (long)f, w);
+      break;
+    case MDE_CMD_ACTIVE_VOICES:
+      return mdeGranularActiveVoicesOK(f, g->layoutSent->voices->maxVoices,
+                                       w);
+    case MDE_CMD_RAMP_LEN_MS:
+    case MDE_CMD_RAMP_TYPE:
+      /* until there's a ramp, what's asked for is just remembered (see
+       * mdeGranularRampSend()), but without a queue a length's set anyway */
+      base = mdeGranularRampBase(g);
+      if (!base && (g->queue || c->what == MDE_CMD_RAMP_TYPE))
+        break;
+      if (c->what == MDE_CMD_RAMP_LEN_MS)
+        ms = f;
+      else
+        ms = g->queue ? base->lenMS : v->rampLenMS;
+      return mdeGranularRampLenOK(ms, v->grainLengthMS, w);
+    case MDE_CMD_HUGE_PAGES:
+      return mdeGranularSwitchOK((long)f, "HugePages", w);
+    case MDE_CMD_FIXED_PHASE:
+      return mdeGranularSwitchOK((long)f, "FixedPhase", w);
+    case MDE_CMD_OCTAVE_SIZE:
+      return mdeGranularPositiveOK(f, "OctaveSize", w);
+    case MDE_CMD_OCTAVE_DIVISIONS:
+      return mdeGranularPositiveOK(f, "OctaveDivisions", w);
+    case MDE_CMD_PORTION:
+      if (!mdeGranularPortionOK(c->f[0], c->f[1], w))
+        return 0;
+      mdeGranularPortionMS(v->BufferSamplesMS, c->f[0], c->f[1], &start,
+                           &end);
+      mdeGranularStartPoint(g, start, v->nBufferSamples, v->BufferSamplesMS,
+                            &ms, w);
+      mdeGranularEndPoint(g, end, v->nBufferSamples, v->BufferSamplesMS, &ms,
+                          w);
+      break;
+    case MDE_CMD_LIVE_BUFFER_SIZE:
+      /* (only when there's no queue: see mdeGranularSend()) */
+      if (g->status == OFF)
+        break;
+      if (w)
+      {
+        mdePost("mdeGranular~:");
+        mdePost("              Can't change buffer size while object is "
+                "running ");
+        mdePost("              (or ramping down)!");
+      }
+      return 0;
+    case MDE_CMD_SAMPLES:
+      n = mdeGranularSourceLength(g, c->source, &ms);
+      if (!n && w)
+        mdeError("mdeGranular~: No samples in buffer %s",
+                 g->config->BufferName);
+      if (n < v->grainLength)
+        mdeGranularShortBuffer(g, n, ms, v->grainLengthMS, w);
+      break;
+    default:
+      break;
+  }
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+/* -c- (and its -list-) is about to be sent: remember what it'll do for the
+ * messages sent after it to be checked against. Called by senders holding
+ * the queue's lock. */
+static void mdeGranularSentUpdate(mdeGranular* g, mdeGranularCommand* c,
+                                  mdefloat* list)
+{
+  mdeGranularSent* v = &g->sent;
+  mdefloat f = c->f[0];
+  mdefloat noTransp = (mdefloat)0.0;
+  mdefloat src;
+  mdefloat ms;
+  long n;
+
+  switch (c->what)
+  {
+    case MDE_CMD_GRAIN_LENGTH_MS:
+      v->grainLengthMS = f;
+      v->grainLength = ms2samples(g->samplingRate, f);
+      break;
+    case MDE_CMD_RAMP_LEN_MS:
+    case MDE_CMD_RAMP_TYPE:
+      if (c->ramp)
+        v->rampLenMS = c->ramp->lenMS;
+      else if (!g->queue && c->what == MDE_CMD_RAMP_LEN_MS)
+        v->rampLenMS = f;
+      break;
+    case MDE_CMD_CLEAR_LENGTHS:
+      v->grainLength = 0;
+      v->grainLengthMS = (mdefloat)0.0;
+      v->rampLenMS = (mdefloat)0.0;
+      break;
+    case MDE_CMD_TRANSPOSITION_OFFSET_ST:
+      v->transpositionOffset = st2src(f, v->octaveSize, v->octaveDivisions);
+      break;
+    case MDE_CMD_TRANSPOSITIONS:
+      /* as mdeGranularSetTranspositions() will have them */
+      n = c->n;
+      if (!n)
+      {
+        n = 1;
+        list = &noTransp;
+      }
+      v->highestSRC = (mdefloat)DBL_MIN;
+      for (long i = 0; i < n; ++i)
+      {
+        src = st2src(list[i], v->octaveSize, v->octaveDivisions);
+        if (src > v->highestSRC)
+          v->highestSRC = src;
+      }
+      break;
+    case MDE_CMD_OCTAVE_SIZE:
+      v->octaveSize = f;
+      break;
+    case MDE_CMD_OCTAVE_DIVISIONS:
+      v->octaveDivisions = f;
+      break;
+    case MDE_CMD_PORTION:
+      v->portionPosition = f;
+      v->portionWidth = c->f[1];
+      break;
+    case MDE_CMD_SAMPLES:
+      n = mdeGranularSourceLength(g, c->source, &ms);
+      mdeGranularSentSamples(g, n, ms);
+      break;
+    default:
+      break;
+  }
+}
+//------------------------------------------------------------------------------
+
+/* returns 0 if the message should be applied now (there's no queue), 1 if
+ * it's been queued (or was dropped, for being invalid or because there was
+ * no room for it, in which case its source, if any, has been freed and
+ * c->source is NULL) */
+static int mdeGranularQueuePush(mdeGranular* g, mdeGranularCommand* c,
+                                mdefloat* list)
+{
+  mdeGranularQueue* q = g->queue;
+  uint64_t tail;
+  uint64_t listTail;
+  int full;
+  int warn = 0;
+
+  mdeGranularLock(g);
+  mdeGranularCollect(g);
+  if (!mdeGranularCheck(g, c))
+  {
+    if (c->source)
+      mdeGranularSourceFree(g, c->source);
+    c->source = NULL;
+    mdeGranularUnlock(g);
+    return 1;
+  }
+  if (!q)
+  {
+    mdeGranularSentUpdate(g, c, list);
+    mdeGranularUnlock(g);
+    return 0;
+  }
+  tail = q->tail;
+  listTail = q->listTail;
+  full = tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == MDE_COMMANDS ||
+    (c->what == MDE_CMD_TRANSPOSITIONS &&
+     listTail - __atomic_load_n(&q->listHead, __ATOMIC_ACQUIRE)
+     == MDE_COMMAND_LISTS);
+  if (full)
+  {
+    warn = !q->warned;
+    q->warned = 1;
+    if (c->source)
+      mdeGranularSourceFree(g, c->source);
+    c->source = NULL;
+  }
+  /* a new ramp or layout's made here rather than by the audio thread */
+  else if (mdeGranularRampSend(g, c) && mdeGranularLayoutSend(g, c))
+  {
+    /* (before the renderer can get to it and its source) */
+    mdeGranularSentUpdate(g, c, list);
+    q->warned = 0;
+    c->block = __atomic_load_n(&g->ticks, __ATOMIC_ACQUIRE);
+    if (c->what == MDE_CMD_TRANSPOSITIONS)
+    {
+      c->list = (int)(listTail & (MDE_COMMAND_LISTS - 1));
+      if (list)
+        memcpy(q->lists[c->list], list, c->n * sizeof(mdefloat));
+      __atomic_store_n(&q->listTail, listTail + 1, __ATOMIC_RELEASE);
+    }
+    q->commands[tail & (MDE_COMMANDS - 1)] = *c;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    if (c->layout)
+      mdeGranularLayoutSent(g, c->layout);
+  }
+  mdeGranularUnlock(g);
+  if (warn && g->warnings)
+    mdePost("mdeGranular~: too many messages waiting (is DSP on?); "
+            "ignoring them until there's room.");
+  return 1;
+}
+//------------------------------------------------------------------------------
+
+/* apply the messages stamped up to -tick- (called by whoever renders it).
+ * One whose layout changes the tick size can't be until the start of the
+ * host's block, so it and those after it wait for -boundary- (see
+ * mdeGranularPerform()). */
+static void mdeGranularQueueApply(mdeGranular* g, int64_t tick, int boundary)
+{
+  mdeGranularQueue* q = g->queue;
+  mdeGranularCommand* c;
+  uint64_t head;
+  uint64_t tail;
+
+  if (!q)
+    return;
+  head = q->head;
+  tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+  g->layoutWaiting = 0;
+  for (; head != tail; ++head)
+  {
+    c = &q->commands[head & (MDE_COMMANDS - 1)];
+    if (c->block > tick)
+      break;
+    if (!boundary && mdeGranularLayoutWaits(g, c->layout))
+    {
+      g->layoutWaiting = 1;
+      break;
+    }
+    if (c->what == MDE_CMD_TRANSPOSITIONS)
+    {
+      mdeGranularApply(g, c, q->lists[c->list]);
+      __atomic_store_n(&q->listHead, q->listHead + 1, __ATOMIC_RELEASE);
+    }
+    else
+      mdeGranularApply(g, c, NULL);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+  }
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularLock(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  if (g->queue)
+    pthread_mutex_lock(&g->queue->send);
+#else
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularUnlock(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  if (g->queue)
+    pthread_mutex_unlock(&g->queue->send);
+#else
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* free what the renderer's finished with: called by senders holding the
+ * queue's lock (or by mdeGranularFree()) */
+static void mdeGranularCollect(mdeGranular* g)
+{
+  mdeGranularRetired* r = __atomic_exchange_n(&g->retired, NULL,
+                                              __ATOMIC_ACQUIRE);
+  mdeGranularRetired* next;
+
+  for (; r; r = next)
+  {
+    next = r->next;
+    if (r->what == MDE_RETIRED_LAYOUT)
+      mdeGranularLayoutUnref(g, (mdeGranularLayout*)r);
+    else if (r->what == MDE_RETIRED_SOURCE)
+      mdeGranularSourceFree(g, (mdeGranularSource*)r);
+    else
+      mdeArenaFree(&g->arena, r);
+  }
+  mdeGranularRampsCollect(g);
+  mdeGranularResizeCollect(g);
+  mdeGranularPoolRelease(g);
+}
+//------------------------------------------------------------------------------
+
+/* render a tick into -outs-, having applied the messages for it (unless a
+ * worker's still reading what they'd change: see THREADS) */
+static void mdeGranularRenderTick(mdeGranular* g, mdefloat* in,
+                                  mdefloat** outs, long nsamps, int64_t tick)
+{
+  if (!mdeGranularJobsBusy(g))
+  {
+    mdeGranularQueueApply(g, tick, 0);
+    mdeGranularResizeStep(g);
+  }
+  if (outs)
+    for (int i = 0; i < g->numChannels; ++i)
+      g->channelBuffers[i] = outs[i];
+  if (in && g->live && g->status)
+    mdeGranularCopyInputSamples(g, in, nsamps);
+  mdeGranularGo(g);
+}
+//------------------------------------------------------------------------------
+
+#pragma mark RENDER AHEAD
+
+/* When rendering ahead, each mdeGranularPerform() hands the host the tick
+ * rendered since the last one and then wakes the granulator's own thread to
+ * render the next, with this call's input. The messages it applies first are
+ * just those that would have been applied before that tick had we not been
+ * rendering ahead (see MESSAGES), so the output is the same, only a tick
+ * later. */
+
+#ifdef MDE_THREADS
+/* only the audio thread moves us from starting to running (so that it's
+ * never rendering a tick when we start) and only the message side does the
+ * rest */
+enum
+{
+  MDE_AHEAD_STOPPED,
+  MDE_AHEAD_STARTING,
+  MDE_AHEAD_RUNNING,
+  MDE_AHEAD_STOPPING
+};
+
+struct _mdeGranularAhead
+{
+  /* serialises starting and stopping */
+  pthread_mutex_t control;
+  /* lock and wake are only for the thread to sleep on */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  int mode;
+  char sleeping;
+  /* how many ticks have been rendered (the host has asked for g->ticks) */
+  int64_t rendered;
+  /* how many of the host's blocks came before we'd rendered the tick for
+   * them; late is set when the last one did (audio thread only) */
+  long xruns;
+  char late;
+  /* whilst mdeGranularPerformTick() might be reading the buffers */
+  int users;
+  /* the tick size the buffers are for */
+  long n;
+  /* numChannels buffers of n: the last tick rendered */
+  mdefloat* samples;
+  mdefloat** outs;
+  /* n: the input for the tick being rendered, if haveInput */
+  mdefloat* in;
+  char haveInput;
+};
+//------------------------------------------------------------------------------
+
+static void* mdeGranularAheadThread(void* arg)
+{
+  mdeGranular* g = (mdeGranular*)arg;
+  mdeGranularAhead* a = g->ahead;
+  struct timespec until;
+  int64_t tick;
+  int mode;
+
+  while ((mode = __atomic_load_n(&a->mode, __ATOMIC_ACQUIRE))
+         != MDE_AHEAD_STOPPING)
+  {
+    tick = __atomic_load_n(&a->rendered, __ATOMIC_RELAXED);
+    if (mode == MDE_AHEAD_RUNNING &&
+        tick != __atomic_load_n(&g->ticks, __ATOMIC_ACQUIRE))
+    {
+      /* as in mdeGranularPerformTick(), unless the tick size has changed
+       * under us, in which case we're about to be restarted and the host
+       * gets silence until then */
+      if (g->nOutputSamples == a->n)
+        mdeGranularRenderTick(g, a->haveInput ? a->in : NULL, a->outs, a->n,
+                              tick);
+      else
+        silence(a->samples, g->numChannels * (int)a->n);
+      __atomic_store_n(&a->rendered, tick + 1, __ATOMIC_RELEASE);
+      continue;
+    }
+    /* sleep until the next tick's asked for; as with the pool the wake-up's
+     * sent without the lock so we might miss it, but then we only sleep for
+     * a while */
+    pthread_mutex_lock(&a->lock);
+    __atomic_store_n(&a->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g->ticks, __ATOMIC_SEQ_CST) == tick &&
+        __atomic_load_n(&a->mode, __ATOMIC_SEQ_CST) == mode)
+    {
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += MDE_POOL_NAP;
+      if (until.tv_nsec >= 1000000000)
+      {
+        until.tv_nsec -= 1000000000;
+        ++until.tv_sec;
+      }
+      pthread_cond_timedwait(&a->wake, &a->lock, &until);
+    }
+    __atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&a->lock);
+  }
+  return NULL;
+}
+//------------------------------------------------------------------------------
+
+/* called by the audio thread, so without the lock */
+static void mdeGranularAheadWake(mdeGranularAhead* a)
+{
+  if (__atomic_load_n(&a->sleeping, __ATOMIC_SEQ_CST))
+    pthread_cond_signal(&a->wake);
+}
+//------------------------------------------------------------------------------
+
+/* call with the control lock held. The tick the thread was rendering is
+ * lost, and until we're stopped the host gets silence */
+static void mdeGranularAheadStop(mdeGranularAhead* a)
+{
+  if (__atomic_load_n(&a->mode, __ATOMIC_ACQUIRE) == MDE_AHEAD_STOPPED)
+    return;
+  __atomic_store_n(&a->mode, MDE_AHEAD_STOPPING, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&a->lock);
+  pthread_cond_signal(&a->wake);
+  pthread_mutex_unlock(&a->lock);
+  pthread_join(a->thread, NULL);
+  __atomic_store_n(&a->mode, MDE_AHEAD_STOPPED, __ATOMIC_SEQ_CST);
+  /* an mdeGranularPerformTick() that saw us running might still be copying */
+  while (__atomic_load_n(&a->users, __ATOMIC_SEQ_CST))
+    mdeGranularPause();
+}
+//------------------------------------------------------------------------------
+
+/* call with the control lock held, when stopped; returns 0 if we couldn't
+ * start */
+static int mdeGranularAheadStart(mdeGranular* g, long n)
+{
+  mdeGranularAhead* a = g->ahead;
+
+  if (a->n != n)
+  {
+    mdeArenaFree(&g->arena, a->samples);
+    mdeArenaFree(&g->arena, a->in);
+    a->in = NULL;
+    a->n = 0;
+    a->samples = mdeArenaCalloc(&g->arena, g->numChannels * n,
+                                sizeof(mdefloat), "mdeGranularAheadStart",
+                                g->warnings);
+    if (!a->samples)
+      return 0;
+    a->in = mdeArenaCalloc(&g->arena, n, sizeof(mdefloat),
+                           "mdeGranularAheadStart", g->warnings);
+    if (!a->in)
+      return 0;
+    for (int i = 0; i < g->numChannels; ++i)
+      a->outs[i] = a->samples + i * n;
+    a->n = n;
+  }
+  /* the host's first tick from us is silent */
+  silence(a->samples, g->numChannels * (int)n);
+  a->late = 0;
+  __atomic_store_n(&a->mode, MDE_AHEAD_STARTING, __ATOMIC_RELEASE);
+  if (pthread_create(&a->thread, NULL, mdeGranularAheadThread, g))
+  {
+    __atomic_store_n(&a->mode, MDE_AHEAD_STOPPED, __ATOMIC_RELEASE);
+    return 0;
+  }
+  /* it's as urgent as the pool */
+  pthread_mutex_lock(&mdePool.control);
+  if (mdePool.priority)
+    mdeGranularPoolApplyPriority(a->thread, g->warnings);
+  pthread_mutex_unlock(&mdePool.control);
+  return 1;
+}
+#endif /* MDE_THREADS */
+//------------------------------------------------------------------------------
+
+/* start or stop the thread, or restart it for a new tick size, as
+ * renderAhead and the tick size say: only ever from the message side */
+static void mdeGranularAheadUpdate(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  mdeGranularAhead* a = __atomic_load_n(&g->ahead, __ATOMIC_ACQUIRE);
+  long n = mdeGranularTickSize(g);
+  int stopped;
+
+  if (!a)
+    return;
+  pthread_mutex_lock(&a->control);
+  stopped = __atomic_load_n(&a->mode, __ATOMIC_ACQUIRE) == MDE_AHEAD_STOPPED;
+  if (!stopped && (!g->renderAhead || a->n != n))
+  {
+    mdeGranularAheadStop(a);
+    stopped = 1;
+  }
+  /* without a tick size we'll be started by mdeGranularInit2() */
+  if (g->renderAhead && stopped && n > 0 && g->numChannels &&
+      !mdeGranularAheadStart(g, n))
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: couldn't start rendering ahead.");
+    __atomic_store_n(&g->renderAhead, 0, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&a->control);
+#else
+  UNUSED(g);
+#endif
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetRenderAhead(mdeGranular* g, long l)
+{
+#ifdef MDE_THREADS
+  mdeGranularAhead* a;
+
+  if (l && !g->ahead)
+  {
+    a = mdeArenaCalloc(&g->arena, 1, sizeof(mdeGranularAhead),
+                       "mdeGranularSetRenderAhead", g->warnings);
+    if (a)
+      a->outs = mdeArenaCalloc(&g->arena, g->numChannels, sizeof(mdefloat*),
+                               "mdeGranularSetRenderAhead", g->warnings);
+    if (!a || !a->outs)
+    {
+      mdeArenaFree(&g->arena, a);
+      return;
+    }
+    pthread_mutex_init(&a->control, NULL);
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->wake, NULL);
+    __atomic_store_n(&g->ahead, a, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&g->renderAhead, l ? 1 : 0, __ATOMIC_RELAXED);
+  mdeGranularAheadUpdate(g);
+#else
+  if (l && g->warnings)
+    mdePost("mdeGranular~: rendering ahead isn't available here.");
+  g->renderAhead = 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* render a tick, or when rendering ahead hand over the last one */
+static void mdeGranularPerformTick(mdeGranular* g, mdefloat* in,
+                                   mdefloat** outs, long nsamps)
+{
+  int64_t tick = g->ticks;
+#ifdef MDE_THREADS
+  mdeGranularAhead* a = __atomic_load_n(&g->ahead, __ATOMIC_ACQUIRE);
+  int mode = MDE_AHEAD_STOPPED;
+
+  if (a)
+  {
+    /* a user first, so that a stop waits for us */
+    __atomic_fetch_add(&a->users, 1, __ATOMIC_SEQ_CST);
+    mode = __atomic_load_n(&a->mode, __ATOMIC_SEQ_CST);
+    if (mode == MDE_AHEAD_STARTING && a->n == nsamps)
+    {
+      __atomic_store_n(&a->rendered, tick, __ATOMIC_RELAXED);
+      if (__atomic_compare_exchange_n(&a->mode, &mode, MDE_AHEAD_RUNNING, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        mode = MDE_AHEAD_RUNNING;
+    }
+    if (mode == MDE_AHEAD_RUNNING && a->n == nsamps &&
+        __atomic_load_n(&a->rendered, __ATOMIC_ACQUIRE) == tick)
+    {
+      /* the input first: the host might be reusing it for an output */
+      a->haveInput = in != NULL;
+      if (in)
+        memcpy(a->in, in, nsamps * sizeof(mdefloat));
+      /* after a late tick the one rendered since is a block too late too, so
+       * that goes as well: we never fall behind the latency we report */
+      for (int i = 0; i < g->numChannels; ++i)
+        if (outs && outs[i])
+        {
+          if (a->late)
+            silence(outs[i], (int)nsamps);
+          else
+            memcpy(outs[i], a->outs[i], nsamps * sizeof(mdefloat));
+        }
+      a->late = 0;
+      __atomic_store_n(&g->ticks, tick + 1, __ATOMIC_SEQ_CST);
+      mdeGranularAheadWake(a);
+    }
+    else if (mode != MDE_AHEAD_STOPPED && mode != MDE_AHEAD_STARTING)
+    {
+      /* the thread hasn't finished (or is stopping, or being restarted for
+       * a new tick size): never wait for it */
+      if (mode == MDE_AHEAD_RUNNING && a->n == nsamps)
+      {
+        __atomic_fetch_add(&a->xruns, 1, __ATOMIC_RELAXED);
+        a->late = 1;
+      }
+      for (int i = 0; i < g->numChannels; ++i)
+        if (outs && outs[i])
+          silence(outs[i], (int)nsamps);
+    }
+    __atomic_fetch_sub(&a->users, 1, __ATOMIC_RELEASE);
+    if (mode != MDE_AHEAD_STOPPED && mode != MDE_AHEAD_STARTING)
+      return;
+  }
+#endif
+  mdeGranularRenderTick(g, in, outs, nsamps, tick);
+  __atomic_store_n(&g->ticks, tick + 1, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/* The FIFO the host's blocks go through when the tick's longer than they
+ * are (see mdeGranularPerform()). Its size depends on both, so like a layout
+ * it's made by whoever changes either and swapped in at the start of the
+ * host's next block, and the one it replaces is retired. */
+struct _mdeGranularFifo
+{
+  mdeGranularRetired retired;
+  long tick;
+  long hostBlock;
+  /* numChannels outputs of tick samples, then the input */
+  mdefloat* samples;
+  mdefloat** outs;
+};
+//------------------------------------------------------------------------------
+
+/* all in one block from the arena (called by senders) */
+static mdeGranularFifo* mdeGranularFifoNew(mdeGranular* g, long tick,
+                                           long hostBlock)
+{
+  size_t head = (sizeof(mdeGranularFifo) + g->numChannels * sizeof(mdefloat*)
+                 + MDE_CACHE_LINE - 1) & ~(size_t)(MDE_CACHE_LINE - 1);
+  char* block = mdeArenaCalloc(&g->arena, 1, head + (g->numChannels + 1) *
+                               tick * sizeof(mdefloat), "mdeGranularFifoNew",
+                               g->warnings);
+  mdeGranularFifo* f = (mdeGranularFifo*)block;
+
+  if (!f)
+    return NULL;
+  f->tick = tick;
+  f->hostBlock = hostBlock;
+  f->outs = (mdefloat**)(f + 1);
+  f->samples = (mdefloat*)(block + head);
+  for (int i = 0; i < g->numChannels; ++i)
+    f->outs[i] = f->samples + i * tick;
+  return f;
+}
+//------------------------------------------------------------------------------
+
+/* leave -f- for mdeGranularPerform() to swap in, instead of any still
+ * waiting (called by senders holding the queue's lock) */
+static void mdeGranularFifoPost(mdeGranular* g, mdeGranularFifo* f)
+{
+  mdeArenaFree(&g->arena, __atomic_exchange_n(&g->fifoNext, f,
+                                              __ATOMIC_ACQ_REL));
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularPerform() at the start of the host's block, after
+ * mdeGranularLayoutPoll() */
+static void mdeGranularFifoPoll(mdeGranular* g)
+{
+  mdeGranularFifo* f = __atomic_exchange_n(&g->fifoNext, NULL,
+                                           __ATOMIC_ACQUIRE);
+  mdeGranularFifo* none = NULL;
+
+  if (!f)
+    return;
+  /* its layout was sent first but we might not have seen it yet: try again
+   * next time, unless a newer one's been sent meanwhile */
+  if (f->tick != g->nOutputSamples)
+  {
+    if (!__atomic_compare_exchange_n(&g->fifoNext, &none, f, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      mdeGranularRetire(g, &f->retired, MDE_RETIRED_FIFO);
+    return;
+  }
+  if (g->fifo)
+    mdeGranularRetire(g, &g->fifo->retired, MDE_RETIRED_FIFO);
+  g->fifo = f;
+  g->fifoPos = 0;
+  g->fifoHaveInput = 0;
+}
+//------------------------------------------------------------------------------
+
+/* make what a new tick size (or host's block) needs and leave it for
+ * mdeGranularPerform() to swap in at the start of the host's next block; the
+ * first time, before anything's been rendered, it's swapped in straight
+ * away. Called by senders holding the queue's lock; returns 1 if there's no
+ * memory for it. */
+static int mdeGranularSendTick(mdeGranular* g, int hostChanged)
+{
+  mdeGranularLayout* base = g->layoutSent;
+  mdeGranularLayout* l = NULL;
+  mdeGranularFifo* f = NULL;
+  long tick = mdeGranularTickSize(g);
+
+  if (!base)
+    return 1;
+  if (tick != base->tick)
+  {
+    l = mdeGranularLayoutNew(g, 0, base->threads, tick);
+    if (!l)
+      return 1;
+  }
+  if ((l || hostChanged) && tick > g->hostBlock)
+  {
+    f = mdeGranularFifoNew(g, tick, g->hostBlock);
+    if (!f)
+    {
+      if (l)
+        mdeGranularLayoutFree(g, l);
+      return 1;
+    }
+  }
+  if (base->tick <= 0)
+  {
+    if (l)
+      mdeGranularLayoutSet(g, l);
+    if (f)
+    {
+      mdeArenaFree(&g->arena, g->fifo);
+      g->fifo = f;
+      g->fifoPos = 0;
+      g->fifoHaveInput = 0;
+    }
+    return 0;
+  }
+  /* the layout first (see mdeGranularFifoPoll()) */
+  if (l)
+    mdeGranularLayoutPost(g, l);
+  if (f)
+    mdeGranularFifoPost(g, f);
+  return 0;
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularPerform(mdeGranular* g, mdefloat* in, mdefloat** outs,
+                        long nsamps)
+{
+  mdeGranularFifo* f = g->fifo;
+  long tick;
+  long pos;
+  mdefloat* fifoIn;
+
+  /* a new tick size or host's block is swapped in at the start of the
+   * host's block (or when it's changed under us), whilst nothing else is
+   * rendering, along with the messages that were waiting for it */
+  if ((!g->fifoPos || !f || f->hostBlock != nsamps) &&
+      !mdeGranularAheadRunning(g) && !mdeGranularJobsBusy(g))
+  {
+    mdeGranularLayoutPoll(g);
+    if (g->layoutWaiting)
+      mdeGranularQueueApply(g, g->ticks, 1);
+    mdeGranularFifoPoll(g);
+    f = g->fifo;
+  }
+  tick = g->nOutputSamples;
+  if (tick == nsamps)
+  {
+    mdeGranularPerformTick(g, in, outs, nsamps);
+    return;
+  }
+  /* the host's blocks go into and come out of the FIFO, the tick being
+   * rendered (with the input collected so far) when the host's last block
+   * of it arrives; the output is therefore tick - nsamps samples late */
+  if (!f || f->tick != tick || f->hostBlock != nsamps)
+  {
+    for (int i = 0; i < g->numChannels; ++i)
+      if (outs && outs[i])
+        silence(outs[i], (int)nsamps);
+    return;
+  }
+  pos = g->fifoPos;
+  fifoIn = f->samples + g->numChannels * tick;
+  /* the input first: the host might be reusing it for an output */
+  if (in)
+  {
+    memcpy(fifoIn + pos, in, nsamps * sizeof(mdefloat));
+    g->fifoHaveInput = 1;
+  }
+  else
+    silence(fifoIn + pos, (int)nsamps);
+  pos += nsamps;
+  if (pos >= tick)
+  {
+    mdeGranularPerformTick(g, g->fifoHaveInput ? fifoIn : NULL, f->outs,
+                           tick);
+    g->fifoHaveInput = 0;
+    pos = 0;
+  }
+  g->fifoPos = pos;
+  for (int i = 0; i < g->numChannels; ++i)
+    if (outs && outs[i])
+      memcpy(outs[i], f->outs[i] + pos, nsamps * sizeof(mdefloat));
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSetInternalBlock(mdeGranular* g, long n)
+{
+  if (n < 0)
+    n = 0;
+  if (n > MDE_MAX_INTERNAL_BLOCK)
+  {
+    if (g->warnings)
+      mdePost("mdeGranular~: the internal block can't be more than %d "
+              "samples.", MDE_MAX_INTERNAL_BLOCK);
+    n = MDE_MAX_INTERNAL_BLOCK;
+  }
+  mdeGranularLock(g);
+  __atomic_store_n(&g->internalBlock, n, __ATOMIC_RELAXED);
+  if (mdeGranularDidInit(g))
+    mdeGranularSendTick(g, 0);
+  mdeGranularUnlock(g);
+  /* the thread renders whole ticks so is restarted for the new size */
+  mdeGranularAheadUpdate(g);
+}
+//------------------------------------------------------------------------------
+
+long mdeGranularLatency(mdeGranular* g)
+{
+  long tick = mdeGranularTickSize(g);
+
+  return tick - g->hostBlock +
+    (__atomic_load_n(&g->renderAhead, __ATOMIC_RELAXED) ? tick : 0);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSend(mdeGranular* g, t_command what, mdefloat f1,
+                     mdefloat f2)
+{
+  mdeGranularCommand c;
+
+  /* these make what they need themselves and send that (see RESIZING THE
+   * LIVE BUFFER and SOURCES) */
+  if (what == MDE_CMD_LIVE_BUFFER_SIZE && g->queue)
+  {
+    mdeGranularResizeStart(g, f1);
+    return;
+  }
+  if (what == MDE_CMD_MIRROR_LIVE_BUFFER)
+  {
+    mdeGranularSetMirrorLiveBuffer(g, (long)f1);
+    return;
+  }
+  memset(&c, 0, sizeof(c));
+  c.what = what;
+  c.f[0] = f1;
+  c.f[1] = f2;
+  if (mdeGranularQueuePush(g, &c, NULL))
+    return;
+  mdeGranularApply(g, &c, NULL);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSendName(mdeGranular* g, t_command what, const char* name)
+{
+  mdeGranularCommand c;
+
+  memset(&c, 0, sizeof(c));
+  c.what = what;
+  strncpy(c.name, name, MDE_COMMAND_NAME_LEN - 1);
+  if (mdeGranularQueuePush(g, &c, NULL))
+    return;
+  mdeGranularApply(g, &c, NULL);
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularSendList(mdeGranular* g, t_command what, int n,
+                         mdefloat* list)
+{
+  mdeGranularCommand c;
+
+  memset(&c, 0, sizeof(c));
+  c.what = what;
+  c.n = n < 0 || !list ? 0 : n > MAXTRANSPOSITIONS ? MAXTRANSPOSITIONS : n;
+  if (mdeGranularQueuePush(g, &c, list))
+    return;
+  mdeGranularApply(g, &c, list);
+}
+//------------------------------------------------------------------------------
+
+/* this is usually called by the audio thread (or the one rendering ahead),
+ * so it mustn't post: messages have been warned about as they were sent
+ * (see mdeGranularCheck()) and whatever's still out of range now is clamped
+ * or ignored quietly */
+void mdeGranularApply(mdeGranular* g, mdeGranularCommand* c, mdefloat* list)
+{
+  mdefloat f = c->f[0];
+
+  switch (c->what)
+  {
+    case MDE_CMD_TRANSPOSITION_OFFSET_ST:
+      mdeGranularTranspositionOffset(g, f);
+      break;
+    case MDE_CMD_GRAIN_LENGTH_MS:
+      mdeGranularGrainLength(g, f, 0);
+      break;
+    case MDE_CMD_GRAIN_LENGTH_DEVIATION:
+      mdeGranularSetGrainLengthDeviation(g, f);
+      break;
+    case MDE_CMD_SAMPLES_START_MS:
+      mdeGranularSamplesStartMS(g, f, 0);
+      break;
+    case MDE_CMD_SAMPLES_END_MS:
+      mdeGranularSamplesEndMS(g, f, 0);
+      break;
+    case MDE_CMD_DENSITY:
+      mdeGranularSetDensity(g, f);
+      break;
+    case MDE_CMD_ACTIVE_CHANNELS:
+      g->activeChannels = mdeGranularActiveChannels(g, (long)f, 0);
+      break;
+    case MDE_CMD_GRAIN_AMP:
+      mdeGranularSetGrainAmp(g, f);
+      break;
+    case MDE_CMD_MAX_VOICES:
+    case MDE_CMD_THREADS:
+      /* made by the sender (see LAYOUTS) unless there's no queue */
+      if (c->layout)
+        mdeGranularLayoutInstall(g, c->layout);
+      else if (c->what == MDE_CMD_MAX_VOICES)
+        mdeGranularSetMaxVoices(g, f);
+      else
+        mdeGranularSetThreads(g, (long)f);
+      break;
+    case MDE_CMD_ACTIVE_VOICES:
+      mdeGranularActiveVoices(g, f, 0);
+      break;
+    case MDE_CMD_RAMP_LEN_MS:
+      if (c->ramp)
+        mdeGranularRampInstall(g, c->ramp, 0);
+      else
+        mdeGranularRampLen(g, f, 0);
+      break;
+    case MDE_CMD_RAMP_TYPE:
+      if (c->ramp)
+        mdeGranularRampInstall(g, c->ramp, 0);
+      else
+        mdeGranularRampType(g, c->name, 0);
+      break;
+    case MDE_CMD_ON:
+      mdeGranularOn(g);
+      break;
+    case MDE_CMD_OFF:
+      mdeGranularOff(g);
+      break;
+    case MDE_CMD_TOGGLE:
+      if (mdeGranularIsOn(g))
+        mdeGranularOff(g);
+      else if (mdeGranularIsOff(g))
+        mdeGranularOn(g);
+      break;
+    case MDE_CMD_LIVE_BUFFER_SIZE:
+      /* only when there's no queue (see mdeGranularSend()), so we're the
+       * sender and may warn */
+      mdeGranularSetLiveBufferSize(g, f);
+      break;
+    case MDE_CMD_MIRROR_LIVE_BUFFER:
+      /* (never queued: see mdeGranularSend()) */
+      break;
+    case MDE_CMD_HUGE_PAGES:
+      mdeGranularSetHugePages(g, (long)f);
+      break;
+    case MDE_CMD_FIXED_PHASE:
+      mdeGranularSetFixedPhase(g, (long)f);
+      break;
+    case MDE_CMD_SEED:
+      mdeGranularSetSeed(g, f);
+      break;
+    case MDE_CMD_DO_GRAIN_DELAYS:
+      mdeGranularDoGrainDelays(g);
+      break;
+    case MDE_CMD_SMOOTH_MODE:
+      mdeGranularSmoothMode(g);
+      break;
+    case MDE_CMD_OCTAVE_SIZE:
+      if (f > 0.0)
+        g->octaveSize = f;
+      break;
+    case MDE_CMD_OCTAVE_DIVISIONS:
+      if (f > 0.0)
+        g->octaveDivisions = f;
+      break;
+    case MDE_CMD_PORTION:
+      mdeGranularPortionSet(g, f, c->f[1], 0);
+      break;
+    case MDE_CMD_PORTION_POSITION:
+    case MDE_CMD_PORTION_WIDTH:
+      /* (sent as MDE_CMD_PORTION: see mdeGranularCheck()) */
+      break;
+    case MDE_CMD_TRANSPOSITIONS:
+      mdeGranularTranspositions(g, c->n, list);
+      break;
+    case MDE_CMD_CLEAR_LENGTHS:
+      /* so that the lengths sent next are checked against each other rather
+       * than against the old ones */
+      g->grainLength = 0;
+      g->grainLengthMS = (mdefloat)0.0;
+      g->rampLenSamples = 0;
+      g->rampLenMS = (mdefloat)0.0;
+      break;
+    case MDE_CMD_SAMPLES:
+      /* (always sent with a source: see mdeGranularSendSamples()) */
+      if (c->source)
+        mdeGranularSourceInstall(g, c->source, 0);
+      break;
+  }
+}
+//------------------------------------------------------------------------------
+
+/* whether the thread's rendering our ticks (so nothing else may) */
+static int mdeGranularAheadRunning(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  mdeGranularAhead* a = __atomic_load_n(&g->ahead, __ATOMIC_ACQUIRE);
+
+  int mode;
+
+  if (!a)
+    return 0;
+  /* (until it's stopped the thread might still be rendering) */
+  mode = __atomic_load_n(&a->mode, __ATOMIC_ACQUIRE);
+  return mode == MDE_AHEAD_RUNNING || mode == MDE_AHEAD_STOPPING;
+#else
+  UNUSED(g);
+  return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+static long mdeGranularAheadXruns(mdeGranular* g)
+{
+#ifdef MDE_THREADS
+  mdeGranularAhead* a = __atomic_load_n(&g->ahead, __ATOMIC_ACQUIRE);
+
+  return a ? __atomic_load_n(&a->xruns, __ATOMIC_RELAXED) : 0;
+#else
+  UNUSED(g);
+  return 0;
+#endif
+}
+//------------------------------------------------------------------------------
+
+/* called by mdeGranularFree() */
+static void mdeGranularAheadFree(mdeGranular* g)
 {
-  mdefloat* samples = g->theSamples;
-  long i;
-  long num = nsamps;
+#ifdef MDE_THREADS
+  mdeGranularAhead* a = g->ahead;
 
-  if (nsamps > g->nAllocatedBufferSamples && g->warnings)
-  {
-    post("mdeGranular~:");
-    post("              The allocated live sample buffer is only ");
-    post("              %fms but your buffer~ length is %fms ",
-         g->AllocatedBufferMS, (mdefloat)nsamps / (g->samplingRate * .001));
-    post("              (assuming the buffer~'s sampling rate is the ");
-    post("              same as the dac~'s).");
-    post("              Please send the object a \"MaxLiveBufferMS\" ");
-    post("              message to increase this (preferably do this at");
-    post("              the beginning of your performance, allocating ");
-    post("              enough for all the performance's needs).");
-    num = g->nAllocatedBufferSamples;
-  }
-  if (samples && in)
-  {
-    for (i = 0; i < num; ++i)
-    {
-      *samples++ = (mdefloat) * in++;
-    }
-  }
-  return num;
+  if (!a)
+    return;
+  mdeGranularAheadStop(a);
+  pthread_mutex_destroy(&a->control);
+  pthread_mutex_destroy(&a->lock);
+  pthread_cond_destroy(&a->wake);
+  mdeArenaFree(&g->arena, a->samples);
+  mdeArenaFree(&g->arena, a->in);
+  mdeArenaFree(&g->arena, a->outs);
+  mdeArenaFree(&g->arena, a);
+  g->ahead = NULL;
+#else
+  UNUSED(g);
+#endif
+  g->renderAhead = 0;
 }
 //------------------------------------------------------------------------------
 
-mdefloat mdeGranularGrainGetRampVal(mdeGranularGrain* gg,
-                                    mdefloat* rampUp, mdefloat* rampDown,
-                                    /* rampLen is in samples */
-                                    long rampLen)
+#pragma mark HOST
+
+/* what we use until (or unless) the host gives us its own */
+
+static void mdeGranularDefaultPost(const char* line)
 {
-  if (rampUp == NULL || rampDown == NULL)
-    return (mdefloat)0.0;
+  fprintf(stderr, "%s\n", line);
+}
 
-  if (gg->icurrent < gg->endRampUp)
-    return rampUp[gg->icurrent];
-  else if (gg->icurrent >= gg->startRampDown)
-  {
-    /* 10.9.10: to be honest we shouldn't have to do this check as we should
-     * never go over the ramp length but in certain circumstances, when
-     * changing ramp length we're getting crashes in accessing the ramp down,
-     * so just make sure */
-    if (gg->rampi < rampLen)
-      return rampDown[gg->rampi++];
-    else
-      return (mdefloat)0.0;
-  }
-  else
-    return (mdefloat)1.0;
+static void mdeGranularDefaultError(const char* line)
+{
+  fprintf(stderr, "error: %s\n", line);
 }
-//------------------------------------------------------------------------------
 
-int mdeGranularGrainExhausted(mdeGranularGrain* gg)
+static void* mdeGranularDefaultAlloc(size_t size)
 {
-  return (gg->icurrent > gg->length);
+  return calloc(1, size);
+}
+
+static void mdeGranularDefaultFree(void* what)
+{
+  free(what);
 }
-//------------------------------------------------------------------------------
 
-void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
-                                double grain_len, double ramp_len)
+static double mdeGranularDefaultSamplingRate(void)
 {
-  mdeGranular* g = &x->x_g;
+  return 44100.0;
+}
 
-  if (g->status != OFF)
-  {
-    if (g->warnings)
-    {
-      post("mdeGranular~:");
-      post("              BufferGrainRamp can only be called when off. ");
-    }
+static mdeGranularHost mdeHost =
+{
+  mdeGranularDefaultPost,
+  mdeGranularDefaultError,
+  mdeGranularDefaultAlloc,
+  mdeGranularDefaultFree,
+  mdeGranularDefaultSamplingRate
+};
+//------------------------------------------------------------------------------
+
+void mdeGranularSetHost(const mdeGranularHost* host)
+{
+  if (!host)
     return;
+  if (host->post)
+    mdeHost.post = host->post;
+  if (host->error)
+    mdeHost.error = host->error;
+  /* memory has to be given back to whoever it came from, so these only go
+   * together */
+  if (host->alloc && host->free)
+  {
+    mdeHost.alloc = host->alloc;
+    mdeHost.free = host->free;
   }
-  g->grainLength = 0L;
-  g->grainLengthMS = (mdefloat)0.0;
-  g->rampLenSamples = 0L;
-  g->rampLenMS = (mdefloat)0.0;
-  mdeGranular_tildeSet(x, s);
-  mdeGranularSetGrainLengthMS(g, (mdefloat)grain_len);
-  mdeGranularSetRampLenMS(g, (mdefloat)ramp_len);
+  if (host->samplingRate)
+    mdeHost.samplingRate = host->samplingRate;
 }
 //------------------------------------------------------------------------------
 
-void mdeGranularWelcome(void)
+double mdeGranularHostSamplingRate(void)
 {
-  post("____________________________________________________");
-  post("mdeGranular~");
-  post("multi-channel, multi-voice, multi-transposition ");
-  post("granular synthesis external for Max/MSP and PD");
-  post("Version %s (%s %s)", VERSION, __TIME__, __DATE__);
-  post("Michael Edwards ~ m@michael-edwards.org");
-  post("____________________________________________________");
+  return mdeHost.samplingRate();
 }
 //------------------------------------------------------------------------------
-#pragma mark HELPER FUNCTIONS
 
-void silence(mdefloat* where, int numSamples)
+void mdePost(const char* format, ...)
 {
-  if (where)
-    memset(where, 0, numSamples * sizeof(mdefloat));
+  char line[1024];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  mdeHost.post(line);
 }
 //------------------------------------------------------------------------------
 
-mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation)
+void mdeError(const char* format, ...)
 {
-  mdefloat dev = between((mdefloat)0.0, maxDeviation);
-  mdefloat ndev = number * (dev * (mdefloat)0.01);
+  char line[1024];
+  va_list args;
 
-  if (flip())
-    ndev = -ndev;
-  return number + ndev;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  mdeHost.error(line);
 }
 //------------------------------------------------------------------------------
 
-void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown)
+/** Simple memory allocation for an array using the host's allocator (calloc
+ *  unless we've been told otherwise, e.g. MaxMSP API's sysmem_newptrclear)
+ *  but checking for out of memory problem. The bytes are guaranteed to be
+ *  initialized to zero. */
+
+void* mdeCalloc(int howmany, size_t size, char* caller, char warn)
 {
-  mdefloat inc = (mdefloat)1.0 / (mdefloat)(rampLen - 1);
-  mdefloat f = (mdefloat)0.0;
+  void* ret = 0x0;
 
-  for (int i = 0; i < rampLen; ++i, f += inc, ++rampUp, ++rampDown)
+  if (howmany < 1 || size < 1)
   {
-    *rampUp = f;
-    *rampDown = 1.0f - f;
+    if (warn)
+      mdePost("mdeGranular~: request for 0 bytes (from %s)????", caller);
+    return NULL;
   }
+  ret = mdeHost.alloc(howmany * size);
+  if (!ret && warn)
+    mdePost("mdeGranular~: mdeCalloc: Out of memory (from %s)!", caller);
+  return ret;
 }
 //------------------------------------------------------------------------------
 
-mdefloat st2src(mdefloat st, mdefloat octaveSize,
-                mdefloat octaveDivisions)
+void mdeFree(void* what)
 {
-  return (mdefloat)pow(octaveSize, st / octaveDivisions);
+  if (what)
+    mdeHost.free(what);
 }
 //------------------------------------------------------------------------------
 
-long ms2samples(mdefloat samplingRate, mdefloat milliseconds)
+#pragma mark ARENA
+
+/* Each block from an arena has one of these in the cache line before it.
+ * Blocks we've had from the host (chunks that small blocks are carved from,
+ * and large blocks) are on the arena's list of chunks too. */
+struct _mdeGranularArenaBlock
 {
-  return (long)ceil((milliseconds * (mdefloat)0.001) * samplingRate);
-}
+  /* the next free block of the same size class (or the next large one) */
+  mdeGranularArenaBlock* next;
+  mdeGranularArenaBlock* chunkNext;
+  mdeGranularArenaBlock* chunkPrev;
+  /* for blocks from the host: what it gave us and how big that was */
+  void* raw;
+  long reserved;
+  /* bytes after this header */
+  long size;
+  /* the size class of a small block, or one of these */
+  int sizeClass;
+  /* 1 if it was mapped by mdeArenaMapBlock() rather than from the host */
+  char mapped;
+};
+
+#define MDE_ARENA_HEADER MDE_CACHE_LINE
+#define MDE_ARENA_LARGE_BLOCK -1
+#define MDE_ARENA_CHUNK_BLOCK -2
 //------------------------------------------------------------------------------
 
-mdefloat samples2ms(mdefloat samplingRate, int samples)
+void mdeArenaInit(mdeGranularArena* a)
 {
-  return (mdefloat)1000.0 * ((mdefloat)samples / samplingRate);
+  memset(a, 0, sizeof(mdeGranularArena));
 }
 //------------------------------------------------------------------------------
-mdefloat interpolate(mdefloat findex, mdefloat* samples, long numSamples,
-                     char backwards) /*, char live)*/
-{
-  long indexTrunc = (long)findex;
-  mdefloat fraction =  fabs(findex - (mdefloat)indexTrunc);
-  mdefloat a;
-  mdefloat b;
-  mdefloat c;
-  mdefloat d;
-  mdefloat cminusb;
-  mdefloat* fp;
-  mdefloat* lastsamp;
-  mdefloat lastsampval;
-  mdefloat result;
 
-  if (!samples)
-    return (mdefloat)0.0;
+/* Only threads that can afford to wait take this: senders (one at a time,
+ * under the queue's lock), the resize thread and mdeGranularFree(). The
+ * renderer never allocates or frees (it retires things for senders to free
+ * instead), so whoever holds it can be preempted without costing a tick;
+ * hence the yield rather than spinning on until it's their turn again. */
+static void mdeArenaLock(mdeGranularArena* a)
+{
+#ifdef MDE_THREADS
+  int spins = 0;
+#endif
 
-  /* do boundary sanity for circular buffer case */
-  indexTrunc %= numSamples;
-  /* could be the case if going backwards (% doesn't wrap as lisp's mod does so
-   * negative numbers remain negative)
-   */
-  if (indexTrunc < 0)
-  {
-    indexTrunc = numSamples + indexTrunc;
-  }
-  lastsamp = (mdefloat*)(samples + numSamples - 1);
-  lastsampval = *lastsamp;
-  /* some of these saw samples cast to long but since going 64 bit that no
-     longer works (too small?) */
-  fp = (mdefloat*)(samples + indexTrunc);
-  b = *fp;
-  if (backwards)
-  {
-    a = *(samples + ((indexTrunc + 1) % numSamples));
-    c = indexTrunc ? *(fp - 1) : lastsampval;
-    d = !indexTrunc ? *(lastsamp - 1) : (indexTrunc == 1 ?
-                                         lastsampval : *(fp - 2));
-  }
-  else
+  while (__atomic_test_and_set(&a->lock, __ATOMIC_ACQUIRE))
   {
-    a = indexTrunc ? *(fp - 1) : lastsampval;
-    c = *(samples + ((indexTrunc + 1) % numSamples));
-    d = *(samples + ((indexTrunc + 2) % numSamples));
-  }
-
-  cminusb = c - b;
-  result = (b + fraction * (cminusb - (mdefloat)0.5 * (fraction - (mdefloat)1.0)
-                            * ((a - d + (mdefloat)3.0 * cminusb) * fraction +
-                               (b - a - cminusb))));
-#ifdef DEBUG
-  if (result > 1.0)
-    post("%f at index %d (numSamples: %d, a,b,c,d=%f %f %f %f)\n",
-         result, indexTrunc, numSamples, a, b, c, d);
+#ifdef MDE_THREADS
+    if (++spins <= MDE_ARENA_SPINS)
+      mdeGranularPause();
+    else
+      sched_yield();
 #endif
+  }
+}
 
-  return result;
+static void mdeArenaUnlock(mdeGranularArena* a)
+{
+  __atomic_clear(&a->lock, __ATOMIC_RELEASE);
 }
 //------------------------------------------------------------------------------
 
-mdefloat between(mdefloat min, mdefloat max)
+/* get -size- bytes (plus the header) from the host, starting on an -align-
+ * byte boundary; called without the lock as the host may take a while */
+static mdeGranularArenaBlock* mdeArenaHostBlock(long size, long align,
+                                                int sizeClass, char* caller,
+                                                char warn)
 {
-  /* 2/4/08 the code used to be (mdefloat)(RAND_MAX + 1) but
-   * with MacIntel this obviously caused wraparound to a negative
-   * int and a negative number to be returned when min and
-   * max were both positive!  Should have seen that one coming....
-   */
-  static const mdefloat div = (mdefloat)RAND_MAX + (mdefloat)1.0;
+  long bytes = size + MDE_ARENA_HEADER + align;
+  char* raw = mdeCalloc(1, (size_t)bytes, caller, warn);
+  mdeGranularArenaBlock* b;
 
-  if (min == max)
-    return min;
-  else
+  if (!raw)
+    return NULL;
+  b = (mdeGranularArenaBlock*)
+    ((((uintptr_t)raw + MDE_ARENA_HEADER + align - 1) &
+      ~(uintptr_t)(align - 1)) - MDE_ARENA_HEADER);
+  b->raw = raw;
+  b->reserved = bytes;
+  b->size = size;
+  b->sizeClass = sizeClass;
+  return b;
+}
+//------------------------------------------------------------------------------
+
+/* With HugePages on, a block of MDE_HUGE_PAGE bytes or more (a long live
+ * buffer, or the copy of a buffer~) is mapped by us rather than had from the
+ * host, so that it can be backed by huge pages: grains read all over it, and
+ * with 4K pages hundreds of grains a tick means hundreds of TLB misses. We
+ * try the system's pool of huge pages first, if it has one, then ordinary
+ * memory that the kernel's asked to back with (transparent) huge pages.
+ * Returns NULL (and the host's used instead) if neither works; it doesn't
+ * matter if the kernel can't find huge pages after all. */
+static mdeGranularArenaBlock* mdeArenaMapBlock(long size)
+{
+#ifdef __linux__
+  long bytes = (size + MDE_ARENA_HEADER + MDE_HUGE_PAGE - 1) &
+    ~(long)(MDE_HUGE_PAGE - 1);
+  char* base;
+  char* start = NULL;
+  mdeGranularArenaBlock* b;
+
+#ifdef MAP_HUGETLB
+  base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (base != MAP_FAILED)
+    start = base;
+#endif
+  if (!start)
   {
-    int r = rand();
-    mdefloat diff = max - min;
-    mdefloat scaler = diff / div;
-    return (min + (r * scaler));
+    /* map a huge page more than we need and trim it to a boundary */
+    base = mmap(NULL, bytes + MDE_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      return NULL;
+    start = (char*)(((uintptr_t)base + MDE_HUGE_PAGE - 1) &
+                    ~(uintptr_t)(MDE_HUGE_PAGE - 1));
+    if (start > base)
+      munmap(base, start - base);
+    munmap(start + bytes, base + MDE_HUGE_PAGE - start);
+#ifdef MADV_HUGEPAGE
+    madvise(start, bytes, MADV_HUGEPAGE);
+#endif
   }
+  /* (the mapping's already zeroed) */
+  b = (mdeGranularArenaBlock*)start;
+  b->raw = start;
+  b->reserved = bytes;
+  b->size = size;
+  b->sizeClass = MDE_ARENA_LARGE_BLOCK;
+  b->mapped = 1;
+  return b;
+#else
+  UNUSED(size);
+  return NULL;
+#endif
 }
 //------------------------------------------------------------------------------
 
-int flip(void)
+/* give back a block from the host or mdeArenaMapBlock() */
+static void mdeArenaRelease(void* raw, long reserved, char mapped)
 {
-  static const long thresh = (RAND_MAX / 2);
-  return (rand() > thresh);
+#ifdef __linux__
+  if (mapped)
+  {
+    munmap(raw, reserved);
+    return;
+  }
+#else
+  UNUSED(reserved);
+  UNUSED(mapped);
+#endif
+  mdeFree(raw);
 }
 //------------------------------------------------------------------------------
 
-/** Simple memory allocation for an array using stdlib's calloc (PD) or MaxMSP
- *  API's sysmem_newptrclear but checking for out of memory problem. By using
- *  calloc (PD) or the MAX function, the bytes are guaranteed to be initialized
- *  to zero. */
+/* these two with the lock held */
+static void mdeArenaLink(mdeGranularArena* a, mdeGranularArenaBlock* b)
+{
+  b->chunkPrev = NULL;
+  b->chunkNext = a->chunks;
+  if (a->chunks)
+    a->chunks->chunkPrev = b;
+  a->chunks = b;
+  a->reserved += b->reserved;
+  if (b->mapped)
+    a->mapped += b->reserved;
+}
 
-void* mdeCalloc(int howmany, size_t size, char* caller, char warn)
+static void mdeArenaUnlink(mdeGranularArena* a, mdeGranularArenaBlock* b)
 {
-  void* ret = 0x0;
+  if (b->chunkPrev)
+    b->chunkPrev->chunkNext = b->chunkNext;
+  else
+    a->chunks = b->chunkNext;
+  if (b->chunkNext)
+    b->chunkNext->chunkPrev = b->chunkPrev;
+  a->reserved -= b->reserved;
+  if (b->mapped)
+    a->mapped -= b->reserved;
+}
+//------------------------------------------------------------------------------
+
+/* Blocks of up to MDE_ARENA_SMALL bytes are rounded up to a power of 2 and
+ * come from that size's free list, otherwise from the chunk being carved.
+ * Larger ones come from the smallest freed large block that's big enough (but
+ * not more than twice as big as needed), otherwise straight from the host.
+ * What's new from the host is already zeroed; what's reused has to be. */
+void* mdeArenaCalloc(mdeGranularArena* a, long howmany, size_t size,
+                     char* caller, char warn)
+{
+  long bytes;
+  long zero;
+  long align;
+  int sizeClass = 0;
+  mdeGranularArenaBlock* b = NULL;
+  mdeGranularArenaBlock** best = NULL;
+  mdeGranularArenaBlock* chunk;
 
   if (howmany < 1 || size < 1)
   {
     if (warn)
-      post("mdeGranular~: request for 0 bytes (from %s)????", caller);
+      mdePost("mdeGranular~: request for 0 bytes (from %s)????", caller);
     return NULL;
   }
-#ifdef MAXMSP
-  ret = sysmem_newptrclear(howmany * size);
-#else
-  ret = calloc(howmany, size);
-#endif
-  if (!ret && warn)
-    post("mdeGranular~: mdeCalloc: Out of memory (from %s)!", caller);
-  return ret;
+  zero = howmany * (long)size;
+  bytes = (zero + MDE_CACHE_LINE - 1) & ~(long)(MDE_CACHE_LINE - 1);
+  if (bytes <= MDE_ARENA_SMALL)
+  {
+    while ((MDE_CACHE_LINE << sizeClass) < bytes)
+      ++sizeClass;
+    bytes = MDE_CACHE_LINE << sizeClass;
+    mdeArenaLock(a);
+    if ((b = a->free[sizeClass]))
+      a->free[sizeClass] = b->next;
+    else
+    {
+      zero = 0;
+      if (a->end - a->next < bytes + MDE_ARENA_HEADER)
+      {
+        /* (what's left of the old chunk is wasted: less than the biggest
+         * small block) */
+        mdeArenaUnlock(a);
+        chunk = mdeArenaHostBlock(MDE_ARENA_CHUNK, MDE_CACHE_LINE,
+                                  MDE_ARENA_CHUNK_BLOCK, caller, warn);
+        if (!chunk)
+          return NULL;
+        mdeArenaLock(a);
+        mdeArenaLink(a, chunk);
+        a->next = (char*)chunk + MDE_ARENA_HEADER;
+        a->end = a->next + MDE_ARENA_CHUNK;
+      }
+      b = (mdeGranularArenaBlock*)a->next;
+      a->next += MDE_ARENA_HEADER + bytes;
+      b->size = bytes;
+      b->sizeClass = sizeClass;
+    }
+  }
+  else
+  {
+    mdeArenaLock(a);
+    for (mdeGranularArenaBlock** l = &a->large; *l; l = &(*l)->next)
+      if ((*l)->size >= bytes && (*l)->size <= 2 * bytes &&
+          (!best || (*l)->size < (*best)->size))
+        best = l;
+    if (best)
+    {
+      b = *best;
+      *best = b->next;
+    }
+    else
+    {
+      mdeArenaUnlock(a);
+      align = __atomic_load_n(&a->hugePages, __ATOMIC_RELAXED) &&
+        bytes >= MDE_HUGE_PAGE ? MDE_HUGE_PAGE : MDE_CACHE_LINE;
+      b = align == MDE_HUGE_PAGE ? mdeArenaMapBlock(bytes) : NULL;
+      if (!b)
+        b = mdeArenaHostBlock(bytes, align, MDE_ARENA_LARGE_BLOCK, caller,
+                              warn);
+      if (!b)
+        return NULL;
+      zero = 0;
+      mdeArenaLock(a);
+      mdeArenaLink(a, b);
+    }
+  }
+  a->used += b->size;
+  mdeArenaUnlock(a);
+  if (zero)
+    memset((char*)b + MDE_ARENA_HEADER, 0, zero);
+  return (char*)b + MDE_ARENA_HEADER;
 }
 //------------------------------------------------------------------------------
 
-void mdeFree(void* what)
+/* freed blocks are kept for reuse, apart from large blocks of
+ * MDE_ARENA_KEEP bytes or more (i.e. live buffers) which go back to the host
+ * straight away */
+void mdeArenaFree(mdeGranularArena* a, void* what)
 {
-#ifdef MAXMSP
-  sysmem_freeptr(what);
-#else
-  free(what);
-#endif
+  mdeGranularArenaBlock* b;
+  void* raw = NULL;
+  long reserved = 0;
+  char mapped = 0;
+
+  if (!what)
+    return;
+  b = (mdeGranularArenaBlock*)((char*)what - MDE_ARENA_HEADER);
+  mdeArenaLock(a);
+  a->used -= b->size;
+  if (b->sizeClass >= 0)
+  {
+    b->next = a->free[b->sizeClass];
+    a->free[b->sizeClass] = b;
+  }
+  else if (b->size < MDE_ARENA_KEEP)
+  {
+    b->next = a->large;
+    a->large = b;
+  }
+  else
+  {
+    mdeArenaUnlink(a, b);
+    raw = b->raw;
+    reserved = b->reserved;
+    mapped = b->mapped;
+  }
+  mdeArenaUnlock(a);
+  if (raw)
+    mdeArenaRelease(raw, reserved, mapped);
+}
+//------------------------------------------------------------------------------
+
+void mdeArenaFreeAll(mdeGranularArena* a)
+{
+  mdeGranularArenaBlock* next;
+
+  for (mdeGranularArenaBlock* b = a->chunks; b; b = next)
+  {
+    next = b->chunkNext;
+    mdeArenaRelease(b->raw, b->reserved, b->mapped);
+  }
+  mdeArenaInit(a);
 }
 //------------------------------------------------------------------------------
 
@@ -1748,108 +7097,6 @@ int isanum(char* input)
   return ok;
 }
 //------------------------------------------------------------------------------
-
-#pragma mark Inlet methods just call portable object's methods
-
-void mdeGranular_tildeTranspositionOffsetST(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetTranspositionOffsetST(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeGrainLengthMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainLengthMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeGrainLengthDeviation(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainLengthDeviation(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeSamplesStartMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetSamplesStartMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeSamplesEndMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetSamplesEndMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeDensity(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetDensity(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeActiveChannels(t_mdeGranular_tilde* x, long l)
-{
-  mdeGranularSetActiveChannels(&x->x_g, l);
-}
-void mdeGranular_tildeWarnings(t_mdeGranular_tilde* x, long l)
-{
-  mdeGranularSetWarnings(&x->x_g, l);
-}
-void mdeGranular_tildeGrainAmp(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetGrainAmp(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeMaxVoices(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetMaxVoices(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeActiveVoices(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetActiveVoices(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeRampLenMS(t_mdeGranular_tilde* x, mdefloat f)
-{
-  mdeGranularSetRampLenMS(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeRampType(t_mdeGranular_tilde *x, t_symbol *s)
-{
-  mdeGranularSetRampType(&x->x_g, (char*)s->s_name);
-}
-void mdeGranular_tildeOn(t_mdeGranular_tilde *x)
-{
-  mdeGranularOn(&x->x_g);
-}
-void mdeGranular_tildeOff(t_mdeGranular_tilde *x)
-{
-  mdeGranularOff(&x->x_g);
-}
-void mdeGranular_tildeSetLiveBufferSize(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularSetLiveBufferSize(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeDoGrainDelays(t_mdeGranular_tilde *x)
-{
-  mdeGranularDoGrainDelays(&x->x_g);
-}
-void mdeGranular_tildeSmoothMode(t_mdeGranular_tilde *x)
-{
-  mdeGranularSmoothMode(&x->x_g);
-}
-void mdeGranular_tildeOctaveSize(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularOctaveSize(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildeOctaveDivisions(t_mdeGranular_tilde *x, mdefloat f)
-{
-  mdeGranularOctaveDivisions(&x->x_g, (mdefloat)f);
-}
-void mdeGranular_tildePortion(t_mdeGranular_tilde *x, mdefloat position,
-                              mdefloat width)
-{
-  mdeGranularPortion(&x->x_g, (mdefloat)position, (mdefloat)width);
-}
-void mdeGranular_tildePortionPosition(t_mdeGranular_tilde *x, mdefloat position)
-{
-  mdeGranularPortionPosition(&x->x_g, (mdefloat)position);
-}
-void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width)
-{
-  mdeGranularPortionWidth(&x->x_g, (mdefloat)width);
-}
-void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
-                                      mdefloat grain_len, mdefloat ramp_len)
-{
-  mdeGranularBufferGrainRamp(x, s, grain_len, ramp_len);
-}
-//------------------------------------------------------------------------------
 #pragma mark WINDOWS FOR RAMPS
 
 /** This section taken (and modified slightly) from Bill Schottstaedt's CLM
@@ -1935,7 +7182,7 @@ mdefloat* makeWindow(char* type, int size, mdefloat beta, mdefloat *window)
   mdefloat freq, rate, sr1, angle, expn, expsum, I0beta, cx;
 
   if (window == NULL)
-    error("No memory for ramp!");
+    mdeError("No memory for ramp!");
 
   /* Bill assumes a power of 2 window size, we don't: */
   midn = size / 2; /* size >> 1; */
@@ -2120,7 +7367,10 @@ mdefloat* makeWindow(char* type, int size, mdefloat beta, mdefloat *window)
     }
   }
   else
-    error("unknown ramp type: %s\n", type);
+  {
+    mdeError("unknown ramp type: %s\n", type);
+    return NULL;
+  }
   return(window);
 }
 //------------------------------------------------------------------------------
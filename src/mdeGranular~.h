@@ -42,15 +42,24 @@
 #include "ext_obex.h"
 #include "z_dsp.h"
 #include "buffer.h"
-#define VERSION "1.2 (Max API 8.0.3)"
+#define VERSION "1.3 (Max API 8.0.3)"
 #endif
 
 #ifdef PD
 #include "m_pd.h"
 
-#define VERSION "1.2"
+#define VERSION "1.3"
 #endif
 
+/* without PD or MAXMSP we're building the portable engine on its own (see
+ * ../Makefile): it talks to its host only through mdeGranularHost */
+#ifndef VERSION
+#define VERSION "1.3"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef WIN32
 #define inline __inline
 #else
@@ -67,12 +76,25 @@
 #ifdef PD
 /// Here the t_float is from PD.
 typedef t_float mdefloat;
+#if defined(PD_FLOATSIZE) && PD_FLOATSIZE == 64
+#define MDEFLOAT_DOUBLE 1
+#endif
 #endif
 #ifdef MAXMSP
 /** MDE Wed Sep 18 18:16:48 2013 -- changing to doubles with dsp64
    typedef t_float mdefloat;
  */
 typedef double mdefloat;
+#define MDEFLOAT_DOUBLE 1
+#endif
+#if !defined(PD) && !defined(MAXMSP)
+/// The standalone engine is built with 32-bit floats (to link with PD) unless
+/// MDEFLOAT_DOUBLE is defined (for Max, or PD with 64-bit floats).
+#ifdef MDEFLOAT_DOUBLE
+typedef double mdefloat;
+#else
+typedef float mdefloat;
+#endif
 #endif
 
 //------------------------------------------------------------------------------
@@ -82,6 +104,26 @@ typedef enum
 { OFF, ON, STARTING, STOPPING, ACTIVE, INACTIVE, SKIPGRAIN }
 t_status;
 
+/** The messages that can be sent to a granulator with mdeGranularSend() etc.
+ *  and so queued and applied at the start of a tick. MDE_CMD_CLEAR_LENGTHS
+ *  forgets the grain and ramp lengths so that new ones can be given in any
+ *  order (for BufferGrainRamp); MDE_CMD_SAMPLES is only sent by the engine
+ *  itself (see mdeGranularSendSamples()).
+ */
+typedef enum
+{ MDE_CMD_TRANSPOSITION_OFFSET_ST, MDE_CMD_GRAIN_LENGTH_MS,
+  MDE_CMD_GRAIN_LENGTH_DEVIATION, MDE_CMD_SAMPLES_START_MS,
+  MDE_CMD_SAMPLES_END_MS, MDE_CMD_DENSITY, MDE_CMD_ACTIVE_CHANNELS,
+  MDE_CMD_GRAIN_AMP, MDE_CMD_MAX_VOICES, MDE_CMD_ACTIVE_VOICES,
+  MDE_CMD_RAMP_LEN_MS, MDE_CMD_RAMP_TYPE, MDE_CMD_ON, MDE_CMD_OFF,
+  MDE_CMD_TOGGLE, MDE_CMD_LIVE_BUFFER_SIZE, MDE_CMD_MIRROR_LIVE_BUFFER,
+  MDE_CMD_FIXED_PHASE, MDE_CMD_SEED, MDE_CMD_THREADS, MDE_CMD_DO_GRAIN_DELAYS,
+  MDE_CMD_SMOOTH_MODE, MDE_CMD_OCTAVE_SIZE, MDE_CMD_OCTAVE_DIVISIONS,
+  MDE_CMD_PORTION, MDE_CMD_PORTION_POSITION, MDE_CMD_PORTION_WIDTH,
+  MDE_CMD_TRANSPOSITIONS, MDE_CMD_HUGE_PAGES, MDE_CMD_CLEAR_LENGTHS,
+  MDE_CMD_SAMPLES }
+t_command;
+
 //------------------------------------------------------------------------------
 
 /** the maximum number of transpositions the granulator can handle */
@@ -90,6 +132,57 @@ t_status;
 /* The minimum size in millisecs of the buffer used for live granulation, */
 #define MINLIVEBUFSIZE 6.0
 
+/* the number of guard samples stored either side of theSamples: copies of
+ * the samples at the other end of the buffer so that 4-point interpolation
+ * never has to wrap */
+#define MDE_GUARD_SAMPLES 4
+
+/* grain positions in fixed-point mode are 32.32: the sample index is the top
+ * 32 bits and the fraction the bottom 32 */
+#define MDE_PHASE_BITS 32
+#define MDE_PHASE_ONE ((int64_t)1 << MDE_PHASE_BITS)
+#define MDE_PHASE_MASK (MDE_PHASE_ONE - 1)
+
+/* how many random numbers we generate at a time for grain initialisation */
+#define MDE_RANDOM_BATCH 64
+
+/* with more voices than this, each this many voices (a partition) are mixed
+ * into their own buffers which are then added into the outlets, always in the
+ * same order; partitions are what worker threads render (see
+ * mdeGranularSetThreads()) */
+#define MDE_PARTITION_VOICES 64
+/* how many runs of its grains' samples (see mdeGranularGrainPlan()) a
+ * partition has room for each tick */
+#define MDE_PARTITION_RUNS (2 * MDE_PARTITION_VOICES)
+/* the most threads one granulator can render with */
+#define MDE_MAX_THREADS 64
+/* how many granulators can be rendering with threads at once */
+#define MDE_POOL_SLOTS 64
+/* how long the audio thread waits for the workers to finish a tick's
+ * partitions, as a fraction of the tick, before it renders those they haven't
+ * itself; and how long (ns) an idle worker sleeps before looking again */
+#ifndef MDE_JOIN_WAIT
+#define MDE_JOIN_WAIT 0.25
+#endif
+#define MDE_POOL_NAP 2000000
+/* how many messages, and of those how many lists of transpositions, can be
+ * waiting to be applied (both powers of 2) */
+#define MDE_COMMANDS 256
+#define MDE_COMMAND_LISTS 8
+#define MDE_COMMAND_NAME_LEN 32
+/* how many ramp tables a granulator can have in use at once: the current one
+ * and those still used by grains started before it was changed */
+#define MDE_RAMPS 4
+/* the longest internal block (tick) we'll render, in samples */
+#define MDE_MAX_INTERNAL_BLOCK 8192
+/* when the live buffer's resized whilst running, the recorded samples are
+ * copied into the new one this many ticks' worth a tick */
+#define MDE_RESIZE_TICKS 16
+/* the live buffer is cleared (when the granulator's switched on) in chunks of
+ * this many samples, this many chunks a tick, unless a grain needs one sooner */
+#define MDE_CLEAR_CHUNK 4096
+#define MDE_CLEAR_CHUNKS 8
+
 #define DEFAULT_RAMP_TYPE "HANNING"
 #define DEFAULT_RAMP_LEN 10
 #define RAMPLENMINMS 0.5
@@ -97,94 +190,396 @@ t_status;
 /* to suppress warnings about unused arguments */
 #define UNUSED(x) (void)(x)
 
+/* the size of a cache line, which the grains and other per-tick data are
+ * aligned to */
+#define MDE_CACHE_LINE 64
+/* each granulator's memory comes from its own arena (see mdeArenaCalloc()):
+ * blocks of up to MDE_ARENA_SMALL bytes are carved out of chunks of
+ * MDE_ARENA_CHUNK bytes and kept, once freed, for reuse by the next block of
+ * the same size class (powers of 2 from a cache line up); larger blocks get
+ * their own, which are kept too unless they're MDE_ARENA_KEEP or more */
+#define MDE_ARENA_CHUNK 65536
+#define MDE_ARENA_SMALL 16384
+#define MDE_ARENA_CLASSES 9
+#define MDE_ARENA_KEEP 1048576
+/* how many times to spin on the arena's lock before yielding the CPU */
+#define MDE_ARENA_SPINS 64
+/* with HugePages on, blocks at least this big are mapped to be backed by huge
+ * pages where possible, otherwise start on a boundary of it */
+#define MDE_HUGE_PAGE 2097152
+
 //------------------------------------------------------------------------------
 /** @struct:
+ * All the engine needs from whatever it's running in: somewhere to print
+ *  messages, memory, and the sampling rate. The PD and Max wrappers install
+ *  their own with mdeGranularSetHost() when the class is set up; until then
+ *  (e.g. when the engine is used on its own) messages go to stderr, memory
+ *  comes from calloc() and the sampling rate is 44100.
+ */
+typedef struct _mdeGranularHost
+{
+  /** print a line of information */
+  void (*post)(const char* line);
+  /** print an error */
+  void (*error)(const char* line);
+  /** return -size- bytes of zeroed memory, or NULL if there isn't any */
+  void* (*alloc)(size_t size);
+  /** give back memory returned by alloc */
+  void (*free)(void* what);
+  /** the sampling rate the host is running at */
+  double (*samplingRate)(void);
+} mdeGranularHost;
+
+typedef struct _mdeGranularArenaBlock mdeGranularArenaBlock;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * Where all of a granulator's own memory comes from (its grains, voices,
+ *  ramps, buffers, message queue and live samples), so that it's together rather than all
+ *  over the heap, it's reused when the granulator's reconfigured, and we
+ *  know exactly how much of it there is. See mdeArenaCalloc().
+ */
+typedef struct _mdeGranularArena
+{
+  /** everything we've had from the host, so it can all be given back */
+  mdeGranularArenaBlock* chunks;
+  /** what's left of the chunk small blocks are being carved from */
+  char* next;
+  char* end;
+  /** small blocks that have been freed, by size class */
+  mdeGranularArenaBlock* free[MDE_ARENA_CLASSES];
+  /** large blocks that have been freed */
+  mdeGranularArenaBlock* large;
+  /** bytes we've had from the host (or mapped ourselves) and still have */
+  long reserved;
+  /** bytes of that mapped ourselves, to be backed by huge pages */
+  long mapped;
+  /** bytes of that handed out and not yet freed */
+  long used;
+  /** 1 = back large blocks with huge pages if we can (see HugePages) */
+  char hugePages;
+  /** set whilst a thread is using the arena; only senders, the resize
+   *  thread and mdeGranularFree() take it, never the audio thread */
+  char lock;
+} mdeGranularArena;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The state of a grain that's needed while rendering it, i.e. whenever it's
+ *  visited in a tick. This is kept to one cache line (the grains array is
+ *  cache line aligned) so a grain costs one line whatever it's doing; the
+ *  rest of what we know about each voice is in mdeGranularVoice.
  */
 typedef struct _mdeGranularGrain
 {
-  /** grain length in samples */
-  long length;
-  /** start sample */
-  mdefloat start;
-  /** end sample */
-  mdefloat end;
-  /** at which value of icurrent does the ramp up end */
-  long endRampUp;
-  /** at which value of icurrent does the ramp down start */
-  long startRampDown;
+  /** current and inc again but in 32.32 fixed point. When the parent's
+   *  fixedPhase is on, these are what's used to step through the samples and
+   *  current is only updated from phase, once per tick. */
+  int64_t phase;
+  int64_t phaseInc;
   /** current sample index (partial) into the sample buffer */
   mdefloat current;
+  /** sample increment; negative when we're playing backwards */
+  mdefloat inc;
+  /** grain length in samples */
+  int length;
   /** sample counter for the grain (from 0 to length) */
-  long icurrent;
+  int icurrent;
   /** index into ramp */
-  long rampi;
-  /** sample increment */
-  mdefloat inc;
-  /** 1 when we're playing backwards, 0 if not */
-  char backwards;
+  int rampi;
+  /** at which value of icurrent does the ramp up end */
+  int endRampUp;
+  /** at which value of icurrent does the ramp down start */
+  int startRampDown;
+  /** when the grains are initialized at the beginning, we make it wait for a
+   *  while until it actually starts output: this is how many samples of that
+   *  wait are left */
+  int delay;
   /** whether the grain should be played or not or whether it's
    *  stopping/starting */
   t_status status;
+  /** which channel the grain will be played on */
+  short channel;
+  /** which of the parent's ramps the grain was started with (and so will
+   *  finish with, should the ramp be changed whilst it's playing) */
+  short ramp;
+} mdeGranularGrain;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The rest of the state of a voice: what's only looked at when a grain is
+ *  initialised or the voices are reconfigured. These are in their own array,
+ *  parallel to the grains.
+ */
+typedef struct _mdeGranularVoice
+{
+  /** start sample */
+  mdefloat start;
+  /** end sample */
+  mdefloat end;
   /** 19/7/04: Added this slot to take over whether the grain is
    *  active or inactive rather than setting the status slot (which
    *  could be trying to indicate that it's stopping or starting */
   t_status activeStatus;
-  /** which channel the grain will be played on */
-  int channel;
   /** whether to introduce a delay the next time the grain is initialised.
    * 4/4/08:  0 = no delay; 1 = random delay; anything else is the number of
    * samples to delay */
   int doDelay;
-  /** when the grains are initialized at the beginning, we make it wait for a
-   *  while until it actually starts output */
-  long firstDelay;
-  /** this is the counter up to firstDelay */
-  long firstDelayCounter;
-} mdeGranularGrain;
+  /** the delay the grain was given when it was last initialised */
+  int firstDelay;
+  /** 1 if the grain is in the parent's sounding list or sleepers queue, 0 if
+   *  it's been dropped (i.e. it's inactive and finished) */
+  char scheduled;
+  /** when rendering with threads, the grain's latest run in its partition's
+   *  list this tick (see mdeGranularGrainPlan()) */
+  int render;
+} mdeGranularVoice;
 
 //------------------------------------------------------------------------------
+/** @struct:
+ * An entry in the queue of sleeping grains: the voice, and the sample (on the
+ *  parent's clock) at which it next has something to do.
+ */
+typedef struct _mdeGranularWake
+{
+  int64_t wake;
+  int voice;
+} mdeGranularWake;
 
+//------------------------------------------------------------------------------
 /** @struct:
- * Wrapper structure to hold the grain voices and other data relating
- *  to the overal granulation process.
- *
- *  Before using this structure (i.e. calling mdeGranularGo), the
- *  initialization functions mdeGranularInit1, mdeGranularInit2 and
- *  mdeGranularInit3 must be called.
- * */
+ * One run of samples for a worker thread to render: a copy of the grain as
+ *  it was when the run was planned (its channel says which of the
+ *  partition's buffers it's mixed into).
+ */
+typedef struct _mdeGranularRender
+{
+  mdeGranularGrain grain;
+  /** where in the tick the run starts */
+  int from;
+  int howMany;
+  /** the voice to copy the grain's position back to once the run's done, or
+   *  -1 if the voice has moved on to a new grain since */
+  int voice;
+} mdeGranularRender;
 
-typedef struct _mdeGranular
+//------------------------------------------------------------------------------
+/** @struct:
+ * The runs planned for one partition this tick, in the order they'd have
+ *  been mixed in without threads.
+ */
+typedef struct _mdeGranularRenderList
 {
-  mdefloat samplingRate;
-  /** the max number of voices (layers) of granulation requested */
-  int maxVoices;
-  /** the number of those voices that are presently active */
-  int activeVoices;
-  /** the semitone offset added to transpositions */
-  mdefloat transpositionOffsetST;
-  /** the above converted to src */
+  mdeGranularRender* runs;
+  /** the grains as a worker's runs left them, for the audio thread to copy
+   *  their positions back from */
+  mdeGranularGrain* ends;
+  int n;
+  int size;
+} mdeGranularRenderList;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * A ramp (grain envelope) table: its type and length and the ramp up and down
+ *  themselves (see mdeGranularSetRampType()). Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularRamp mdeGranularRamp;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * Everything that's the size of the voices or the tick (the grains, the
+ *  partitions' buffers, the jobs for the pool...), made in one go by
+ *  whoever changes one of those and swapped in at the start of a tick (see
+ *  mdeGranularSetMaxVoices()). Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularLayout mdeGranularLayout;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * New samples to granulate, with whatever buffers, mappings etc. they need
+ *  already made, waiting to be swapped in at the start of a tick (see
+ *  mdeGranularSendSamples()). Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularSource mdeGranularSource;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The buffers mdeGranularPerform() collects the host's blocks in when the
+ *  tick is longer than them (see mdeGranularSetInternalBlock()). Defined in
+ *  mdeGranular~.c.
+ */
+typedef struct _mdeGranularFifo mdeGranularFifo;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * What the renderer has finished with, for whoever sends next to free.
+ *  Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularRetired mdeGranularRetired;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * A message waiting to be applied to a granulator (see mdeGranularSend()).
+ */
+typedef struct _mdeGranularCommand
+{
+  /** the tick it's to be applied before, at the latest (see
+   *  mdeGranularSend()) */
+  int64_t block;
+  t_command what;
+  mdefloat f[2];
+  /** for MDE_CMD_RAMP_TYPE */
+  char name[MDE_COMMAND_NAME_LEN];
+  /** for MDE_CMD_RAMP_TYPE and MDE_CMD_RAMP_LEN_MS: the new ramp, made by
+   *  the sender so the audio thread only has to swap it in */
+  mdeGranularRamp* ramp;
+  /** the same for MDE_CMD_MAX_VOICES and MDE_CMD_THREADS */
+  mdeGranularLayout* layout;
+  /** and for MDE_CMD_SAMPLES */
+  mdeGranularSource* source;
+  /** for MDE_CMD_TRANSPOSITIONS: which of the queue's lists holds the
+   *  semitones, and how many there are */
+  int list;
+  int n;
+} mdeGranularCommand;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The thread a granulator renders ahead on and the tick it rendered last
+ *  (see mdeGranularSetRenderAhead()). Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularAhead mdeGranularAhead;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The messages waiting to be applied to a granulator and the lock its
+ *  senders take turns with (see mdeGranularSend() and mdeGranularLock()).
+ *  Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularQueue mdeGranularQueue;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * A new live buffer being allocated on its own thread and copied into (see
+ *  mdeGranularSetLiveBufferSize()). Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularResize mdeGranularResize;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * A granulator's partitions, planned and waiting to be rendered by the pool
+ *  of threads shared by all granulators (see mdeGranularSetThreads()).
+ *  Defined in mdeGranular~.c.
+ */
+typedef struct _mdeGranularJobs mdeGranularJobs;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * A counter-based random number generator (SplitMix64): the nth number of a
+ *  sequence is a hash of the key and n, so there's no hidden state shared
+ *  between granulators and any one of them can be made to repeat itself
+ *  exactly by seeding it (see mdeGranularSetSeed()).
+ */
+typedef struct _mdeGranularRandom
+{
+  /** derived from the seed */
+  uint64_t key;
+  /** how many numbers have been generated since seeding */
+  uint64_t counter;
+} mdeGranularRandom;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The settings messages sent so far would leave a granulator with, as far as
+ *  they're needed to check the next ones (see mdeGranularCheck()). The audio
+ *  thread may not have got to them yet, so senders keep their own view.
+ */
+typedef struct _mdeGranularSent
+{
+  mdefloat grainLengthMS;
+  long grainLength;
+  mdefloat rampLenMS;
+  /** the samples to be granulated (the ring, if it's mirrored) */
+  long nBufferSamples;
+  mdefloat BufferSamplesMS;
+  /** the highest transposition (as a src) and the offset it's multiplied by */
+  mdefloat highestSRC;
   mdefloat transpositionOffset;
-  /** the number of transpositions in semitones given as a list to the object
-   */
-  int numTranspositions;
+  mdefloat octaveSize;
+  mdefloat octaveDivisions;
+  mdefloat portionPosition;
+  mdefloat portionWidth;
+} mdeGranularSent;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * The granulator's settings that are big and/or only looked at when they're
+ *  changed (or when a grain picks a transposition), plus the grains' batch of
+ *  random numbers. These are allocated
+ *  separately so that they don't spread the data mdeGranularGo needs every
+ *  tick over more cache lines than it has to be.
+ */
+typedef struct _mdeGranularConfig
+{
   /** an array of transpositions as given in semitones to the object */
   mdefloat transpositions[MAXTRANSPOSITIONS];
   /** an array of transpositions in src (1 no transposition, 0.5 octave lower,
    *  2 octave above), convereted from above */
   mdefloat srcs[MAXTRANSPOSITIONS];
-  /** the grain length in milliseconds, as given to the object */
-  mdefloat grainLengthMS;
-  /** the grain length in samples, converted from above */
-  int grainLength;
-  /** percentage deviation for grain length: actual grain length will be
-   * randomised within grainLength +/- deviation */
-  mdefloat grainLengthDeviation;
   /** The name of the buffer to be granulated */
   char BufferName[128];
+  /** the next batch of random numbers for grain initialisation; see
+   *  mdeGranularRandom32() */
+  uint32_t randoms[MDE_RANDOM_BATCH];
+} mdeGranularConfig;
+
+//------------------------------------------------------------------------------
+/** @struct:
+ * Wrapper structure to hold the grain voices and other data relating
+ *  to the overal granulation process.
+ *
+ *  Before using this structure (i.e. calling mdeGranularGo), the
+ *  initialization functions mdeGranularInit1, mdeGranularInit2 and
+ *  mdeGranularInit3 must be called.
+ *
+ *  The slots are in three groups: first those read on every tick, then
+ *  those read when a grain is (re)initialised, then the rest, which are
+ *  only used when settings change (or, like the queue, are just a pointer,
+ *  loaded once a tick, to what the tick does look at). Keep them that way:
+ *  a patch can have dozens of these and the first two groups are all that
+ *  should need to be in the cache while they run. (The struct is embedded
+ *  in the PD/Max object so we can't choose its alignment.)
+ * */
+
+typedef struct _mdeGranular
+{
+  /*** read every tick ***/
+  /** whether the granulator should produce output or not (i.e. if this is 0,
+   *  then it is silent) */
+  t_status status;
+  /** we can granulate a static buffer of samples or a live incoming signal,
+   *  this will be 0 or 1 respectively */
+  char live;
+  /** 1 if samples has guard samples around it (i.e. it's theSamples), 0 if
+   *  it's a borrowed buffer (e.g. a PD array) that we can't read past */
+  char samplesGuarded;
+  /** 1 if samples is mirrorSamples */
+  char samplesMirrored;
+  /** 1 if grains should step through the samples with their fixed-point
+   *  phase rather than their (floating point) current position. Slower to
+   *  drift and cheaper to split into index and fraction; see
+   *  mdeGranularSetFixedPhase() */
+  char fixedPhase;
+  /** whether we should print stuff to the max window whilst running. */
+  char warnings;
   /** the number of output channels */
   int numChannels;
   /** the number of output channels currently sending grains */
   int activeChannels;
+  /** how many samples to output each time mdeGranularGo is called (the
+   *  tick): the host's block size unless we've been given an internal
+   *  block */
+  long nOutputSamples;
   /** where MSP/PD wants us to write each individual output channel
    * i.e. the signal outlets. N.B. Although it would seem that this
    * should be external to our object, we need access to all the
@@ -194,13 +589,6 @@ typedef struct _mdeGranular
   mdefloat** channelBuffers;
   /** where maxmsp/PD stores the incoming signal */
   mdefloat* signalIn;
-  /** how many samples to output each time mdeGranularGo is called */
-  long nOutputSamples;
-  /** array of grain structures, one for each voice */
-  mdeGranularGrain* grains;
-  /** a sample buffer for storing live incoming samples; samples will
-   *  point to this when we are granulating live. */
-  mdefloat* theSamples;
   /** the samples to granulate, whether live or from a buffer (always
    *  a mono signal). this is only a pointer; the actual allocated buffer is
    *  theSamples */
@@ -211,37 +599,27 @@ typedef struct _mdeGranular
    *  actual buffer allocated by SetLiveBufferSize(), which will
    *  probably be larger. */
   long nBufferSamples;
-  /** this is the actual number of samples allocated for in the live
-   *  buffer */
-  long nAllocatedBufferSamples;
-  /** this is the same in millisecs */
-  mdefloat AllocatedBufferMS;
-  /** how many millisecs of samples there are in the buffer */
-  mdefloat BufferSamplesMS;
-  /** where to start in the samples in millisecs */
-  mdefloat samplesStartMS;
-  /** where to start in the samples in samples */
-  long samplesStart;
-  /** where to end in the samples in millisecs */
-  mdefloat samplesEndMS;
-  /** where to end in the samples in samples */
-  long samplesEnd;
-  /** we do a straight ramp up, this is the length of such in
-   *  milliseconds... */
-  mdefloat rampLenMS;
-  /** ...and this is it in samples */
-  long rampLenSamples;
+  /** we store the incoming samples in |samples| which is then a circular
+   *  buffer; this is the index to the oldest sample. */
+  long liveIndex;
   /** this is the array of scalers for the ramp up... */
   mdefloat* rampUp;
   /** ...and ramp down */
   mdefloat* rampDown;
-  /** what percentage of grains should actually produce output. This
-   *  is a percentage that will be used to randomly switch a grain on
-   *  when it's over this threshold. */
-  mdefloat density;
-  /** whether the granulator should produce output or not (i.e. if this is 0,
-   *  then it is silent) */
-  t_status status;
+  /** the length of the ramps in samples */
+  long rampLenSamples;
+  /** rampUp, rampDown and rampLenSamples are those of ramps[ramp], the one
+   *  new grains use; the others are NULL or still being used by grains that
+   *  started before the ramp was changed */
+  mdeGranularRamp* ramps[MDE_RAMPS];
+  int ramp;
+  /** the same as ramps[ramp], for senders to read */
+  mdeGranularRamp* rampNow;
+  /** a ramp waiting for a free slot in ramps */
+  mdeGranularRamp* rampNext;
+  /** index into rampDown or rampUp for doing a quick fade in/out when the
+   *  granulator is stopped. */
+  long statusRampIndex;
   /** amplitude scaler applied to all grains */
   mdefloat grainAmp;
   /** the last grain amp accepted */
@@ -254,23 +632,184 @@ typedef struct _mdeGranular
   /** we need a tick's worth of grainAmps when moving from lastGrainAmp to
    *  targetGrainAmp so here's storage for them */
   mdefloat* grainAmps;
-  /** index into rampDown or rampUp for doing a quick fade in/out when the
-   *  granulator is stopped. */
-  long statusRampIndex;
-  /** we can granulate a static buffer of samples or a live incoming signal,
-   *  this will be 0 or 1 respectively */
-  char live;
-  /** we store the incoming samples in |samples| which is then a circular
-   *  buffer; this is the index to the oldest sample. */
-  long liveIndex;
+  /** a tick's worth of storage for the (transposed) samples of the grain
+   *  currently being rendered, before the envelope is applied */
+  mdefloat* grainScratch;
+  /** array of grain structures, one for each voice (cache line aligned) */
+  mdeGranularGrain* grains;
+  /** and the rest of each voice's state, parallel to grains */
+  mdeGranularVoice* voices;
+  /** how many samples we've rendered (while on) since we were created: grains
+   *  waiting to start are scheduled against this */
+  int64_t clock;
+  /** a min-heap (on wake) of the grains that are delayed or skipped, i.e.
+   *  have nothing to do until some time after this tick, maxVoices long */
+  mdeGranularWake* sleepers;
+  int nSleepers;
+  /** the indices of the grains that are currently making sound, maxVoices
+   *  long; only these and any sleepers that wake are visited each tick */
+  int* sounding;
+  int nSounding;
+  /** how many partitions of MDE_PARTITION_VOICES the voices are split into;
+   *  1 (the voices mix straight into the outlets) unless there are more than
+   *  MDE_PARTITION_VOICES of them */
+  int nPartitions;
+  /** 1 during a tick in which the grains are only being planned, for the
+   *  pool to render */
+  char planning;
+  /** each partition's own output: numChannels buffers of nOutputSamples */
+  mdefloat* partitionSamples;
+  /** NULL unless we've been told to render with more than one thread */
+  mdeGranularJobs* jobs;
+  /** the most threads (our own included) that may render our partitions */
+  int threads;
+  /** where grainAmps, grainScratch, grains etc. and the above came from:
+   *  the one swapped in last, and one with a new tick waiting for the start
+   *  of the host's next block (see mdeGranularPerform()). layoutWaiting is 1
+   *  when a message with one of those is waiting for the same. */
+  mdeGranularLayout* layout;
+  mdeGranularLayout* layoutNext;
+  char layoutWaiting;
+  /** our slot in the pool (see mdeGranularSetThreads()), -1 if we haven't
+   *  got one */
+  int poolSlot;
+  /** 1 if we've been asked to render a block ahead; the thread's started
+   *  or stopped accordingly on the message side */
+  char renderAhead;
+  /** how many ticks have been started: what messages are stamped with */
+  int64_t ticks;
+  /** the tick size we've been asked for (0 = the host's block size); see
+   *  mdeGranularSetInternalBlock() */
+  long internalBlock;
+  /** when the tick is longer than the host's block, the buffers it's
+   *  collected in (and one waiting to be swapped in, as layoutNext), and
+   *  where in the tick the next host block is */
+  mdeGranularFifo* fifo;
+  mdeGranularFifo* fifoNext;
+  long fifoPos;
+  char fifoHaveInput;
+
+  /*** read when a grain is initialised ***/
+  /** the max number of voices (layers) of granulation requested */
+  int maxVoices;
+  /** the number of those voices that are presently active */
+  int activeVoices;
+  /** the grain length in samples, converted from grainLengthMS */
+  int grainLength;
+  /** the number of transpositions in semitones given as a list to the object
+   */
+  int numTranspositions;
+  /** percentage deviation for grain length: actual grain length will be
+   * randomised within grainLength +/- deviation */
+  mdefloat grainLengthDeviation;
+  /** the transposition offset converted to src */
+  mdefloat transpositionOffset;
+  /** what percentage of grains should actually produce output. This
+   *  is a percentage that will be used to randomly switch a grain on
+   *  when it's over this threshold. */
+  mdefloat density;
+  /** where to start in the samples in samples */
+  long samplesStart;
+  /** where to end in the samples in samples */
+  long samplesEnd;
+  /** the transpositions (in config) */
+  mdeGranularConfig* config;
+  /** where the random numbers for between() etc. come from, and the index of
+   *  the next unused one in config->randoms */
+  mdeGranularRandom rng;
+  int nextRandom;
+
+  /*** settings ***/
+  /** allocated by mdeGranularInit1() */
+  mdeGranularQueue* queue;
+  /** NULL until we're first asked to render ahead, then kept until we're
+   *  freed */
+  mdeGranularAhead* ahead;
+  /** allocated the first time the live buffer is resized whilst we're
+   *  running */
+  mdeGranularResize* resize;
+  /** the last layout and ramp sent (which may not have been swapped in
+   *  yet) */
+  mdeGranularLayout* layoutSent;
+  mdeGranularRamp* rampSent;
+  /** ramps, and layouts etc., the renderer's finished with, for senders to
+   *  free */
+  mdeGranularRamp* rampsDead;
+  mdeGranularRetired* retired;
+  /** the block size the host gave mdeGranularInit2() */
+  long hostBlock;
+  /** where the memory for grainAmps, grains, the queue etc. comes from */
+  mdeGranularArena arena;
+  mdefloat samplingRate;
+  /** the semitone offset added to transpositions */
+  mdefloat transpositionOffsetST;
+  /** the grain length in milliseconds, as given to the object */
+  mdefloat grainLengthMS;
+  /** a sample buffer for storing live incoming samples; samples will
+   *  point to this when we are granulating live. There are
+   *  MDE_GUARD_SAMPLES guard samples before theSamples[0] and after
+   *  theSamples[nBufferSamples - 1]. */
+  mdefloat* theSamples;
+  /** 1 if live granulation should use a mirrored buffer (see
+   *  mdeGranularMapMirror()) rather than theSamples, when one can be made */
+  char mirrorLive;
+  /** the mirrored live buffer: nMirrorSamples samples mapped twice, back to
+   *  back, so that mirrorSamples[i + nMirrorSamples] is mirrorSamples[i]. NULL
+   *  if we're not using one. */
+  mdefloat* mirrorSamples;
+  long nMirrorSamples;
+  /** a sound file being granulated in place (see mdeGranularMapFile()):
+   *  fileMapBytes bytes mapped at fileMap, nFileSamples of which, starting at
+   *  fileSamples, are the samples. NULL if there isn't one. */
+  void* fileMap;
+  long fileMapBytes;
+  mdefloat* fileSamples;
+  long nFileSamples;
+  /** this is the actual number of samples allocated for in the live
+   *  buffer */
+  long nAllocatedBufferSamples;
+  /** this is the same in millisecs */
+  mdefloat AllocatedBufferMS;
+  /** 1 once MaxLiveBufferMS has been sent: the live buffer then stays the
+   *  size it was given rather than being allocated (or grown) as needed */
+  char liveBufferFixed;
+  /** 1 whilst the live buffer's being cleared (see
+   *  mdeGranularClearTheSamples()): until then only the first clearWritten
+   *  samples of the ring, and the chunks of it whose entry in clearMap is
+   *  clearEpoch, are clean; the rest are silenced before any grain reads
+   *  them. clearNext is the next chunk to be silenced anyway, counting
+   *  those beyond the ring. */
+  char clearing;
+  long clearWritten;
+  long clearNext;
+  unsigned clearEpoch;
+  unsigned* clearMap;
+  long nClearMap;
+  /** how many millisecs of samples there are in the buffer */
+  mdefloat BufferSamplesMS;
+  /** where to start in the samples in millisecs */
+  mdefloat samplesStartMS;
+  /** where to end in the samples in millisecs */
+  mdefloat samplesEndMS;
+  /** we do a straight ramp up, this is the length of such in
+   *  milliseconds */
+  mdefloat rampLenMS;
   /** the type of window to use for ramping: hamming, blackman etc. */
-  char* rampType;
+  char rampType[MDE_COMMAND_NAME_LEN];
+  /** a ramp length sent before there were any ramps, for
+   *  mdeGranularInit2() to start with */
+  mdefloat rampLenAsked;
+  /** the live buffer size last sent to mdeGranularSendSamples() (0 if the
+   *  last samples sent weren't live), for mdeGranularSetMirrorLiveBuffer()
+   *  to send again */
+  mdefloat liveSentMS;
+  long liveSentN;
+  /** what the messages sent so far amount to (only senders use it) */
+  mdeGranularSent sent;
   /** when doing transposition, what octave size and number of divisions are we
    *  working with (default 2 and 12) */
   mdefloat octaveSize;
   mdefloat octaveDivisions;
-  /** whether we should print stuff to the max window whilst running. */
-  char warnings;
   /** 31/8/10: just holding positions for the new data associated with the
    *  Portion message */
   mdefloat portionPosition;
@@ -291,6 +830,9 @@ typedef struct _mdeGranular_tilde
   mdeGranular x_g;
   /* whether we're recording the incoming signal or not */
   char x_liverunning;
+  /* 1 if x_arrayname is a sound file rather than an array (2 if it's raw
+   * samples) */
+  char x_file;
   /* all classes that have a signal in need a float member in case a single
    * float instead of a signal is given (apparently). */
   t_float x_f;
@@ -308,6 +850,9 @@ typedef struct _mdeGranular_tilde
   mdeGranular x_g;
   /* whether we're recording the incoming signal or not */
   char x_liverunning;
+  /* 1 if x_arrayname is a sound file rather than a buffer~ (2 if it's raw
+   * samples) */
+  char x_file;
 } t_mdeGranular_tilde;
 #endif
 
@@ -318,6 +863,23 @@ typedef struct _mdeGranular_tilde
 /// avoid starting/stopping at exactly the same point in each voice.
 /// @param g grains pointer
 void mdeGranularInitGrains(mdeGranular* g);
+/// Put every grain that's active or still sounding into the sleepers queue to
+/// be woken at the start of the next tick, which will sort them into sounding
+/// or sleeping.  Call this whenever grains have been changed behind the
+/// scheduler's back.
+/// @param g <#g description#>
+void mdeGranularReschedule(mdeGranular* g);
+/// Put voice -voice- in the sleepers queue to be woken at sample -wake- (on
+/// g's clock).
+/// @param g <#g description#>
+/// @param voice <#voice description#>
+/// @param wake <#wake description#>
+void mdeGranularSleep(mdeGranular* g, int voice, int64_t wake);
+/// Render a tick's worth of the grains that are sounding or due to wake up,
+/// and advance the clock.
+/// @param g <#g description#>
+/// @param tickSize <#tickSize description#>
+void mdeGranularRunGrains(mdeGranular* g, long tickSize);
 /// <#Description#>
 /// @param gg <#gg description#>
 /// @param parent <#parent description#>
@@ -325,36 +887,131 @@ void mdeGranularInitGrains(mdeGranular* g);
 int mdeGranularGrainInit(mdeGranularGrain* gg, mdeGranular* parent,
                          int doFirstDelay);
 
-/// Get -howMany- samples from -samples- and mix them into -where- i.e. mix
-/// with what's already there.
+/// Get samples -from- to -howMany- of this tick from -samples- and mix them
+/// into the grain's channel buffer i.e. mix with what's already there.
+/// The tick is split into runs (delay, ramp up, steady state, ramp down,
+/// skipped) each of which is handled in one go rather than sample by sample.
+/// Returns 0 if the grain is sounding at the end of the tick, -1 if it's
+/// inactive and finished, otherwise the number of samples after the tick it
+/// will stay silent for (delayed or skipped); in that case the grain has
+/// already been moved on past those samples.
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+/// @param from <#from description#>
+/// @param howMany <#howMany description#>
+long mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* g, int from,
+                           int howMany);
+/// Render -howMany- samples of a sounding grain into -where-, applying the
+/// ramp up/down and the grain amps (-gamp-). -howMany- must not go past the
+/// end of the grain. The grain's (transposed) samples are read into
+/// -scratch- first.
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+/// @param where <#where description#>
+/// @param gamp <#gamp description#>
+/// @param scratch <#scratch description#>
+/// @param howMany <#howMany description#>
+void mdeGranularGrainRenderRun(mdeGranularGrain* gg, mdeGranular* g,
+                               mdefloat* where, mdefloat* gamp,
+                               mdefloat* scratch, long howMany);
+/// Move a sounding grain on by -howMany- samples as
+/// mdeGranularGrainRenderRun() would, but without reading or mixing anything
+/// (nor moving its position through the samples).
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+/// @param howMany <#howMany description#>
+void mdeGranularGrainAdvance(mdeGranularGrain* gg, mdeGranular* g,
+                             long howMany);
+/// Where a grain should mix itself in: its channel's outlet, or, when the
+/// voices are partitioned, its partition's buffer for that channel.
+/// @param g <#g description#>
+/// @param gg <#gg description#>
+mdefloat* mdeGranularGrainOutput(mdeGranular* g, mdeGranularGrain* gg);
+/// Instead of rendering a run of a grain, add it to its partition's list for
+/// the pool and move the grain on (see mdeGranularGrainAdvance()). If the
+/// partition can't be planned this tick the run's rendered into -where-
+/// straight away.
 /// @param gg <#gg description#>
 /// @param g <#g description#>
 /// @param where <#where description#>
+/// @param from <#from description#>
 /// @param howMany <#howMany description#>
-void mdeGranularGrainMixIn(mdeGranularGrain* gg, mdeGranular* g,
-                           mdefloat* where, int howMany);
+void mdeGranularGrainPlan(mdeGranularGrain* gg, mdeGranular* g,
+                          mdefloat* where, int from, long howMany);
+/// A grain is about to be reinitialised: make sure the last run planned for
+/// it this tick doesn't copy its old position back over the new one.
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+void mdeGranularGrainUnplan(mdeGranularGrain* gg, mdeGranular* g);
+/// Render the runs planned for a partition, in order, into -out- (its
+/// numChannels buffers). The grains' final positions go into the list's ends
+/// if -ends- is 1 (a worker), otherwise straight back into the voices.
+/// @param g <#g description#>
+/// @param list <#list description#>
+/// @param out <#out description#>
+/// @param scratch <#scratch description#>
+/// @param ends <#ends description#>
+void mdeGranularRenderPartition(mdeGranular* g, mdeGranularRenderList* list,
+                                mdefloat* out, mdefloat* scratch, int ends);
+/// Add the partitions' buffers (and those rendered by workers) into the
+/// outlets, always in the same order.
+/// @param g <#g description#>
+/// @param tickSize <#tickSize description#>
+void mdeGranularMixPartitions(mdeGranular* g, long tickSize);
+/// Read -howMany- (possibly transposed) samples for the grain into -out-,
+/// advancing its current position.
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+/// @param out <#out description#>
+/// @param howMany <#howMany description#>
+void mdeGranularGrainRead(mdeGranularGrain* gg, mdeGranular* g,
+                          mdefloat* out, long howMany);
+/// As mdeGranularGrainRead but stepping through the samples with the grain's
+/// fixed-point phase and phaseInc.
+/// @param gg <#gg description#>
+/// @param g <#g description#>
+/// @param out <#out description#>
+/// @param howMany <#howMany description#>
+void mdeGranularGrainReadFixed(mdeGranularGrain* gg, mdeGranular* g,
+                               mdefloat* out, long howMany);
+/// Mix -src- scaled by -gamp- into -where-.
+/// @param where <#where description#>
+/// @param src <#src description#>
+/// @param gamp <#gamp description#>
+/// @param numSamples <#numSamples description#>
+void mixIn(mdefloat* where, mdefloat* src, mdefloat* gamp, long numSamples);
+/// Mix -src- scaled by -env- and -gamp- into -where-.
+/// @param where <#where description#>
+/// @param src <#src description#>
+/// @param env <#env description#>
+/// @param gamp <#gamp description#>
+/// @param numSamples <#numSamples description#>
+void mixInWithEnvelope(mdefloat* where, mdefloat* src, mdefloat* env,
+                       mdefloat* gamp, long numSamples);
 
 /// Convert semitones to sampling-rate conversion factor
 /// e.g. st2src(-12) -> 0.5,  st2src(12) -> 2,  st2src(0) -> 1
 /// @param st <#st description#>
 /// @param octaveSize <#octaveSize description#>
 /// @param octaveDivisions <#octaveDivisions description#>
-inline mdefloat st2src(mdefloat st, mdefloat octaveSize,
-                       mdefloat octaveDivisions);
+mdefloat st2src(mdefloat st, mdefloat octaveSize, mdefloat octaveDivisions);
 /// Convert milliseconds to samples using the given sampling rate.
 /// @param samplingRate <#samplingRate description#>
 /// @param milliseconds <#milliseconds description#>
-inline long ms2samples(mdefloat samplingRate, mdefloat milliseconds);
+long ms2samples(mdefloat samplingRate, mdefloat milliseconds);
 /// Convert samples to milliseconds using the given sampling rate.
 /// @param samplingRate <#samplingRate description#>
 /// @param samples <#samples description#>
-inline mdefloat samples2ms(mdefloat samplingRate, int samples);
-/// Return a random number between min (inclusive) and max (exclusive).
+mdefloat samples2ms(mdefloat samplingRate, int samples);
+/// Return a random number between min (inclusive) and max (exclusive), using
+/// the granulator's random number generator.
+/// @param g <#g description#>
 /// @param min <#min description#>
 /// @param max <#max description#>
-inline mdefloat between(mdefloat min, mdefloat max);
+mdefloat between(mdeGranular* g, mdefloat min, mdefloat max);
 /// Flip of a coin, i.e. return randomly 0 or 1
-inline int flip(void);
+/// @param g <#g description#>
+int flip(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
 void mdeGranularMdeFree(mdeGranular* g);
@@ -367,9 +1024,11 @@ void mdeGranularMdeFree(mdeGranular* g);
 void makeRamps(int rampLen, mdefloat* rampUp, mdefloat* rampDown);
 /// Randomly deviate -number- by maxDeviation  this can be > or < than -number-
 /// maxDeviation is a percentage
+/// @param g <#g description#>
 /// @param number <#number description#>
 /// @param maxDeviation <#maxDeviation description#>
-mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation);
+mdefloat randomlyDeviate(mdeGranular* g, mdefloat number,
+                         mdefloat maxDeviation);
 //// 4-point interpolating table lookup nicked and modified from pd's d_array.c (tabread4~)
 /// @updated: MDE Thu Feb 20 11:39:46 2020 -- 'live' arg doesn't seem to be used at all, so
 /// removing
@@ -384,6 +1043,57 @@ mdefloat randomlyDeviate(mdefloat number, mdefloat maxDeviation);
 /// @param backwards <#backwards description#>
 mdefloat interpolate(mdefloat findex, mdefloat* samples, long numSamples,
                      char backwards); /* , char live);*/
+/// interpolate() with the index already split into its whole and fractional
+/// parts.  -index- may be anywhere; it's wrapped into the buffer here.
+/// @param index <#index description#>
+/// @param fraction <#fraction description#>
+/// @param samples <#samples description#>
+/// @param numSamples <#numSamples description#>
+/// @param backwards <#backwards description#>
+mdefloat interpolateIndex(long index, mdefloat fraction, mdefloat* samples,
+                          long numSamples, char backwards);
+/// The cubic used by interpolate(), given the four points around the index
+/// and the fractional part of the index.
+/// @param a <#a description#>
+/// @param b <#b description#>
+/// @param c <#c description#>
+/// @param d <#d description#>
+/// @param fraction <#fraction description#>
+mdefloat cubic(mdefloat a, mdefloat b, mdefloat c, mdefloat d,
+               mdefloat fraction);
+/// Interpolate -howMany- samples starting at -findex- and moving by -inc-
+/// each sample, writing the results to -out-. This is the same 4-point
+/// lookup as interpolate() but without any wrapping, so the caller must make
+/// sure that every index read (i.e. up to 2 samples either side of each
+/// position) is inside -samples-. On x86-64 this uses SSE2, or AVX2 when the
+/// CPU has it (decided at run time), otherwise it's plain C.
+/// Positions are calculated as findex + i * inc rather than by repeated
+/// addition, so they can differ from those of a loop calling interpolate()
+/// by the rounding error of that addition; for the same position the result
+/// is the same as interpolate()'s to within a few ulps (float) or better.
+/// @param out <#out description#>
+/// @param samples <#samples description#>
+/// @param findex <#findex description#>
+/// @param inc <#inc description#>
+/// @param howMany <#howMany description#>
+/// @param backwards <#backwards description#>
+void interpolateSpan(mdefloat* out, mdefloat* samples, mdefloat findex,
+                     mdefloat inc, long howMany, char backwards);
+/// interpolateSpan() for a 32.32 fixed-point -phase- and -inc-.  The whole
+/// sample part of the lowest position read is taken off before any floating
+/// point is involved, so the positions handed to the interpolation are never
+/// more than a tick's worth of samples, whatever the size of the buffer.
+/// @param out <#out description#>
+/// @param samples <#samples description#>
+/// @param phase <#phase description#>
+/// @param inc <#inc description#>
+/// @param howMany <#howMany description#>
+/// @param backwards <#backwards description#>
+void interpolateSpanFixed(mdefloat* out, mdefloat* samples, int64_t phase,
+                          int64_t inc, long howMany, char backwards);
+/// Convert a sample position or increment to 32.32 fixed point (rounding).
+/// @param x <#x description#>
+int64_t mdeGranularPhase(double x);
 /// The side-effect here is that status changes when it is detected that ramp
 /// up/down is over
 /// 10.9.10 NB that the ramp used for starting and stopping is exactly the same
@@ -394,38 +1104,49 @@ mdefloat mdeGranularGetAmpForStatus(mdeGranular* g);
 
 /// Do we need to reinitialise our grain, i.e. have we finished with the ramp down?
 /// @param g <#g description#>
-inline int mdeGranularGrainExhausted(mdeGranularGrain* g);
- 
-/// Get the amplitude scaler for the grain depending on whether we're in the
-/// ramp up, steady state, or ramp down.
-/// @param gg <#gg description#>
-/// @param rampUp <#rampUp description#>
-/// @param rampDown <#rampDown description#>
-/// @param rampLen <#rampLen description#>
-inline mdefloat mdeGranularGrainGetRampVal(mdeGranularGrain* gg,
-                                           mdefloat* rampUp,
-                                           mdefloat* rampDown, long rampLen);
+int mdeGranularGrainExhausted(mdeGranularGrain* g);
 
 /// <#Description#>
 /// @param howmany <#howmany description#>
 /// @param size <#size description#>
 /// @param caller <#caller description#>
 /// @param warn <#warn description#>
-inline void* mdeCalloc(int howmany, size_t size, char* caller, char warn);
+void* mdeCalloc(int howmany, size_t size, char* caller, char warn);
 /// <#Description#>
 /// @param what <#what description#>
-inline void mdeFree(void* what);
+void mdeFree(void* what);
+/// Make -a- ready to allocate from; it has nothing until it's first asked.
+/// @param a <#a description#>
+void mdeArenaInit(mdeGranularArena* a);
+/// As mdeCalloc but from the arena -a-: the returned memory is cache line
+/// aligned and comes from a block that was freed before if there is one the
+/// right size, otherwise from the host.  Safe to call from any thread.
+/// @param a <#a description#>
+/// @param howmany <#howmany description#>
+/// @param size <#size description#>
+/// @param caller <#caller description#>
+/// @param warn <#warn description#>
+void* mdeArenaCalloc(mdeGranularArena* a, long howmany, size_t size,
+                     char* caller, char warn);
+/// Give memory from mdeArenaCalloc back to -a- (NULL is OK).
+/// @param a <#a description#>
+/// @param what <#what description#>
+void mdeArenaFree(mdeGranularArena* a, void* what);
+/// Give everything -a- has back to the host, whether it's been freed or not.
+/// @param a <#a description#>
+void mdeArenaFreeAll(mdeGranularArena* a);
 /// Zero out a bunch of samples (starting at -where-), i.e. make them silent.
 /// @param where <#where description#>
 /// @param numSamples <#numSamples description#>
-inline void silence(mdefloat* where, int numSamples);
+void silence(mdefloat* where, int numSamples);
 /// <#Description#>
 /// @param g <#g description#>
-inline int mdeGranularAtTargetGrainAmp(mdeGranular* g);
+int mdeGranularAtTargetGrainAmp(mdeGranular* g);
 /// Check whether a string contains a number, i.e. only digits and dots.
 /// @param input <#input description#>
 int isanum(char *input);
-/// <#Description#>
+/// Fill -window- with -size- points of the given type of window. Returns
+/// -window-, or NULL if the type is unknown.
 /// @param type <#type description#>
 /// @param size <#size description#>
 /// @param beta <#beta description#>
@@ -435,31 +1156,20 @@ mdefloat* makeWindow(char* type, int size, mdefloat beta, mdefloat* window);
 /// @param g <#g description#>
 /// @param type <#type description#>
 void mdeGranularStoreRampType(mdeGranular* g, char* type);
-/// <#Description#>
-/// @param g <#g description#>
-inline void mdeGranularClearLiveSamples(mdeGranular* g);
 
-/// @updated 3.10.11 set buffer, grain and ramp lengths simultaneously, thus avoiding all
-/// of the length conflicts NB buffer is a symbol, not just a size e.g. ms1000
-/// @param x <#x description#>
-/// @param s <#s description#>
-/// @param grain_len <#grain_len description#>
-/// @param ramp_len <#ramp_len description#>
-void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
-                                double grain_len, double ramp_len);
 /// <#Description#>
 /// @param g <#g description#>
 void warnGrain2BufferLength(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
-inline void mdeGranularDoGrainDelays(mdeGranular* g);
+void mdeGranularDoGrainDelays(mdeGranular* g);
 /// <#Description#>
 /// @param array <#array description#>
 /// @param size <#size description#>
 mdefloat maxFloat(mdefloat* array, int size);
 /// <#Description#>
 /// @param g <#g description#>
-inline void mdeGranularForceGrainReinit(mdeGranular* g);
+void mdeGranularForceGrainReinit(mdeGranular* g);
 /// @updated 3/4/08: the rampLenMS and samplingRate arguments are no longer
 /// used here as they are only valid once the audio has been turned on
 /// and srate selected. Functionality that used these is passed down
@@ -474,13 +1184,25 @@ void mdeGranularPrint(mdeGranular* g);
 
 /// Called when a set message is sent to the object
 /// samplesMS is the length of the buffer (-samples-) in millisecs
-/// numSamples the length of the same in samples.
+/// numSamples the length of the same in samples. This changes the granulator
+/// directly, so only call it whilst it isn't rendering; whilst it is, use
+/// mdeGranularSendSamples() instead.
 /// @param g <#g description#>
 /// @param samples <#samples description#>
 /// @param samplesMS <#samplesMS description#>
 /// @param numSamples <#numSamples description#>
 int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
                      mdefloat numSamples);
+/// As mdeGranularInit3() but from any thread whilst we're rendering: the
+/// live buffer, mirror etc. the samples need are made here and the lot is
+/// swapped in at the start of a tick, the old ones being freed by whoever
+/// sends next. Returns 1 if they couldn't be made.
+/// @param g <#g description#>
+/// @param samples <#samples description#>
+/// @param samplesMS <#samplesMS description#>
+/// @param numSamples <#numSamples description#>
+int mdeGranularSendSamples(mdeGranular* g, mdefloat* samples,
+                           mdefloat samplesMS, mdefloat numSamples);
 
 /// When we're granulating a live input rather than a static buffer use this
 /// function to copy -nsamps- samples into our samples buffer, incrementing the
@@ -490,15 +1212,98 @@ int mdeGranularInit3(mdeGranular* g, mdefloat* samples, mdefloat samplesMS,
 ///
 /// @param g <#g description#>
 /// @param nsamps <#nsamps description#>
-inline void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in,
-                                        long nsamps);
+void mdeGranularCopyInputSamples(mdeGranular* g, mdefloat* in, long nsamps);
 /// <#Description#>
 /// @param g <#g description#>
 void mdeGranularGo(mdeGranular* g);
+/// What the perform routines call every tick: apply the messages waiting,
+/// copy the input (NULL when we're not recording it) into the live buffer
+/// and render a block into -outs- (or, if that's NULL, the channel buffers
+/// given to mdeGranularInit2()). When rendering ahead, -outs- instead gets
+/// the block rendered during the last call, whilst the next one is rendered
+/// on another thread; if that isn't ready yet the block is silent (and
+/// counted as an xrun by mdeGranularPrint()) rather than waited for. Never
+/// takes a lock: what's been sent since the last block (new voices, a new
+/// tick size...) has already been made and is only swapped in here.
+/// @param g <#g description#>
+/// @param in <#in description#>
+/// @param outs <#outs description#>
+/// @param nsamps <#nsamps description#>
+void mdeGranularPerform(mdeGranular* g, mdefloat* in, mdefloat** outs,
+                        long nsamps);
+/// Whether to render each block on a thread of its own whilst the host plays
+/// the one before (1) or in mdeGranularPerform() (0, the default). The
+/// output is then a block later, but the granulation no longer costs the
+/// host's audio thread anything. Messages sent with mdeGranularSend() etc.
+/// are queued and applied before the block they'd have been applied before
+/// otherwise. The thread's started and stopped here (and restarted by
+/// mdeGranularInit2() and mdeGranularSetInternalBlock() when the tick size
+/// changes), never by mdeGranularPerform(). Not available on Windows.
+/// @param g <#g description#>
+/// @param l <#l description#>
+void mdeGranularSetRenderAhead(mdeGranular* g, long l);
+/// Render -n- samples at a time (rounded up to a whole number of the host's
+/// blocks) rather than one host block at a time, so that what every tick
+/// costs, however many samples it renders, is paid less often. The input is
+/// collected and the output served a host block at a time by
+/// mdeGranularPerform(), which delays the output by n less a host block (see
+/// mdeGranularLatency()). 0 (the default) or anything up to the host's block
+/// size renders host blocks. The buffers for the new tick are made here and
+/// swapped in by mdeGranularPerform() at the start of the host's next block.
+/// @param g <#g description#>
+/// @param n <#n description#>
+void mdeGranularSetInternalBlock(mdeGranular* g, long n);
+/// How many samples later than the host asked for them our output arrives,
+/// given the internal block and whether we're rendering ahead.
+/// @param g <#g description#>
+/// @return <#return value description#>
+long mdeGranularLatency(mdeGranular* g);
+/// Send the granulator a message (-what-) with up to two numbers. It's
+/// queued, without waiting for the audio thread, and applied at the start
+/// of the next tick (or, when rendering ahead, the tick it belongs to), so
+/// it can be sent from any thread whilst the granulator renders. If the
+/// queue's full (e.g. DSP is off) the message is ignored, with a warning.
+/// It's checked here, against the messages sent before it, so any warning
+/// about it comes from the sender rather than the audio thread.
+/// @param g <#g description#>
+/// @param what <#what description#>
+/// @param f1 <#f1 description#>
+/// @param f2 <#f2 description#>
+void mdeGranularSend(mdeGranular* g, t_command what, mdefloat f1,
+                     mdefloat f2);
+/// As mdeGranularSend() but for messages with a name (RampType).
+/// @param g <#g description#>
+/// @param what <#what description#>
+/// @param name <#name description#>
+void mdeGranularSendName(mdeGranular* g, t_command what, const char* name);
+/// As mdeGranularSend() but for messages with a list (of transpositions).
+/// @param g <#g description#>
+/// @param what <#what description#>
+/// @param n <#n description#>
+/// @param list <#list description#>
+void mdeGranularSendList(mdeGranular* g, t_command what, int n,
+                         mdefloat* list);
+/// Apply a message by calling the set method it stands for; -list- holds
+/// its transpositions, if it has any. This doesn't post: what's out of range
+/// is clamped or ignored quietly.
+/// @param g <#g description#>
+/// @param c <#c description#>
+/// @param list <#list description#>
+void mdeGranularApply(mdeGranular* g, mdeGranularCommand* c, mdefloat* list);
+/// Stop other threads sending to the granulator until mdeGranularUnlock(),
+/// e.g. whilst a wrapper sends it several things that go together. Only
+/// senders take this: the audio thread never waits for it. Can be nested.
+/// @param g <#g description#>
+void mdeGranularLock(mdeGranular* g);
+/// <#Description#>
+/// @param g <#g description#>
+void mdeGranularUnlock(mdeGranular* g);
 
 /// args are the object, the number of samples to ouput per dsp tick and the
 /// ramp length in millisecs
-/// Called from mdeGranular_tildeDSP i.e. after the audio engine starts.
+/// Called from mdeGranular_tildeDSP i.e. after the audio engine starts. The
+/// first time it sets the granulator up directly; after that a new block
+/// size is sent like mdeGranularSetInternalBlock()'s.
 /// @param g <#g description#>
 /// @param nOutputSamples <#nOutputSamples description#>
 /// @param rampLenMS <#rampLenMS description#>
@@ -508,13 +1313,13 @@ int mdeGranularInit2(mdeGranular* g, long nOutputSamples, mdefloat rampLenMS,
                      mdefloat** channelBuffers);
 /// <#Description#>
 /// @param g <#g description#>
-inline int mdeGranularIsOn(mdeGranular* g);
+int mdeGranularIsOn(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
-inline int mdeGranularIsOff(mdeGranular* g);
+int mdeGranularIsOff(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
-inline void mdeGranularOn(mdeGranular* g);
+void mdeGranularOn(mdeGranular* g);
 /// The list of transpositions
 /// @param g <#g description#>
 /// @param num <#num description#>
@@ -526,27 +1331,27 @@ void mdeGranularFree(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetTranspositionOffsetST(mdeGranular* g, mdefloat f);
+void mdeGranularSetTranspositionOffsetST(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f);
+void mdeGranularSetGrainLengthMS(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetGrainLengthDeviation(mdeGranular* g, mdefloat f);
+void mdeGranularSetGrainLengthDeviation(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f);
+void mdeGranularSetSamplesStartMS(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetSamplesEndMS(mdeGranular* g, mdefloat f);
+void mdeGranularSetSamplesEndMS(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetDensity(mdeGranular* g, mdefloat f);
+void mdeGranularSetDensity(mdeGranular* g, mdefloat f);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param l <#l description#>
@@ -558,8 +1363,11 @@ void mdeGranularSetWarnings(mdeGranular* g, long l);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param f <#f description#>
-inline void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f);
-/// -maxVoices- is only a float because this is the type we get from PD
+void mdeGranularSetGrainAmp(mdeGranular* g, mdefloat f);
+/// -maxVoices- is only a float because this is the type we get from PD.
+/// This swaps the new grains in directly, so only call it whilst the
+/// granulator isn't rendering: sent with mdeGranularSend() instead, they're
+/// made on the sender's thread and swapped in at the start of a tick.
 /// @param g <#g description#>
 /// @param maxVoices <#maxVoices description#>
 void mdeGranularSetMaxVoices(mdeGranular* g, mdefloat maxVoices);
@@ -567,28 +1375,121 @@ void mdeGranularSetMaxVoices(mdeGranular* g, mdefloat maxVoices);
 /// @param g <#g description#>
 /// @param activeVoices <#activeVoices description#>
 void mdeGranularSetActiveVoices(mdeGranular* g, mdefloat activeVoices);
-/// <#Description#>
+/// Make a new ramp of the given length and swap it in. This can be done
+/// whilst running: grains already playing finish with the ramp they started
+/// with. Only call it whilst the granulator isn't rendering (see
+/// mdeGranularLock()); mdeGranularSend() makes the ramp on the sender's
+/// thread and leaves only the swap to the audio thread.
 /// @param g <#g description#>
 /// @param rampLenMS <#rampLenMS description#>
 void mdeGranularSetRampLenMS(mdeGranular* g, mdefloat rampLenMS);
-/// <#Description#>
+/// As mdeGranularSetRampLenMS() but for the type of ramp (HANNING etc.)
 /// @param g <#g description#>
 /// @param type <#type description#>
 void mdeGranularSetRampType(mdeGranular* g, char* type);
 /// This does the actual memory allocation for live granulation (i.e. not
-/// the 'set ms500' message--that's handled in init3.  Should generally only be
-/// called once per performance unless you're really careful.  */
+/// the 'set ms500' message--that's handled in init3.  What's been recorded so
+/// far is kept.  Until this is called the buffer is allocated by init3 when
+/// it's first needed, just big enough for the window asked for (plus a
+/// transposed grain), and grown if a longer one is asked for later; once it's
+/// been called the size given is kept to.  Only call it whilst the granulator isn't rendering (see
+/// mdeGranularLock()): sent with mdeGranularSend() instead, the buffer is
+/// allocated on a thread of its own (or by the sender, where there are no
+/// threads) and swapped in whilst we carry on playing, the recorded samples
+/// being copied over a chunk a tick.
 ///
 /// @param g <#g description#>
 /// @param sizeMS <#sizeMS description#>
 void mdeGranularSetLiveBufferSize(mdeGranular* g, mdefloat sizeMS);
+/// Whether live granulation should use a mirrored buffer (1) or not (0).  The
+/// live buffer size will be rounded up to a whole number of memory pages.
+/// Only available on Linux; elsewhere, or if the mapping fails, we carry on
+/// with the ordinary buffer. Only call it whilst the granulator isn't
+/// rendering: sent with mdeGranularSend() instead, the mirror is mapped on
+/// the sender's thread and swapped in with the live buffer it mirrors.
+/// @param g <#g description#>
+/// @param l <#l description#>
+void mdeGranularSetMirrorLiveBuffer(mdeGranular* g, long l);
+/// Whether blocks of memory of at least MDE_HUGE_PAGE (2MB), e.g. the live
+/// buffer or a copied buffer~, should be backed by huge pages (1) or not (0,
+/// the default). On Linux they're then mapped from the system's hugetlb pool
+/// if it has one, or else advised as transparent huge pages; if neither's
+/// possible we quietly carry on with 4K pages. Elsewhere such blocks just
+/// start on a 2MB boundary. Only affects what's allocated from then on, so
+/// send it before the live buffer's size is set.
+/// @param g <#g description#>
+/// @param l <#l description#>
+void mdeGranularSetHugePages(mdeGranular* g, long l);
+/// Whether grain positions should be kept in 32.32 fixed point (1) or as
+/// mdefloats (0, the default).  Fixed point positions don't lose precision
+/// far into long (live) buffers, even with 32-bit floats, and don't drift
+/// over the length of a grain.  Can be changed at any time.
+/// @param g <#g description#>
+/// @param l <#l description#>
+void mdeGranularSetFixedPhase(mdeGranular* g, long l);
+/// Seed this granulator's random number generator and restart the grains.
+/// From then on the output depends only on the seed, the settings and the
+/// input, so a given seed always gives the same result.
+/// @param g <#g description#>
+/// @param seed <#seed description#>
+void mdeGranularSetSeed(mdeGranular* g, mdefloat seed);
+/// How many threads (the audio thread included) this granulator may render
+/// with, taking the others from the pool shared by all granulators (which
+/// is started, with one thread per core but one, if it hasn't been sized
+/// yet). With more than MDE_PARTITION_VOICES voices, the grains of each
+/// partition are then mixed by whichever thread gets to it first, but as
+/// the partitions are always added together in the same order the output is
+/// identical to rendering with one thread. 0 or 1 (the default) renders
+/// everything on the audio thread. Not available on Windows. As with
+/// mdeGranularSetMaxVoices(), only call it whilst the granulator isn't
+/// rendering, otherwise send it.
+/// @param g <#g description#>
+/// @param threads <#threads description#>
+void mdeGranularSetThreads(mdeGranular* g, long threads);
+/// Stop the shared pool's threads and start -size- new ones. This affects
+/// every granulator in the process; with 0, they all render on their own
+/// threads. -g- is only needed for its warnings setting.
+/// @param g <#g description#>
+/// @param size <#size description#>
+void mdeGranularSetPoolSize(mdeGranular* g, long size);
+/// Run the shared pool's threads with real-time (SCHED_FIFO) -priority-, or
+/// with normal priority if it's 0 (the default). Most systems only allow the
+/// former with the right permissions. Affects every granulator.
+/// @param g <#g description#>
+/// @param priority <#priority description#>
+void mdeGranularSetPoolPriority(mdeGranular* g, long priority);
+/// How many threads the shared pool has running.
+int mdeGranularPoolSize(void);
+/// Get the lists ready for a new tick to be planned.
+/// @param j <#j description#>
+void mdeGranularJobsBegin(mdeGranularJobs* j);
+/// Hand the partitions that have just been planned to the pool, render as
+/// many as we can ourselves, and return once they've all been rendered: by
+/// the workers that took them, or, for those a worker hasn't finished in
+/// time (see MDE_JOIN_WAIT), by us.
+/// @param j <#j description#>
+void mdeGranularJobsRun(mdeGranularJobs* j);
+/// Start the sequence of random numbers for -seed-.
+/// @param r <#r description#>
+/// @param seed <#seed description#>
+void mdeGranularRandomSeed(mdeGranularRandom* r, uint64_t seed);
+/// Fill -out- with the next -howMany- random numbers (uniform over all 32
+/// bits) in the sequence.
+/// @param r <#r description#>
+/// @param out <#out description#>
+/// @param howMany <#howMany description#>
+void mdeGranularRandomFill(mdeGranularRandom* r, uint32_t* out, int howMany);
+/// Return the next of the granulator's random numbers, generating another
+/// batch of MDE_RANDOM_BATCH when needed.
+/// @param g <#g description#>
+uint32_t mdeGranularRandom32(mdeGranular* g);
 
 /// Spread out the grains evenly (and with no grain length deviation)
 /// NOTE: if ActiveVoices is changed, this will not retrigger this
 /// function
 /// May cause click in output so it is envisaged that the fader is down
 /// @param g <#g description#>
-inline void mdeGranularSmoothMode(mdeGranular* g);
+void mdeGranularSmoothMode(mdeGranular* g);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param size <#size description#>
@@ -601,30 +1502,25 @@ void mdeGranularOctaveDivisions(mdeGranular* g, mdefloat divs);
 void mdeGranularWelcome(void);
 /// <#Description#>
 /// @param g <#g description#>
-inline void mdeGranularOff(mdeGranular* g);
+void mdeGranularOff(mdeGranular* g);
 /// @updated 1.8.10: Here we set the start/end points in the buffer by passing values in
 /// percentages: the position will set the middle point between start and end,
 /// as determined by width.
 /// @param g <#g description#>
 /// @param position <#position description#>
 /// @param width <#width description#>
-inline void mdeGranularPortion(mdeGranular* g, mdefloat position,
-                            mdefloat width);
-/// <#Description#>
-/// @param x <#x description#>
-/// @param bufsize <#bufsize description#>
-void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize);
+void mdeGranularPortion(mdeGranular* g, mdefloat position, mdefloat width);
 /// @updated 31/8/10 similar to Portion, here we just set one of the parameters, using the previously stored value for the other
 /// @param g <#g description#>
 /// @param position <#position description#>
-inline void mdeGranularPortionPosition(mdeGranular* g, mdefloat position);
+void mdeGranularPortionPosition(mdeGranular* g, mdefloat position);
 /// <#Description#>
 /// @param g <#g description#>
 /// @param width <#width description#>
-inline void mdeGranularPortionWidth(mdeGranular* g, mdefloat width);
-/// <#Description#>
+void mdeGranularPortionWidth(mdeGranular* g, mdefloat width);
+/// Whether mdeGranularInit2() has been called (successfully).
 /// @param g <#g description#>
-inline int mdeGranularDidInit(mdeGranular* g);
+int mdeGranularDidInit(mdeGranular* g);
 #ifdef MAXMSP
 /// <#Description#>
 /// @param buf <#buf description#>
@@ -633,15 +1529,102 @@ void mdegranular_tildeUnlockBuffer(t_buffer_ref* buf);
 /// <#Description#>
 /// @param g <#g description#>
 void mdeGranularClearTheSamples(mdeGranular* g);
+/// Allocate -numSamples- (zeroed) samples plus the guard samples either side,
+/// from -g-'s arena.  The returned pointer is to the first real sample.
+/// @param g <#g description#>
+/// @param numSamples <#numSamples description#>
+/// @param warn <#warn description#>
+mdefloat* mdeGranularAllocSamples(mdeGranular* g, long numSamples, char warn);
+/// Free samples allocated with mdeGranularAllocSamples.
+/// @param g <#g description#>
+/// @param samples <#samples description#>
+void mdeGranularFreeSamples(mdeGranular* g, mdefloat* samples);
+/// Copy the first and last MDE_GUARD_SAMPLES of -samples- into the guard
+/// samples at the other end, so that reading off either end of the buffer
+/// gives the same as wrapping around.
+/// @param samples <#samples description#>
+/// @param numSamples <#numSamples description#>
+void mdeGranularMirrorGuards(mdefloat* samples, long numSamples);
+/// How many samples a mirrored buffer of at least -numSamples- samples would
+/// have (i.e. rounded up to a whole number of pages), or 0 if we can't make
+/// one on this platform.
+/// @param numSamples <#numSamples description#>
+long mdeGranularMirrorSize(long numSamples);
+/// Map -numSamples- (zeroed) samples twice, back to back, so that writing or
+/// reading off the end of the first copy wraps round to the start.
+/// -numSamples- must come from mdeGranularMirrorSize().  Returns NULL on
+/// failure.
+/// @param numSamples <#numSamples description#>
+/// @param warn <#warn description#>
+mdefloat* mdeGranularMapMirror(long numSamples, char warn);
+/// Unmap a buffer returned by mdeGranularMapMirror.
+/// @param samples <#samples description#>
+/// @param numSamples <#numSamples description#>
+void mdeGranularUnmapMirror(mdefloat* samples, long numSamples);
+/// Granulate the sound file at -path- straight from disk: it's mapped into
+/// memory and the grains read its pages directly, so there's no copy and
+/// nothing to load however long it is. It must be a mono WAV (or RF64) file
+/// of float samples (double in the double build) unless -raw- is 1 or its
+/// extension is .raw or .f32 (.f64 in the double build), in which case it's
+/// nothing but such samples; anything else is refused. The file's mapped
+/// here, its pages are asked to be read in ahead of the grains, and it's sent
+/// like mdeGranularSendSamples(), so this can be called whilst we're
+/// rendering; returns 1 if it couldn't be. The file stays mapped until
+/// something else is granulated or g is freed.
+/// @param g <#g description#>
+/// @param path <#path description#>
+/// @param raw <#raw description#>
+int mdeGranularMapFile(mdeGranular* g, const char* path, int raw);
+/// Unmap the file mapped by mdeGranularMapFile, if there is one.
+/// @param g <#g description#>
+void mdeGranularUnmapFile(mdeGranular* g);
 /// MDE Thu Sep 19 09:24:13 2013 -- now that msp is 64 bit, we're still stuck
 /// with 32 bit float buffer~s so we'll need to copy samples over and promote to
-/// doubles.
+/// doubles.  This copies into the live buffer directly, so only call it
+/// whilst the granulator isn't rendering: see mdeGranularSendFloatSamples().
 ///
 /// @param g <#g description#>
 /// @param nsamps <#nsamps description#>
 long mdeGranularCopyFloatSamples(mdeGranular* g, float* in, long nsamps);
+/// Copy -nsamps- float samples into a new buffer (the live buffer's size, if
+/// that's been fixed) and send them to be granulated, as
+/// mdeGranularSendSamples().  Returns 1 if they couldn't be.
+/// @param g <#g description#>
+/// @param in <#in description#>
+/// @param nsamps <#nsamps description#>
+int mdeGranularSendFloatSamples(mdeGranular* g, float* in, long nsamps);
+/// Install the functions the engine uses to talk to its host (see
+/// mdeGranularHost). Any that are NULL keep their default. The host is shared
+/// by all granulators in the process so this should be called once, before
+/// any of them is created.
+/// @param host <#host description#>
+void mdeGranularSetHost(const mdeGranularHost* host);
+/// The host's sampling rate.
+double mdeGranularHostSamplingRate(void);
+/// printf() style message to the host's post function.
+/// @param format <#format description#>
+void mdePost(const char* format, ...);
+/// printf() style message to the host's error function.
+/// @param format <#format description#>
+void mdeError(const char* format, ...);
 //------------------------------------------------------------------------------
 #pragma mark Inlet methods
+/* these are the glue between the PD/Max objects and the engine, in
+ * mdeGranular~tilde.c, which is compiled along with each wrapper */
+#if defined(PD) || defined(MAXMSP)
+
+/// @updated 3.10.11 set buffer, grain and ramp lengths simultaneously, thus avoiding all
+/// of the length conflicts NB buffer is a symbol, not just a size e.g. ms1000
+/// @param x <#x description#>
+/// @param s <#s description#>
+/// @param grain_len <#grain_len description#>
+/// @param ramp_len <#ramp_len description#>
+void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
+                                double grain_len, double ramp_len);
+/// <#Description#>
+/// @param x <#x description#>
+/// @param bufsize <#bufsize description#>
+void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize);
 
 /// <#Description#>
 /// @param x <#x description#>
@@ -710,6 +1693,22 @@ void mdeGranular_tildeOff(t_mdeGranular_tilde *x);
 /// @param x <#x description#>
 /// @param f <#f description#>
 void mdeGranular_tildeSetLiveBufferSize(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeMirrorLiveBuffer(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeHugePages(t_mdeGranular_tilde *x, mdefloat f);
+/// Granulate a sound file from disk (see mdeGranularMapFile()); -mode- raw
+/// reads it as raw samples whatever it's called.
+/// @param x <#x description#>
+/// @param s <#s description#>
+/// @param mode <#mode description#>
+void mdeGranular_tildeFile(t_mdeGranular_tilde *x, t_symbol *s,
+                           t_symbol *mode);
+void mdeGranular_tildeFixedPhase(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeSeed(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeThreads(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildePoolSize(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildePoolPriority(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeRenderAhead(t_mdeGranular_tilde *x, mdefloat f);
+void mdeGranular_tildeInternalBlock(t_mdeGranular_tilde *x, mdefloat f);
 /// <#Description#>
 /// @param x <#x description#>
 void mdeGranular_tildeDoGrainDelays(t_mdeGranular_tilde *x);
@@ -746,6 +1745,7 @@ void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width);
 /// @param ramp_len <#ramp_len description#>
 void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
                                       mdefloat grain_len, mdefloat ramp_len);
+#endif /* PD || MAXMSP */
 
 //------------------------------------------------------------------------------
 
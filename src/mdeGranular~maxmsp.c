@@ -87,6 +87,7 @@ void* mdeGranular_tildeNew(long maxVoices, long numChannels)
    * method is called */
   x->x_arrayname = gensym("ms1000");
   x->x_liverunning = 1;
+  x->x_file = 0;
   /* 2/4/08: no longer pass ramp len and srate here as they're now
    * used in init2 once audio is turned on
    */
@@ -171,7 +172,9 @@ void mdeGranular_tildeLivestop(t_mdeGranular_tilde *x)
 
 void mdeGranular_tildePrint(t_mdeGranular_tilde *x)
 {
+  mdeGranularLock(&x->x_g);
   mdeGranularPrint(&x->x_g);
+  mdeGranularUnlock(&x->x_g);
   post("x_liverunning = %d", x->x_liverunning);
 }
 //------------------------------------------------------------------------------
@@ -191,13 +194,15 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
   int got_ms = strncmp(s->s_name, "ms", 2) == 0;
   t_buffer_ref* bref = buffer_ref_new((t_object*)x, s);
   t_buffer_obj* bobj = buffer_ref_getobject(bref);
-  long copied;
 
+  /* senders take turns (see mdeGranularLock()) */
+  mdeGranularLock(g);
   /* MDE Thu Sep 19 10:39:17 2013 -- in case it's changed, might as well update
    */
   g->samplingRate = srate;
-  strncpy(g->BufferName, s->s_name, sizeof(g->BufferName));
-  /* post("%s", g->BufferName); */
+  strncpy(g->config->BufferName, s->s_name, sizeof(g->config->BufferName));
+  x->x_file = 0;
+  /* post("%s", g->config->BufferName); */
   if ((got_ms && isanum((char*)(s->s_name + 2))) || isanum((char*)s->s_name))
   {
     /* we got a millisecond buffer size e.g. "ms1000" for live input */
@@ -212,16 +217,16 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
       if ((buffer_getchannelcount(bobj) != 1) && g->warnings)
       {
         post("mdeGranular~: Only mono buffers allowed: %s", s->s_name);
+        mdeGranularUnlock(g);
         return;
       }
       nsamples = buffer_getframecount(bobj);
       samples = buffer_locksamples(bobj);
-      copied = mdeGranularCopyFloatSamples(g, samples, nsamples);
-      mdegranular_tildeUnlockBuffer(bref);
-      if (!samples ||
-          mdeGranularInit3(g, g->theSamples, samples2ms(srate, nsamples), copied)
-          < 0)
+      /* the copy's made in a new buffer and swapped in at the start of a
+       * tick (see mdeGranularSendFloatSamples()) */
+      if (!samples || mdeGranularSendFloatSamples(g, samples, nsamples))
         post("mdeGranular~: couldn't init Granular object");
+      mdegranular_tildeUnlockBuffer(bref);
     }
     else
     {
@@ -230,6 +235,7 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
       samples = NULL;
     }
   }
+  mdeGranularUnlock(g);
 }
 //------------------------------------------------------------------------------
 void mdegranular_tildeUnlockBuffer(t_buffer_ref* buf)
@@ -252,22 +258,14 @@ void mspExternalPerform(t_mdeGranular_tilde* x, t_object* dsp64, double** ins,
 {
   mdefloat* in = (mdefloat*)ins[0];
   mdeGranular* g = &x->x_g;
-  int i;
-
-  for (i = 0; i < g->numChannels; ++i)
-  {
-    g->channelBuffers[i] = (mdefloat*)outs[i];
-    /* post("%ld", g->channelBuffers[i]); */
-  }
-  if (g->live && x->x_liverunning && g->status)
-    mdeGranularCopyInputSamples(g, in, sampleframes);
 
 #ifdef DEBUG
   if (DebugFP)
     fprintf(DebugFP, "\n\nPerform\n\n");
 #endif
 
-  mdeGranularGo(g);
+  mdeGranularPerform(g, x->x_liverunning ? in : NULL, (mdefloat**)outs,
+                     sampleframes);
   /*
      post("toffset %f", x->x_g.transpositionOffsetST);
      post("glen %f", x->x_g.grainLengthMS);
@@ -286,6 +284,14 @@ void mspExternalPerform(t_mdeGranular_tilde* x, t_object* dsp64, double** ins,
 void mdeGranular_tildeDSP(t_mdeGranular_tilde* x, t_object* dsp64, short* count,
                           double samplerate, long vectorsize, long flags)
 {
+  mdeGranular* g = &x->x_g;
+
+  /* the vector size might not be what it was when we were created (the new
+   * tick's swapped in at the start of the next one: see
+   * mdeGranularInit2()) */
+  mdeGranularLock(g);
+  mdeGranularInit2(g, vectorsize, (mdefloat)DEFAULT_RAMP_LEN, NULL);
+  mdeGranularUnlock(g);
   object_method(dsp64, gensym("dsp_add64"), x, mspExternalPerform, 0, NULL);
 }
 //------------------------------------------------------------------------------
@@ -294,12 +300,7 @@ void mdeGranular_tildeDSP(t_mdeGranular_tilde* x, t_object* dsp64, short* count,
 
 void mdeGranular_tildeBang(t_mdeGranular_tilde *x)
 {
-  mdeGranular* g = &x->x_g;
-
-  if (mdeGranularIsOn(g))
-    mdeGranularOff(g);
-  else if (mdeGranularIsOff(g))
-    mdeGranularOn(g);
+  mdeGranularSend(&x->x_g, MDE_CMD_TOGGLE, 0, 0);
 }
 //------------------------------------------------------------------------------
 
@@ -314,7 +315,7 @@ void mdeGranular_tildeList(t_mdeGranular_tilde *x, t_symbol *s,
   UNUSED(s);
   for (i = 0; i < argc && i < MAXTRANSPOSITIONS; ++i)
     semitones[i] = atom_getfloatarg(i, argc, argv);
-  mdeGranularSetTranspositions(&x->x_g, argc, semitones);
+  mdeGranularSendList(&x->x_g, MDE_CMD_TRANSPOSITIONS, argc, semitones);
 }
 //------------------------------------------------------------------------------
 
@@ -327,16 +328,55 @@ void mdeGranular_tildeFree(t_mdeGranular_tilde *x)
 }
 //------------------------------------------------------------------------------
 
+/* how the engine talks to Max */
+
+static void mdeGranular_tildeHostPost(const char* line)
+{
+  post("%s", line);
+}
+
+static void mdeGranular_tildeHostError(const char* line)
+{
+  error("%s", line);
+}
+
+static void* mdeGranular_tildeHostAlloc(size_t size)
+{
+  return sysmem_newptrclear((t_ptr_size)size);
+}
+
+static void mdeGranular_tildeHostFree(void* what)
+{
+  sysmem_freeptr(what);
+}
+
+static double mdeGranular_tildeHostSamplingRate(void)
+{
+  return (double)sys_getsr();
+}
+//------------------------------------------------------------------------------
+
 /* This method is called first. */
 
 int C74_EXPORT main(void)
 {
-  t_class* c = class_new("mdeGranular~", (method)mdeGranular_tildeNew,
-                         (method)mdeGranular_tildeFree,
-                         (short)sizeof(t_mdeGranular_tilde),
-                         /* 0L, A_DEFFLOAT, A_DEFFLOAT, 0); */
-                         /* MDE Fri Feb 21 09:03:38 2020 */
-                         0L, A_DEFLONG, A_DEFLONG, 0);
+  static const mdeGranularHost host =
+  {
+    mdeGranular_tildeHostPost,
+    mdeGranular_tildeHostError,
+    mdeGranular_tildeHostAlloc,
+    mdeGranular_tildeHostFree,
+    mdeGranular_tildeHostSamplingRate
+  };
+  t_class* c;
+
+  mdeGranularSetHost(&host);
+  c = class_new("mdeGranular~", (method)mdeGranular_tildeNew,
+                (method)mdeGranular_tildeFree,
+                (short)sizeof(t_mdeGranular_tilde),
+                /* 0L, A_DEFFLOAT, A_DEFFLOAT, 0); */
+                /* MDE Fri Feb 21 09:03:38 2020 */
+                0L, A_DEFLONG, A_DEFLONG, 0);
   /* to couple an inlet to a method */
   class_addmethod(c, (method)mdeGranular_tildeTranspositionOffsetST, "ft7",
                   A_FLOAT, 0);
@@ -355,6 +395,8 @@ int C74_EXPORT main(void)
   class_addmethod(c, (method)mdeGranular_tildeLivestop, "livestop", 0);
   class_addmethod(c, (method)mdeGranular_tildePrint, "print", 0);
   class_addmethod(c, (method)mdeGranular_tildeSet, "set", A_DEFSYM, 0);
+  class_addmethod(c, (method)mdeGranular_tildeFile, "file", A_DEFSYM,
+                  A_DEFSYM, 0);
   class_addmethod(c, (method)mdeGranular_tildeSetF, "setms", A_DEFFLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeRampType, "RampType", A_DEFSYM,
                   0);
@@ -389,6 +431,24 @@ int C74_EXPORT main(void)
   class_addmethod(c, (method)mdeGranular_tildeSmoothMode, "SmoothMode", 0);
   class_addmethod(c, (method)mdeGranular_tildeSetLiveBufferSize,
                   "MaxLiveBufferMS",  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeMirrorLiveBuffer,
+                  "MirrorLiveBuffer",  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeHugePages, "HugePages",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeFixedPhase, "FixedPhase",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeSeed, "Seed", A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeThreads, "Threads", A_DEFFLOAT,
+                  0);
+  /* these two set up the pool of threads shared by all instances */
+  class_addmethod(c, (method)mdeGranular_tildePoolSize, "PoolSize",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildePoolPriority, "PoolPriority",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeRenderAhead, "RenderAhead",
+                  A_DEFFLOAT, 0);
+  class_addmethod(c, (method)mdeGranular_tildeInternalBlock, "InternalBlock",
+                  A_DEFFLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeOctaveSize, "OctaveSize",
                   A_DEFFLOAT, 0);
   class_addmethod(c, (method)mdeGranular_tildeOctaveDivisions,
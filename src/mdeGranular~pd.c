@@ -77,6 +77,7 @@ void *mdeGranular_tildeNew(t_float maxVoices, t_float numChannels)
   x->x_arrayname = gensym("ms1000");
   x->x_f = 0;
   x->x_liverunning = 1;
+  x->x_file = 0;
   mdeGranularInit1(g, maxVoices, numChannels);
   for (i = 0; i < (int)numChannels; i++)
     outlet_new(&x->x_obj, gensym("signal"));
@@ -122,7 +123,9 @@ void mdeGranular_tildeLivestop(t_mdeGranular_tilde *x)
 
 void mdeGranular_tildePrint(t_mdeGranular_tilde *x)
 {
+  mdeGranularLock(&x->x_g);
   mdeGranularPrint(&x->x_g);
+  mdeGranularUnlock(&x->x_g);
   post("x_liverunning = %d", x->x_liverunning);
 }
 /*****************************************************************************/
@@ -141,21 +144,19 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
   int got_ms = strncmp(s->s_name, "ms", 2) == 0;
   mdeGranular* g = &x->x_g;
 
+  /* senders take turns (see mdeGranularLock()) */
+  mdeGranularLock(g);
   /* MDE Thu Sep 19 10:39:17 2013 -- in case it's changed, might as well update
    */
   g->samplingRate = srate;
-  strncpy(g->BufferName, s->s_name, sizeof(g->BufferName));
+  strncpy(g->config->BufferName, s->s_name, sizeof(g->config->BufferName));
+  x->x_file = 0;
 
   if ((got_ms && isanum((char*)(s->s_name + 2))) || isanum((char*)s->s_name))
   {
     /* we got a millisecond buffer size e.g. "ms1000" for live input */
     mdefloat bufsize = atof(s->s_name + 2);
     mdeGranular_tildeSetF(x, bufsize);
-    if (mdeGranularInit3(&x->x_g, NULL, bufsize,
-                         ms2samples((mdefloat)sys_getsr(),
-                                    bufsize))
-        < 0)
-      pd_error(x, "mdeGranular~: couldn't init Granular object");
   }
   else/* static buffer */
   {
@@ -179,13 +180,15 @@ void mdeGranular_tildeSet(t_mdeGranular_tilde *x, t_symbol *s)
     }
     else                   /* success!! */
     {
-      if (mdeGranularInit3(&x->x_g, samples, samples2ms(srate, nsamples),
-                           (mdefloat)nsamples)
+      if (mdeGranularSendSamples(&x->x_g, samples,
+                                 samples2ms(srate, nsamples),
+                                 (mdefloat)nsamples)
           < 0)
         pd_error(x, "mdeGranular~: couldn't init Granular object");
       garray_usedindsp(a);
     }
   }
+  mdeGranularUnlock(g);
 }
 /*****************************************************************************/
 
@@ -196,17 +199,16 @@ t_int *mdeGranular_tildePerform(t_int *w)
   t_mdeGranular_tilde* x = (t_mdeGranular_tilde*)(w[1]);
   mdefloat* in = (mdefloat*)(w[2]);
   long nsamps = (long)(w[3]);
+  /* the outlets' vectors follow */
+  mdefloat** outs = (mdefloat**)(w + 4);
   mdeGranular* g = &x->x_g;
 
-  if (g->live && x->x_liverunning && g->status)
-    mdeGranularCopyInputSamples(g, in, nsamps);
-
 #ifdef DEBUG
   if (DebugFP)
     fprintf(DebugFP, "\n\nPerform\n\n");
 #endif
 
-  mdeGranularGo(g);
+  mdeGranularPerform(g, x->x_liverunning ? in : NULL, outs, nsamps);
   /*
      post("toffset %f", x->x_g.transpositionOffsetST);
      post("glen %f", x->x_g.grainLengthMS);
@@ -217,7 +219,7 @@ t_int *mdeGranular_tildePerform(t_int *w)
      post("density %f", x->x_g.density);
      post("gamp %f", x->x_g.grainAmp);
    */
-  return w + 4;
+  return w + 4 + g->numChannels;
 }
 /*****************************************************************************/
 
@@ -231,16 +233,39 @@ void mdeGranular_tildeDSP(t_mdeGranular_tilde *x, t_signal **sp)
   int nchan = g->numChannels;
   mdefloat** chbufs = mdeCalloc(nchan, sizeof(mdefloat*),
                                 "mdeGranular_tildeDSP", g->warnings);
+  t_int* vec = mdeCalloc(3 + nchan, sizeof(t_int), "mdeGranular_tildeDSP",
+                         g->warnings);
 
+  if (!chbufs || !vec)
+  {
+    mdeFree(vec);
+    mdeFree(chbufs);
+    /* the outlets still need something writing to them */
+    for (i = 0; i < nchan; ++i)
+      dsp_add_zero(sp[i + 1]->s_vec, sp[0]->s_n);
+    return;
+  }
   for (i = 0; i < nchan; ++i)
     /* sp[0] is the input of course, so the first output is sp[1] */
     chbufs[i] = sp[i + 1]->s_vec;
+  /* senders take turns (see mdeGranularLock()) */
+  mdeGranularLock(g);
   mdeGranularInit2(g, sp[0]->s_n, (mdefloat)DEFAULT_RAMP_LEN, chbufs);
-  mdeGranular_tildeSet(x, x->x_arrayname);
-  /* the second arg specifies how many elements of the w array arg to the
-   * perform routine we can access and the remaining args are the objects that
-   * will be those elements. */
-  dsp_add(mdeGranular_tildePerform, 3, x, sp[0]->s_vec, sp[0]->s_n);
+  if (x->x_file)
+    mdeGranular_tildeFile(x, x->x_arrayname,
+                          gensym(x->x_file == 2 ? "raw" : ""));
+  else
+    mdeGranular_tildeSet(x, x->x_arrayname);
+  mdeGranularUnlock(g);
+  /* the perform routine gets the object, the input, the block size and then
+   * the outlets: the second arg specifies how many of those there are. */
+  vec[0] = (t_int)x;
+  vec[1] = (t_int)sp[0]->s_vec;
+  vec[2] = (t_int)sp[0]->s_n;
+  for (i = 0; i < nchan; ++i)
+    vec[3 + i] = (t_int)sp[i + 1]->s_vec;
+  dsp_addv(mdeGranular_tildePerform, 3 + nchan, vec);
+  mdeFree(vec);
   mdeFree(chbufs);
 }
 /*****************************************************************************/
@@ -249,12 +274,7 @@ void mdeGranular_tildeDSP(t_mdeGranular_tilde *x, t_signal **sp)
 
 void mdeGranular_tildeBang(t_mdeGranular_tilde *x)
 {
-  mdeGranular* g = &x->x_g;
-
-  if (mdeGranularIsOn(g))
-    mdeGranularOff(g);
-  else if (mdeGranularIsOff(g))
-    mdeGranularOn(g);
+  mdeGranularSend(&x->x_g, MDE_CMD_TOGGLE, 0, 0);
 }
 /*****************************************************************************/
 
@@ -269,7 +289,7 @@ void mdeGranular_tildeList(t_mdeGranular_tilde *x, t_symbol *s,
   UNUSED(s);
   for (i = 0; i < argc && i < MAXTRANSPOSITIONS; ++i)
     semitones[i] = atom_getfloatarg(i, argc, argv);
-  mdeGranularSetTranspositions(&x->x_g, argc, semitones);
+  mdeGranularSendList(&x->x_g, MDE_CMD_TRANSPOSITIONS, argc, semitones);
 }
 /*****************************************************************************/
 
@@ -279,10 +299,39 @@ void mdeGranular_tildeFree(t_mdeGranular_tilde *x)
 }
 /*****************************************************************************/
 
+/* how the engine talks to PD: memory comes from calloc() as before */
+
+static void mdeGranular_tildeHostPost(const char* line)
+{
+  post("%s", line);
+}
+
+static void mdeGranular_tildeHostError(const char* line)
+{
+  error("%s", line);
+}
+
+static double mdeGranular_tildeHostSamplingRate(void)
+{
+  return (double)sys_getsr();
+}
+
+/*****************************************************************************/
+
 /** This method is called first. */
 
 void mdeGranular_tilde_setup(void)
 {
+  static const mdeGranularHost host =
+  {
+    mdeGranular_tildeHostPost,
+    mdeGranular_tildeHostError,
+    NULL,
+    NULL,
+    mdeGranular_tildeHostSamplingRate
+  };
+
+  mdeGranularSetHost(&host);
   mdeGranular_tildeClass =
     class_new(gensym("mdeGranular~"),
               (t_newmethod)mdeGranular_tildeNew,
@@ -303,6 +352,8 @@ void mdeGranular_tilde_setup(void)
                   gensym("print"), 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeSet,
                   gensym("set"), A_DEFSYM, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeFile,
+                  gensym("file"), A_DEFSYM, A_DEFSYM, 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeSetF,
                   gensym("setms"), A_DEFSYM, 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeRampType,
@@ -352,6 +403,29 @@ void mdeGranular_tilde_setup(void)
   class_addmethod(mdeGranular_tildeClass,
                   (t_method)mdeGranular_tildeSetLiveBufferSize,
                   gensym("MaxLiveBufferMS"),  A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeMirrorLiveBuffer,
+                  gensym("MirrorLiveBuffer"),  A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeHugePages,
+                  gensym("HugePages"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeFixedPhase,
+                  gensym("FixedPhase"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeSeed,
+                  gensym("Seed"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeThreads,
+                  gensym("Threads"), A_DEFFLOAT, 0);
+  /* these two set up the pool of threads shared by all instances */
+  class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildePoolSize,
+                  gensym("PoolSize"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildePoolPriority,
+                  gensym("PoolPriority"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeRenderAhead,
+                  gensym("RenderAhead"), A_DEFFLOAT, 0);
+  class_addmethod(mdeGranular_tildeClass,
+                  (t_method)mdeGranular_tildeInternalBlock,
+                  gensym("InternalBlock"), A_DEFFLOAT, 0);
   class_addmethod(mdeGranular_tildeClass, (t_method)mdeGranular_tildeOctaveSize,
                   gensym("OctaveSize"), A_DEFFLOAT, 0);
   class_addmethod(mdeGranular_tildeClass,
@@ -0,0 +1,263 @@
+/******************************************************************************
+ *
+ * File:             mdeGranular~tilde.c
+ *
+ * Author:           Michael Edwards - m@michael-edwards.org -
+ *                   http://www.michael-edwards.org
+ *
+ * Date:             October 17th 2026
+ *
+ * $$ Last modified:  10:12:40 Sat Oct 17 2026 BST
+ *
+ * Purpose:          The glue between the PD and Max objects and the portable
+ *                   engine (mdeGranular~.c): the inlet methods and what else
+ *                   needs to know about t_mdeGranular_tilde. Compiled along
+ *                   with mdeGranular~pd.c or mdeGranular~maxmsp.c, with PD
+ *                   or MAXMSP defined.
+ *
+ * License:          Copyright (c) 2003 Michael Edwards
+ *
+ *                   This file is part of mdeGranular~
+ *
+ *                   mdeGranular~ is free software; you can redistribute it
+ *                   and/or modify it under the terms of the GNU General
+ *                   Public License as published by the Free Software
+ *                   Foundation; either version 2 of the License, or (at your
+ *                   option) any later version.
+ *
+ *                   mdeGranular~ is distributed in the hope that it will be
+ *                   useful, but WITHOUT ANY WARRANTY; without even the
+ *                   implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *                   PARTICULAR PURPOSE.  See the GNU General Public License
+ *                   for more details.
+ *
+ *                   You should have received a copy of the <a
+ *                   href="../../COPYING.TXT">GNU General Public License</a>
+ *                   along with mdeGranular~; if not, write to the Free
+ *                   Software Foundation, Inc., 59 Temple Place, Suite 330,
+ *                   Boston, MA 02111-1307 USA
+ *
+ *****************************************************************************/
+
+#include "mdeGranular~.h"
+
+//------------------------------------------------------------------------------
+
+void mdeGranular_tildeSetF(t_mdeGranular_tilde *x, double bufsize)
+{
+  mdefloat srate = (mdefloat)mdeGranularHostSamplingRate();
+  mdeGranular* g = &x->x_g;
+
+  if ((bufsize < MINLIVEBUFSIZE))
+  {
+    if (g->warnings)
+      post("mdeGranular~: Minimum buffer size is %f millisecs, ignoring %f",
+           MINLIVEBUFSIZE, bufsize);
+    return;
+  }
+  if (mdeGranularSendSamples(g, NULL, bufsize, ms2samples(srate, bufsize))
+      < 0)
+    post("mdeGranular~: couldn't init Granular object \n\
+                        for live granulation");
+}
+//------------------------------------------------------------------------------
+
+void mdeGranularBufferGrainRamp(t_mdeGranular_tilde* x, t_symbol* s,
+                                double grain_len, double ramp_len)
+{
+  mdeGranular* g = &x->x_g;
+
+  if (!mdeGranularIsOff(g))
+  {
+    if (g->warnings)
+    {
+      post("mdeGranular~:");
+      post("              BufferGrainRamp can only be called when off. ");
+    }
+    return;
+  }
+  /* in Max we might be rendering on another thread, so this is all sent,
+   * in order, like any other message */
+  mdeGranularSend(g, MDE_CMD_CLEAR_LENGTHS, 0, 0);
+  mdeGranular_tildeSet(x, s);
+  mdeGranularSend(g, MDE_CMD_GRAIN_LENGTH_MS, (mdefloat)grain_len, 0);
+  mdeGranularSend(g, MDE_CMD_RAMP_LEN_MS, (mdefloat)ramp_len, 0);
+}
+//------------------------------------------------------------------------------
+
+/** This gets called when you send the object a file message with the path of
+ *  a sound file to granulate from disk, optionally followed by raw (and, in
+ *  PD, when the audio engine starts, if that's what we were granulating). */
+
+void mdeGranular_tildeFile(t_mdeGranular_tilde* x, t_symbol* s,
+                           t_symbol* mode)
+{
+  mdeGranular* g = &x->x_g;
+  const char* path = s->s_name;
+  int raw = mode == gensym("raw");
+#ifdef MAXMSP
+  char native[MAX_PATH_CHARS];
+
+  /* e.g. Macintosh HD:/Users/... */
+  if (path_nameconform(s->s_name, native, PATH_STYLE_NATIVE,
+                       PATH_TYPE_BOOT) == 0)
+    path = native;
+#endif
+  if (*mode->s_name && !raw)
+  {
+    post("mdeGranular~: file takes a path and optionally raw, not %s",
+         mode->s_name);
+    return;
+  }
+  mdeGranularLock(g);
+  g->samplingRate = (mdefloat)mdeGranularHostSamplingRate();
+  x->x_arrayname = s;
+  x->x_file = raw ? 2 : 1;
+  if (mdeGranularMapFile(g, path, raw))
+    post("mdeGranular~: couldn't granulate %s", s->s_name);
+  mdeGranularUnlock(g);
+}
+//------------------------------------------------------------------------------
+
+#pragma mark Inlet methods just send the portable object messages
+
+/* (which are queued and applied by the audio thread at the start of its
+ * next tick, so they're safe from any thread) */
+
+void mdeGranular_tildeTranspositionOffsetST(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_TRANSPOSITION_OFFSET_ST, f, 0);
+}
+void mdeGranular_tildeGrainLengthMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_GRAIN_LENGTH_MS, f, 0);
+}
+void mdeGranular_tildeGrainLengthDeviation(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_GRAIN_LENGTH_DEVIATION, f, 0);
+}
+void mdeGranular_tildeSamplesStartMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_SAMPLES_START_MS, f, 0);
+}
+void mdeGranular_tildeSamplesEndMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_SAMPLES_END_MS, f, 0);
+}
+void mdeGranular_tildeDensity(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_DENSITY, f, 0);
+}
+void mdeGranular_tildeActiveChannels(t_mdeGranular_tilde* x, long l)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_ACTIVE_CHANNELS, (mdefloat)l, 0);
+}
+void mdeGranular_tildeWarnings(t_mdeGranular_tilde* x, long l)
+{
+  mdeGranularSetWarnings(&x->x_g, l);
+}
+void mdeGranular_tildeGrainAmp(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_GRAIN_AMP, f, 0);
+}
+void mdeGranular_tildeMaxVoices(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_MAX_VOICES, f, 0);
+}
+void mdeGranular_tildeActiveVoices(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_ACTIVE_VOICES, f, 0);
+}
+void mdeGranular_tildeRampLenMS(t_mdeGranular_tilde* x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_RAMP_LEN_MS, f, 0);
+}
+void mdeGranular_tildeRampType(t_mdeGranular_tilde *x, t_symbol *s)
+{
+  mdeGranularSendName(&x->x_g, MDE_CMD_RAMP_TYPE, s->s_name);
+}
+void mdeGranular_tildeOn(t_mdeGranular_tilde *x)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_ON, 0, 0);
+}
+void mdeGranular_tildeOff(t_mdeGranular_tilde *x)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_OFF, 0, 0);
+}
+void mdeGranular_tildeSetLiveBufferSize(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_LIVE_BUFFER_SIZE, f, 0);
+}
+void mdeGranular_tildeMirrorLiveBuffer(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_MIRROR_LIVE_BUFFER, f, 0);
+}
+void mdeGranular_tildeHugePages(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_HUGE_PAGES, f, 0);
+}
+void mdeGranular_tildeFixedPhase(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_FIXED_PHASE, f, 0);
+}
+void mdeGranular_tildeSeed(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_SEED, f, 0);
+}
+void mdeGranular_tildeThreads(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_THREADS, f, 0);
+}
+void mdeGranular_tildePoolSize(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSetPoolSize(&x->x_g, (long)f);
+}
+void mdeGranular_tildePoolPriority(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSetPoolPriority(&x->x_g, (long)f);
+}
+void mdeGranular_tildeRenderAhead(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSetRenderAhead(&x->x_g, (long)f);
+}
+void mdeGranular_tildeInternalBlock(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSetInternalBlock(&x->x_g, (long)f);
+}
+void mdeGranular_tildeDoGrainDelays(t_mdeGranular_tilde *x)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_DO_GRAIN_DELAYS, 0, 0);
+}
+void mdeGranular_tildeSmoothMode(t_mdeGranular_tilde *x)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_SMOOTH_MODE, 0, 0);
+}
+void mdeGranular_tildeOctaveSize(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_OCTAVE_SIZE, f, 0);
+}
+void mdeGranular_tildeOctaveDivisions(t_mdeGranular_tilde *x, mdefloat f)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_OCTAVE_DIVISIONS, f, 0);
+}
+void mdeGranular_tildePortion(t_mdeGranular_tilde *x, mdefloat position,
+                              mdefloat width)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_PORTION, position, width);
+}
+void mdeGranular_tildePortionPosition(t_mdeGranular_tilde *x, mdefloat position)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_PORTION_POSITION, position, 0);
+}
+void mdeGranular_tildePortionWidth(t_mdeGranular_tilde *x, mdefloat width)
+{
+  mdeGranularSend(&x->x_g, MDE_CMD_PORTION_WIDTH, width, 0);
+}
+void mdeGranular_tildeBufferGrainRamp(t_mdeGranular_tilde *x, t_symbol *s,
+                                      mdefloat grain_len, mdefloat ramp_len)
+{
+  mdeGranularBufferGrainRamp(x, s, grain_len, ramp_len);
+}
+//------------------------------------------------------------------------------
+
+/* EOF mdeGranular~tilde.c */
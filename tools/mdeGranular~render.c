@@ -0,0 +1,1262 @@
+/******************************************************************************
+ *
+ * File:             mdeGranular~render.c
+ *
+ * Author:           Michael Edwards - m@michael-edwards.org -
+ *                   http://www.michael-edwards.org
+ *
+ * Date:             October 17th 2026
+ *
+ * $$ Last modified:  15:40:27 Sat Oct 17 2026 BST
+ *
+ * Purpose:          Offline rendering with the mdeGranular~ engine: granulate
+ *                   a WAV or AIFF file and write a (multichannel) WAV file
+ *                   as fast as the CPU allows, instead of recording a live
+ *                   PD or Max session in real time.  The granulator is set
+ *                   up with the same messages the PD and Max objects take
+ *                   (GrainLengthMS 80, Density 50, a list of transpositions
+ *                   etc.) which are passed through to the same setters the
+ *                   inlet methods call, so settings can be copied from a
+ *                   patch.  Messages come from the command line or a
+ *                   settings file, one per line, optionally timed:
+ *
+ *                   # comments and ;s are ignored
+ *                   GrainLengthMS 120
+ *                   -12 -5 0 7 12;
+ *                   @4.5 Density 30
+ *                   @10 Portion 0.5 0.1
+ *
+ *                   Messages without a time (or @0) are sent before the
+ *                   granulator is turned on; the others when rendering gets
+ *                   to their time in seconds.  At the end the granulator is
+ *                   turned off and rendering goes on until it has ramped
+ *                   down.
+ *
+ *                   Many variations can be rendered at once, in parallel,
+ *                   from a job file (-j): each job gets its own granulator
+ *                   and a thread from a pool (one per core by default) and
+ *                   jobs granulating the same file share one read-only copy
+ *                   of its samples:
+ *
+ *                   job in.aif short.wav -c 4
+ *                   GrainLengthMS 40
+ *                   Seed 1
+ *                   job in.aif long.wav -c 4 -v 30
+ *                   GrainLengthMS 400
+ *                   0 7 12
+ *
+ *                   make render
+ *                   build/mdegranular-render -c 4 -v 40 in.aif out.wav \
+ *                     "GrainLengthMS 200" "Density 60"
+ *                   build/mdegranular-render -j variations.txt
+ *
+ * License:          Copyright (c) 2003 Michael Edwards
+ *
+ *                   This file is part of mdeGranular~
+ *
+ *                   mdeGranular~ is free software; you can redistribute it
+ *                   and/or modify it under the terms of the GNU General
+ *                   Public License as published by the Free Software
+ *                   Foundation; either version 2 of the License, or (at your
+ *                   option) any later version.
+ *
+ *                   mdeGranular~ is distributed in the hope that it will be
+ *                   useful, but WITHOUT ANY WARRANTY; without even the
+ *                   implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *                   PARTICULAR PURPOSE.  See the GNU General Public License
+ *                   for more details.
+ *
+ *                   You should have received a copy of the <a
+ *                   href="../../COPYING.TXT">GNU General Public License</a>
+ *                   along with mdeGranular~; if not, write to the Free
+ *                   Software Foundation, Inc., 59 Temple Place, Suite 330,
+ *                   Boston, MA 02111-1307 USA
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mdeGranular~.h"
+
+#define RENDER_MAX_CHANNELS 64
+#define RENDER_MAX_BLOCK 8192
+#define RENDER_MAX_ARGS MAXTRANSPOSITIONS
+#define RENDER_MAX_LINE 4096
+#define RENDER_MAX_PATH 1024
+#define RENDER_MAX_THREADS 256
+/* give up waiting for the granulator to ramp down after this long */
+#define RENDER_MAX_TAIL_SECS 10
+
+/* a sound file read into memory and mixed (or reduced) to one channel */
+typedef struct
+{
+  int channels;
+  double samplingRate;
+  long frames;
+  mdefloat* samples;
+} renderSound;
+
+/* a message for the granulator, as it would be sent to the PD/Max object */
+typedef struct
+{
+  /* in seconds; messages at time 0 are sent before we turn on */
+  double time;
+  /* where it was given, so those at the same time keep their order */
+  int order;
+  char name[32];
+  /* RampType's argument */
+  char symbol[32];
+  int argc;
+  double argv[RENDER_MAX_ARGS];
+} renderMessage;
+
+/* our own output file */
+typedef struct
+{
+  FILE* fp;
+  int channels;
+  /* 16 or 24 bit integer or 32 bit float */
+  int bits;
+  double samplingRate;
+  unsigned long frames;
+  /* one interleaved block */
+  unsigned char* buf;
+} renderWav;
+
+/* one output file: what to granulate, how, and into what */
+typedef struct
+{
+  char inFile[RENDER_MAX_PATH];
+  char outFile[RENDER_MAX_PATH];
+  int channels;
+  int voices;
+  /* granulate only this input channel (from 0), or mix them all (-1) */
+  int channel;
+  int block;
+  int bits;
+  /* of the output before turning off, in seconds; < 0 = the input's */
+  double duration;
+  /* non-zero: feed the input in as live input into a buffer this long */
+  double liveMS;
+  renderMessage* messages;
+  int numMessages;
+  int messagesSize;
+  /* read-only, and shared by all the jobs with the same file and channel */
+  renderSound* sound;
+  /* results */
+  int ok;
+  unsigned long frames;
+  double secs;
+} renderJob;
+
+/*****************************************************************************/
+
+#pragma mark Reading WAV and AIFF
+
+static unsigned long le(const unsigned char* p, int bytes)
+{
+  unsigned long result = 0;
+
+  for (int i = bytes - 1; i >= 0; --i)
+    result = (result << 8) | p[i];
+  return result;
+}
+
+static unsigned long be(const unsigned char* p, int bytes)
+{
+  unsigned long result = 0;
+
+  for (int i = 0; i < bytes; ++i)
+    result = (result << 8) | p[i];
+  return result;
+}
+
+/*****************************************************************************/
+
+/* the 80-bit IEEE extended float AIFF uses for the sampling rate */
+static double extended(const unsigned char* p)
+{
+  int exponent = (int)(((p[0] & 0x7f) << 8) | p[1]);
+  double mantissa = (double)be(p + 2, 4) * 4294967296.0 + (double)be(p + 6, 4);
+
+  if (!exponent && !mantissa)
+    return 0.0;
+  return (p[0] & 0x80 ? -1.0 : 1.0) * ldexp(mantissa, exponent - 16383 - 63);
+}
+
+/*****************************************************************************/
+
+/* one sample, scaled to +/- 1 */
+static double decode(const unsigned char* p, int bytes, int isFloat,
+                     int bigEndian, int unsigned8)
+{
+  unsigned long bits = bigEndian ? be(p, bytes) : le(p, bytes);
+
+  if (isFloat && bytes == 4)
+  {
+    float f;
+    uint32_t u = (uint32_t)bits;
+
+    memcpy(&f, &u, 4);
+    return f;
+  }
+  if (isFloat && bytes == 8)
+  {
+    double d;
+    /* unsigned long might only be 32 bits */
+    uint64_t u = bigEndian
+      ? (uint64_t)be(p, 4) << 32 | be(p + 4, 4)
+      : (uint64_t)le(p + 4, 4) << 32 | le(p, 4);
+
+    memcpy(&d, &u, 8);
+    return d;
+  }
+  if (bytes == 1 && unsigned8)
+    return ((double)bits - 128.0) / 128.0;
+  /* sign extend */
+  if (bits & (1UL << (bytes * 8 - 1)))
+    return ((double)bits - ldexp(1.0, bytes * 8)) / ldexp(1.0, bytes * 8 - 1);
+  return (double)bits / ldexp(1.0, bytes * 8 - 1);
+}
+
+/*****************************************************************************/
+
+/* mix the interleaved frames down to one channel (channel < 0) or just take
+ * one of them */
+static int renderDecode(renderSound* s, const unsigned char* data,
+                        unsigned long size, int bits, int isFloat,
+                        int bigEndian, int unsigned8, int channel)
+{
+  int bytes = (bits + 7) / 8;
+  long frameBytes = (long)bytes * s->channels;
+
+  if (!s->channels || !s->samplingRate ||
+      (isFloat ? bytes != 4 && bytes != 8 : bytes < 1 || bytes > 4))
+  {
+    fprintf(stderr, "mdegranular-render: unsupported sample format "
+            "(%d channels, %d bits%s)\n", s->channels, bits,
+            isFloat ? " float" : "");
+    return 0;
+  }
+  if (channel >= s->channels)
+  {
+    fprintf(stderr, "mdegranular-render: the input only has %d channels\n",
+            s->channels);
+    return 0;
+  }
+  s->frames = (long)(size / frameBytes);
+  if (!s->frames)
+  {
+    fprintf(stderr, "mdegranular-render: the input is empty\n");
+    return 0;
+  }
+  s->samples = calloc(s->frames + 1, sizeof(mdefloat));
+  if (!s->samples)
+    return 0;
+  for (long i = 0; i < s->frames; ++i)
+  {
+    const unsigned char* frame = data + i * frameBytes;
+    double sum = 0.0;
+
+    if (channel >= 0)
+      sum = decode(frame + channel * bytes, bytes, isFloat, bigEndian,
+                   unsigned8);
+    else
+    {
+      for (int c = 0; c < s->channels; ++c)
+        sum += decode(frame + c * bytes, bytes, isFloat, bigEndian,
+                      unsigned8);
+      sum /= s->channels;
+    }
+    s->samples[i] = (mdefloat)sum;
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+static int renderReadWav(renderSound* s, const unsigned char* file,
+                         unsigned long size, int channel)
+{
+  const unsigned char* p = file + 12;
+  const unsigned char* data = NULL;
+  unsigned long dataSize = 0;
+  int format = 0, bits = 0;
+
+  while (p + 8 <= file + size)
+  {
+    unsigned long chunkSize = le(p + 4, 4);
+    const unsigned char* body = p + 8;
+
+    if (chunkSize > (unsigned long)(file + size - body))
+      chunkSize = (unsigned long)(file + size - body);
+    if (!memcmp(p, "fmt ", 4) && chunkSize >= 16)
+    {
+      format = (int)le(body, 2);
+      s->channels = (int)le(body + 2, 2);
+      s->samplingRate = (double)le(body + 4, 4);
+      bits = (int)le(body + 14, 2);
+      /* WAVE_FORMAT_EXTENSIBLE: the real format starts the subformat GUID */
+      if (format == 0xfffe && chunkSize >= 40)
+        format = (int)le(body + 24, 2);
+    }
+    else if (!memcmp(p, "data", 4))
+    {
+      data = body;
+      dataSize = chunkSize;
+    }
+    p = body + chunkSize + (chunkSize & 1);
+  }
+  if (!data || (format != 1 && format != 3))
+  {
+    fprintf(stderr, "mdegranular-render: not a PCM or float WAV file\n");
+    return 0;
+  }
+  return renderDecode(s, data, dataSize, bits, format == 3, 0, 1, channel);
+}
+
+/*****************************************************************************/
+
+static int renderReadAiff(renderSound* s, const unsigned char* file,
+                          unsigned long size, int channel)
+{
+  int aifc = !memcmp(file + 8, "AIFC", 4);
+  const unsigned char* p = file + 12;
+  const unsigned char* data = NULL;
+  unsigned long dataSize = 0;
+  int bits = 0, isFloat = 0, bigEndian = 1;
+
+  while (p + 8 <= file + size)
+  {
+    unsigned long chunkSize = be(p + 4, 4);
+    const unsigned char* body = p + 8;
+
+    if (chunkSize > (unsigned long)(file + size - body))
+      chunkSize = (unsigned long)(file + size - body);
+    if (!memcmp(p, "COMM", 4) && chunkSize >= 18)
+    {
+      s->channels = (int)be(body, 2);
+      bits = (int)be(body + 6, 2);
+      s->samplingRate = extended(body + 8);
+      if (aifc && chunkSize >= 22)
+      {
+        const unsigned char* type = body + 18;
+
+        if (!memcmp(type, "sowt", 4))
+          bigEndian = 0;
+        else if (!memcmp(type, "fl32", 4) || !memcmp(type, "FL32", 4))
+        {
+          isFloat = 1;
+          bits = 32;
+        }
+        else if (!memcmp(type, "fl64", 4) || !memcmp(type, "FL64", 4))
+        {
+          isFloat = 1;
+          bits = 64;
+        }
+        else if (memcmp(type, "NONE", 4) && memcmp(type, "twos", 4))
+        {
+          fprintf(stderr, "mdegranular-render: compressed AIFF-C (%.4s) "
+                  "isn't supported\n", (const char*)type);
+          return 0;
+        }
+      }
+    }
+    else if (!memcmp(p, "SSND", 4) && chunkSize >= 8)
+    {
+      unsigned long offset = be(body, 4);
+
+      if (offset > chunkSize - 8)
+        offset = chunkSize - 8;
+      data = body + 8 + offset;
+      dataSize = chunkSize - 8 - offset;
+    }
+    p = body + chunkSize + (chunkSize & 1);
+  }
+  if (!data)
+  {
+    fprintf(stderr, "mdegranular-render: no sound data in AIFF file\n");
+    return 0;
+  }
+  return renderDecode(s, data, dataSize, bits, isFloat, bigEndian, 0,
+                      channel);
+}
+
+/*****************************************************************************/
+
+/* read a WAV or AIFF(-C) file; channel is 0-based, or -1 to mix them all */
+static int renderReadSound(renderSound* s, const char* path, int channel)
+{
+  FILE* fp = fopen(path, "rb");
+  unsigned char* file;
+  long size;
+  int ok = 0;
+
+  memset(s, 0, sizeof(renderSound));
+  if (!fp)
+  {
+    fprintf(stderr, "mdegranular-render: can't open %s\n", path);
+    return 0;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  file = malloc(size > 0 ? size : 1);
+  if (!file || size < 12 || fread(file, 1, size, fp) != (size_t)size)
+    fprintf(stderr, "mdegranular-render: can't read %s\n", path);
+  else if (!memcmp(file, "RIFF", 4) && !memcmp(file + 8, "WAVE", 4))
+    ok = renderReadWav(s, file, (unsigned long)size, channel);
+  else if (!memcmp(file, "FORM", 4) &&
+           (!memcmp(file + 8, "AIFF", 4) || !memcmp(file + 8, "AIFC", 4)))
+    ok = renderReadAiff(s, file, (unsigned long)size, channel);
+  else
+    fprintf(stderr, "mdegranular-render: %s is neither WAV nor AIFF\n",
+            path);
+  fclose(fp);
+  free(file);
+  return ok;
+}
+
+/*****************************************************************************/
+
+#pragma mark Writing WAV
+
+static void putLE(FILE* fp, unsigned long value, int bytes)
+{
+  for (int i = 0; i < bytes; ++i, value >>= 8)
+    fputc((int)(value & 0xff), fp);
+}
+
+/*****************************************************************************/
+
+/* the header, with sizes of 0 until renderWavClose() knows them */
+static void renderWavHeader(renderWav* w, unsigned long dataSize)
+{
+  int bytes = w->bits / 8;
+  /* more than two channels (or 24 bits) should be WAVE_FORMAT_EXTENSIBLE */
+  int extensible = w->channels > 2 || w->bits == 24;
+  int format = w->bits == 32 ? 3 : 1;
+  unsigned long fmtSize = extensible ? 40 : 16;
+
+  fwrite("RIFF", 1, 4, w->fp);
+  putLE(w->fp, 4 + 8 + fmtSize + 8 + dataSize + (dataSize & 1), 4);
+  fwrite("WAVEfmt ", 1, 8, w->fp);
+  putLE(w->fp, fmtSize, 4);
+  putLE(w->fp, extensible ? 0xfffe : format, 2);
+  putLE(w->fp, w->channels, 2);
+  putLE(w->fp, (unsigned long)w->samplingRate, 4);
+  putLE(w->fp, (unsigned long)w->samplingRate * w->channels * bytes, 4);
+  putLE(w->fp, w->channels * bytes, 2);
+  putLE(w->fp, w->bits, 2);
+  if (extensible)
+  {
+    putLE(w->fp, 22, 2);
+    putLE(w->fp, w->bits, 2);
+    /* no speaker positions: our channels aren't a standard layout */
+    putLE(w->fp, 0, 4);
+    /* the subformat GUID: format followed by the standard suffix */
+    putLE(w->fp, format, 2);
+    fwrite("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 1, 14,
+           w->fp);
+  }
+  fwrite("data", 1, 4, w->fp);
+  putLE(w->fp, dataSize, 4);
+}
+
+/*****************************************************************************/
+
+static int renderWavOpen(renderWav* w, const char* path, int channels,
+                         int bits, double samplingRate, int block)
+{
+  w->fp = fopen(path, "wb");
+  w->channels = channels;
+  w->bits = bits;
+  w->samplingRate = samplingRate;
+  w->frames = 0;
+  w->buf = malloc((size_t)block * channels * (bits / 8));
+  if (!w->fp || !w->buf)
+  {
+    fprintf(stderr, "mdegranular-render: can't write %s\n", path);
+    if (w->fp)
+      fclose(w->fp);
+    free(w->buf);
+    return 0;
+  }
+  renderWavHeader(w, 0);
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* interleave and write one block from the granulator's output buffers */
+static void renderWavWrite(renderWav* w, mdefloat** outs, long frames)
+{
+  int bytes = w->bits / 8;
+  unsigned char* p = w->buf;
+
+  for (long i = 0; i < frames; ++i)
+    for (int c = 0; c < w->channels; ++c, p += bytes)
+    {
+      double x = outs[c][i];
+
+      if (w->bits == 32)
+      {
+        float f = (float)x;
+        uint32_t u;
+
+        memcpy(&u, &f, 4);
+        p[0] = u & 0xff;
+        p[1] = (u >> 8) & 0xff;
+        p[2] = (u >> 16) & 0xff;
+        p[3] = (u >> 24) & 0xff;
+      }
+      else
+      {
+        double scale = ldexp(1.0, w->bits - 1);
+        long v = lrint(x * scale);
+
+        if (v >= (long)scale)
+          v = (long)scale - 1;
+        else if (v < -(long)scale)
+          v = -(long)scale;
+        for (int b = 0; b < bytes; ++b)
+          p[b] = (unsigned char)((unsigned long)v >> (8 * b));
+      }
+    }
+  fwrite(w->buf, 1, p - w->buf, w->fp);
+  w->frames += frames;
+}
+
+/*****************************************************************************/
+
+static int renderWavClose(renderWav* w)
+{
+  unsigned long dataSize = w->frames * w->channels * (w->bits / 8);
+  int ok;
+
+  if (dataSize & 1)
+    fputc(0, w->fp);
+  fseek(w->fp, 0, SEEK_SET);
+  renderWavHeader(w, dataSize);
+  ok = !ferror(w->fp);
+  if (fclose(w->fp))
+    ok = 0;
+  free(w->buf);
+  if (!ok)
+    fprintf(stderr, "mdegranular-render: error writing the output file\n");
+  /* the sizes in the header are only 32 bits */
+  if ((double)dataSize > 4294967295.0 - 80.0)
+  {
+    fprintf(stderr, "mdegranular-render: output is too long for a WAV "
+            "file\n");
+    ok = 0;
+  }
+  return ok;
+}
+
+/*****************************************************************************/
+
+#pragma mark Messages
+
+/* parse a line such as "@2.5 GrainLengthMS 80;" or "-12 0 7" (a list of
+ * transpositions, as in PD/Max); returns 0 for blank lines and comments,
+ * -1 on error */
+static int renderParse(renderMessage* m, const char* line)
+{
+  char copy[RENDER_MAX_LINE];
+  char* token;
+  char* end;
+
+  memset(m, 0, sizeof(renderMessage));
+  strncpy(copy, line, sizeof(copy) - 1);
+  copy[sizeof(copy) - 1] = '\0';
+  if ((end = strchr(copy, '#')))
+    *end = '\0';
+  for (char* c = copy; *c; ++c)
+    if (*c == ';' || *c == ',')
+      *c = ' ';
+  token = strtok(copy, " \t\r\n");
+  if (!token)
+    return 0;
+  if (*token == '@')
+  {
+    m->time = strtod(token + 1, &end);
+    if (*end || m->time < 0)
+    {
+      fprintf(stderr, "mdegranular-render: bad time in \"%s\"\n", line);
+      return -1;
+    }
+    token = strtok(NULL, " \t\r\n");
+    if (!token)
+      return 0;
+  }
+  strtod(token, &end);
+  if (*end)
+  {
+    strncpy(m->name, token, sizeof(m->name) - 1);
+    token = strtok(NULL, " \t\r\n");
+  }
+  else
+    strcpy(m->name, "list");
+  for (; token; token = strtok(NULL, " \t\r\n"))
+  {
+    double d = strtod(token, &end);
+
+    if (*end)
+    {
+      if (m->symbol[0] || m->argc)
+      {
+        fprintf(stderr, "mdegranular-render: bad argument %s in \"%s\"\n",
+                token, line);
+        return -1;
+      }
+      strncpy(m->symbol, token, sizeof(m->symbol) - 1);
+    }
+    else if (m->argc < RENDER_MAX_ARGS)
+      m->argv[m->argc++] = d;
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* send a message to the granulator, through the same calls the inlet
+ * methods (mdeGranular~tilde.c) make */
+static int renderSend(mdeGranular* g, renderMessage* m)
+{
+  const char* name = m->name;
+  mdefloat f = m->argc ? (mdefloat)m->argv[0] : (mdefloat)0.0;
+  mdefloat f2 = m->argc > 1 ? (mdefloat)m->argv[1] : (mdefloat)0.0;
+
+  if (!strcmp(name, "list") || !strcmp(name, "Transpositions"))
+  {
+    mdefloat semitones[MAXTRANSPOSITIONS];
+
+    for (int i = 0; i < m->argc; ++i)
+      semitones[i] = (mdefloat)m->argv[i];
+    mdeGranularSetTranspositions(g, m->argc, semitones);
+  }
+  else if (!strcmp(name, "TranspositionOffsetST"))
+    mdeGranularSetTranspositionOffsetST(g, f);
+  else if (!strcmp(name, "GrainLengthMS"))
+    mdeGranularSetGrainLengthMS(g, f);
+  else if (!strcmp(name, "GrainLengthDeviation"))
+    mdeGranularSetGrainLengthDeviation(g, f);
+  else if (!strcmp(name, "SamplesStartMS"))
+    mdeGranularSetSamplesStartMS(g, f);
+  else if (!strcmp(name, "SamplesEndMS"))
+    mdeGranularSetSamplesEndMS(g, f);
+  else if (!strcmp(name, "Density"))
+    mdeGranularSetDensity(g, f);
+  else if (!strcmp(name, "GrainAmp"))
+    mdeGranularSetGrainAmp(g, f);
+  else if (!strcmp(name, "ActiveChannels"))
+    mdeGranularSetActiveChannels(g, (long)f);
+  else if (!strcmp(name, "Warnings"))
+    mdeGranularSetWarnings(g, (long)f);
+  else if (!strcmp(name, "MaxVoices"))
+    mdeGranularSetMaxVoices(g, f);
+  else if (!strcmp(name, "ActiveVoices"))
+    mdeGranularSetActiveVoices(g, f);
+  else if (!strcmp(name, "RampLenMS"))
+    mdeGranularSetRampLenMS(g, f);
+  else if (!strcmp(name, "RampType"))
+    mdeGranularSetRampType(g, m->symbol);
+  else if (!strcmp(name, "on"))
+    mdeGranularOn(g);
+  else if (!strcmp(name, "off"))
+    mdeGranularOff(g);
+  else if (!strcmp(name, "MaxLiveBufferMS"))
+    mdeGranularSetLiveBufferSize(g, f);
+  else if (!strcmp(name, "MirrorLiveBuffer"))
+    mdeGranularSetMirrorLiveBuffer(g, (long)f);
+  else if (!strcmp(name, "HugePages"))
+    mdeGranularSetHugePages(g, (long)f);
+  else if (!strcmp(name, "FixedPhase"))
+    mdeGranularSetFixedPhase(g, (long)f);
+  else if (!strcmp(name, "Seed"))
+    mdeGranularSetSeed(g, f);
+  else if (!strcmp(name, "Threads"))
+    mdeGranularSetThreads(g, (long)f);
+  else if (!strcmp(name, "PoolSize"))
+    mdeGranularSetPoolSize(g, (long)f);
+  else if (!strcmp(name, "PoolPriority"))
+    mdeGranularSetPoolPriority(g, (long)f);
+  else if (!strcmp(name, "DoGrainDelays"))
+    mdeGranularDoGrainDelays(g);
+  else if (!strcmp(name, "SmoothMode"))
+    mdeGranularSmoothMode(g);
+  else if (!strcmp(name, "OctaveSize"))
+    mdeGranularOctaveSize(g, f);
+  else if (!strcmp(name, "OctaveDivisions"))
+    mdeGranularOctaveDivisions(g, f);
+  else if (!strcmp(name, "Portion"))
+    mdeGranularPortion(g, f, f2);
+  else if (!strcmp(name, "PortionPosition"))
+    mdeGranularPortionPosition(g, f);
+  else if (!strcmp(name, "PortionWidth"))
+    mdeGranularPortionWidth(g, f);
+  else
+  {
+    fprintf(stderr, "mdegranular-render: unknown message %s\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+static int renderCompareTimes(const void* a, const void* b)
+{
+  const renderMessage* ma = a;
+  const renderMessage* mb = b;
+
+  if (ma->time != mb->time)
+    return ma->time < mb->time ? -1 : 1;
+  return ma->order - mb->order;
+}
+
+/*****************************************************************************/
+
+
+/* add a message (if there's one on the line) to a job */
+static int renderAdd(renderJob* job, const char* line)
+{
+  renderMessage m;
+  int result = renderParse(&m, line);
+
+  if (result <= 0)
+    return result == 0;
+  if (job->numMessages == job->messagesSize)
+  {
+    int newSize = job->messagesSize ? job->messagesSize * 2 : 32;
+    renderMessage* grown = realloc(job->messages,
+                                   newSize * sizeof(renderMessage));
+
+    if (!grown)
+      return 0;
+    job->messages = grown;
+    job->messagesSize = newSize;
+  }
+  m.order = job->numMessages;
+  job->messages[job->numMessages++] = m;
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* read messages from a file, one per line */
+static int renderAddFile(renderJob* job, const char* path)
+{
+  FILE* fp = fopen(path, "r");
+  char line[RENDER_MAX_LINE];
+  int ok = 1;
+
+  if (!fp)
+  {
+    fprintf(stderr, "mdegranular-render: can't read %s\n", path);
+    return 0;
+  }
+  while (ok && fgets(line, sizeof(line), fp))
+    ok = renderAdd(job, line);
+  fclose(fp);
+  return ok;
+}
+
+/*****************************************************************************/
+
+static void renderDefaults(renderJob* job)
+{
+  memset(job, 0, sizeof(renderJob));
+  job->channels = 2;
+  job->voices = 10;
+  job->channel = -1;
+  job->block = 64;
+  job->bits = 32;
+  job->duration = -1.0;
+}
+
+/*****************************************************************************/
+
+/* a copy of job, with its own copy of the messages */
+static int renderCopy(renderJob* to, const renderJob* from)
+{
+  *to = *from;
+  to->messages = NULL;
+  to->messagesSize = 0;
+  if (from->numMessages)
+  {
+    to->messages = malloc(from->numMessages * sizeof(renderMessage));
+    if (!to->messages)
+      return 0;
+    memcpy(to->messages, from->messages,
+           from->numMessages * sizeof(renderMessage));
+    to->messagesSize = from->numMessages;
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* an option and its value, e.g. -c 4; returns 0 if it isn't one of ours */
+static int renderOption(renderJob* job, const char* option, const char* val)
+{
+  if (!val || option[0] != '-' || !option[1] || option[2])
+    return 0;
+  switch (option[1])
+  {
+    case 'c': job->channels = atoi(val); break;
+    case 'v': job->voices = atoi(val); break;
+    case 'd': job->duration = atof(val); break;
+    case 'i': job->channel = atoi(val) - 1; break;
+    case 'l': job->liveMS = atof(val); break;
+    case 'b': job->block = atoi(val); break;
+    case 'f': job->bits = atoi(val); break;
+    case 's': return renderAddFile(job, val);
+    default: return 0;
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+static int renderCheck(renderJob* job)
+{
+  if (job->channels < 1 || job->channels > RENDER_MAX_CHANNELS ||
+      job->voices < 1 || job->block < 1 || job->block > RENDER_MAX_BLOCK ||
+      (job->bits != 16 && job->bits != 24 && job->bits != 32) ||
+      (job->liveMS && job->liveMS < MINLIVEBUFSIZE))
+    return 0;
+  if (job->numMessages)
+    qsort(job->messages, job->numMessages, sizeof(renderMessage),
+          renderCompareTimes);
+  return 1;
+}
+
+/*****************************************************************************/
+
+/* read a job file: each job starts with a line
+ *   job in.wav out.wav [options]
+ * followed by its messages, one per line.  Options given on the command line
+ * (before -j) are the defaults for every job, and messages from -s there are
+ * sent before each job's own. */
+static int renderReadJobs(const char* path, const renderJob* defaults,
+                          renderJob** jobs, int* numJobs)
+{
+  FILE* fp = fopen(path, "r");
+  char line[RENDER_MAX_LINE];
+  int size = 0, lineNum = 0, ok = 1;
+  renderJob* job = NULL;
+
+  *jobs = NULL;
+  *numJobs = 0;
+  if (!fp)
+  {
+    fprintf(stderr, "mdegranular-render: can't read %s\n", path);
+    return 0;
+  }
+  while (ok && fgets(line, sizeof(line), fp))
+  {
+    char copy[RENDER_MAX_LINE];
+    char* token;
+
+    ++lineNum;
+    strcpy(copy, line);
+    token = strtok(copy, " \t\r\n");
+    if (!token || strcmp(token, "job"))
+    {
+      if (!job && token && *token != '#')
+      {
+        fprintf(stderr, "mdegranular-render: %s:%d: a message before the "
+                "first job\n", path, lineNum);
+        ok = 0;
+      }
+      else if (job)
+        ok = renderAdd(job, line);
+      continue;
+    }
+    if (*numJobs == size)
+    {
+      renderJob* grown;
+
+      size = size ? size * 2 : 64;
+      grown = realloc(*jobs, size * sizeof(renderJob));
+      if (!grown)
+      {
+        ok = 0;
+        break;
+      }
+      *jobs = grown;
+    }
+    job = &(*jobs)[(*numJobs)++];
+    if (!renderCopy(job, defaults))
+    {
+      ok = 0;
+      break;
+    }
+    token = strtok(NULL, " \t\r\n");
+    if (token)
+      strncpy(job->inFile, token, RENDER_MAX_PATH - 1);
+    token = strtok(NULL, " \t\r\n");
+    if (token)
+      strncpy(job->outFile, token, RENDER_MAX_PATH - 1);
+    while ((token = strtok(NULL, " \t\r\n")))
+      if (!renderOption(job, token, strtok(NULL, " \t\r\n")))
+      {
+        ok = 0;
+        break;
+      }
+    if (!ok || !job->outFile[0])
+    {
+      fprintf(stderr, "mdegranular-render: %s:%d: expected "
+              "job in.wav out.wav [options]\n", path, lineNum);
+      ok = 0;
+    }
+  }
+  fclose(fp);
+  for (int i = 0; ok && i < *numJobs; ++i)
+    if (!renderCheck(&(*jobs)[i]))
+    {
+      fprintf(stderr, "mdegranular-render: bad options for %s\n",
+              (*jobs)[i].outFile);
+      ok = 0;
+    }
+  return ok;
+}
+
+/*****************************************************************************/
+
+/* read each job's input, once per file and channel however many jobs use
+ * it; the samples are only ever read by the granulators so they can be
+ * shared between threads */
+static int renderLoadSounds(renderJob* jobs, int numJobs)
+{
+  for (int i = 0; i < numJobs; ++i)
+  {
+    renderJob* job = &jobs[i];
+
+    for (int j = 0; j < i && !job->sound; ++j)
+      if (!strcmp(jobs[j].inFile, job->inFile) &&
+          jobs[j].channel == job->channel)
+        job->sound = jobs[j].sound;
+    if (job->sound)
+      continue;
+    job->sound = malloc(sizeof(renderSound));
+    if (!job->sound || !renderReadSound(job->sound, job->inFile,
+                                        job->channel))
+    {
+      free(job->sound);
+      job->sound = NULL;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*****************************************************************************/
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+
+/* render one job with its own granulator; sets job->ok */
+static void renderRun(renderJob* job)
+{
+  mdeGranular* g = calloc(1, sizeof(mdeGranular));
+  renderSound* sound = job->sound;
+  double samplingRate = sound->samplingRate;
+  double duration = job->duration < 0
+    ? sound->frames / samplingRate : job->duration;
+  mdefloat* outs[RENDER_MAX_CHANNELS] = { NULL };
+  mdefloat* in = NULL;
+  int block = job->block, next = 0;
+  long ticks, tail, pos = 0;
+  double start = now();
+  renderWav wav;
+
+  job->ok = 0;
+  if (!g)
+    return;
+  /* the same order PD goes through: new, dsp (Init2), set (Init3) */
+  g->samplingRate = (mdefloat)samplingRate;
+  /* (what Init1 got before failing is given back at done) */
+  if (mdeGranularInit1(g, job->voices, job->channels))
+    goto done;
+  for (int c = 0; c < job->channels; ++c)
+    if (!(outs[c] = calloc(block, sizeof(mdefloat))))
+      goto done;
+  mdeGranularInit2(g, block, (mdefloat)DEFAULT_RAMP_LEN, outs);
+  if (!mdeGranularDidInit(g))
+    goto done;
+  if (job->liveMS)
+  {
+    if (mdeGranularInit3(g, NULL, (mdefloat)job->liveMS,
+                         (mdefloat)ms2samples(g->samplingRate,
+                                              (mdefloat)job->liveMS)))
+      goto done;
+    if (!(in = calloc(block, sizeof(mdefloat))))
+      goto done;
+  }
+  else
+    mdeGranularInit3(g, sound->samples,
+                     samples2ms(g->samplingRate, (int)sound->frames),
+                     (mdefloat)sound->frames);
+  for (; next < job->numMessages && job->messages[next].time <= 0; ++next)
+    if (!renderSend(g, &job->messages[next]))
+      goto done;
+  /* unless we were told to start off */
+  if (mdeGranularIsOff(g) &&
+      !(next && !strcmp(job->messages[next - 1].name, "off")))
+    mdeGranularOn(g);
+
+  if (!renderWavOpen(&wav, job->outFile, job->channels, job->bits,
+                     samplingRate, block))
+    goto done;
+  ticks = (long)ceil(duration * samplingRate / block);
+  tail = (long)ceil(RENDER_MAX_TAIL_SECS * samplingRate / block);
+  for (long t = 0; t < ticks + tail; ++t)
+  {
+    double time = (double)t * block / samplingRate;
+
+    for (; next < job->numMessages && job->messages[next].time <= time;
+         ++next)
+      renderSend(g, &job->messages[next]);
+    if (t == ticks)
+      mdeGranularOff(g);
+    if (t >= ticks && mdeGranularIsOff(g))
+      break;
+    if (in && g->status)
+    {
+      for (int j = 0; j < block; ++j, ++pos)
+        in[j] = pos < sound->frames ? sound->samples[pos] : (mdefloat)0.0;
+      mdeGranularCopyInputSamples(g, in, block);
+    }
+    mdeGranularGo(g);
+    renderWavWrite(&wav, outs, block);
+  }
+  job->frames = wav.frames;
+  job->ok = renderWavClose(&wav);
+
+done:
+  job->secs = now() - start;
+  mdeGranularFree(g);
+  free(g);
+  for (int c = 0; c < job->channels; ++c)
+    free(outs[c]);
+  free(in);
+}
+
+/*****************************************************************************/
+
+static void renderReport(renderJob* job)
+{
+  double secs = job->frames / job->sound->samplingRate;
+
+  if (job->ok)
+    fprintf(stderr, "mdegranular-render: %s: %lu frames (%.1fs) in %.2fs "
+            "(%.0fx real time)\n", job->outFile, job->frames, secs,
+            job->secs, job->secs > 0 ? secs / job->secs : 0.0);
+  else
+    fprintf(stderr, "mdegranular-render: %s failed\n", job->outFile);
+}
+
+/*****************************************************************************/
+
+#pragma mark Batch rendering
+
+/* the jobs a pool of threads works through, each taking the next one not
+ * yet started */
+typedef struct
+{
+  renderJob* jobs;
+  int numJobs;
+  int next;
+  pthread_mutex_t lock;
+} renderQueue;
+
+/*****************************************************************************/
+
+static void* renderWorker(void* arg)
+{
+  renderQueue* q = arg;
+
+  for (;;)
+  {
+    renderJob* job;
+
+    pthread_mutex_lock(&q->lock);
+    job = q->next < q->numJobs ? &q->jobs[q->next++] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    if (!job)
+      return NULL;
+    renderRun(job);
+    /* one line at a time */
+    pthread_mutex_lock(&q->lock);
+    renderReport(job);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+/*****************************************************************************/
+
+/* render all the jobs on numThreads threads; returns how many failed */
+static int renderBatch(renderJob* jobs, int numJobs, int numThreads)
+{
+  renderQueue q;
+  pthread_t threads[RENDER_MAX_THREADS];
+  int started = 0, failed = 0;
+
+  q.jobs = jobs;
+  q.numJobs = numJobs;
+  q.next = 0;
+  pthread_mutex_init(&q.lock, NULL);
+  if (numThreads > numJobs)
+    numThreads = numJobs;
+  for (; started < numThreads; ++started)
+    if (pthread_create(&threads[started], NULL, renderWorker, &q))
+      break;
+  /* if we couldn't start any threads, do it all ourselves */
+  if (!started)
+    renderWorker(&q);
+  for (int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&q.lock);
+  for (int i = 0; i < numJobs; ++i)
+    failed += !jobs[i].ok;
+  return failed;
+}
+
+/*****************************************************************************/
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: mdegranular-render [options] in.wav|in.aif out.wav "
+          "[message ...]\n"
+          "       mdegranular-render [options] -j jobs.txt [-t threads]\n"
+          "  -c n     output channels (default 2)\n"
+          "  -v n     voices (default 10)\n"
+          "  -d secs  length of the output before turning off (default: "
+          "the input's)\n"
+          "  -i n     granulate only this input channel, from 1 (default: "
+          "mix them)\n"
+          "  -l ms    treat the input as live input into a buffer of ms "
+          "milliseconds\n"
+          "  -b n     block (tick) size (default 64)\n"
+          "  -f bits  16, 24 or 32 (float, the default)\n"
+          "  -s file  read messages from file, one per line\n"
+          "  -j file  render the jobs in file in parallel: each starts with "
+          "a line\n"
+          "           \"job in.wav out.wav [options]\" followed by its "
+          "messages\n"
+          "  -t n     threads for -j (default: one per core)\n"
+          "Messages are those of the PD/Max object, e.g. \"GrainLengthMS "
+          "80\" or\n"
+          "\"-12 0 7\" (transpositions); prefix with @secs to send them "
+          "at that time.\n");
+}
+
+/*****************************************************************************/
+
+int main(int argc, char** argv)
+{
+  renderJob defaults;
+  renderJob* jobs = NULL;
+  const char* jobFile = NULL;
+  int numJobs = 0, failed;
+  int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  double start = now();
+  int i;
+
+  renderDefaults(&defaults);
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] &&
+         !strchr("0123456789.", argv[i][1]); i += 2)
+  {
+    const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (val && !strcmp(argv[i], "-j"))
+      jobFile = val;
+    else if (val && !strcmp(argv[i], "-t"))
+      numThreads = atoi(val);
+    else if (!renderOption(&defaults, argv[i], val))
+    {
+      usage();
+      return 2;
+    }
+  }
+  if (jobFile)
+  {
+    if (i < argc || !renderReadJobs(jobFile, &defaults, &jobs, &numJobs))
+    {
+      if (i < argc)
+        usage();
+      return 2;
+    }
+  }
+  else
+  {
+    if (argc - i < 2)
+    {
+      usage();
+      return 2;
+    }
+    jobs = &defaults;
+    numJobs = 1;
+    strncpy(defaults.inFile, argv[i++], RENDER_MAX_PATH - 1);
+    strncpy(defaults.outFile, argv[i++], RENDER_MAX_PATH - 1);
+    for (; i < argc; ++i)
+      if (!renderAdd(&defaults, argv[i]))
+        return 2;
+    if (!renderCheck(&defaults))
+    {
+      usage();
+      return 2;
+    }
+  }
+  if (!numJobs)
+    return 0;
+  if (!renderLoadSounds(jobs, numJobs))
+    return 1;
+  if (numThreads < 1)
+    numThreads = 1;
+  if (numThreads > RENDER_MAX_THREADS)
+    numThreads = RENDER_MAX_THREADS;
+  failed = renderBatch(jobs, numJobs, numThreads);
+  if (jobFile)
+    fprintf(stderr, "mdegranular-render: %d jobs (%d failed) on %d threads "
+            "in %.2fs\n", numJobs, failed, numThreads < numJobs
+            ? numThreads : numJobs, now() - start);
+
+  for (i = 0; i < numJobs; ++i)
+  {
+    /* free each sound once, with the first job that uses it */
+    int shared = 0;
+
+    for (int j = 0; j < i && !shared; ++j)
+      shared = jobs[j].sound == jobs[i].sound;
+    if (!shared && jobs[i].sound)
+    {
+      free(jobs[i].sound->samples);
+      free(jobs[i].sound);
+    }
+    free(jobs[i].messages);
+  }
+  if (jobFile)
+  {
+    free(defaults.messages);
+    free(jobs);
+  }
+  return failed ? 1 : 0;
+}